@@ -10,6 +10,16 @@ newoption {
     description = "Additional linker options",
 }
 
+newoption {
+    trigger = "stats",
+    description = "Enable the instrumentation counters (Format_stats.h)",
+}
+
+newoption {
+    trigger = "header-only",
+    description = "Include the implementation into Format.h (FMTXX_HEADER_ONLY)",
+}
+
 --------------------------------------------------------------------------------
 solution "Format"
     configurations { "release", "debug" }
@@ -69,6 +79,11 @@ solution "Format"
             -- "-fsanitize=memory",
         }
 
+    configuration { "gmake", "linux" }
+        links {
+            "pthread", -- std::thread (Format_async.cc, Format_parallel.cc)
+        }
+
     configuration { "vs*" }
         buildoptions {
             "/utf-8",
@@ -105,6 +120,20 @@ solution "Format"
             }
     end
 
+    if _OPTIONS["stats"] then
+        configuration {}
+            defines {
+                "FMTXX_STATS=1",
+            }
+    end
+
+    if _OPTIONS["header-only"] then
+        configuration {}
+            defines {
+                "FMTXX_HEADER_ONLY=1",
+            }
+    end
+
 --------------------------------------------------------------------------------
 group "Libs"
 
@@ -115,6 +144,12 @@ project "fmtxx"
         "src/**.h",
         "src/**.cc",
     }
+    if _OPTIONS["header-only"] then
+        -- Format.cc is included by Format.h.
+        removefiles {
+            "src/Format.cc",
+        }
+    end
     configuration { "gmake" }
         buildoptions {
             "-Wsign-compare",
@@ -147,3 +182,29 @@ project "Example"
     links {
         "fmtxx",
     }
+
+--------------------------------------------------------------------------------
+group "Tools"
+
+project "fmtxx-decode"
+    language "C++"
+    kind "ConsoleApp"
+    files {
+        "tools/Decode.cc",
+    }
+    links {
+        "fmtxx",
+    }
+
+--------------------------------------------------------------------------------
+group "Benchmarks"
+
+project "Bench"
+    language "C++"
+    kind "ConsoleApp"
+    files {
+        "test/Bench.cc",
+    }
+    links {
+        "fmtxx",
+    }
@@ -18,7 +18,12 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+#ifndef FMTXX_FORMAT_CC
+#define FMTXX_FORMAT_CC 1
+
 #include "Format.h"
+#include "Format_scan.h"
+#include "Format_stats.h"
 
 #ifndef FMTXX_DOUBLE_CONVERSION_EXTERNAL
 #include "__double_conversion.h"
@@ -26,15 +31,60 @@
 #include <double-conversion/bignum-dtoa.h>
 #include <double-conversion/fast-dtoa.h>
 #include <double-conversion/fixed-dtoa.h>
+#include <double-conversion/strtod.h>
+#endif
+
+// Define FMTXX_USE_DOUBLE_CONVERSION_SHORTEST to 1 to use Grisu3 (with the
+// bignum fallback) from the double-conversion library to compute the shortest
+// representation of doubles, instead of Ryu. Both produce the same digits.
+#ifndef FMTXX_USE_DOUBLE_CONVERSION_SHORTEST
+#define FMTXX_USE_DOUBLE_CONVERSION_SHORTEST 0
+#endif
+
+#if !FMTXX_USE_DOUBLE_CONVERSION_SHORTEST
+#include "__ryu.h"
 #endif
 
 #include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <iterator> // stdext::checked_array_iterator
 #include <limits>
+#include <new>
+
+#if defined(_MSC_VER)
+#include <intrin.h> // _BitScanReverse64
+#endif
+
+// Select the instruction set used to scan format strings for '{' and '}'.
+// Define FMTXX_NO_SIMD to always use the scalar loop.
+#if !defined(FMTXX_NO_SIMD)
+#if defined(__AVX2__)
+#define FMTXX_SIMD_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FMTXX_SIMD_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define FMTXX_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+#endif
+
+// Helper functions and classes have internal linkage, unless this file is
+// included from Format.h (FMTXX_HEADER_ONLY). Then they are inline and live in
+// the inline namespace fmtxx::impl::internal, so that all translation units share the
+// same definitions.
+#if FMTXX_HEADER_ONLY
+#define FMTXX_STATIC inline
+#define FMTXX_NAMESPACE_INTERNAL inline namespace internal
+#else
+#define FMTXX_STATIC static
+#define FMTXX_NAMESPACE_INTERNAL namespace
+#endif
 
-using namespace fmtxx;
-using namespace fmtxx::impl;
+namespace fmtxx {
+namespace impl {
 
 //------------------------------------------------------------------------------
 //
@@ -55,18 +105,6 @@ static_assert(kMaxIntPrec >= 64,
 static_assert(kMaxFloatPrec >= 1074,
     "A minimum precision of 1074 is required to print denorm_min (= [751 digits] 10^-323) when using %f");
 
-static constexpr char const* kDecDigits100 =
-    "00010203040506070809"
-    "10111213141516171819"
-    "20212223242526272829"
-    "30313233343536373839"
-    "40414243444546474849"
-    "50515253545556575859"
-    "60616263646566676869"
-    "70717273747576777879"
-    "80818283848586878889"
-    "90919293949596979899";
-
 static constexpr char const* kUpperDigits = "0123456789ABCDEF";
 static constexpr char const* kLowerDigits = "0123456789abcdef";
 
@@ -76,7 +114,7 @@ static constexpr char const* kLowerDigits = "0123456789abcdef";
 
 // EXPECT and EXPECT_NOT must evaluate their arguments X exactly once!
 #if 0
-static /*[[noreturn]]*/ void AssertionFailed(char const* file, unsigned line, char const* what)
+FMTXX_STATIC /*[[noreturn]]*/ void AssertionFailed(char const* file, unsigned line, char const* what)
 {
     std::fprintf(stderr, "%s(%d) : Assertion failed: %s\n", file, line, what);
     std::abort();
@@ -90,19 +128,27 @@ static /*[[noreturn]]*/ void AssertionFailed(char const* file, unsigned line, ch
 #endif
 
 template <typename T>
-static void MaybeUnused(T&&)
+FMTXX_STATIC void MaybeUnused(T&&)
 {
 }
 
+#if defined(__GNUC__)
+#define FMTXX_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define FMTXX_NOINLINE __declspec(noinline)
+#else
+#define FMTXX_NOINLINE
+#endif
+
 #if defined(_MSC_VER) && (_ITERATOR_DEBUG_LEVEL > 0 && _SECURE_SCL_DEPRECATE)
 template <typename RanIt>
-static stdext::checked_array_iterator<RanIt> MakeArrayIterator(RanIt buffer, intptr_t buffer_size, intptr_t position = 0)
+FMTXX_STATIC stdext::checked_array_iterator<RanIt> MakeArrayIterator(RanIt buffer, intptr_t buffer_size, intptr_t position = 0)
 {
     return stdext::make_checked_array_iterator(buffer, buffer_size, position);
 }
 #else
 template <typename RanIt>
-static RanIt MakeArrayIterator(RanIt buffer, intptr_t /*buffer_size*/, intptr_t position = 0)
+FMTXX_STATIC RanIt MakeArrayIterator(RanIt buffer, intptr_t /*buffer_size*/, intptr_t position = 0)
 {
     return buffer + position;
 }
@@ -112,22 +158,31 @@ static RanIt MakeArrayIterator(RanIt buffer, intptr_t /*buffer_size*/, intptr_t
 //
 //------------------------------------------------------------------------------
 
-fmtxx::Writer::~Writer() noexcept
+} // namespace impl
+
+FMTXX_INLINE fmtxx::Writer::~Writer() noexcept
+{
+}
+
+FMTXX_INLINE ErrorCode fmtxx::Writer::Reserve(size_t /*n*/)
 {
+    return {};
 }
 
-ErrorCode fmtxx::FILEWriter::Put(char c)
+FMTXX_INLINE ErrorCode fmtxx::FILEWriter::Put(char c)
 {
     if (EOF == std::fputc(c, file_))
         return ErrorCode::io_error;
 
+    stats::impl::CountBytes(stats::WriterKind::file, 1);
     size_ += 1;
     return {};
 }
 
-ErrorCode fmtxx::FILEWriter::Write(char const* ptr, size_t len)
+FMTXX_INLINE ErrorCode fmtxx::FILEWriter::Write(char const* ptr, size_t len)
 {
     size_t n = std::fwrite(ptr, 1, len, file_);
+    stats::impl::CountBytes(stats::WriterKind::file, n);
 
     // Count the number of characters successfully transmitted.
     // This is unlike ArrayWriter, which counts characters that would have been written on success.
@@ -136,7 +191,7 @@ ErrorCode fmtxx::FILEWriter::Write(char const* ptr, size_t len)
     return n == len ? ErrorCode{} : ErrorCode::io_error;
 }
 
-ErrorCode fmtxx::FILEWriter::Pad(char c, size_t count)
+FMTXX_INLINE ErrorCode fmtxx::FILEWriter::Pad(char c, size_t count)
 {
     size_t const kBlockSize = 32;
 
@@ -154,54 +209,337 @@ ErrorCode fmtxx::FILEWriter::Pad(char c, size_t count)
     return {};
 }
 
-size_t fmtxx::ArrayWriter::finish() noexcept
+FMTXX_INLINE size_t fmtxx::ArrayWriter::finish() noexcept
 {
-    if (size_ < bufsize_)
-        buf_[size_] = '\0';
+    size_t const size = this->size();
+
+    if (size < bufsize_)
+        buf_[size] = '\0';
     else if (bufsize_ > 0)
         buf_[bufsize_ - 1] = '\0';
 
-    return size_;
+    return size;
+}
+
+FMTXX_INLINE ErrorCode fmtxx::ArrayWriter::Put(char c)
+{
+    stats::impl::CountBytes(stats::WriterKind::array, 1);
+
+    char* const next = window_next();
+    if (next != window_last())
+    {
+        *next = c;
+        set_window(next + 1, window_last());
+    }
+    else
+    {
+        dropped_ += 1;
+    }
+
+    return {};
+}
+
+FMTXX_INLINE ErrorCode fmtxx::ArrayWriter::Write(char const* ptr, size_t len)
+{
+    stats::impl::CountBytes(stats::WriterKind::array, len);
+
+    char* const next = window_next();
+    size_t const n = std::min(len, static_cast<size_t>(window_last() - next));
+
+    std::copy_n(ptr, n, impl::MakeArrayIterator(next, static_cast<intptr_t>(n)));
+    set_window(next + n, window_last());
+    dropped_ += len - n;
+    return {};
 }
 
-ErrorCode fmtxx::ArrayWriter::Put(char c)
+FMTXX_INLINE ErrorCode fmtxx::ArrayWriter::Pad(char c, size_t count)
 {
-    if (size_ < bufsize_)
-        buf_[size_] = c;
+    stats::impl::CountBytes(stats::WriterKind::array, count);
 
+    char* const next = window_next();
+    size_t const n = std::min(count, static_cast<size_t>(window_last() - next));
+
+    std::fill_n(impl::MakeArrayIterator(next, static_cast<intptr_t>(n)), n, c);
+    set_window(next + n, window_last());
+    dropped_ += count - n;
+    return {};
+}
+
+FMTXX_INLINE ErrorCode fmtxx::CountingWriter::Put(char /*c*/)
+{
+    stats::impl::CountBytes(stats::WriterKind::counting, 1);
     size_ += 1;
     return {};
 }
 
-ErrorCode fmtxx::ArrayWriter::Write(char const* ptr, size_t len)
+FMTXX_INLINE ErrorCode fmtxx::CountingWriter::Write(char const* /*ptr*/, size_t len)
+{
+    stats::impl::CountBytes(stats::WriterKind::counting, len);
+    size_ += len;
+    return {};
+}
+
+FMTXX_INLINE ErrorCode fmtxx::CountingWriter::Pad(char /*c*/, size_t count)
+{
+    stats::impl::CountBytes(stats::WriterKind::counting, count);
+    size_ += count;
+    return {};
+}
+
+FMTXX_INLINE fmtxx::MemoryWriterBase::~MemoryWriterBase() noexcept
+{
+    if (heap_allocated())
+        std::free(buf_);
+}
+
+FMTXX_INLINE void fmtxx::MemoryWriterBase::release_into(std::string& str)
+{
+    size_t const size = this->size();
+
+    if (str.capacity() >= size)
+        str.assign(buf_, size);
+    else
+        str = std::string(buf_, size); // Exact size. Does not reserve additional space.
+
+    clear();
+}
+
+FMTXX_INLINE ErrorCode fmtxx::MemoryWriterBase::Grow(size_t n)
 {
-    if (size_ < bufsize_)
+    size_t const size = this->size();
+
+    if EXPECT_NOT(n > SIZE_MAX - size)
+        return ErrorCode::io_error;
+
+    size_t const required = size + n;
+
+    size_t new_capacity = capacity_ <= SIZE_MAX / 2 ? capacity_ * 2 : SIZE_MAX;
+    if (new_capacity < required)
+        new_capacity = required;
+
+    char* new_buf;
+    if (heap_allocated())
+    {
+        new_buf = static_cast<char*>(std::realloc(buf_, new_capacity));
+    }
+    else
     {
-        auto I = MakeArrayIterator(buf_, static_cast<intptr_t>(bufsize_), static_cast<intptr_t>(size_));
-        std::copy_n(ptr, std::min(len, bufsize_ - size_), I);
+        new_buf = static_cast<char*>(std::malloc(new_capacity));
+        if (new_buf != nullptr)
+            std::memcpy(new_buf, buf_, size);
     }
 
-    size_ += len;
+    if EXPECT_NOT(new_buf == nullptr)
+        return ErrorCode::io_error;
+
+    buf_ = new_buf;
+    capacity_ = new_capacity;
+    set_window(buf_ + size, buf_ + capacity_);
+
+    return {};
+}
+
+inline ErrorCode fmtxx::MemoryWriterBase::Reserve(size_t n)
+{
+    if (static_cast<size_t>(window_last() - window_next()) >= n)
+        return {};
+
+    return Grow(n);
+}
+
+FMTXX_INLINE ErrorCode fmtxx::MemoryWriterBase::Put(char c)
+{
+    if (Failed ec = Reserve(1))
+        return ec;
+
+    char* const next = window_next();
+    *next = c;
+    set_window(next + 1, window_last());
+    stats::impl::CountBytes(stats::WriterKind::memory, 1);
+    return {};
+}
+
+FMTXX_INLINE ErrorCode fmtxx::MemoryWriterBase::Write(char const* ptr, size_t len)
+{
+    if (Failed ec = Reserve(len))
+        return ec;
+
+    char* const next = window_next();
+    std::memcpy(next, ptr, len);
+    set_window(next + len, window_last());
+    stats::impl::CountBytes(stats::WriterKind::memory, len);
+    return {};
+}
+
+FMTXX_INLINE ErrorCode fmtxx::MemoryWriterBase::Pad(char c, size_t count)
+{
+    if (Failed ec = Reserve(count))
+        return ec;
+
+    char* const next = window_next();
+    std::memset(next, static_cast<unsigned char>(c), count);
+    set_window(next + count, window_last());
+    stats::impl::CountBytes(stats::WriterKind::memory, count);
     return {};
 }
 
-ErrorCode fmtxx::ArrayWriter::Pad(char c, size_t count)
+namespace impl {
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+#if FMTXX_SIMD_AVX2 || FMTXX_SIMD_SSE2 || FMTXX_SIMD_NEON
+FMTXX_STATIC int CountTrailingZeros64(uint64_t n)
 {
-    if (size_ < bufsize_)
+    assert(n != 0);
+
+#if defined(__GNUC__)
+    return __builtin_ctzll(n);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long low = 0;
+    _BitScanForward64(&low, n);
+    return static_cast<int>(low);
+#else
+    int z = 0;
+    while ((n & 1) == 0)
     {
-        auto I = MakeArrayIterator(buf_, static_cast<intptr_t>(bufsize_), static_cast<intptr_t>(size_));
-        std::fill_n(I, std::min(count, bufsize_ - size_), c);
+        ++z;
+        n >>= 1;
     }
 
-    size_ += count;
-    return {};
+    return z;
+#endif
+}
+#endif
+
+// Returns a pointer to the first character CH in [f, end) for which
+// CharClass::Match(ch) returns true, or END if there is none.
+//
+// CharClass provides a scalar Match(char) and, for each enabled instruction
+// set, a Match overload which returns 0xFF in each matching byte.
+template <typename CharClass>
+FMTXX_STATIC char const* FindFirstOf(char const* f, char const* end)
+{
+#if FMTXX_SIMD_AVX2
+    for ( ; end - f >= 32; f += 32)
+    {
+        __m256i const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(f));
+        uint32_t const mask = static_cast<uint32_t>(_mm256_movemask_epi8(CharClass::Match(v)));
+        if (mask != 0)
+            return f + CountTrailingZeros64(mask);
+    }
+#endif
+#if FMTXX_SIMD_AVX2 || FMTXX_SIMD_SSE2
+    for ( ; end - f >= 16; f += 16)
+    {
+        __m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(f));
+        uint32_t const mask = static_cast<uint32_t>(_mm_movemask_epi8(CharClass::Match(v)));
+        if (mask != 0)
+            return f + CountTrailingZeros64(mask);
+    }
+#elif FMTXX_SIMD_NEON
+    for ( ; end - f >= 16; f += 16)
+    {
+        uint8x16_t const v = vld1q_u8(reinterpret_cast<uint8_t const*>(f));
+        uint8x16_t const m = CharClass::Match(v);
+        // Narrow each byte of the mask to 4 bits.
+        uint64_t const mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+        if (mask != 0)
+            return f + CountTrailingZeros64(mask) / 4;
+    }
+#endif
+
+    for ( ; f != end; ++f)
+    {
+        if (CharClass::Match(*f))
+            break;
+    }
+
+    return f;
 }
 
+FMTXX_NAMESPACE_INTERNAL {
+
+// Matches every character in the set {C1, C2}.
+template <char C1, char C2>
+struct AnyOf2
+{
+    static bool Match(char ch) { return ch == C1 || ch == C2; }
+#if FMTXX_SIMD_AVX2
+    static __m256i Match(__m256i v) {
+        return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(C1)), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(C2)));
+    }
+#endif
+#if FMTXX_SIMD_AVX2 || FMTXX_SIMD_SSE2
+    static __m128i Match(__m128i v) {
+        return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(C1)), _mm_cmpeq_epi8(v, _mm_set1_epi8(C2)));
+    }
+#elif FMTXX_SIMD_NEON
+    static uint8x16_t Match(uint8x16_t v) {
+        return vorrq_u8(vceqq_u8(v, vdupq_n_u8(static_cast<uint8_t>(C1))), vceqq_u8(v, vdupq_n_u8(static_cast<uint8_t>(C2))));
+    }
+#endif
+};
+
+// Matches all characters which are not printable ASCII characters, i.e. all
+// characters outside the range [0x20, 0x7E].
+struct NonPrintableChars
+{
+    static bool Match(char ch) {
+        unsigned char const uch = static_cast<unsigned char>(ch);
+        return uch < 0x20 || uch > 0x7E;
+    }
+#if FMTXX_SIMD_AVX2
+    static __m256i Match(__m256i v) {
+        // Signed compare: bytes >= 0x80 are negative and compare less than 0x20.
+        return _mm256_or_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(0x20), v), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7F)));
+    }
+#endif
+#if FMTXX_SIMD_AVX2 || FMTXX_SIMD_SSE2
+    static __m128i Match(__m128i v) {
+        return _mm_or_si128(_mm_cmplt_epi8(v, _mm_set1_epi8(0x20)), _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7F)));
+    }
+#elif FMTXX_SIMD_NEON
+    static uint8x16_t Match(uint8x16_t v) {
+        return vorrq_u8(vcltq_u8(v, vdupq_n_u8(0x20)), vcgtq_u8(v, vdupq_n_u8(0x7E)));
+    }
+#endif
+};
+
+// Matches all characters which must be escaped in JSON strings: '"', '\\' and
+// the control characters [0x00, 0x1F].
+struct JSONSpecialChars
+{
+    static bool Match(char ch) {
+        return ch == '"' || ch == '\\' || static_cast<unsigned char>(ch) < 0x20;
+    }
+#if FMTXX_SIMD_AVX2
+    static __m256i Match(__m256i v) {
+        // Unsigned compare: v < 0x20 iff min(v, 0x1F) == v.
+        __m256i const ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(0x1F)), v);
+        return _mm256_or_si256(ctrl, AnyOf2<'"', '\\'>::Match(v));
+    }
+#endif
+#if FMTXX_SIMD_AVX2 || FMTXX_SIMD_SSE2
+    static __m128i Match(__m128i v) {
+        __m128i const ctrl = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1F)), v);
+        return _mm_or_si128(ctrl, AnyOf2<'"', '\\'>::Match(v));
+    }
+#elif FMTXX_SIMD_NEON
+    static uint8x16_t Match(uint8x16_t v) {
+        return vorrq_u8(vcltq_u8(v, vdupq_n_u8(0x20)), AnyOf2<'"', '\\'>::Match(v));
+    }
+#endif
+};
+
+} // namespace
+
 //------------------------------------------------------------------------------
 //
 //------------------------------------------------------------------------------
 
-static char ComputeSignChar(bool neg, Sign sign, char fill)
+FMTXX_STATIC char ComputeSignChar(bool neg, Sign sign, char fill)
 {
     if (neg)
         return '-';
@@ -213,7 +551,7 @@ static char ComputeSignChar(bool neg, Sign sign, char fill)
     return '\0';
 }
 
-namespace {
+FMTXX_NAMESPACE_INTERNAL {
 
 struct Padding
 {
@@ -224,7 +562,7 @@ struct Padding
 
 } // namespace
 
-static Padding ComputePadding(size_t len, Align align, int width)
+FMTXX_STATIC Padding ComputePadding(size_t len, Align align, int width)
 {
     assert(width >= 0); // internal error
 
@@ -258,7 +596,7 @@ static Padding ComputePadding(size_t len, Align align, int width)
 
 // Prints out exactly LEN characters (including '\0's) starting at STR,
 // possibly padding on the left and/or right.
-static ErrorCode PrintAndPadString(Writer& w, FormatSpec const& spec, char const* str, size_t len)
+FMTXX_STATIC ErrorCode PrintAndPadString(Writer& w, FormatSpec const& spec, char const* str, size_t len)
 {
     auto const pad = ComputePadding(len, spec.align, spec.width);
 
@@ -272,129 +610,164 @@ static ErrorCode PrintAndPadString(Writer& w, FormatSpec const& spec, char const
     return {};
 }
 
-static ErrorCode PrintAndPadString(Writer& w, FormatSpec const& spec, string_view str)
+FMTXX_STATIC ErrorCode PrintAndPadString(Writer& w, FormatSpec const& spec, string_view str)
 {
     return PrintAndPadString(w, spec, str.data(), str.size());
 }
 
-template <typename F>
-static ErrorCode ForEachQuoted(char const* str, size_t len, F func)
+FMTXX_NAMESPACE_INTERNAL {
+
+// Escapes '"' and '\\' with a backslash.
+struct QuoteEscaper
+{
+    using SpecialChars = AnyOf2<'"', '\\'>;
+
+    static size_t Escape(char* buf, char ch)
+    {
+        buf[0] = '\\';
+        buf[1] = ch;
+        return 2;
+    }
+};
+
+// Replaces all non-printable characters with a backslash followed by 3 octal
+// digits.
+struct OctalEscaper
+{
+    using SpecialChars = NonPrintableChars;
+
+    static size_t Escape(char* buf, char ch)
+    {
+        unsigned char const uch = static_cast<unsigned char>(ch);
+
+        buf[0] = '\\';
+        buf[1] = kUpperDigits[(uch >> 6)      ];
+        buf[2] = kUpperDigits[(uch >> 3) & 0x7];
+        buf[3] = kUpperDigits[(uch >> 0) & 0x7];
+        return 4;
+    }
+};
+
+// Escapes characters as required by JSON (RFC 8259). Bytes >= 0x80 are copied
+// as-is, i.e. the input is assumed to be UTF-8.
+struct JSONEscaper
 {
-    for (size_t i = 0; i < len; ++i)
+    using SpecialChars = JSONSpecialChars;
+
+    static size_t Escape(char* buf, char ch)
     {
-        char const ch = str[i];
+        buf[0] = '\\';
         switch (ch)
         {
         case '"':
         case '\\':
-            if (Failed ec = func('\\'))
-                return ec;
-            if (Failed ec = func(ch))
-                return ec;
-            break;
+            buf[1] = ch;
+            return 2;
+        case '\b':
+            buf[1] = 'b';
+            return 2;
+        case '\f':
+            buf[1] = 'f';
+            return 2;
+        case '\n':
+            buf[1] = 'n';
+            return 2;
+        case '\r':
+            buf[1] = 'r';
+            return 2;
+        case '\t':
+            buf[1] = 't';
+            return 2;
         default:
-            if (Failed ec = func(ch))
-                return ec;
-            break;
+            unsigned char const uch = static_cast<unsigned char>(ch);
+            buf[1] = 'u';
+            buf[2] = '0';
+            buf[3] = '0';
+            buf[4] = kLowerDigits[uch >> 4];
+            buf[5] = kLowerDigits[uch & 0xF];
+            return 6;
         }
     }
+};
 
-    return {};
-}
-
-static ErrorCode WriteQuoted(Writer& w, char const* str, size_t len, size_t quoted_len)
-{
-    if (len == 0)
-        return {};
-    if (len == quoted_len)
-        return w.write(str, len);
+} // namespace
 
-    return ForEachQuoted(str, len, [&](char c) { return w.put(c); });
-}
+// Maximum length of an escape sequence.
+static constexpr size_t kMaxEscapeLength = 6;
 
-static ErrorCode PrintAndPadQuotedString(Writer& w, FormatSpec const& spec, char const* str, size_t len)
+// Returns the length of STR after escaping.
+template <typename Escaper>
+FMTXX_STATIC size_t ComputeEscapedLength(char const* str, size_t len)
 {
-    size_t quoted_len = 0;
+    char buf[kMaxEscapeLength];
 
-    ForEachQuoted(str, len, [&](char) -> ErrorCode {
-        ++quoted_len;
-        return {};
-    });
+    char const*       f   = str;
+    char const* const end = str + len;
 
-    auto const pad = ComputePadding(2 + quoted_len, spec.align, spec.width);
+    size_t escaped_len = len;
+    for (;;)
+    {
+        f = FindFirstOf<typename Escaper::SpecialChars>(f, end);
+        if (f == end)
+            break;
 
-    if (Failed ec = w.pad(spec.fill, pad.left))
-        return ec;
-    if (Failed ec = w.put('"'))
-        return ec;
-    if (Failed ec = WriteQuoted(w, str, len, quoted_len))
-        return ec;
-    if (Failed ec = w.put('"'))
-        return ec;
-    if (Failed ec = w.pad(spec.fill, pad.right))
-        return ec;
+        escaped_len += Escaper::Escape(buf, *f) - 1;
+        ++f;
+    }
 
-    return {};
+    return escaped_len;
 }
 
-static bool IsASCIIPrintable(char ch)
+// Writes STR to W, escaping special characters.
+// Runs of characters which do not need to be escaped are written all at once.
+template <typename Escaper>
+FMTXX_STATIC ErrorCode WriteEscaped(Writer& w, char const* str, size_t len)
 {
-    return 0x20 <= ch && ch <= 0x7E;
-}
+    char buf[kMaxEscapeLength];
 
-template <typename F>
-static ErrorCode ForEachEscaped(char const* str, size_t len, F func)
-{
-    for (size_t i = 0; i < len; ++i)
+    char const*       f   = str;
+    char const* const end = str + len;
+
+    for (;;)
     {
-        char const ch = str[i];
-        if (IsASCIIPrintable(ch))
-        {
-            if (Failed ec = func(ch))
-                return ec;
-        }
-        else
-        {
-            unsigned char uch = static_cast<unsigned char>(ch);
+        char const* const p = FindFirstOf<typename Escaper::SpecialChars>(f, end);
 
-            if (Failed ec = func('\\'))
-                return ec;
-            if (Failed ec = func(kUpperDigits[(uch >> 6)      ]))
-                return ec;
-            if (Failed ec = func(kUpperDigits[(uch >> 3) & 0x7]))
-                return ec;
-            if (Failed ec = func(kUpperDigits[(uch >> 0) & 0x7]))
-                return ec;
-        }
-    }
+        if (Failed ec = w.write(f, static_cast<size_t>(p - f)))
+            return ec;
+        if (p == end)
+            break;
 
-    return {};
-}
+        if (Failed ec = w.write(buf, Escaper::Escape(buf, *p)))
+            return ec;
 
-static ErrorCode WriteEscaped(Writer& w, char const* str, size_t len, size_t escaped_len)
-{
-    if (len == 0)
-        return {};
-    if (len == escaped_len)
-        return w.write(str, len);
+        f = p + 1;
+    }
 
-    return ForEachEscaped(str, len, [&](char c) { return w.put(c); });
+    return {};
 }
 
-static ErrorCode PrintAndPadEscapedString(Writer& w, FormatSpec const& spec, char const* str, size_t len)
+// Prints the escaped string STR, optionally enclosed in QUOTE characters, and
+// pads the result to the field width.
+template <typename Escaper>
+FMTXX_STATIC ErrorCode PrintAndPadEscapedString(Writer& w, FormatSpec const& spec, char const* str, size_t len, char quote = '\0')
 {
-    size_t escaped_len = 0;
-
-    ForEachEscaped(str, len, [&](char) -> ErrorCode {
-        ++escaped_len;
-        return {};
-    });
+    Padding pad;
 
-    auto const pad = ComputePadding(escaped_len, spec.align, spec.width);
+    // The escaped length is only required for padding. Avoid scanning the
+    // string twice if no field width was specified.
+    if (spec.width > 0)
+    {
+        size_t const escaped_len = ComputeEscapedLength<Escaper>(str, len) + (quote ? 2u : 0u);
+        pad = ComputePadding(escaped_len, spec.align, spec.width);
+    }
 
     if (Failed ec = w.pad(spec.fill, pad.left))
         return ec;
-    if (Failed ec = WriteEscaped(w, str, len, escaped_len))
+    if (Failed ec = w.put_nonnull(quote))
+        return ec;
+    if (Failed ec = WriteEscaped<Escaper>(w, str, len))
+        return ec;
+    if (Failed ec = w.put_nonnull(quote))
         return ec;
     if (Failed ec = w.pad(spec.fill, pad.right))
         return ec;
@@ -402,26 +775,35 @@ static ErrorCode PrintAndPadEscapedString(Writer& w, FormatSpec const& spec, cha
     return {};
 }
 
-ErrorCode fmtxx::Util::format_string(Writer& w, FormatSpec const& spec, char const* str, size_t len)
+FMTXX_STATIC ErrorCode PrintAndPadConvertedString(Writer& w, FormatSpec const& spec, char const* str, size_t len)
 {
-    size_t const n = (spec.prec >= 0)
-        ? std::min(len, static_cast<size_t>(spec.prec))
-        : len;
-
     switch (spec.conv) {
     default:
-        return PrintAndPadString(w, spec, str, n);
+        return PrintAndPadString(w, spec, str, len);
     case 'q':
-        return PrintAndPadQuotedString(w, spec, str, n);
+        return PrintAndPadEscapedString<QuoteEscaper>(w, spec, str, len, '"');
     case 'x':
-        return PrintAndPadEscapedString(w, spec, str, n);
+        return PrintAndPadEscapedString<OctalEscaper>(w, spec, str, len);
+    case 'j':
+        return PrintAndPadEscapedString<JSONEscaper>(w, spec, str, len, '"');
     }
 }
 
-ErrorCode fmtxx::Util::format_char_pointer(Writer& w, FormatSpec const& spec, char const* str)
+} // namespace impl
+
+FMTXX_INLINE ErrorCode fmtxx::Util::format_string(Writer& w, FormatSpec const& spec, char const* str, size_t len)
+{
+    size_t const n = (spec.prec >= 0)
+        ? std::min(len, static_cast<size_t>(spec.prec))
+        : len;
+
+    return impl::PrintAndPadConvertedString(w, spec, str, n);
+}
+
+FMTXX_INLINE ErrorCode fmtxx::Util::format_char_pointer(Writer& w, FormatSpec const& spec, char const* str)
 {
     if (str == nullptr)
-        return PrintAndPadString(w, spec, "(null)");
+        return impl::PrintAndPadString(w, spec, "(null)");
 
     // Use strnlen if a precision was specified.
     // The string may not be null-terminated!
@@ -429,17 +811,12 @@ ErrorCode fmtxx::Util::format_char_pointer(Writer& w, FormatSpec const& spec, ch
         ? ::strnlen(str, static_cast<size_t>(spec.prec))
         : ::strlen(str);
 
-    switch (spec.conv) {
-    default:
-        return PrintAndPadString(w, spec, str, len);
-    case 'q':
-        return PrintAndPadQuotedString(w, spec, str, len);
-    case 'x':
-        return PrintAndPadEscapedString(w, spec, str, len);
-    }
+    return impl::PrintAndPadConvertedString(w, spec, str, len);
 }
 
-static ErrorCode PrintAndPadNumber(Writer& w, FormatSpec const& spec, char sign, char const* prefix, size_t nprefix, char const* digits, size_t ndigits)
+namespace impl {
+
+FMTXX_STATIC ErrorCode PrintAndPadNumber(Writer& w, FormatSpec const& spec, char sign, char const* prefix, size_t nprefix, char const* digits, size_t ndigits)
 {
     size_t const len = (sign ? 1u : 0u) + nprefix + ndigits;
 
@@ -461,90 +838,241 @@ static ErrorCode PrintAndPadNumber(Writer& w, FormatSpec const& spec, char sign,
     return {};
 }
 
-static char* DecIntToAsciiBackwards(char* last/*[-20]*/, uint64_t n)
+// Returns the number of leading zero bits.
+FMTXX_STATIC int CountLeadingZeros64(uint64_t n)
 {
-    while (n >= 100)
+    assert(n != 0);
+
+#if defined(__GNUC__)
+    return __builtin_clzll(n);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long high = 0;
+    _BitScanReverse64(&high, n);
+    return 63 - static_cast<int>(high);
+#else
+    int z = 0;
+    while ((n & (uint64_t{1} << 63)) == 0)
     {
-        auto const q = n / 100;
-        auto const r = n % 100;
-        *--last = kDecDigits100[2*r + 1];
-        *--last = kDecDigits100[2*r + 0];
-        n = q;
+        ++z;
+        n <<= 1;
     }
 
-    if (n >= 10)
+    return z;
+#endif
+}
+
+static constexpr uint64_t kPow10[] = {
+    1ull,
+    10ull,
+    100ull,
+    1000ull,
+    10000ull,
+    100000ull,
+    1000000ull,
+    10000000ull,
+    100000000ull,
+    1000000000ull,
+    10000000000ull,
+    100000000000ull,
+    1000000000000ull,
+    10000000000000ull,
+    100000000000000ull,
+    1000000000000000ull,
+    10000000000000000ull,
+    100000000000000000ull,
+    1000000000000000000ull,
+    10000000000000000000ull,
+};
+
+// Returns the number of decimal digits of N. (Returns 1 for N = 0.)
+FMTXX_STATIC int CountDecimalDigits(uint64_t n)
+{
+    // t = floor(log_10(2) * bit_length(n)) is either floor(log_10(n)) or floor(log_10(n)) + 1.
+    uint64_t const x = n | 1;
+    int const t = ((64 - CountLeadingZeros64(x)) * 1233) >> 12;
+    return t + (x >= kPow10[t] ? 1 : 0);
+}
+
+// Returns the number of base-2^BITS_PER_DIGIT digits of N. (Returns 1 for N = 0.)
+FMTXX_STATIC int CountBinaryDigits(uint64_t n, int bits_per_digit)
+{
+    return (64 - CountLeadingZeros64(n | 1) + (bits_per_digit - 1)) / bits_per_digit;
+}
+
+// Converts N < 10^8 into 8 ASCII digits (with leading zeros).
+// The most significant digit is stored in the lowest byte of the result.
+FMTXX_STATIC uint64_t EncodeEightDecimalDigits(uint32_t n)
+{
+    assert(n < 100000000);
+
+    // Split into 2 groups of 4 digits, 4 groups of 2 digits, and 8 digits (one per byte).
+    // The high part of each group is stored in the lower half of the group.
+    // (x / 10^4 = (x * 109951163) >> 40 for all x < 10^8,
+    //  x / 10^2 = (x * 5243) >> 19 for all x < 10^4,
+    //  x / 10^1 = (x * 103) >> 10 for all x < 10^2)
+    uint64_t x = n;
+
+    uint64_t const q4 = (x * 109951163) >> 40;
+    x = (x << 32) - q4 * ((uint64_t{10000} << 32) - 1);
+
+    uint64_t const q2 = ((x * 5243) >> 19) & 0x0000007F0000007F;
+    x = (x << 16) - q2 * ((uint64_t{100} << 16) - 1);
+
+    uint64_t const q1 = ((x * 103) >> 10) & 0x000F000F000F000F;
+    x = (x << 8) - q1 * ((uint64_t{10} << 8) - 1);
+
+    return x + 0x3030303030303030;
+}
+
+// Stores the bytes [8 - count, 8) of the 8-digit group DIGITS at DST.
+FMTXX_STATIC void StoreDecimalDigits(char* dst, uint64_t digits, int count)
+{
+    assert(count >= 1);
+    assert(count <= 8);
+
+    digits >>= 8 * (8 - count);
+    for (int i = 0; i < count; ++i)
     {
-        *--last = kDecDigits100[2*n + 1];
-        *--last = kDecDigits100[2*n + 0];
+        dst[i] = static_cast<char>(digits & 0xFF);
+        digits >>= 8;
     }
-    else
+}
+
+// Writes the NDIGITS least significant decimal digits of N to [first, first + ndigits).
+// Leading zeros are written as required.
+FMTXX_STATIC void WriteDecimalDigits(char* first, int ndigits, uint64_t n)
+{
+    assert(ndigits >= 1);
+    assert(ndigits <= 20);
+
+    char* last = first + ndigits;
+
+    while (ndigits > 8)
+    {
+        uint64_t const q = n / 100000000;
+        uint32_t const r = static_cast<uint32_t>(n - q * 100000000);
+
+        last -= 8;
+        ndigits -= 8;
+        StoreDecimalDigits(last, EncodeEightDecimalDigits(r), 8);
+        n = q;
+    }
+
+    assert(n < kPow10[ndigits]);
+    StoreDecimalDigits(first, EncodeEightDecimalDigits(static_cast<uint32_t>(n)), ndigits);
+}
+
+// Spreads the 8 least significant base-2^BITS_PER_DIGIT digits of N into the
+// bytes of the result, the least significant digit into the lowest byte.
+FMTXX_STATIC uint64_t SpreadBinaryDigits(uint64_t n, int bits_per_digit)
+{
+    uint64_t x = 0;
+    switch (bits_per_digit)
     {
-        *--last = kDecDigits100[2*n + 1];
+    case 4: // 32 bits
+        x = n & 0xFFFFFFFF;
+        x = (x | (x << 16)) & 0x0000FFFF0000FFFF;
+        x = (x | (x <<  8)) & 0x00FF00FF00FF00FF;
+        x = (x | (x <<  4)) & 0x0F0F0F0F0F0F0F0F;
+        break;
+    case 3: // 24 bits
+        x = n & 0xFFFFFF;
+        x = (x | (x << 20)) & 0x00000FFF00000FFF;
+        x = (x | (x << 10)) & 0x003F003F003F003F;
+        x = (x | (x <<  5)) & 0x0707070707070707;
+        break;
+    case 1: // 8 bits
+        x = n & 0xFF;
+        x = (x | (x << 28)) & 0x0000000F0000000F;
+        x = (x | (x << 14)) & 0x0003000300030003;
+        x = (x | (x <<  7)) & 0x0101010101010101;
+        break;
+    default:
+        assert(false && "not implemented"); // internal error
+        break;
     }
 
-    return last;
+    return x;
+}
+
+// Converts 8 spread digits (one per byte, values 0...15) into ASCII.
+FMTXX_STATIC uint64_t BinaryDigitsToAscii(uint64_t x, bool capitals)
+{
+    // 1 in each byte which is >= 10.
+    uint64_t const alpha = ((x + 0x0606060606060606) >> 4) & 0x0101010101010101;
+
+    return x + 0x3030303030303030 + alpha * (capitals ? ('A' - '0' - 10) : ('a' - '0' - 10));
 }
 
-static char* IntToAsciiBackwards(char* last/*[-64]*/, uint64_t n, int base, bool capitals)
+// Writes the NDIGITS least significant base-2^BITS_PER_DIGIT digits of N to [first, first + ndigits).
+// Leading zeros are written as required.
+FMTXX_STATIC void WriteBinaryDigits(char* first, int ndigits, uint64_t n, int bits_per_digit, bool capitals)
 {
-    char const* const xdigits = capitals ? kUpperDigits : kLowerDigits;
+    assert(ndigits >= 1);
+    assert(ndigits <= 64);
+
+    char* last = first + ndigits;
+
+    while (ndigits > 0)
+    {
+        int const count = std::min(ndigits, 8);
+
+        uint64_t const digits = BinaryDigitsToAscii(SpreadBinaryDigits(n, bits_per_digit), capitals);
 
-    assert(base >= 2);
-    assert(base <= 16);
+        last -= count;
+        ndigits -= count;
+        for (int i = 0; i < count; ++i)
+            last[i] = static_cast<char>((digits >> (8 * (count - 1 - i))) & 0xFF);
+
+        n = (bits_per_digit * 8 < 64) ? (n >> (bits_per_digit * 8)) : 0;
+    }
+}
 
+// Writes the digits of N in the given BASE to [first, first + ndigits).
+// NDIGITS must be computed by CountDigits (and may include leading zeros).
+FMTXX_STATIC void WriteDigits(char* first, int ndigits, uint64_t n, int base, bool capitals)
+{
     switch (base)
     {
     case 10:
-        return DecIntToAsciiBackwards(last, n);
+        WriteDecimalDigits(first, ndigits, n);
+        return;
     case 16:
-        do *--last = xdigits[n & 15]; while (n >>= 4);
-        return last;
+        WriteBinaryDigits(first, ndigits, n, 4, capitals);
+        return;
     case 8:
-        do *--last = kUpperDigits[n & 7]; while (n >>= 3);
-        return last;
+        WriteBinaryDigits(first, ndigits, n, 3, capitals);
+        return;
     case 2:
-        do *--last = kUpperDigits[n & 1]; while (n >>= 1);
-        return last;
+        WriteBinaryDigits(first, ndigits, n, 1, capitals);
+        return;
     }
 
     assert(false && "not implemented"); // internal error
-    return last;
 }
 
-// Inserts thousands separators into [first, +off1).
-// Returns the number of separators inserted.
-static int InsertThousandsSep(char* first, char* last, int off1, int off2, char sep, int group_len)
+// Returns the number of digits of N in the given BASE.
+FMTXX_STATIC int CountDigits(uint64_t n, int base)
 {
-    assert(off1 >= 0);
-    assert(off2 >= off1);
-    assert(sep != '\0');
-    assert(group_len > 0);
-
-    int const nsep = (off1 - 1) / group_len;
-
-    if (nsep <= 0)
-        return 0;
-
-    if (off1 != off2)
-    {
-        auto I = MakeArrayIterator(first, last - first);
-        std::copy_backward(I + off1, I + off2, I + (off2 + nsep));
-    }
-
-    char* src = first + off1;
-    char* dst = first + (off1 + nsep);
-
-    for (int i = 0; i < nsep; ++i)
+    switch (base)
     {
-        for (int j = 0; j < group_len; ++j)
-            *--dst = *--src;
-        *--dst = sep;
+    case 10:
+        return CountDecimalDigits(n);
+    case 16:
+        return CountBinaryDigits(n, 4);
+    case 8:
+        return CountBinaryDigits(n, 3);
+    case 2:
+        return CountBinaryDigits(n, 1);
     }
 
-    return nsep;
+    assert(false && "not implemented"); // internal error
+    return 0;
 }
 
-ErrorCode fmtxx::Util::format_int(Writer& w, FormatSpec const& spec, int64_t sext, uint64_t zext)
+} // namespace impl
+
+FMTXX_INLINE ErrorCode fmtxx::Util::format_int(Writer& w, FormatSpec const& spec, int64_t sext, uint64_t zext)
 {
     // N1570, p. 310
     //
@@ -570,7 +1098,7 @@ ErrorCode fmtxx::Util::format_int(Writer& w, FormatSpec const& spec, int64_t sex
     case 'd':
     case 'i':
         base = 10;
-        sign = ComputeSignChar(sext < 0, spec.sign, spec.fill);
+        sign = impl::ComputeSignChar(sext < 0, spec.sign, spec.fill);
         if (sext < 0)
             number = 0 - static_cast<uint64_t>(sext);
         break;
@@ -595,52 +1123,74 @@ ErrorCode fmtxx::Util::format_int(Writer& w, FormatSpec const& spec, int64_t sex
         break;
     }
 
-    constexpr int kMaxSeps = (kMaxIntPrec - 1) / 3;
-    constexpr int kBufSize = kMaxIntPrec + kMaxSeps;
+    // The number of digits, the number of leading zeros and the number of
+    // separators is known in advance. The digits are written from left to
+    // right to their final position.
+
+    int const ndigits = impl::CountDigits(number, base);
+    int const nzeros  = (spec.prec > ndigits) ? std::min(spec.prec, impl::kMaxIntPrec) - ndigits : 0;
+    int const len     = nzeros + ndigits;
+
+    int const group_len = (base == 10) ? 3 : 4;
+    int const nsep      = (spec.tsep != '\0') ? (len - 1) / group_len : 0;
+
+    constexpr int kMaxSeps = (impl::kMaxIntPrec - 1) / 3;
+    constexpr int kBufSize = impl::kMaxIntPrec + kMaxSeps;
 
     char buf[kBufSize];
 
-    char* l = buf + kMaxIntPrec;
-    char* f = IntToAsciiBackwards(l, number, base, upper);
+    char* const f = buf;
+    char* const l = buf + (len + nsep);
 
-    if (spec.prec >= 0)
+    if (nsep == 0)
     {
-        int const prec = std::min(spec.prec, kMaxIntPrec);
-        while (l - f < prec)
-        {
-            *--f = '0';
-        }
+        std::fill_n(f, nzeros, '0');
+        impl::WriteDigits(f + nzeros, ndigits, number, base, upper);
     }
-
-    if (spec.tsep != '\0')
+    else
     {
-        int const pos = static_cast<int>(l - f);
-        l += InsertThousandsSep(f, buf + kBufSize, pos, pos, spec.tsep, base == 10 ? 3 : 4);
+        // Write the digits to the end of the buffer, then move them into place,
+        // one group at a time. The destination never overtakes the source.
+        char* src = l - len;
+        std::fill_n(src, nzeros, '0');
+        impl::WriteDigits(src + nzeros, ndigits, number, base, upper);
+
+        char* dst = f;
+        int n = len - nsep * group_len; // The first group (1...group_len digits)
+        for (;;)
+        {
+            for (int i = 0; i < n; ++i)
+                *dst++ = *src++;
+            if (dst == l)
+                break;
+            *dst++ = spec.tsep;
+            n = group_len;
+        }
     }
 
     char const prefix[] = {'0', conv};
-    return PrintAndPadNumber(w, spec, sign, prefix, nprefix, f, static_cast<size_t>(l - f));
+    return impl::PrintAndPadNumber(w, spec, sign, prefix, nprefix, f, static_cast<size_t>(l - f));
 }
 
-ErrorCode fmtxx::Util::format_bool(Writer& w, FormatSpec const& spec, bool val)
+FMTXX_INLINE ErrorCode fmtxx::Util::format_bool(Writer& w, FormatSpec const& spec, bool val)
 {
     switch (spec.conv)
     {
     default:
-        return PrintAndPadString(w, spec, val ? "true" : "false");
+        return impl::PrintAndPadString(w, spec, val ? "true" : "false");
     case 'y':
-        return PrintAndPadString(w, spec, val ? "yes" : "no");
+        return impl::PrintAndPadString(w, spec, val ? "yes" : "no");
     case 'o':
-        return PrintAndPadString(w, spec, val ? "on" : "off");
+        return impl::PrintAndPadString(w, spec, val ? "on" : "off");
     }
 }
 
-ErrorCode fmtxx::Util::format_char(Writer& w, FormatSpec const& spec, char ch)
+FMTXX_INLINE ErrorCode fmtxx::Util::format_char(Writer& w, FormatSpec const& spec, char ch)
 {
     switch (spec.conv)
     {
     default:
-        return PrintAndPadString(w, spec, &ch, 1u);
+        return impl::PrintAndPadString(w, spec, &ch, 1u);
     case 'd':
     case 'i':
     case 'u':
@@ -653,10 +1203,10 @@ ErrorCode fmtxx::Util::format_char(Writer& w, FormatSpec const& spec, char ch)
     }
 }
 
-ErrorCode fmtxx::Util::format_pointer(Writer& w, FormatSpec const& spec, void const* pointer)
+FMTXX_INLINE ErrorCode fmtxx::Util::format_pointer(Writer& w, FormatSpec const& spec, void const* pointer)
 {
     if (pointer == nullptr)
-        return PrintAndPadString(w, spec, "(nil)");
+        return impl::PrintAndPadString(w, spec, "(nil)");
 
     FormatSpec fs = spec;
     switch (fs.conv)
@@ -688,9 +1238,11 @@ ErrorCode fmtxx::Util::format_pointer(Writer& w, FormatSpec const& spec, void co
     return Util::format_int(w, fs, reinterpret_cast<uintptr_t>(pointer));
 }
 
+namespace impl {
+
 namespace dtoa {
 
-namespace {
+FMTXX_NAMESPACE_INTERNAL {
 
 struct Double
 {
@@ -753,62 +1305,86 @@ struct Options {
     bool emit_positive_exponent_sign = true;  //   E G A
 };
 
+// Describes the textual representation of a floating-point number:
+//
+//      digits[000][.][000]digits[000][e+123]
+//
+// Only the significant digits are stored in a buffer. The zeros are implied
+// and are emitted directly into the output, so that the amount of memory
+// required does not depend on the requested precision.
+struct Repr
+{
+    char const* digits     = nullptr;
+    int  int_digits        = 0;    // digits[0, int_digits)
+    int  int_zeros         = 0;
+    char thousands_sep     = '\0'; // Separates groups of 3 digits in the integral part
+    char decimal_point     = '\0'; // '\0' if the decimal point is omitted
+    int  frac_zeros        = 0;
+    int  frac_digits       = 0;    // digits[int_digits, int_digits + frac_digits)
+    int  trailing_zeros    = 0;
+    int  exponent_len      = 0;
+    char exponent[8];
+};
+
 } // namespace
 
-static int CreateFixedRepresentation(char* buf, int bufsize, int num_digits, int decpt, int precision, Options const& options)
+// The maximum number of significant decimal digits of a double-precision
+// number. Any digits beyond are zeros.
+static constexpr int kMaxSignificantDigits = 767;
+
+// Buffer size for the fast digit generators. FastFixedDtoa produces at most 22
+// integral and 20 fractional digits. Short numbers are formatted in place.
+static constexpr int kFastDigitsBufSize = 64;
+
+static_assert(kFastDigitsBufSize >= 22 + 20 + 1/*null*/, "buffer too small");
+
+// Buffer size required for the bignum fallback. The number of requested
+// digits is limited to the number of possibly non-zero digits.
+static constexpr int kBignumDigitsBufSize = kMaxSignificantDigits + 1/*null*/;
+
+FMTXX_STATIC void CreateFixedRepresentation(Repr& repr, char const* buf, int num_digits, int decpt, int precision, Options const& options)
 {
     assert(options.decimal_point != '\0');
 
+    repr.digits = buf;
+
     if (decpt <= 0)
     {
         // 0.[000]digits[000]
 
         assert(precision == 0 || precision >= -decpt + num_digits);
 
+        repr.int_zeros = 1;
+
         if (precision > 0)
         {
-            int const len       = 2 + precision;
-            int const pad_front = 2 + -decpt;
-            int const pad_back  = len - num_digits - pad_front;
-
-            auto I = MakeArrayIterator(buf, bufsize);
-
-            // digits --> 0.[000]digits
-            std::copy_backward(I, I + num_digits, I + (num_digits + pad_front));
-            std::fill_n(I, pad_front, '0');
-            I[1] = options.decimal_point;
-
-            // 0.[000]digits --> 0.[000]digits[000]
-            std::fill_n(I + (num_digits + pad_front), pad_back, '0');
-
-            return len;
+            repr.decimal_point  = options.decimal_point;
+            repr.frac_zeros     = -decpt;
+            repr.frac_digits    = num_digits;
+            repr.trailing_zeros = precision - num_digits - -decpt;
         }
-        else
+        else if (options.use_alternative_form)
         {
-            buf[0] = '0';
-            if (options.use_alternative_form)
-                buf[1] = options.decimal_point;
-
-            return 1 + (options.use_alternative_form ? 1 : 0);
+            repr.decimal_point = options.decimal_point;
         }
+
+        return;
     }
 
-    int last = 0;
+    repr.thousands_sep = options.thousands_sep;
+
     if (decpt >= num_digits)
     {
         // digits[000][.000]
 
-        int const nzeros = decpt - num_digits;
-        int const nextra = precision > 0 ? 1 + precision : (options.use_alternative_form ? 1 : 0);
-        // nextra includes the decimal point -- if any.
+        repr.int_digits = num_digits;
+        repr.int_zeros  = decpt - num_digits;
 
-        std::fill_n(buf + num_digits, nzeros + nextra, '0');
-        if (nextra > 0)
+        if (precision > 0 || options.use_alternative_form)
         {
-            buf[decpt] = options.decimal_point;
+            repr.decimal_point  = options.decimal_point;
+            repr.trailing_zeros = precision;
         }
-
-        last = decpt + nextra;
     }
     else
     {
@@ -816,28 +1392,155 @@ static int CreateFixedRepresentation(char* buf, int bufsize, int num_digits, int
 
         assert(precision >= num_digits - decpt); // >= 1
 
-        auto I = MakeArrayIterator(buf, bufsize);
+        repr.int_digits     = decpt;
+        repr.decimal_point  = options.decimal_point;
+        repr.frac_digits    = num_digits - decpt;
+        repr.trailing_zeros = precision - (num_digits - decpt);
+    }
+}
+
+// Returns the 128-bit product a * b. The high 64 bits are stored in HI.
+FMTXX_STATIC uint64_t Mul128(uint64_t a, uint64_t b, uint64_t& hi)
+{
+#if defined(__SIZEOF_INT128__)
+    __extension__ using uint128_t = unsigned __int128;
+
+    uint128_t const p = static_cast<uint128_t>(a) * b;
+    hi = static_cast<uint64_t>(p >> 64);
+    return static_cast<uint64_t>(p);
+#else
+    uint64_t const a_lo = a & 0xFFFFFFFF;
+    uint64_t const a_hi = a >> 32;
+    uint64_t const b_lo = b & 0xFFFFFFFF;
+    uint64_t const b_hi = b >> 32;
+
+    uint64_t const p0 = a_lo * b_lo;
+    uint64_t const p1 = a_lo * b_hi;
+    uint64_t const p2 = a_hi * b_lo;
+    uint64_t const p3 = a_hi * b_hi;
+
+    uint64_t const mid = (p0 >> 32) + (p1 & 0xFFFFFFFF) + (p2 & 0xFFFFFFFF);
+
+    hi = p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32);
+    return (mid << 32) | (p0 & 0xFFFFFFFF);
+#endif
+}
+
+// Maximum precision supported by FastFixedDigits.
+static constexpr int kMaxFastFixedPrecision = 17;
+
+// Computes the digits of round(v * 10^requested_digits) using 128-bit integer
+// arithmetic. Like FastFixedDtoa, ties are rounded away from zero.
+// Returns false if the result does not fit into 64 bits.
+FMTXX_STATIC bool FastFixedDigits(double v, int requested_digits, char* buf, int bufsize, int* num_digits, int* decpt)
+{
+    static_assert(sizeof(kPow10) / sizeof(kPow10[0]) > kMaxFastFixedPrecision, "invalid table size");
+
+    assert(requested_digits >= 0);
+    assert(requested_digits <= kMaxFastFixedPrecision);
+
+    Double const d{v};
+
+    uint64_t f = d.Significand();
+    int      e = static_cast<int>(d.Exponent());
+    if (e == 0) // denormal
+        e = 1;
+    else
+        f |= Double::kHiddenBit;
+    e -= Double::kExponentBias + 52;
+
+    // v = f * 2^e
+
+    uint64_t n = 0; // = round(v * 10^requested_digits)
+    if (e >= 0)
+    {
+        // v is an integer.
+        if (e >= 64 - 53)
+            return false;
+
+        uint64_t hi = 0;
+        n = Mul128(f << e, kPow10[requested_digits], hi);
+        if (hi != 0)
+            return false;
+    }
+    else
+    {
+        // f * 10^requested_digits < 2^53 * 2^57 = 2^110.
+        uint64_t hi = 0;
+        uint64_t lo = Mul128(f, kPow10[requested_digits], hi);
 
-        // digits --> dig.its
-        std::copy_backward(I + decpt, I + num_digits, I + (num_digits + 1));
-        I[decpt] = options.decimal_point;
+        int const s = -e;
+        if (s >= 111)
+        {
+            // The product is less than 2^110 <= 2^(s - 1).
+            // The result rounds to 0.
+            n = 0;
+        }
+        else if (s >= 64)
+        {
+            n = hi >> (s - 64);
+            // Round up iff bit (s - 1) is set.
+            uint64_t const half = (s == 64) ? (lo >> 63) : (hi >> (s - 64 - 1));
+            n += half & 1;
+        }
+        else
+        {
+            if ((hi >> s) != 0)
+                return false;
 
-        // dig.its --> dig.its[000]
-        std::fill_n(I + (num_digits + 1), precision - (num_digits - decpt), '0');
+            n = (hi << (64 - s)) | (lo >> s);
+            // Round up iff bit (s - 1) is set.
+            n += (lo >> (s - 1)) & 1;
+            if (n == 0) // overflow
+                return false;
+        }
+    }
 
-        last = decpt + 1 + precision;
+    if (n == 0)
+    {
+        *num_digits = 0;
+        *decpt = -requested_digits;
+        return true;
     }
 
-    if (options.thousands_sep != '\0')
+    // Remove trailing zeros. (Like FastFixedDtoa.)
+    int k = 0;
+    while (n % 10 == 0)
     {
-        last += InsertThousandsSep(buf, buf + bufsize, decpt, last, options.thousands_sep, 3);
+        n /= 10;
+        k++;
     }
 
-    return last;
+    int const len = CountDecimalDigits(n);
+    assert(len <= bufsize);
+    static_cast<void>(bufsize);
+
+    WriteDecimalDigits(buf, len, n);
+    *num_digits = len;
+    *decpt = len + k - requested_digits;
+
+    return true;
+}
+
+// Returns the number of (possibly) non-zero digits after the decimal point.
+FMTXX_STATIC int CountFractionalDigits(double v)
+{
+    Double const d{v};
+
+    int e = static_cast<int>(d.Exponent());
+    if (e == 0) // denormal
+        e = 1;
+    e -= Double::kExponentBias + 52;
+
+    // v = f * 2^e = f * 5^-e / 10^-e
+    return e < 0 ? -e : 0;
 }
 
-static void GenerateFixedDigits(double v, int requested_digits, char* buf, int bufsize, int* num_digits, int* decpt)
+// Returns false if the bignum fallback is required, but BUF is too small.
+FMTXX_STATIC bool GenerateFixedDigits(double v, int requested_digits, char* buf, int bufsize, int* num_digits, int* decpt)
 {
+    assert(bufsize >= kFastDigitsBufSize);
+
     Double const d{v};
 
     assert(!d.IsSpecial());
@@ -849,33 +1552,50 @@ static void GenerateFixedDigits(double v, int requested_digits, char* buf, int b
         buf[0] = '0';
         *num_digits = 1;
         *decpt = 1;
-        return;
+        return true;
     }
 
-    double_conversion::Vector<char> vec(buf, bufsize);
-
-    bool const fast_worked = FastFixedDtoa(v, requested_digits, vec, num_digits, decpt);
-    if (!fast_worked)
+    if (requested_digits <= kMaxFastFixedPrecision)
     {
-        BignumDtoa(v, double_conversion::BIGNUM_DTOA_FIXED, requested_digits, vec, num_digits, decpt);
+        if (FastFixedDigits(v, requested_digits, buf, bufsize, num_digits, decpt))
+            return true;
     }
+
+    double_conversion::Vector<char> vec(buf, bufsize);
+
+    if (FastFixedDtoa(v, requested_digits, vec, num_digits, decpt))
+        return true;
+
+    if (bufsize < kBignumDigitsBufSize)
+        return false;
+
+    stats::impl::CountBignumFallback(stats::DtoaMode::fixed);
+
+    // The digits following the last non-zero digit are not required: they are
+    // all zeros and there is nothing to round.
+    requested_digits = std::min(requested_digits, CountFractionalDigits(v));
+
+    BignumDtoa(v, double_conversion::BIGNUM_DTOA_FIXED, requested_digits, vec, num_digits, decpt);
+    return true;
 }
 
-static int ToFixed(char* buf, int bufsize, double d, int precision, Options const& options)
+FMTXX_STATIC bool ToFixed(Repr& repr, char* buf, int bufsize, double d, int precision, Options const& options)
 {
     int num_digits = 0;
     int decpt = 0;
 
-    GenerateFixedDigits(d, precision, buf, bufsize, &num_digits, &decpt);
+    if (!GenerateFixedDigits(d, precision, buf, bufsize, &num_digits, &decpt))
+        return false;
 
     assert(num_digits >= 0);
 
-    return CreateFixedRepresentation(buf, bufsize, num_digits, decpt, precision, options);
+    CreateFixedRepresentation(repr, buf, num_digits, decpt, precision, options);
+    return true;
 }
 
 // Append a decimal representation of EXPONENT to BUF.
 // Returns pos + number of characters written.
-static int AppendExponent(char* buf, int /*bufsize*/, int pos, int exponent, Options const& options)
+FMTXX_STATIC int AppendExponent(char* buf, int /*bufsize*/, int pos, int exponent, Options const& options)
 {
     assert(exponent > -10000);
     assert(exponent <  10000);
@@ -905,52 +1625,40 @@ static int AppendExponent(char* buf, int /*bufsize*/, int pos, int exponent, Opt
     return pos;
 }
 
-static int CreateExponentialRepresentation(char* buf, int bufsize, int num_digits, int exponent, int precision, Options const& options)
+FMTXX_STATIC void CreateExponentialRepresentation(Repr& repr, char const* buf, int num_digits, int exponent, int precision, Options const& options)
 {
     assert(options.decimal_point != '\0');
+    assert(num_digits > 0);
 
-    int pos = 0;
+    repr.digits     = buf;
+    repr.int_digits = 1; // leading digit
 
-    pos += 1; // leading digit
     if (num_digits > 1)
     {
         // d.igits[000]e+123
 
-        auto I = MakeArrayIterator(buf, bufsize);
-
-        std::copy_backward(I + pos, I + (pos + num_digits - 1), I + (pos + num_digits));
-        I[pos] = options.decimal_point;
-        pos += 1 + (num_digits - 1);
+        repr.decimal_point = options.decimal_point;
+        repr.frac_digits   = num_digits - 1;
 
         if (precision > num_digits - 1)
-        {
-            int const nzeros = precision - (num_digits - 1);
-            std::fill_n(I + pos, nzeros, '0');
-            pos += nzeros;
-        }
+            repr.trailing_zeros = precision - (num_digits - 1);
     }
-    else if (precision > 0)
+    else if (precision > 0 || options.use_alternative_form)
     {
         // d.0[000]e+123
-
-        std::fill_n(buf + pos, 1 + precision, '0');
-        buf[pos] = options.decimal_point;
-        pos += 1 + precision;
-    }
-    else
-    {
         // d[.]e+123
 
-        if (options.use_alternative_form)
-            buf[pos++] = options.decimal_point;
+        repr.decimal_point  = options.decimal_point;
+        repr.trailing_zeros = precision;
     }
 
-    return AppendExponent(buf, bufsize, pos, exponent, options);
+    repr.exponent_len = AppendExponent(repr.exponent, static_cast<int>(sizeof(repr.exponent)), 0, exponent, options);
 }
 
-static void GeneratePrecisionDigits(double v, int requested_digits, char* buf, int bufsize, int* num_digits, int* decpt)
+// Returns false if the bignum fallback is required, but BUF is too small.
+FMTXX_STATIC bool GeneratePrecisionDigits(double v, int requested_digits, char* buf, int bufsize, int* num_digits, int* decpt)
 {
-    assert(bufsize >= 1);
+    assert(bufsize >= kFastDigitsBufSize);
     assert(requested_digits >= 0);
 
     Double const d{v};
@@ -962,7 +1670,7 @@ static void GeneratePrecisionDigits(double v, int requested_digits, char* buf, i
     {
         *num_digits = 0;
         *decpt = 0;
-        return;
+        return true;
     }
 
     if (d.IsZero())
@@ -970,32 +1678,48 @@ static void GeneratePrecisionDigits(double v, int requested_digits, char* buf, i
         buf[0] = '0';
         *num_digits = 1;
         *decpt = 1;
-        return;
+        return true;
     }
 
     double_conversion::Vector<char> vec(buf, bufsize);
 
-    bool const fast_worked = FastDtoa(v, double_conversion::FAST_DTOA_PRECISION, requested_digits, vec, num_digits, decpt);
-    if (!fast_worked)
+    // FastDtoa writes up to requested_digits digits before it possibly gives
+    // up.
+    if (requested_digits < bufsize)
     {
-        BignumDtoa(v, double_conversion::BIGNUM_DTOA_PRECISION, requested_digits, vec, num_digits, decpt);
+        if (FastDtoa(v, double_conversion::FAST_DTOA_PRECISION, requested_digits, vec, num_digits, decpt))
+            return true;
     }
+
+    if (bufsize < kBignumDigitsBufSize)
+        return false;
+
+    stats::impl::CountBignumFallback(stats::DtoaMode::precision);
+
+    // The digits following the last non-zero digit are not required: they are
+    // all zeros and there is nothing to round.
+    requested_digits = std::min(requested_digits, kMaxSignificantDigits);
+
+    BignumDtoa(v, double_conversion::BIGNUM_DTOA_PRECISION, requested_digits, vec, num_digits, decpt);
+    return true;
 }
 
-static int ToExponential(char* buf, int bufsize, double d, int precision, Options const& options)
+FMTXX_STATIC bool ToExponential(Repr& repr, char* buf, int bufsize, double d, int precision, Options const& options)
 {
     int num_digits = 0;
     int decpt = 0;
 
-    GeneratePrecisionDigits(d, precision + 1, buf, bufsize, &num_digits, &decpt);
+    if (!GeneratePrecisionDigits(d, precision + 1, buf, bufsize, &num_digits, &decpt))
+        return false;
 
     assert(num_digits > 0);
 
     int const exponent = decpt - 1;
-    return CreateExponentialRepresentation(buf, bufsize, num_digits, exponent, precision, options);
+    CreateExponentialRepresentation(repr, buf, num_digits, exponent, precision, options);
+    return true;
 }
 
-static int ToGeneral(char* buf, int bufsize, double d, int precision, Options const& options)
+FMTXX_STATIC bool ToGeneral(Repr& repr, char* buf, int bufsize, double d, int precision, Options const& options)
 {
     assert(precision >= 0);
 
@@ -1004,7 +1728,8 @@ static int ToGeneral(char* buf, int bufsize, double d, int precision, Options co
 
     int const P = precision == 0 ? 1 : precision;
 
-    GeneratePrecisionDigits(d, P, buf, bufsize, &num_digits, &decpt);
+    if (!GeneratePrecisionDigits(d, P, buf, bufsize, &num_digits, &decpt))
+        return false;
 
     assert(num_digits > 0);
     assert(num_digits <= P); // GeneratePrecisionDigits is allowed to return fewer digits if they are all 0's.
@@ -1025,7 +1750,7 @@ static int ToGeneral(char* buf, int bufsize, double d, int precision, Options co
             prec = std::min(prec, num_digits - decpt);
         }
 
-        return CreateFixedRepresentation(buf, bufsize, num_digits, decpt, prec, options);
+        CreateFixedRepresentation(repr, buf, num_digits, decpt, prec, options);
     }
     else
     {
@@ -1035,25 +1760,13 @@ static int ToGeneral(char* buf, int bufsize, double d, int precision, Options co
             prec = std::min(prec, num_digits - 1);
         }
 
-        return CreateExponentialRepresentation(buf, bufsize, num_digits, X, prec, options);
-    }
-}
-
-static int CountLeadingZeros64(uint64_t n)
-{
-    assert(n != 0);
-
-    int z = 0;
-    while ((n & (uint64_t{1} << 63)) == 0)
-    {
-        ++z;
-        n <<= 1;
+        CreateExponentialRepresentation(repr, buf, num_digits, X, prec, options);
     }
 
-    return z;
+    return true;
 }
 
-static void GenerateHexDigits(double v, int precision, bool normalize, bool upper, char* buffer, int buffer_size, int* num_digits, int* binary_exponent)
+FMTXX_STATIC void GenerateHexDigits(double v, int precision, bool normalize, bool upper, char* buffer, int buffer_size, int* num_digits, int* binary_exponent)
 {
     assert(buffer_size >= 52/4 + 1);
     MaybeUnused(buffer_size);
@@ -1148,7 +1861,7 @@ static void GenerateHexDigits(double v, int precision, bool normalize, bool uppe
     }
 }
 
-static int ToHex(char* buf, int bufsize, double d, int precision, Options const& options)
+FMTXX_STATIC bool ToHex(Repr& repr, char* buf, int bufsize, double d, int precision, Options const& options)
 {
     int num_digits = 0;
     int binary_exponent = 0;
@@ -1157,10 +1870,56 @@ static int ToHex(char* buf, int bufsize, double d, int precision, Options const&
 
     assert(num_digits > 0);
 
-    return CreateExponentialRepresentation(buf, bufsize, num_digits, binary_exponent, precision, options);
+    CreateExponentialRepresentation(repr, buf, num_digits, binary_exponent, precision, options);
+    return true;
+}
+
+// Generates the shortest decimal digits for the single-precision value V.
+FMTXX_STATIC void GenerateShortestSingleDigits(double v, char* buf, int bufsize, int* num_digits, int* decpt)
+{
+    assert(bufsize >= 9 + 1 /*null*/);
+    assert(static_cast<double>(static_cast<float>(v)) == v);
+
+#if FMTXX_USE_DOUBLE_CONVERSION_SHORTEST
+    double_conversion::Vector<char> vec(buf, bufsize);
+
+    bool const fast_worked = FastDtoa(v, double_conversion::FAST_DTOA_SHORTEST_SINGLE, -1, vec, num_digits, decpt);
+    if (!fast_worked)
+    {
+        stats::impl::CountBignumFallback(stats::DtoaMode::shortest);
+        BignumDtoa(v, double_conversion::BIGNUM_DTOA_SHORTEST_SINGLE, -1, vec, num_digits, decpt);
+    }
+#else
+    static_cast<void>(bufsize);
+
+    float const f = static_cast<float>(v);
+
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(float));
+
+    uint32_t digits = 0;
+    int exponent = 0;
+    ryu::ShortestDecimalSingle(bits & 0x007FFFFF, bits >> 23, &digits, &exponent);
+
+    assert(digits != 0);
+
+    // Remove trailing zeros. (Only the digits are required here.)
+    while (digits % 10 == 0)
+    {
+        digits /= 10;
+        exponent++;
+    }
+
+    int const k = CountDecimalDigits(digits);
+    assert(k <= 9);
+
+    WriteDecimalDigits(buf, k, digits);
+    *num_digits = k;
+    *decpt = exponent + k;
+#endif
 }
 
-static void GenerateShortestDigits(double v, char* buf, int bufsize, int* num_digits, int* decpt)
+FMTXX_STATIC void GenerateShortestDigits(double v, bool single, char* buf, int bufsize, int* num_digits, int* decpt)
 {
     assert(bufsize >= 17 + 1 /*null*/);
 
@@ -1177,59 +1936,90 @@ static void GenerateShortestDigits(double v, char* buf, int bufsize, int* num_di
         return;
     }
 
+    if (single)
+    {
+        GenerateShortestSingleDigits(v, buf, bufsize, num_digits, decpt);
+        return;
+    }
+
+#if FMTXX_USE_DOUBLE_CONVERSION_SHORTEST
     double_conversion::Vector<char> vec(buf, bufsize);
 
     bool const fast_worked = FastDtoa(v, double_conversion::FAST_DTOA_SHORTEST, -1, vec, num_digits, decpt);
     if (!fast_worked)
     {
+        stats::impl::CountBignumFallback(stats::DtoaMode::shortest);
         BignumDtoa(v, double_conversion::BIGNUM_DTOA_SHORTEST, -1, vec, num_digits, decpt);
     }
+#else
+    uint64_t digits = 0;
+    int exponent = 0;
+    ryu::ShortestDecimal(d.Significand(), static_cast<uint32_t>(d.Exponent()), &digits, &exponent);
+
+    assert(digits != 0);
+
+    // Remove trailing zeros. (Only the digits are required here.)
+    while (digits % 10 == 0)
+    {
+        digits /= 10;
+        exponent++;
+    }
+
+    int const k = CountDecimalDigits(digits);
+    assert(k <= 17);
+
+    WriteDecimalDigits(buf, k, digits);
+    *num_digits = k;
+    *decpt = exponent + k;
+#endif
 }
 
-static int ToECMAScript(char* buf, int bufsize, double d, char decimal_point, char exponent_char)
+FMTXX_STATIC bool ToECMAScript(Repr& repr, char* buf, int bufsize, double d, bool single, char decimal_point, char exponent_char)
 {
-    assert(bufsize >= 24);
-
-    auto I = MakeArrayIterator(buf, bufsize);
+    assert(bufsize >= 17 + 1 /*null*/);
 
     int num_digits = 0;
     int decpt = 0;
 
-    GenerateShortestDigits(d, buf, bufsize, &num_digits, &decpt);
+    GenerateShortestDigits(d, single, buf, bufsize, &num_digits, &decpt);
 
     assert(num_digits > 0);
 
     int const k = num_digits;
     int const n = decpt;
 
+    repr.digits = buf;
+
     // Use a decimal notation if -6 < n <= 21.
 
     if (k <= n && n <= 21)
     {
         // digits[000]
 
-        std::fill_n(I + k, n - k, '0');
-        return n;
+        repr.int_digits = k;
+        repr.int_zeros  = n - k;
+        return true;
     }
 
     if (0 < n && n <= 21)
     {
         // dig.its
 
-        std::copy_backward(I + n, I + k, I + (k + 1));
-        I[n] = decimal_point;
-        return k + 1;
+        repr.int_digits    = n;
+        repr.decimal_point = decimal_point;
+        repr.frac_digits   = k - n;
+        return true;
     }
 
     if (-6 < n && n <= 0)
     {
         // 0.[000]digits
 
-        std::copy_backward(I, I + k, I + (2 + -n + k));
-        I[0] = '0';
-        I[1] = decimal_point;
-        std::fill_n(I + 2, -n, '0');
-        return 2 + (-n) + k;
+        repr.int_zeros     = 1;
+        repr.decimal_point = decimal_point;
+        repr.frac_zeros    = -n;
+        repr.frac_digits   = k;
+        return true;
     }
 
     // Otherwise use an exponential notation.
@@ -1240,27 +2030,23 @@ static int ToECMAScript(char* buf, int bufsize, double d, char decimal_point, ch
     options.exponent_char = exponent_char;
     options.emit_positive_exponent_sign = true;
 
-    if (k == 1)
-    {
-        // dE+123
+    // dE+123
+    // d.igitsE+123
 
-        int const endpos = AppendExponent(buf, bufsize, /*pos*/ 1, n - 1, options);
-        return endpos;
-    }
-    else
+    repr.int_digits = 1;
+    if (k > 1)
     {
-        // d.igitsE+123
-
-        std::copy_backward(I + 1, I + k, I + (k + 1));
-        I[1] = decimal_point;
-        int const endpos = AppendExponent(buf, bufsize, /*pos*/ k + 1, n - 1, options);
-        return endpos;
+        repr.decimal_point = decimal_point;
+        repr.frac_digits   = k - 1;
     }
+
+    repr.exponent_len = AppendExponent(repr.exponent, static_cast<int>(sizeof(repr.exponent)), 0, n - 1, options);
+    return true;
 }
 
 } // namespace dtoa
 
-static ErrorCode HandleSpecialFloat(Writer& w, FormatSpec const& spec, char sign, bool upper, bool is_nan)
+FMTXX_STATIC ErrorCode HandleSpecialFloat(Writer& w, FormatSpec const& spec, char sign, bool upper, bool is_nan)
 {
     if (is_nan)
         return PrintAndPadString(w, spec, upper ? "NAN" : "nan");
@@ -1268,16 +2054,232 @@ static ErrorCode HandleSpecialFloat(Writer& w, FormatSpec const& spec, char sign
     char  inf_lower[] = " inf";
     char  inf_upper[] = " INF";
     char* str = upper ? inf_upper : inf_lower;
+    size_t len = 4;
 
     if (sign != '\0')
         *str = sign;
     else
+    {
         ++str; // skip leading space
+        --len;
+    }
 
-    return PrintAndPadString(w, spec, str);
+    return PrintAndPadString(w, spec, str, len);
 }
 
-ErrorCode fmtxx::Util::format_double(Writer& w, FormatSpec const& spec, double x)
+FMTXX_NAMESPACE_INTERNAL {
+
+struct FloatConversion
+{
+    char          conv;
+    int           prec;
+    bool          single;
+    double        abs_x;
+    dtoa::Options options;
+};
+
+} // namespace
+
+// Returns false if BUF is too small to hold the digits.
+FMTXX_STATIC bool ConvertFloat(dtoa::Repr& repr, char* buf, int bufsize, FloatConversion const& fc)
+{
+    switch (fc.conv)
+    {
+    case 's':
+    case 'S':
+        return dtoa::ToECMAScript(repr, buf, bufsize, fc.abs_x, fc.single, fc.options.decimal_point, fc.options.exponent_char);
+    case 'f':
+    case 'F':
+        return dtoa::ToFixed(repr, buf, bufsize, fc.abs_x, fc.prec, fc.options);
+    case 'e':
+    case 'E':
+        return dtoa::ToExponential(repr, buf, bufsize, fc.abs_x, fc.prec, fc.options);
+    case 'g':
+    case 'G':
+        return dtoa::ToGeneral(repr, buf, bufsize, fc.abs_x, fc.prec, fc.options);
+    case 'x':
+    case 'X':
+        return dtoa::ToHex(repr, buf, bufsize, fc.abs_x, fc.prec, fc.options);
+    default:
+        assert(false && "internal error");
+        return true;
+    }
+}
+
+FMTXX_STATIC size_t ComputeLength(dtoa::Repr const& repr)
+{
+    int const int_len = repr.int_digits + repr.int_zeros;
+    int const nsep    = (repr.thousands_sep != '\0') ? (int_len - 1) / 3 : 0;
+
+    int const len = int_len
+                  + nsep
+                  + (repr.decimal_point != '\0' ? 1 : 0)
+                  + repr.frac_zeros
+                  + repr.frac_digits
+                  + repr.trailing_zeros
+                  + repr.exponent_len;
+
+    return static_cast<size_t>(len);
+}
+
+// Converts the digits in BUF into the textual representation described by
+// REPR. The result must fit into BUF.
+// The characters are written from right to left, so that no digit is
+// overwritten before it has been moved into its final position.
+FMTXX_STATIC void ExpandFloatRepr(char* buf, dtoa::Repr const& repr, size_t len)
+{
+    assert(repr.digits == buf);
+
+    char* p = buf + len;
+
+    for (int i = repr.exponent_len; i > 0; --i)
+        *--p = repr.exponent[i - 1];
+    p -= repr.trailing_zeros;
+    std::fill_n(p, repr.trailing_zeros, '0');
+    p = std::copy_backward(buf + repr.int_digits, buf + (repr.int_digits + repr.frac_digits), p);
+    p -= repr.frac_zeros;
+    std::fill_n(p, repr.frac_zeros, '0');
+    if (repr.decimal_point != '\0')
+        *--p = repr.decimal_point;
+
+    int const int_len = repr.int_digits + repr.int_zeros;
+
+    if (repr.thousands_sep == '\0')
+    {
+        p -= repr.int_zeros;
+        std::fill_n(p, repr.int_zeros, '0');
+
+        // The integral digits are already in place.
+        p -= repr.int_digits;
+    }
+    else
+    {
+        for (int i = int_len, n = 0; i > 0; --i, ++n)
+        {
+            if (n == 3)
+            {
+                *--p = repr.thousands_sep;
+                n = 0;
+            }
+            *--p = (i <= repr.int_digits) ? buf[i - 1] : '0';
+        }
+    }
+
+    assert(p == buf);
+}
+
+// Writes the digits [first, last) of the integral part of REPR, i.e. of
+// digits[0, int_digits) followed by int_zeros zeros.
+FMTXX_STATIC ErrorCode WriteIntegralDigits(Writer& w, dtoa::Repr const& repr, int first, int last)
+{
+    int const mid = std::max(first, std::min(last, repr.int_digits));
+
+    if (Failed ec = w.write(repr.digits + first, static_cast<size_t>(mid - first)))
+        return ec;
+    if (Failed ec = w.pad('0', static_cast<size_t>(last - mid)))
+        return ec;
+
+    return {};
+}
+
+// Writes the textual representation described by REPR piecewise. The zeros
+// are sent using Writer::pad.
+FMTXX_STATIC ErrorCode WriteFloatRepr(Writer& w, dtoa::Repr const& repr)
+{
+    int const int_len = repr.int_digits + repr.int_zeros;
+
+    assert(int_len >= 1);
+
+    if (repr.thousands_sep == '\0')
+    {
+        if (Failed ec = WriteIntegralDigits(w, repr, 0, int_len))
+            return ec;
+    }
+    else
+    {
+        int first = 0;
+        int last  = (int_len - 1) % 3 + 1; // The first group (1...3 digits)
+        for (;;)
+        {
+            if (Failed ec = WriteIntegralDigits(w, repr, first, last))
+                return ec;
+            if (last == int_len)
+                break;
+            if (Failed ec = w.put(repr.thousands_sep))
+                return ec;
+            first = last;
+            last += 3;
+        }
+    }
+
+    if (Failed ec = w.put_nonnull(repr.decimal_point))
+        return ec;
+    if (Failed ec = w.pad('0', static_cast<size_t>(repr.frac_zeros)))
+        return ec;
+    if (Failed ec = w.write(repr.digits + repr.int_digits, static_cast<size_t>(repr.frac_digits)))
+        return ec;
+    if (Failed ec = w.pad('0', static_cast<size_t>(repr.trailing_zeros)))
+        return ec;
+    if (Failed ec = w.write(repr.exponent, static_cast<size_t>(repr.exponent_len)))
+        return ec;
+
+    return {};
+}
+
+FMTXX_STATIC ErrorCode PrintAndPadFloatPiecewise(Writer& w, FormatSpec const& spec, char sign, char const* prefix, size_t nprefix, dtoa::Repr const& repr, size_t ndigits)
+{
+    size_t const len = (sign ? 1u : 0u) + nprefix + ndigits;
+
+    auto const pad = ComputePadding(len, spec.zero ? Align::pad_after_sign : spec.align, spec.width);
+
+    if (Failed ec = w.pad(spec.fill, pad.left))
+        return ec;
+    if (Failed ec = w.put_nonnull(sign))
+        return ec;
+    if (Failed ec = w.write(prefix, nprefix))
+        return ec;
+    if (Failed ec = w.pad(spec.zero ? '0' : spec.fill, pad.after_sign))
+        return ec;
+    if (Failed ec = WriteFloatRepr(w, repr))
+        return ec;
+    if (Failed ec = w.pad(spec.fill, pad.right))
+        return ec;
+
+    return {};
+}
+
+// Like PrintAndPadNumber, but the digits are described by REPR.
+// If the result fits into the digit buffer BUF, it is formatted in place and
+// written at once. Otherwise it is written piecewise.
+FMTXX_STATIC ErrorCode PrintAndPadFloat(Writer& w, FormatSpec const& spec, char sign, char const* prefix, size_t nprefix, dtoa::Repr const& repr, char* buf, int bufsize)
+{
+    size_t const ndigits = ComputeLength(repr);
+
+    if (ndigits > static_cast<size_t>(bufsize))
+        return PrintAndPadFloatPiecewise(w, spec, sign, prefix, nprefix, repr, ndigits);
+
+    ExpandFloatRepr(buf, repr, ndigits);
+    return PrintAndPadNumber(w, spec, sign, prefix, nprefix, buf, ndigits);
+}
+
+FMTXX_NOINLINE
+FMTXX_STATIC ErrorCode PrintAndPadFloatBignum(Writer& w, FormatSpec const& spec, char sign, size_t nprefix, FloatConversion const& fc)
+{
+    char buf[dtoa::kBignumDigitsBufSize];
+
+    dtoa::Repr repr;
+    bool const ok = ConvertFloat(repr, buf, dtoa::kBignumDigitsBufSize, fc);
+    assert(ok);
+    MaybeUnused(ok);
+
+    char const prefix[] = {'0', fc.conv};
+    return PrintAndPadFloat(w, spec, sign, prefix, nprefix, repr, buf, dtoa::kBignumDigitsBufSize);
+}
+
+// If SINGLE is true, X must be exactly representable as a float and the
+// shortest representation is computed with respect to single-precision.
+// All other conversions produce the same digits for floats and doubles.
+FMTXX_STATIC ErrorCode FormatFloatingPoint(Writer& w, FormatSpec const& spec, double x, bool single)
 {
     dtoa::Options options;
 
@@ -1359,62 +2361,57 @@ ErrorCode fmtxx::Util::format_double(Writer& w, FormatSpec const& spec, double x
     if (prec > kMaxFloatPrec)
         prec = kMaxFloatPrec;
 
-    // Allow printing *ALL* double-precision floating-point values with prec <= kMaxFloatPrec
-    // and thousands separators.
+    // The fast digit generators require only a small buffer. If they fail,
+    // the digits are computed again with a buffer large enough for the bignum
+    // fallback. This buffer lives in a separate stack frame, which is only
+    // required in this rare case.
     //
-    // Mode         Max length
-    // ---------------------------------------------
-    // ECMAScript   27
-    // Fixed        [309 digits + separators].[prec digits]
-    // Scientific   D.[prec digits]E+123
-    // Hex          0xH.[prec digits]P+1234
-    //
-    constexpr int kMaxDigitsBeforePoint = 309;
-    constexpr int kMaxSeps = (kMaxDigitsBeforePoint - 1) / 3;
-    constexpr int kBufSize = kMaxDigitsBeforePoint + kMaxSeps + 1 + kMaxFloatPrec + 1/*null*/;
+    // Zeros implied by the precision and the exponent are never stored in a
+    // buffer: All double-precision floating-point values can be printed with
+    // prec <= kMaxFloatPrec (and thousands separators) using a bounded amount
+    // of stack space.
 
-    char buf[kBufSize];
+    FloatConversion const fc { conv, prec, single, abs_x, options };
 
-    int buflen;
-    switch (conv)
-    {
-    case 's':
-    case 'S':
-        buflen = dtoa::ToECMAScript(buf, kBufSize, abs_x, options.decimal_point, options.exponent_char);
-        break;
-    case 'f':
-    case 'F':
-        buflen = dtoa::ToFixed(buf, kBufSize, abs_x, prec, options);
-        break;
-    case 'e':
-    case 'E':
-        buflen = dtoa::ToExponential(buf, kBufSize, abs_x, prec, options);
-        break;
-    case 'g':
-    case 'G':
-        buflen = dtoa::ToGeneral(buf, kBufSize, abs_x, prec, options);
-        break;
-    case 'x':
-    case 'X':
-        buflen = dtoa::ToHex(buf, kBufSize, abs_x, prec, options);
-        break;
-    default:
-        buflen = 0;
-        assert(false && "internal error");
-        break;
-    }
+    char buf[dtoa::kFastDigitsBufSize];
 
-    assert(buflen >= 0);
+    dtoa::Repr repr;
+    if (!ConvertFloat(repr, buf, dtoa::kFastDigitsBufSize, fc))
+        return PrintAndPadFloatBignum(w, spec, sign, nprefix, fc);
 
     char const prefix[] = {'0', conv};
-    return PrintAndPadNumber(w, spec, sign, prefix, nprefix, buf, static_cast<size_t>(buflen));
+    return PrintAndPadFloat(w, spec, sign, prefix, nprefix, repr, buf, dtoa::kFastDigitsBufSize);
+}
+
+} // namespace impl
+
+FMTXX_INLINE ErrorCode fmtxx::Util::format_double(Writer& w, FormatSpec const& spec, double x)
+{
+    return impl::FormatFloatingPoint(w, spec, x, /*single*/ false);
+}
+
+FMTXX_INLINE ErrorCode fmtxx::Util::format_float(Writer& w, FormatSpec const& spec, float x)
+{
+    return impl::FormatFloatingPoint(w, spec, static_cast<double>(x), /*single*/ true);
+}
+
+namespace impl {
+
+FMTXX_INLINE double DecimalToDouble(char const* digits, int num_digits, int exponent)
+{
+    return double_conversion::Strtod(double_conversion::Vector<char const>(digits, num_digits), exponent);
+}
+
+FMTXX_INLINE float DecimalToFloat(char const* digits, int num_digits, int exponent)
+{
+    return double_conversion::Strtof(double_conversion::Vector<char const>(digits, num_digits), exponent);
 }
 
 //------------------------------------------------------------------------------
 //
 //------------------------------------------------------------------------------
 
-static void FixNegativeFieldWidth(FormatSpec& spec)
+FMTXX_STATIC void FixNegativeFieldWidth(FormatSpec& spec)
 {
     if (spec.width < 0)
     {
@@ -1423,8 +2420,10 @@ static void FixNegativeFieldWidth(FormatSpec& spec)
     }
 }
 
-static ErrorCode CallFormatFunc(Writer& w, FormatSpec const& spec, Arg const& arg, Type type)
+FMTXX_STATIC ErrorCode CallFormatFunc(Writer& w, FormatSpec const& spec, Arg const& arg, Type type)
 {
+    stats::impl::CountConversions(type);
+
     switch (type)
     {
     case Type::none:
@@ -1455,6 +2454,8 @@ static ErrorCode CallFormatFunc(Writer& w, FormatSpec const& spec, Arg const& ar
         return Util::format_int(w, spec, arg.ulonglong);
     case Type::double_:
         return Util::format_double(w, spec, arg.double_);
+    case Type::float_:
+        return Util::format_float(w, spec, arg.float_);
     case Type::last:
         assert(false && "internal error");
         break;
@@ -1463,9 +2464,39 @@ static ErrorCode CallFormatFunc(Writer& w, FormatSpec const& spec, Arg const& ar
     return {}; // unreachable
 }
 
-static bool IsDigit(char ch) { return '0' <= ch && ch <= '9'; }
+// Calls the formatting function for the ARG_INDEX-th argument.
+FMTXX_STATIC ErrorCode FormatArg(Writer& w, FormatSpec const& spec, int arg_index, Arg const* args, Types types)
+{
+    auto const arg_type = types[arg_index];
+
+    if EXPECT_NOT(arg_type == Type::none)
+        return ErrorCode::index_out_of_range;
+    if EXPECT_NOT(arg_type == Type::formatspec)
+        return ErrorCode::invalid_argument;
+
+    return CallFormatFunc(w, spec, args[arg_index], arg_type);
+}
+
+FMTXX_NAMESPACE_INTERNAL {
+
+// The arguments which may be referenced from within a format-spec ('*', '{}').
+//
+// If args is null, the format string is only parsed (see CompiledFormat).
+// References to arguments are then not resolved, only the 'dynamic' flag is set.
+struct ArgList
+{
+    Arg const* args    = nullptr;
+    Types      types;
+    bool       dynamic = false;
+
+    ArgList(Arg const* args_, Types types_) : args(args_), types(types_) {}
+};
+
+} // namespace
+
+FMTXX_STATIC bool IsDigit(char ch) { return '0' <= ch && ch <= '9'; }
 
-static bool ParseInt(int& value, string_view::const_iterator& f, string_view::const_iterator end)
+FMTXX_STATIC bool ParseInt(int& value, string_view::const_iterator& f, string_view::const_iterator end)
 {
     assert(f != end && IsDigit(*f)); // internal error
     auto const f0 = f;
@@ -1490,7 +2521,7 @@ static bool ParseInt(int& value, string_view::const_iterator& f, string_view::co
     return true;
 }
 
-static ErrorCode GetIntArg(int& value, int index, Arg const* args, Types types)
+FMTXX_STATIC ErrorCode GetIntArg(int& value, int index, Arg const* args, Types types)
 {
     switch (types[index])
     {
@@ -1530,7 +2561,7 @@ static ErrorCode GetIntArg(int& value, int index, Arg const* args, Types types)
     }
 }
 
-static ErrorCode ParseLBrace(int& value, string_view::const_iterator& f, string_view::const_iterator end, int& nextarg, Arg const* args, Types types)
+FMTXX_STATIC ErrorCode ParseLBrace(int& value, string_view::const_iterator& f, string_view::const_iterator end, int& nextarg, ArgList& al)
 {
     assert(f != end && *f == '{'); // internal error
 
@@ -1558,10 +2589,16 @@ static ErrorCode ParseLBrace(int& value, string_view::const_iterator& f, string_
 
     ++f; // skip '}'
 
-    return GetIntArg(value, index, args, types);
+    if (al.args == nullptr)
+    {
+        al.dynamic = true;
+        return {};
+    }
+
+    return GetIntArg(value, index, al.args, al.types);
 }
 
-static ErrorCode ParseFormatSpecArg(FormatSpec& spec, string_view::const_iterator& f, string_view::const_iterator end, int& nextarg, Arg const* args, Types types)
+FMTXX_STATIC ErrorCode ParseFormatSpecArg(FormatSpec& spec, string_view::const_iterator& f, string_view::const_iterator end, int& nextarg, ArgList& al)
 {
     assert(f != end && *f == '*');
 
@@ -1581,18 +2618,24 @@ static ErrorCode ParseFormatSpecArg(FormatSpec& spec, string_view::const_iterato
         index = nextarg++;
     }
 
-    if EXPECT_NOT(types[index] == Type::none)
+    if (al.args == nullptr)
+    {
+        al.dynamic = true;
+        return {};
+    }
+
+    if EXPECT_NOT(al.types[index] == Type::none)
         return ErrorCode::index_out_of_range;
-    if EXPECT_NOT(types[index] != Type::formatspec)
+    if EXPECT_NOT(al.types[index] != Type::formatspec)
         return ErrorCode::invalid_argument;
 
-    spec = *static_cast<FormatSpec const*>(args[index].pvoid);
+    spec = *static_cast<FormatSpec const*>(al.args[index].pvoid);
     FixNegativeFieldWidth(spec);
 
     return {};
 }
 
-static bool ParseAlign(FormatSpec& spec, char c)
+FMTXX_STATIC bool ParseAlign(FormatSpec& spec, char c)
 {
     switch (c) {
     case '<':
@@ -1612,7 +2655,7 @@ static bool ParseAlign(FormatSpec& spec, char c)
     return false;
 }
 
-static ErrorCode ParseFormatSpec(FormatSpec& spec, string_view::const_iterator& f, string_view::const_iterator end, int& nextarg, Arg const* args, Types types)
+FMTXX_STATIC ErrorCode ParseFormatSpec(FormatSpec& spec, string_view::const_iterator& f, string_view::const_iterator end, int& nextarg, ArgList& al)
 {
     assert(f != end && *f == ':');
 
@@ -1683,7 +2726,7 @@ static ErrorCode ParseFormatSpec(FormatSpec& spec, string_view::const_iterator&
             break;
         case '{':
             {
-                Failed ec = ParseLBrace(spec.width, f, end, nextarg, args, types);
+                Failed ec = ParseLBrace(spec.width, f, end, nextarg, al);
                 if EXPECT_NOT(ec)
                     return ec;
                 FixNegativeFieldWidth(spec);
@@ -1714,7 +2757,7 @@ static ErrorCode ParseFormatSpec(FormatSpec& spec, string_view::const_iterator&
                 break;
             case '{':
                 {
-                    Failed ec = ParseLBrace(spec.prec, f, end, nextarg, args, types);
+                    Failed ec = ParseLBrace(spec.prec, f, end, nextarg, al);
                     if EXPECT_NOT(ec)
                         return ec;
                 }
@@ -1739,7 +2782,7 @@ static ErrorCode ParseFormatSpec(FormatSpec& spec, string_view::const_iterator&
     }
 }
 
-static ErrorCode ParseStyle(FormatSpec& spec, string_view::const_iterator& f, string_view::const_iterator end)
+FMTXX_STATIC ErrorCode ParseStyle(FormatSpec& spec, string_view::const_iterator& f, string_view::const_iterator end)
 {
     assert(f != end && *f == '!');
 
@@ -1794,13 +2837,13 @@ static ErrorCode ParseStyle(FormatSpec& spec, string_view::const_iterator& f, st
     return {};
 }
 
-static ErrorCode ParseReplacementField(FormatSpec& spec, string_view::const_iterator& f, string_view::const_iterator end, int& nextarg, Arg const* args, Types types)
+FMTXX_STATIC ErrorCode ParseReplacementField(FormatSpec& spec, string_view::const_iterator& f, string_view::const_iterator end, int& nextarg, ArgList& al)
 {
     assert(f != end);
 
     if (*f == '*')
     {
-        Failed ec = ParseFormatSpecArg(spec, f, end, nextarg, args, types);
+        Failed ec = ParseFormatSpecArg(spec, f, end, nextarg, al);
         if EXPECT_NOT(ec)
             return ec;
         if EXPECT_NOT(f == end)
@@ -1809,7 +2852,7 @@ static ErrorCode ParseReplacementField(FormatSpec& spec, string_view::const_iter
 
     if (*f == ':')
     {
-        Failed ec = ParseFormatSpec(spec, f, end, nextarg, args, types);
+        Failed ec = ParseFormatSpec(spec, f, end, nextarg, al);
         if EXPECT_NOT(ec)
             return ec;
         if EXPECT_NOT(f == end)
@@ -1833,7 +2876,30 @@ static ErrorCode ParseReplacementField(FormatSpec& spec, string_view::const_iter
     return {};
 }
 
-ErrorCode fmtxx::impl::DoFormat(Writer& w, string_view format, Arg const* args, Types types)
+// Returns a pointer to the first '{' or '}' in [f, end), or END if there is none.
+FMTXX_STATIC char const* FindBrace(char const* f, char const* end)
+{
+    return FindFirstOf<AnyOf2<'{', '}'>>(f, end);
+}
+
+// Returns a pointer to the first '%' in [f, end), or END if there is none.
+FMTXX_STATIC char const* FindPercent(char const* f, char const* end)
+{
+    if (f == end)
+        return end;
+
+    // memchr is vectorized in all major C libraries.
+    auto const p = std::memchr(f, '%', static_cast<size_t>(end - f));
+    return p != nullptr ? static_cast<char const*>(p) : end;
+}
+
+// Parses the brace-style format string FORMAT.
+// Calls handler.Literal(str, len) for each run of literal text and
+// handler.Field(spec, arg_index, spec_text, spec_nextarg, dynamic) for each replacement field.
+// SPEC_TEXT is the replacement field following the argument index (including the closing '}'),
+// SPEC_NEXTARG is the value of the "next argument" counter before parsing SPEC_TEXT.
+template <typename Handler>
+FMTXX_STATIC ErrorCode ParseFormatString(string_view format, ArgList& al, Handler& handler)
 {
     if (format.empty())
         return {};
@@ -1845,10 +2911,10 @@ ErrorCode fmtxx::impl::DoFormat(Writer& w, string_view format, Arg const* args,
     auto       s   = f;
     for (;;)
     {
-        f = std::find_if(f, end, [](char ch) { return ch == '{' || ch == '}'; });
+        f = FindBrace(f, end);
         if (f != s)
         {
-            if (Failed ec = w.write(&*s, static_cast<size_t>(f - s)))
+            if (Failed ec = handler.Literal(&*s, static_cast<size_t>(f - s)))
                 return ec;
         }
 
@@ -1881,10 +2947,15 @@ ErrorCode fmtxx::impl::DoFormat(Writer& w, string_view format, Arg const* args,
                 return ErrorCode::invalid_format_string;
         }
 
+        auto const spec_first = f;
+        int  const spec_nextarg = nextarg;
+
+        al.dynamic = false;
+
         FormatSpec spec;
         if (*f != '}')
         {
-            Failed ec = ParseReplacementField(spec, f, end, nextarg, args, types);
+            Failed ec = ParseReplacementField(spec, f, end, nextarg, al);
             if EXPECT_NOT(ec)
                 return ec;
         }
@@ -1898,21 +2969,16 @@ ErrorCode fmtxx::impl::DoFormat(Writer& w, string_view format, Arg const* args,
 
         s = f;
 
-        auto const arg_type = types[arg_index];
+        string_view const spec_text(&*spec_first, static_cast<size_t>(f - spec_first));
 
-        if EXPECT_NOT(arg_type == Type::none)
-            return ErrorCode::index_out_of_range;
-        if EXPECT_NOT(arg_type == Type::formatspec)
-            return ErrorCode::invalid_argument;
-
-        if (Failed ec = CallFormatFunc(w, spec, args[arg_index], arg_type))
+        if (Failed ec = handler.Field(spec, arg_index, spec_text, spec_nextarg, al.dynamic))
             return ec;
     }
 
     return {};
 }
 
-static ErrorCode ParseAsterisk(int& value, string_view::const_iterator& f, string_view::const_iterator end, int& nextarg, Arg const* args, Types types)
+FMTXX_STATIC ErrorCode ParseAsterisk(int& value, string_view::const_iterator& f, string_view::const_iterator end, int& nextarg, ArgList& al)
 {
     assert(f != end && *f == '*'); // internal error
 
@@ -1942,10 +3008,16 @@ static ErrorCode ParseAsterisk(int& value, string_view::const_iterator& f, strin
         index = nextarg++;
     }
 
-    return GetIntArg(value, index, args, types);
+    if (al.args == nullptr)
+    {
+        al.dynamic = true;
+        return {};
+    }
+
+    return GetIntArg(value, index, al.args, al.types);
 }
 
-static ErrorCode ParsePrintfSpec(int& arg_index, FormatSpec& spec, string_view::const_iterator& f, string_view::const_iterator end, int& nextarg, Arg const* args, Types types)
+FMTXX_STATIC ErrorCode ParsePrintfSpec(int& arg_index, FormatSpec& spec, string_view::const_iterator& f, string_view::const_iterator end, int& nextarg, ArgList& al)
 {
     assert(f != end && *(f - 1) == '%');
 
@@ -2026,7 +3098,7 @@ static ErrorCode ParsePrintfSpec(int& arg_index, FormatSpec& spec, string_view::
             break;
         case '*':
             {
-                Failed ec = ParseAsterisk(spec.width, f, end, nextarg, args, types);
+                Failed ec = ParseAsterisk(spec.width, f, end, nextarg, al);
                 if EXPECT_NOT(ec)
                     return ec;
                 FixNegativeFieldWidth(spec);
@@ -2058,7 +3130,7 @@ static ErrorCode ParsePrintfSpec(int& arg_index, FormatSpec& spec, string_view::
                 break;
             case '*':
                 {
-                    Failed ec = ParseAsterisk(spec.prec, f, end, nextarg, args, types);
+                    Failed ec = ParseAsterisk(spec.prec, f, end, nextarg, al);
                     if EXPECT_NOT(ec)
                         return ec;
                 }
@@ -2131,7 +3203,10 @@ static ErrorCode ParsePrintfSpec(int& arg_index, FormatSpec& spec, string_view::
     }
 }
 
-ErrorCode fmtxx::impl::DoPrintf(Writer& w, string_view format, Arg const* args, Types types)
+// Parses the printf-style format string FORMAT.
+// Like ParseFormatString, except that SPEC_TEXT includes the leading '%'.
+template <typename Handler>
+FMTXX_STATIC ErrorCode ParsePrintfString(string_view format, ArgList& al, Handler& handler)
 {
     if (format.empty())
         return {};
@@ -2143,16 +3218,18 @@ ErrorCode fmtxx::impl::DoPrintf(Writer& w, string_view format, Arg const* args,
     auto       s   = f;
     for (;;)
     {
-        f = std::find(f, end, '%');
+        f = FindPercent(f, end);
         if (f != s)
         {
-            if (Failed ec = w.write(&*s, static_cast<size_t>(f - s)))
+            if (Failed ec = handler.Literal(&*s, static_cast<size_t>(f - s)))
                 return ec;
         }
 
         if (f == end) // done.
             break;
 
+        auto const spec_first = f;
+
         ++f; // skip '%'
         if EXPECT_NOT(f == end)
             return ErrorCode::invalid_format_string;
@@ -2165,11 +3242,14 @@ ErrorCode fmtxx::impl::DoPrintf(Writer& w, string_view format, Arg const* args,
         }
 
         int arg_index = -1;
+        int const spec_nextarg = nextarg;
+
+        al.dynamic = false;
 
         FormatSpec spec;
         if (*f != 's') // %s is like {}
         {
-            Failed ec = ParsePrintfSpec(arg_index, spec, f, end, nextarg, args, types);
+            Failed ec = ParsePrintfSpec(arg_index, spec, f, end, nextarg, al);
             if EXPECT_NOT(ec)
                 return ec;
         }
@@ -2185,183 +3265,1000 @@ ErrorCode fmtxx::impl::DoPrintf(Writer& w, string_view format, Arg const* args,
 
         s = f;
 
-        auto const arg_type = types[arg_index];
-
-        if EXPECT_NOT(arg_type == Type::none)
-            return ErrorCode::index_out_of_range;
-        if EXPECT_NOT(arg_type == Type::formatspec)
-            return ErrorCode::invalid_argument;
+        string_view const spec_text(&*spec_first, static_cast<size_t>(f - spec_first));
 
-        if (Failed ec = CallFormatFunc(w, spec, args[arg_index], arg_type))
+        if (Failed ec = handler.Field(spec, arg_index, spec_text, spec_nextarg, al.dynamic))
             return ec;
     }
 
     return {};
 }
 
-ErrorCode fmtxx::impl::DoFormat(std::FILE* file, string_view format, Arg const* args, Types types)
-{
-    FILEWriter w{file};
-    return ::fmtxx::impl::DoFormat(w, format, args, types);
-}
+FMTXX_NAMESPACE_INTERNAL {
 
-ErrorCode fmtxx::impl::DoPrintf(std::FILE* file, string_view format, Arg const* args, Types types)
+struct FormatHandler
 {
-    FILEWriter w{file};
-    return ::fmtxx::impl::DoPrintf(w, format, args, types);
-}
+    Writer&          w;
+    Arg const* const args;
+    Types const      types;
+
+    ErrorCode Literal(char const* str, size_t len) {
+        return w.write(str, len);
+    }
 
-namespace {
+    ErrorCode Field(FormatSpec const& spec, int arg_index, string_view /*spec_text*/, int /*spec_nextarg*/, bool /*dynamic*/) {
+        return FormatArg(w, spec, arg_index, args, types);
+    }
+};
 
-class StringWriter final : public Writer
-{
-public:
-    std::string& str;
+} // namespace
 
-    explicit StringWriter(std::string& s) : str(s) {}
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
 
-private:
-    ErrorCode Put(char c) override;
-    ErrorCode Write(char const* ptr, size_t len) override;
-    ErrorCode Pad(char c, size_t count) override;
-};
+FMTXX_NAMESPACE_INTERNAL {
 
-inline ErrorCode StringWriter::Put(char c)
+struct CompileHandler
 {
-    str.push_back(c);
-    return {};
-}
+    std::string&                text;
+    std::vector<CompiledField>& fields;
+    CompiledField               field; // The current field
 
-inline ErrorCode StringWriter::Write(char const* ptr, size_t len)
-{
-    str.append(ptr, len);
-    return {};
-}
+    CompileHandler(std::string& text_, std::vector<CompiledField>& fields_) : text(text_), fields(fields_) {}
 
-inline ErrorCode StringWriter::Pad(char c, size_t count)
-{
-    str.append(count, c);
-    return {};
-}
+    ErrorCode Literal(char const* str, size_t len)
+    {
+        text.append(str, len);
+        field.text_len += len;
+        return {};
+    }
 
-} // namespace
+    ErrorCode Field(FormatSpec const& spec, int arg_index, string_view spec_text, int spec_nextarg, bool dynamic)
+    {
+        // Dynamic format-specs are re-parsed when formatting. The style is
+        // included in spec_text in this case.
+        string_view const str = dynamic ? spec_text : spec.style;
 
-ErrorCode fmtxx::impl::DoFormat(std::string& str, string_view format, Arg const* args, Types types)
-{
-    StringWriter w{str};
-    return ::fmtxx::impl::DoFormat(w, format, args, types);
-}
+        field.spec_pos = text.size();
+        field.spec_len = str.size();
+        if (!str.empty())
+            text.append(str.data(), str.size());
 
-ErrorCode fmtxx::impl::DoPrintf(std::string& str, string_view format, Arg const* args, Types types)
-{
-    StringWriter w{str};
-    return ::fmtxx::impl::DoPrintf(w, format, args, types);
-}
+        field.spec       = spec;
+        field.spec.style = {};
+        field.arg        = arg_index;
+        field.nextarg    = dynamic ? spec_nextarg : -1;
 
-namespace {
+        fields.push_back(field);
 
-class ToCharsWriter final : public Writer
-{
-public:
-    char*       next = nullptr;
-    char* const last = nullptr;
+        field = CompiledField{};
+        field.text_pos = text.size();
 
-    ToCharsWriter() = default;
-    ToCharsWriter(char* first_, char* last_) : next(first_), last(last_) {}
+        return {};
+    }
 
-private:
-    ErrorCode Put(char c) noexcept override;
-    ErrorCode Write(char const* str, size_t len) noexcept override;
-    ErrorCode Pad(char c, size_t count) noexcept override;
+    void Finish()
+    {
+        // Literal text following the last replacement field (if any).
+        if (field.text_len > 0)
+            fields.push_back(field);
+    }
 };
 
-inline ErrorCode ToCharsWriter::Put(char c) noexcept
-{
-    if (last - next < 1)
-        return ErrorCode::io_error;
+} // namespace
 
-    *next++ = c;
-    return {};
-}
+} // namespace impl
 
-inline ErrorCode ToCharsWriter::Write(char const* ptr, size_t len) noexcept
+FMTXX_INLINE fmtxx::CompiledFormat::CompiledFormat(string_view format, FormatSyntax syntax)
+    : syntax_(syntax)
 {
-    //
-    // XXX:
-    // Write as much as possible?!?!
-    //
+    impl::ArgList al{nullptr, impl::Types{}};
+    impl::CompileHandler handler{text_, fields_};
 
-    if (static_cast<size_t>(last - next) < len)
-        return ErrorCode::io_error;
+    if (syntax == FormatSyntax::printf)
+        ec_ = impl::ParsePrintfString(format, al, handler);
+    else
+        ec_ = impl::ParseFormatString(format, al, handler);
 
-    std::copy_n(ptr, len, MakeArrayIterator(next, last - next));
-    next += len;
-    return {};
+    handler.Finish();
 }
 
-inline ErrorCode ToCharsWriter::Pad(char c, size_t count) noexcept
+namespace impl {
+
+FMTXX_STATIC ErrorCode ParseDynamicSpec(FormatSpec& spec, FormatSyntax syntax, string_view spec_text, int nextarg, Arg const* args, Types types)
 {
-    //
-    // XXX:
-    // Write as much as possible?!?!
-    //
+    ArgList al{args, types};
 
-    if (static_cast<size_t>(last - next) < count)
-        return ErrorCode::io_error;
+    auto       f   = spec_text.begin();
+    auto const end = spec_text.end();
 
-    std::fill_n(MakeArrayIterator(next, last - next), count, c);
-    next += count;
-    return {};
-}
+    assert(f != end); // internal error
+
+    if (syntax == FormatSyntax::printf)
+    {
+        assert(*f == '%'); // internal error
+        ++f;
+
+        int arg_index = -1; // Unused. Has already been determined by the CompiledFormat.
+        return ParsePrintfSpec(arg_index, spec, f, end, nextarg, al);
+    }
+
+    return ParseReplacementField(spec, f, end, nextarg, al);
+}
+
+FMTXX_STATIC ErrorCode FormatCompiled(Writer& w, CompiledFormat const& format, Arg const* args, Types types)
+{
+    char const* const text = format.text();
+
+    for (auto const& field : format.fields())
+    {
+        if (Failed ec = w.write(text + field.text_pos, field.text_len))
+            return ec;
+
+        if (field.arg < 0)
+            continue;
+
+        if (field.nextarg < 0 && field.spec_len == 0)
+        {
+            if (Failed ec = FormatArg(w, field.spec, field.arg, args, types))
+                return ec;
+            continue;
+        }
+
+        string_view const spec_text(text + field.spec_pos, field.spec_len);
+
+        FormatSpec spec;
+        if (field.nextarg >= 0)
+        {
+            if (Failed ec = ParseDynamicSpec(spec, format.syntax(), spec_text, field.nextarg, args, types))
+                return ec;
+        }
+        else
+        {
+            spec = field.spec;
+            spec.style = spec_text;
+        }
+
+        if (Failed ec = FormatArg(w, spec, field.arg, args, types))
+            return ec;
+    }
+
+    return format.ec();
+}
+
+FMTXX_INLINE ErrorCode DoFormat(Writer& w, CompiledFormat const& format, Arg const* args, Types types)
+{
+    stats::impl::CallScope const scope{stats::EntryPoint::format_compiled};
+
+    return FormatCompiled(w, format, args, types);
+}
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+FMTXX_NAMESPACE_INTERNAL {
+
+struct ParseCacheEntry
+{
+    char const*    ptr = nullptr; // Address of the format string at the last lookup
+    uint64_t       hash = 0;
+    uint64_t       last_use = 0;
+    std::string    key;           // Copy of the format string
+    CompiledFormat format;
+};
+
+struct ParseCache
+{
+    std::vector<ParseCacheEntry> entries;
+    uint64_t tick = 0;
+    // Set while formatting from a cached entry. Nested calls (from FormatValue
+    // specializations, say) bypass the cache, so that entries in use are never
+    // replaced.
+    bool busy = false;
+
+    ~ParseCache();
+};
+
+// Looks up (or inserts) the CompiledFormat of a format string and holds the
+// cache for the lifetime of this object.
+class ParseCacheLookup
+{
+    ParseCache* cache_ = nullptr;
+    CompiledFormat const* format_ = nullptr;
+
+public:
+    ParseCacheLookup(string_view format, FormatSyntax syntax);
+    ParseCacheLookup(ParseCacheLookup const&) = delete;
+    ParseCacheLookup& operator=(ParseCacheLookup const&) = delete;
+    ~ParseCacheLookup();
+
+    // Returns the cached format, or null if the cache is disabled or the
+    // format string is invalid.
+    CompiledFormat const* get() const { return format_; }
+};
+
+} // namespace
+
+// Function-local statics, so that there is only one instance of the cache (per
+// thread) in header-only mode, too.
+FMTXX_STATIC std::atomic<size_t>& ParseCacheCapacity()
+{
+    static std::atomic<size_t> capacity{0};
+    return capacity;
+}
+
+FMTXX_STATIC ParseCache& ThreadParseCache()
+{
+    static thread_local ParseCache cache;
+    return cache;
+}
+
+// Set when the cache of the current thread has been destroyed. (The
+// destructors of other thread_local objects might still format.)
+FMTXX_STATIC bool& ThreadParseCacheDestroyed()
+{
+    static thread_local bool destroyed = false;
+    return destroyed;
+}
+
+FMTXX_INLINE ParseCache::~ParseCache()
+{
+    ThreadParseCacheDestroyed() = true;
+}
+
+} // namespace impl
+
+FMTXX_INLINE void set_parse_cache_capacity(size_t capacity)
+{
+    impl::ParseCacheCapacity().store(std::min(capacity, kMaxParseCacheCapacity), std::memory_order_relaxed);
+}
+
+FMTXX_INLINE size_t parse_cache_capacity()
+{
+    return impl::ParseCacheCapacity().load(std::memory_order_relaxed);
+}
+
+namespace impl {
+
+FMTXX_STATIC uint64_t HashFormatString(string_view format)
+{
+    // FNV-1a
+    uint64_t h = 14695981039346656037u;
+    for (char const c : format)
+    {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211u;
+    }
+    return h;
+}
+
+FMTXX_STATIC bool SameFormatString(ParseCacheEntry const& entry, string_view format, FormatSyntax syntax)
+{
+    return entry.key.size() == format.size()
+        && entry.format.syntax() == syntax
+        && std::memcmp(entry.key.data(), format.data(), format.size()) == 0;
+}
+
+FMTXX_INLINE ParseCacheLookup::ParseCacheLookup(string_view format, FormatSyntax syntax)
+{
+    if (ThreadParseCacheDestroyed())
+        return;
+
+    auto& cache = ThreadParseCache();
+    if (cache.busy)
+        return;
+
+    size_t const capacity = ParseCacheCapacity().load(std::memory_order_relaxed);
+    if (capacity < cache.entries.size())
+        cache.entries.resize(capacity); // The capacity has been reduced.
+    if (capacity == 0)
+        return;
+
+    cache.busy = true;
+    cache_ = &cache;
+
+    uint64_t const tick = ++cache.tick;
+
+    // Fast path: the same format string at the same address. The contents
+    // still need to be compared, the string might have been modified in place
+    // or its memory might have been reused for a different string.
+    for (auto& entry : cache.entries)
+    {
+        if (entry.ptr == format.data() && SameFormatString(entry, format, syntax))
+        {
+            stats::impl::CountParseCacheLookup(/*hit*/ true);
+            entry.last_use = tick;
+            format_ = &entry.format;
+            return;
+        }
+    }
+
+    // The same format string at a different address (e.g. a std::string
+    // which is rebuilt for every call).
+    uint64_t const hash = HashFormatString(format);
+    for (auto& entry : cache.entries)
+    {
+        if (entry.hash == hash && SameFormatString(entry, format, syntax))
+        {
+            stats::impl::CountParseCacheLookup(/*hit*/ true);
+            entry.ptr = format.data();
+            entry.last_use = tick;
+            format_ = &entry.format;
+            return;
+        }
+    }
+
+    stats::impl::CountParseCacheLookup(/*hit*/ false);
+
+    CompiledFormat compiled(format, syntax);
+    if (!compiled)
+        return;
+
+    ParseCacheEntry* slot;
+    if (cache.entries.size() < capacity)
+    {
+        cache.entries.emplace_back();
+        slot = &cache.entries.back();
+    }
+    else
+    {
+        slot = &*std::min_element(cache.entries.begin(), cache.entries.end(),
+            [](ParseCacheEntry const& lhs, ParseCacheEntry const& rhs) { return lhs.last_use < rhs.last_use; });
+    }
+
+    slot->ptr = format.data();
+    slot->hash = hash;
+    slot->last_use = tick;
+    slot->key.assign(format.data(), format.size());
+    slot->format = std::move(compiled);
+
+    format_ = &slot->format;
+}
+
+FMTXX_INLINE ParseCacheLookup::~ParseCacheLookup()
+{
+    if (cache_ != nullptr)
+        cache_->busy = false;
+}
+
+FMTXX_INLINE ErrorCode DoFormat(Writer& w, string_view format, Arg const* args, Types types)
+{
+    stats::impl::CallScope const scope{stats::EntryPoint::format};
+
+    ParseCacheLookup const cached{format, FormatSyntax::format};
+    if (cached.get() != nullptr)
+        return FormatCompiled(w, *cached.get(), args, types);
+
+    ArgList al{args, types};
+    FormatHandler handler{w, args, types};
+    return ParseFormatString(format, al, handler);
+}
+
+FMTXX_INLINE ErrorCode DoPrintf(Writer& w, string_view format, Arg const* args, Types types)
+{
+    stats::impl::CallScope const scope{stats::EntryPoint::printf};
+
+    ParseCacheLookup const cached{format, FormatSyntax::printf};
+    if (cached.get() != nullptr)
+        return FormatCompiled(w, *cached.get(), args, types);
+
+    ArgList al{args, types};
+    FormatHandler handler{w, args, types};
+    return ParsePrintfString(format, al, handler);
+}
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+} // namespace impl
+
+FMTXX_INLINE ErrorCode parse_format_spec(FormatSpec& spec, string_view field)
+{
+    spec = FormatSpec{};
+
+    auto       f   = field.begin();
+    auto const end = field.end();
+
+    if (f == end || *f != '{')
+        return ErrorCode::invalid_format_string;
+    ++f;
+    if (f == end)
+        return ErrorCode::invalid_format_string;
+
+    int nextarg = 0;
+    impl::ArgList al{nullptr, impl::Types{}};
+
+    if (Failed ec = impl::ParseReplacementField(spec, f, end, nextarg, al))
+        return ec;
+
+    // There are no arguments to reference.
+    if (al.dynamic || f != end)
+        return ErrorCode::invalid_format_string;
+
+    return {};
+}
+
+namespace impl {
+
+FMTXX_NAMESPACE_INTERNAL {
+
+// Collects the output of many small writes and passes it on to the
+// underlying writer in large blocks.
+// The free space of the buffer is the buffer window.
+class StagingWriter final : public Writer
+{
+    static constexpr size_t kCapacity = 4096;
+
+    Writer& w_;
+    char    buf_[kCapacity];
+
+public:
+    explicit StagingWriter(Writer& w) : w_(w) { set_window(buf_, buf_ + kCapacity); }
+
+    ErrorCode flush() noexcept;
+
+private:
+    ErrorCode Put(char c) noexcept override;
+    ErrorCode Write(char const* str, size_t len) noexcept override;
+    ErrorCode Pad(char c, size_t count) noexcept override;
+
+    size_t Available() const { return static_cast<size_t>(window_last() - window_next()); }
+};
+
+inline ErrorCode StagingWriter::flush() noexcept
+{
+    size_t const len = static_cast<size_t>(window_next() - buf_);
+    set_window(buf_, buf_ + kCapacity);
+    return w_.write(buf_, len);
+}
+
+inline ErrorCode StagingWriter::Put(char c) noexcept
+{
+    if (Available() == 0)
+    {
+        if (Failed ec = flush())
+            return ec;
+    }
+
+    char* const next = window_next();
+    *next = c;
+    set_window(next + 1, window_last());
+    return {};
+}
+
+inline ErrorCode StagingWriter::Write(char const* str, size_t len) noexcept
+{
+    if (Available() < len)
+    {
+        if (Failed ec = flush())
+            return ec;
+        if (len > kCapacity / 2)
+            return w_.write(str, len);
+    }
+
+    char* const next = window_next();
+    std::memcpy(next, str, len);
+    set_window(next + len, window_last());
+    return {};
+}
+
+inline ErrorCode StagingWriter::Pad(char c, size_t count) noexcept
+{
+    while (count > 0)
+    {
+        if (Available() == 0)
+        {
+            if (Failed ec = flush())
+                return ec;
+        }
+
+        char* const next = window_next();
+        size_t const n = std::min(count, Available());
+        std::memset(next, static_cast<unsigned char>(c), n);
+        set_window(next + n, window_last());
+        count -= n;
+    }
+
+    return {};
+}
+
+} // namespace
+
+// Returns whether integers formatted using SPEC are just the decimal digits
+// with an optional minus sign.
+FMTXX_STATIC bool IsPlainDecimal(FormatSpec const& spec, bool is_signed)
+{
+    switch (spec.conv)
+    {
+    case '\0':
+    case 'd':
+    case 'i':
+        break;
+    case 'u':
+        if (is_signed)
+            return false;
+        break;
+    default:
+        return false;
+    }
+
+    return spec.width == 0
+        && spec.prec < 0
+        && (spec.sign == Sign::use_default || spec.sign == Sign::minus)
+        && spec.tsep == '\0';
+}
+
+FMTXX_STATIC bool IsNegative(int64_t n) { return n < 0; }
+FMTXX_STATIC bool IsNegative(uint64_t /*n*/) { return false; }
+
+// Formats the integers [first, first + n) as plain decimal numbers.
+// The digits are written directly into a local buffer, which is passed to the
+// writer when it is full.
+template <typename T>
+FMTXX_STATIC ErrorCode FormatDecimalRange(Writer& w, T const* first, size_t n, string_view sep)
+{
+    static constexpr size_t kMaxLength = 1 + 20; // sign + digits
+
+    char buf[4096];
+    size_t len = 0;
+
+    assert(sep.size() <= sizeof(buf) - kMaxLength);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (sizeof(buf) - len < sep.size() + kMaxLength)
+        {
+            if (Failed ec = w.write(buf, len))
+                return ec;
+            len = 0;
+        }
+
+        if (i != 0)
+        {
+            std::memcpy(buf + len, sep.data(), sep.size());
+            len += sep.size();
+        }
+
+        uint64_t u = static_cast<uint64_t>(first[i]);
+        if (IsNegative(first[i]))
+        {
+            buf[len++] = '-';
+            u = 0 - u;
+        }
+
+        int const ndigits = CountDecimalDigits(u);
+        WriteDecimalDigits(buf + len, ndigits, u);
+        len += static_cast<size_t>(ndigits);
+    }
+
+    return w.write(buf, len);
+}
+
+// Formats the values [first, first + n) using the given formatting function,
+// which is called directly, i.e. without parsing the FormatSpec again and
+// without dispatching on the argument type.
+template <typename T, typename Func>
+FMTXX_STATIC ErrorCode FormatStagedRange(Writer& w, FormatSpec const& spec, T const* first, size_t n, string_view sep, Func func)
+{
+    StagingWriter sw{w};
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (i != 0)
+        {
+            if (Failed ec = sw.write(sep.data(), sep.size()))
+                return ec;
+        }
+        if (Failed ec = func(sw, spec, first[i]))
+            return ec;
+    }
+
+    return sw.flush();
+}
+
+static constexpr size_t kMaxFastSeparatorLength = 256;
+
+FMTXX_INLINE ErrorCode FormatRange(Writer& w, FormatSpec const& spec, int64_t const* first, size_t n, string_view sep, uint64_t zext_mask)
+{
+    stats::impl::CountConversions(Type::slonglong, n);
+
+    if (IsPlainDecimal(spec, /*is_signed*/ true) && sep.size() <= kMaxFastSeparatorLength)
+        return FormatDecimalRange(w, first, n, sep);
+
+    return FormatStagedRange(w, spec, first, n, sep, [zext_mask](Writer& sw, FormatSpec const& s, int64_t x) {
+        return Util::format_int(sw, s, x, static_cast<uint64_t>(x) & zext_mask);
+    });
+}
+
+FMTXX_INLINE ErrorCode FormatRange(Writer& w, FormatSpec const& spec, uint64_t const* first, size_t n, string_view sep)
+{
+    stats::impl::CountConversions(Type::ulonglong, n);
+
+    if (IsPlainDecimal(spec, /*is_signed*/ false) && sep.size() <= kMaxFastSeparatorLength)
+        return FormatDecimalRange(w, first, n, sep);
+
+    return FormatStagedRange(w, spec, first, n, sep, [](Writer& sw, FormatSpec const& s, uint64_t x) {
+        return Util::format_int(sw, s, x);
+    });
+}
+
+FMTXX_INLINE ErrorCode FormatRange(Writer& w, FormatSpec const& spec, double const* first, size_t n, string_view sep)
+{
+    stats::impl::CountConversions(Type::double_, n);
+
+    return FormatStagedRange(w, spec, first, n, sep, [](Writer& sw, FormatSpec const& s, double x) {
+        return Util::format_double(sw, s, x);
+    });
+}
+
+FMTXX_INLINE ErrorCode FormatRange(Writer& w, FormatSpec const& spec, float const* first, size_t n, string_view sep)
+{
+    stats::impl::CountConversions(Type::float_, n);
+
+    return FormatStagedRange(w, spec, first, n, sep, [](Writer& sw, FormatSpec const& s, float x) {
+        return Util::format_float(sw, s, x);
+    });
+}
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+FMTXX_STATIC size_t RoundUpToArgAlignment(size_t n)
+{
+    return (n + (alignof(impl::Arg) - 1)) & ~(alignof(impl::Arg) - 1);
+}
+
+FMTXX_STATIC size_t ComputePayloadSize(impl::Arg const& arg, impl::Type type, size_t copy_size)
+{
+    switch (type)
+    {
+    case Type::formatspec:
+        return RoundUpToArgAlignment(copy_size) + RoundUpToArgAlignment(static_cast<FormatSpec const*>(arg.pvoid)->style.size());
+    case Type::string:
+        return RoundUpToArgAlignment(arg.string.size);
+    case Type::pchar:
+        return arg.pchar != nullptr ? RoundUpToArgAlignment(::strlen(arg.pchar) + 1) : 0;
+    case Type::other:
+        return RoundUpToArgAlignment(copy_size);
+    default:
+        return 0;
+    }
+}
+
+FMTXX_INLINE size_t ComputeArgPayloadSize(impl::Arg const* args, impl::Types types, size_t const* copy_sizes)
+{
+    size_t size = 0;
+    for (int i = 0; types[i] != Type::none; ++i)
+        size += ComputePayloadSize(args[i], types[i], copy_sizes[i]);
+
+    return size;
+}
+
+FMTXX_INLINE void CopyArgs(impl::Arg* dst, char* payload, impl::Arg const* args, impl::Types types, size_t const* copy_sizes)
+{
+    for (int i = 0; types[i] != Type::none; ++i)
+    {
+        Arg arg = args[i];
+
+        switch (types[i])
+        {
+        case Type::formatspec:
+            {
+                FormatSpec const& spec = *static_cast<FormatSpec const*>(arg.pvoid);
+                size_t const style_len = spec.style.size();
+
+                FormatSpec* copy = ::new (static_cast<void*>(payload)) FormatSpec(spec);
+                payload += RoundUpToArgAlignment(copy_sizes[i]);
+
+                if (style_len != 0)
+                    std::memcpy(payload, spec.style.data(), style_len);
+                copy->style = string_view(payload, style_len);
+                payload += RoundUpToArgAlignment(style_len);
+
+                arg.pvoid = copy;
+            }
+            break;
+        case Type::string:
+            if (arg.string.size != 0)
+                std::memcpy(payload, arg.string.data, arg.string.size);
+            arg.string.data = payload;
+            payload += RoundUpToArgAlignment(arg.string.size);
+            break;
+        case Type::pchar:
+            if (arg.pchar != nullptr)
+            {
+                size_t const len = ::strlen(arg.pchar) + 1;
+                std::memcpy(payload, arg.pchar, len);
+                arg.pchar = payload;
+                payload += RoundUpToArgAlignment(len);
+            }
+            break;
+        case Type::other:
+            std::memcpy(payload, arg.other.value, copy_sizes[i]);
+            arg.other.value = payload;
+            payload += RoundUpToArgAlignment(copy_sizes[i]);
+            break;
+        default:
+            break;
+        }
+
+        // DST may point to uninitialized memory.
+        std::memcpy(static_cast<void*>(dst + i), &arg, sizeof(Arg));
+    }
+}
+
+} // namespace impl
+
+FMTXX_INLINE void fmtxx::ArgStore::Assign(impl::Arg const* args, impl::Types types, size_t const* copy_sizes)
+{
+    int num_args = 0;
+    while (types[num_args] != impl::Type::none)
+        ++num_args;
+
+    size_t const payload_size = impl::ComputeArgPayloadSize(args, types, copy_sizes);
+    size_t const num_payload_args = (payload_size + (sizeof(impl::Arg) - 1)) / sizeof(impl::Arg);
+
+    store_.resize(static_cast<size_t>(num_args) + num_payload_args);
+    types_ = types.types;
+
+    impl::CopyArgs(store_.data(), reinterpret_cast<char*>(store_.data() + num_args), args, types, copy_sizes);
+}
+
+namespace impl {
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+// Writes the formatted string to FILE.
+// The string is transmitted with a single call to fwrite. The stream is
+// therefore locked only once per format call, and the output of concurrent
+// calls does not interleave.
+// Returns the number of characters successfully transmitted in COUNT.
+FMTXX_STATIC ErrorCode WriteToFile(std::FILE* file, MemoryWriterBase const& buf, size_t& count)
+{
+    FILEWriter w{file};
+    auto const ec = w.write(buf.data(), buf.size());
+    count = w.size();
+    return ec;
+}
+
+// Format into a local buffer, then write the string to FILE.
+// Partial output is written even if formatting fails (like fprintf).
+template <typename Format>
+FMTXX_STATIC ErrorCode FormatToFile(std::FILE* file, size_t& count, Format func)
+{
+    MemoryWriter<> buf;
+
+    auto const ec = func(buf);
+    auto const ec_write = WriteToFile(file, buf, count);
+
+    return ec != ErrorCode::success ? ec : ec_write;
+}
+
+FMTXX_INLINE ErrorCode DoFormat(std::FILE* file, string_view format, Arg const* args, Types types)
+{
+    stats::impl::CallScope const scope{stats::EntryPoint::format_file};
+
+    size_t count = 0;
+    return FormatToFile(file, count, [&](Writer& w) { return ::fmtxx::impl::DoFormat(w, format, args, types); });
+}
+
+FMTXX_INLINE ErrorCode DoPrintf(std::FILE* file, string_view format, Arg const* args, Types types)
+{
+    stats::impl::CallScope const scope{stats::EntryPoint::printf_file};
+
+    size_t count = 0;
+    return FormatToFile(file, count, [&](Writer& w) { return ::fmtxx::impl::DoPrintf(w, format, args, types); });
+}
+
+FMTXX_INLINE ErrorCode DoFormat(std::FILE* file, CompiledFormat const& format, Arg const* args, Types types)
+{
+    stats::impl::CallScope const scope{stats::EntryPoint::format_file};
+
+    size_t count = 0;
+    return FormatToFile(file, count, [&](Writer& w) { return ::fmtxx::impl::DoFormat(w, format, args, types); });
+}
+
+// Appends the contents of W to STR.
+FMTXX_STATIC void AppendTo(std::string& str, MemoryWriterBase& w)
+{
+    if (str.empty())
+        w.release_into(str);
+    else
+        str.append(w.data(), w.size());
+}
+
+FMTXX_INLINE ErrorCode DoFormat(std::string& str, string_view format, Arg const* args, Types types)
+{
+    stats::impl::CallScope const scope{stats::EntryPoint::format_string};
+
+    MemoryWriter<> w;
+    auto const ec = ::fmtxx::impl::DoFormat(w, format, args, types);
+    AppendTo(str, w);
+    return ec;
+}
+
+FMTXX_INLINE ErrorCode DoPrintf(std::string& str, string_view format, Arg const* args, Types types)
+{
+    stats::impl::CallScope const scope{stats::EntryPoint::printf_string};
+
+    MemoryWriter<> w;
+    auto const ec = ::fmtxx::impl::DoPrintf(w, format, args, types);
+    AppendTo(str, w);
+    return ec;
+}
+
+FMTXX_INLINE ErrorCode DoFormat(std::string& str, CompiledFormat const& format, Arg const* args, Types types)
+{
+    stats::impl::CallScope const scope{stats::EntryPoint::format_string};
+
+    MemoryWriter<> w;
+    auto const ec = ::fmtxx::impl::DoFormat(w, format, args, types);
+    AppendTo(str, w);
+    return ec;
+}
+
+FMTXX_NAMESPACE_INTERNAL {
+
+// The output range is the buffer window. The virtual functions are only called
+// if the output does not fit (or if FMTXX_STATS is defined).
+class ToCharsWriter final : public Writer
+{
+public:
+    ToCharsWriter() = default;
+    ToCharsWriter(char* first, char* last) { set_window(first, last); }
+
+    // Returns the position after the last character written.
+    char* next() const { return window_next(); }
+
+private:
+    ErrorCode Put(char c) noexcept override;
+    ErrorCode Write(char const* str, size_t len) noexcept override;
+    ErrorCode Pad(char c, size_t count) noexcept override;
+};
+
+inline ErrorCode ToCharsWriter::Put(char c) noexcept
+{
+    char* const next = window_next();
+    if (window_last() - next < 1)
+        return ErrorCode::io_error;
+
+    *next = c;
+    set_window(next + 1, window_last());
+    stats::impl::CountBytes(stats::WriterKind::to_chars, 1);
+    return {};
+}
+
+inline ErrorCode ToCharsWriter::Write(char const* ptr, size_t len) noexcept
+{
+    //
+    // XXX:
+    // Write as much as possible?!?!
+    //
+
+    char* const next = window_next();
+    if (static_cast<size_t>(window_last() - next) < len)
+        return ErrorCode::io_error;
+
+    std::copy_n(ptr, len, MakeArrayIterator(next, window_last() - next));
+    set_window(next + len, window_last());
+    stats::impl::CountBytes(stats::WriterKind::to_chars, len);
+    return {};
+}
+
+inline ErrorCode ToCharsWriter::Pad(char c, size_t count) noexcept
+{
+    //
+    // XXX:
+    // Write as much as possible?!?!
+    //
+
+    char* const next = window_next();
+    if (static_cast<size_t>(window_last() - next) < count)
+        return ErrorCode::io_error;
+
+    std::fill_n(MakeArrayIterator(next, window_last() - next), count, c);
+    set_window(next + count, window_last());
+    stats::impl::CountBytes(stats::WriterKind::to_chars, count);
+    return {};
+}
 
 } // namespace
 
-ToCharsResult fmtxx::impl::DoFormatToChars(char* first, char* last, string_view format, Arg const* args, Types types)
+FMTXX_INLINE ToCharsResult DoFormatToChars(char* first, char* last, string_view format, Arg const* args, Types types)
 {
+    stats::impl::CallScope const scope{stats::EntryPoint::format_to_chars};
+
     ToCharsWriter w{first, last};
 
     if (Failed ec = fmtxx::impl::DoFormat(w, format, args, types))
         return ToCharsResult{last, ec};
 
-    return ToCharsResult{w.next, ErrorCode{}};
+    return ToCharsResult{w.next(), ErrorCode{}};
 }
 
-ToCharsResult fmtxx::impl::DoPrintfToChars(char* first, char* last, string_view format, Arg const* args, Types types)
+FMTXX_INLINE ToCharsResult DoPrintfToChars(char* first, char* last, string_view format, Arg const* args, Types types)
 {
+    stats::impl::CallScope const scope{stats::EntryPoint::printf_to_chars};
+
     ToCharsWriter w{first, last};
 
     if (Failed ec = fmtxx::impl::DoPrintf(w, format, args, types))
         return ToCharsResult{last, ec};
 
-    return ToCharsResult{w.next, ErrorCode{}};
+    return ToCharsResult{w.next(), ErrorCode{}};
 }
 
-int fmtxx::impl::DoFileFormat(std::FILE* file, string_view format, Arg const* args, Types types)
+// Measures the output, resizes STR and then formats directly into the string.
+// Like the other std::string overloads, partial output is appended even if
+// formatting fails.
+template <typename Format>
+FMTXX_STATIC ErrorCode FormatExact(std::string& str, Format func)
 {
-    FILEWriter w{file};
+    CountingWriter counter;
+    func(counter);
 
-    if (Failed(::fmtxx::impl::DoFormat(w, format, args, types)))
+    size_t const pos = str.size();
+    str.resize(pos + counter.size());
+
+    char* const first = &str[0] + pos;
+    ToCharsWriter w{first, first + counter.size()};
+    auto const ec = func(w);
+
+    // The output might differ if a user-defined FormatValue is not deterministic.
+    str.resize(pos + static_cast<size_t>(w.next() - first));
+    return ec;
+}
+
+FMTXX_INLINE ErrorCode DoFormatExact(std::string& str, string_view format, Arg const* args, Types types)
+{
+    stats::impl::CallScope const scope{stats::EntryPoint::format_string};
+    return FormatExact(str, [&](Writer& w) { return fmtxx::impl::DoFormat(w, format, args, types); });
+}
+
+FMTXX_INLINE ErrorCode DoPrintfExact(std::string& str, string_view format, Arg const* args, Types types)
+{
+    stats::impl::CallScope const scope{stats::EntryPoint::printf_string};
+    return FormatExact(str, [&](Writer& w) { return fmtxx::impl::DoPrintf(w, format, args, types); });
+}
+
+FMTXX_INLINE int DoFileFormat(std::FILE* file, string_view format, Arg const* args, Types types)
+{
+    stats::impl::CallScope const scope{stats::EntryPoint::format_file};
+
+    size_t count = 0;
+
+    if (Failed(FormatToFile(file, count, [&](Writer& w) { return ::fmtxx::impl::DoFormat(w, format, args, types); })))
         return -1;
-    if (w.size() > INT_MAX)
+    if (count > INT_MAX)
         return -1;
 
-    return static_cast<int>(w.size());
+    return static_cast<int>(count);
 }
 
-int fmtxx::impl::DoFilePrintf(std::FILE* file, string_view format, Arg const* args, Types types)
+FMTXX_INLINE int DoFilePrintf(std::FILE* file, string_view format, Arg const* args, Types types)
 {
-    FILEWriter w{file};
+    stats::impl::CallScope const scope{stats::EntryPoint::printf_file};
 
-    if (Failed(::fmtxx::impl::DoPrintf(w, format, args, types)))
+    size_t count = 0;
+
+    if (Failed(FormatToFile(file, count, [&](Writer& w) { return ::fmtxx::impl::DoPrintf(w, format, args, types); })))
         return -1;
-    if (w.size() > INT_MAX)
+    if (count > INT_MAX)
         return -1;
 
-    return static_cast<int>(w.size());
+    return static_cast<int>(count);
 }
 
-int fmtxx::impl::DoArrayFormat(char* buf, size_t bufsize, string_view format, Arg const* args, Types types)
+FMTXX_INLINE int DoArrayFormat(char* buf, size_t bufsize, string_view format, Arg const* args, Types types)
 {
+    stats::impl::CallScope const scope{stats::EntryPoint::format_to_chars};
+
     ArrayWriter w{buf, bufsize};
 
     if (Failed(::fmtxx::impl::DoFormat(w, format, args, types)))
@@ -2372,8 +4269,10 @@ int fmtxx::impl::DoArrayFormat(char* buf, size_t bufsize, string_view format, Ar
     return static_cast<int>(w.size());
 }
 
-int fmtxx::impl::DoArrayPrintf(char* buf, size_t bufsize, string_view format, Arg const* args, Types types)
+FMTXX_INLINE int DoArrayPrintf(char* buf, size_t bufsize, string_view format, Arg const* args, Types types)
 {
+    stats::impl::CallScope const scope{stats::EntryPoint::printf_to_chars};
+
     ArrayWriter w{buf, bufsize};
 
     if (Failed(::fmtxx::impl::DoPrintf(w, format, args, types)))
@@ -2383,3 +4282,14 @@ int fmtxx::impl::DoArrayPrintf(char* buf, size_t bufsize, string_view format, Ar
 
     return static_cast<int>(w.size());
 }
+
+} // namespace impl
+} // namespace fmtxx
+
+#undef EXPECT
+#undef EXPECT_NOT
+#undef FMTXX_NOINLINE
+#undef FMTXX_STATIC
+#undef FMTXX_NAMESPACE_INTERNAL
+
+#endif // FMTXX_FORMAT_CC
@@ -27,8 +27,25 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <memory>
 #include <string>
 #include <type_traits>
+#include <vector>
+
+// If FMTXX_HEADER_ONLY is 1, the implementation (Format.cc) is included at the
+// end of this header and does not need to be compiled separately. All functions
+// are then inline, so that the compiler may inline the formatting functions
+// into the caller and specialize them for the arguments and the Writer at the
+// call site. The add-ons (Format_*.cc) still need to be compiled.
+#ifndef FMTXX_HEADER_ONLY
+#define FMTXX_HEADER_ONLY 0
+#endif
+
+#if FMTXX_HEADER_ONLY
+#define FMTXX_INLINE inline
+#else
+#define FMTXX_INLINE
+#endif
 
 namespace fmtxx {
 
@@ -153,13 +170,13 @@ struct Failed
 {
     ErrorCode const ec = ErrorCode{};
 
-    Failed() = default;
-    Failed(ErrorCode ec_) : ec(ec_) {}
+    constexpr Failed() = default;
+    constexpr Failed(ErrorCode ec_) : ec(ec_) {}
 
     // Test for failure.
-    explicit operator bool() const { return ec != ErrorCode{}; }
+    constexpr explicit operator bool() const { return ec != ErrorCode{}; }
 
-    operator ErrorCode() const { return ec; }
+    constexpr operator ErrorCode() const { return ec; }
 };
 
 enum struct Align : unsigned char {
@@ -192,27 +209,96 @@ struct FormatSpec
 };
 
 // The base class for output streams.
+//
+// A Writer may provide a buffer window [next, last) (like the put area of a
+// std::streambuf). Characters which fit into the window are stored directly,
+// without calling a virtual function. Only if the window is too small (or not
+// set, the default) the virtual functions Put, Write and Pad are called. These
+// must handle any request and update the window as required.
+//
+// (If FMTXX_STATS is defined, the virtual functions are always called, so that
+// the output of each kind of Writer can be counted.)
 class Writer
 {
+    char* next_ = nullptr;
+    char* last_ = nullptr;
+
 public:
     virtual ~Writer() noexcept;
 
     // Write a character to the output stream.
-    ErrorCode put(char c) { return Put(c); }
+    ErrorCode put(char c)
+    {
+#ifndef FMTXX_STATS
+        if (next_ != last_)
+        {
+            *next_++ = c;
+            return {};
+        }
+#endif
+        return Put(c);
+    }
 
     // Write a character to the output stream iff it is not the null-character.
-    ErrorCode put_nonnull(char c) { return c == '\0' ? ErrorCode{} : Put(c); }
+    ErrorCode put_nonnull(char c) { return c == '\0' ? ErrorCode{} : put(c); }
 
     // Insert a range of characters into the output stream.
-    ErrorCode write(char const* str, size_t len) { return len == 0 ? ErrorCode{} : Write(str, len); }
+    ErrorCode write(char const* str, size_t len)
+    {
+        if (len == 0)
+            return {};
+#ifndef FMTXX_STATS
+        if (len <= static_cast<size_t>(last_ - next_))
+        {
+            std::memcpy(next_, str, len);
+            next_ += len;
+            return {};
+        }
+#endif
+        return Write(str, len);
+    }
 
     // Insert a character multiple times into the output stream.
-    ErrorCode pad(char c, size_t count) { return count == 0 ? ErrorCode{} : Pad(c, count); }
+    ErrorCode pad(char c, size_t count)
+    {
+        if (count == 0)
+            return {};
+#ifndef FMTXX_STATS
+        if (count <= static_cast<size_t>(last_ - next_))
+        {
+            std::memset(next_, static_cast<unsigned char>(c), count);
+            next_ += count;
+            return {};
+        }
+#endif
+        return Pad(c, count);
+    }
+
+    // Hint that (approximately) N more characters are about to be written.
+    // Writers which store the output in memory may use this to allocate the
+    // required storage at once. The default implementation does nothing.
+    ErrorCode reserve(size_t n) { return n == 0 ? ErrorCode{} : Reserve(n); }
+
+protected:
+    // Returns the next position in the buffer window.
+    char* window_next() const { return next_; }
+
+    // Returns the end of the buffer window.
+    char* window_last() const { return last_; }
+
+    // Sets the buffer window to [NEXT, LAST).
+    void set_window(char* next, char* last)
+    {
+        assert(next <= last);
+        next_ = next;
+        last_ = last;
+    }
 
 private:
     virtual ErrorCode Put(char c) = 0;
     virtual ErrorCode Write(char const* str, size_t len) = 0;
     virtual ErrorCode Pad(char c, size_t count) = 0;
+    virtual ErrorCode Reserve(size_t n);
 };
 
 // Write to std::FILE's, keeping track of the number of characters (successfully) transmitted.
@@ -246,11 +332,12 @@ class ArrayWriter : public Writer
 {
     char*  const buf_     = nullptr;
     size_t const bufsize_ = 0;
-    size_t       size_    = 0;
+    size_t       dropped_ = 0; // Number of characters which did not fit into the buffer
 
 public:
     ArrayWriter(char* buffer, size_t buffer_size) : buf_(buffer), bufsize_(buffer_size) {
         assert(bufsize_ == 0 || buf_ != nullptr);
+        set_window(buf_, buf_ + bufsize_);
     }
 
     template <size_t N>
@@ -268,10 +355,10 @@ public:
     size_t capacity() const { return bufsize_; }
 
     // Returns the length of the string.
-    size_t size() const { return size_; }
+    size_t size() const { return static_cast<size_t>(window_next() - buf_) + dropped_; }
 
     // Returns true if the buffer was too small.
-    bool overflow() const { return size_ >= bufsize_; }
+    bool overflow() const { return size() >= bufsize_; }
 
     // Returns the string.
     string_view view() const { return string_view(data(), size()); }
@@ -286,6 +373,96 @@ private:
     ErrorCode Pad(char c, size_t count) override;
 };
 
+// Counts the number of characters written, without storing them.
+class CountingWriter : public Writer
+{
+    size_t size_ = 0;
+
+public:
+    CountingWriter() = default;
+
+    // Returns the number of characters written so far.
+    size_t size() const { return size_; }
+
+private:
+    ErrorCode Put(char c) override;
+    ErrorCode Write(char const* ptr, size_t len) override;
+    ErrorCode Pad(char c, size_t count) override;
+};
+
+// Write to a memory buffer.
+// The first few bytes are stored in a buffer provided by the derived class
+// (see MemoryWriter<N>), the string is moved to the heap if it grows larger.
+//
+// The free space of the buffer is the buffer window, hence the string is
+// [data(), window_next()).
+class MemoryWriterBase : public Writer
+{
+    char*  buf_;
+    size_t capacity_;
+    char*  const inline_buf_;
+
+protected:
+    MemoryWriterBase(char* inline_buf, size_t inline_size) noexcept
+        : buf_(inline_buf)
+        , capacity_(inline_size)
+        , inline_buf_(inline_buf)
+    {
+        set_window(buf_, buf_ + capacity_);
+    }
+
+    ~MemoryWriterBase() noexcept;
+
+public:
+    MemoryWriterBase(MemoryWriterBase const&) = delete;
+    MemoryWriterBase& operator=(MemoryWriterBase const&) = delete;
+
+    // Returns a pointer to the string. The string is NOT null-terminated.
+    char* data() const { return buf_; }
+
+    // Returns the length of the string.
+    size_t size() const { return static_cast<size_t>(window_next() - buf_); }
+
+    // Returns the buffer capacity.
+    size_t capacity() const { return capacity_; }
+
+    // Returns whether the string has been moved to the heap.
+    bool heap_allocated() const { return buf_ != inline_buf_; }
+
+    // Returns the string.
+    string_view view() const { return string_view(data(), size()); }
+
+    // Discards the contents of the buffer. Does not release any memory.
+    void clear() { set_window(buf_, buf_ + capacity_); }
+
+    // Copies the string into STR, replacing its contents, and clears the buffer.
+    // This allocates at most once, exactly size() bytes (plus the null-terminator).
+    void release_into(std::string& str);
+
+private:
+    ErrorCode Put(char c) override;
+    ErrorCode Write(char const* ptr, size_t len) override;
+    ErrorCode Pad(char c, size_t count) override;
+
+    // Make room for at least N more characters.
+    // Returns io_error if the allocation fails.
+    ErrorCode Reserve(size_t n) final;
+    ErrorCode Grow(size_t n);
+};
+
+// Write to a memory buffer.
+// Strings of up to InlineSize bytes are stored inline and do not allocate.
+template <size_t InlineSize = 500>
+class MemoryWriter : public MemoryWriterBase
+{
+    static_assert(InlineSize > 0, "invalid buffer size");
+
+    char inline_[InlineSize];
+
+public:
+    MemoryWriter() noexcept : MemoryWriterBase(inline_, InlineSize) {}
+};
+
 // Returned by the format_to_chars/printf_to_chars function (below).
 // Like std::to_chars.
 struct ToCharsResult
@@ -300,6 +477,19 @@ struct ToCharsResult
     explicit operator bool() const { return ec == ErrorCode{}; }
 };
 
+// Returned by the formatted_size/printf_formatted_size functions (below).
+struct FormattedSizeResult
+{
+    size_t    size = 0;
+    ErrorCode ec   = ErrorCode{};
+
+    FormattedSizeResult() = default;
+    FormattedSizeResult(size_t size_, ErrorCode ec_) : size(size_), ec(ec_) {}
+
+    // Test for successful conversion
+    explicit operator bool() const { return ec == ErrorCode{}; }
+};
+
 // Returned by the string_format/string_printf functions (below).
 struct StringFormatResult
 {
@@ -313,6 +503,21 @@ struct StringFormatResult
     explicit operator bool() const { return ec == ErrorCode{}; }
 };
 
+// Returned by the string_format/string_printf functions taking an allocator (below).
+template <typename Alloc>
+struct BasicStringFormatResult
+{
+    using string_type = std::basic_string<char, std::char_traits<char>, Alloc>;
+
+    string_type str;
+    ErrorCode ec = ErrorCode{};
+
+    explicit BasicStringFormatResult(Alloc const& alloc) : str(alloc) {}
+
+    // Test for successful conversion
+    explicit operator bool() const { return ec == ErrorCode{}; }
+};
+
 struct Util
 {
     // Note:
@@ -327,6 +532,10 @@ struct Util
     static ErrorCode format_char        (Writer& w, FormatSpec const& spec, char ch);
     static ErrorCode format_pointer     (Writer& w, FormatSpec const& spec, void const* pointer);
     static ErrorCode format_double      (Writer& w, FormatSpec const& spec, double x);
+    // Note:
+    // Same as format_double, except that the shortest representation ('s') is
+    // computed with respect to single-precision.
+    static ErrorCode format_float       (Writer& w, FormatSpec const& spec, float x);
 
     template <typename T>
     static ErrorCode format_string(Writer& w, FormatSpec const& spec, T const& value)
@@ -359,6 +568,87 @@ private:
 //
 //------------------------------------------------------------------------------
 
+enum struct FormatSyntax : unsigned char {
+    format, // Brace-style format strings ("{:08x}")
+    printf, // printf-style format strings ("%08x")
+};
+
+namespace impl {
+
+struct CompiledField
+{
+    size_t     text_pos = 0; // Literal text preceding the replacement field
+    size_t     text_len = 0;
+    size_t     spec_pos = 0; // The style, or the format-spec if it is dynamic (see below)
+    size_t     spec_len = 0;
+    FormatSpec spec;         // Note: spec.style is always empty
+    int        arg      = -1; // Negative if this field only consists of literal text
+    int        nextarg  = -1; // If >= 0, the format-spec references run-time arguments ('*', '{}')
+                              // and is re-parsed starting with this argument index.
+};
+
+} // namespace fmtxx::impl
+
+// A pre-parsed format string.
+//
+// The format string is parsed once on construction into a list of literal text
+// segments and format-specs. Formatting a CompiledFormat does not need to parse
+// the format string again. Only replacement fields which reference run-time
+// arguments for the width, the precision or the format-spec are re-parsed.
+class CompiledFormat
+{
+    std::string text_;
+    std::vector<impl::CompiledField> fields_;
+    FormatSyntax syntax_ = FormatSyntax::format;
+    ErrorCode ec_ = ErrorCode{};
+
+public:
+    CompiledFormat() = default;
+
+    // Parses the format string FORMAT.
+    // The format string is copied and need not outlive the CompiledFormat.
+    explicit CompiledFormat(string_view format, FormatSyntax syntax = FormatSyntax::format);
+
+    // Returns the syntax of the format string.
+    FormatSyntax syntax() const { return syntax_; }
+
+    // Returns the error detected while parsing the format string.
+    // If the format string is invalid, formatting writes the output up to the
+    // first invalid replacement field and then returns this error code.
+    ErrorCode ec() const { return ec_; }
+
+    // Test for successfully parsed format strings.
+    explicit operator bool() const { return ec_ == ErrorCode{}; }
+
+    // Internal.
+    char const* text() const { return text_.data(); }
+    std::vector<impl::CompiledField> const& fields() const { return fields_; }
+};
+
+// Upper bound for set_parse_cache_capacity.
+static constexpr size_t kMaxParseCacheCapacity = 256;
+
+// Sets the maximum number of format strings remembered per thread by the
+// parse cache. The default is 0, which disables the cache.
+//
+// If enabled, format() and printf() (and all other functions taking a format
+// string) keep the CompiledFormat of recently used format strings and format
+// repeated calls from it instead of parsing the format string again. Entries
+// are looked up by address and length, and the contents are compared on every
+// lookup, so format strings built at run-time are always formatted correctly.
+// If the cache is full, the least recently used entry is replaced.
+//
+// The capacity is global, the cache itself is thread-local. Hits do not take
+// any locks. Invalid format strings are never cached.
+void set_parse_cache_capacity(size_t capacity);
+
+// Returns the current capacity of the parse cache.
+size_t parse_cache_capacity();
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
 namespace impl {
 
 template <typename T>
@@ -430,7 +720,8 @@ enum struct Type : int {
     sint,
     slonglong,
     ulonglong,
-    double_,    // Includes 'float'
+    double_,
+    float_,
     last,       // Unused -- must be last.
 };
 
@@ -461,7 +752,7 @@ template <>           struct SelectType<unsigned int      > : Type_t<Type::ulong
 template <>           struct SelectType<unsigned long     > : Type_t<Type::ulonglong> {};
 template <>           struct SelectType<unsigned long long> : Type_t<Type::ulonglong> {};
 template <>           struct SelectType<double            > : Type_t<Type::double_> {};
-template <>           struct SelectType<float             > : Type_t<Type::double_> {};
+template <>           struct SelectType<float             > : Type_t<Type::float_> {};
 
 template <typename T, Type Val = SelectType<T>::value>
 struct SelectType_checked : Type_t<Val>
@@ -620,6 +911,14 @@ struct DefaultFormatValue<T, Type::double_>
     }
 };
 
+template <typename T>
+struct DefaultFormatValue<T, Type::float_>
+{
+    ErrorCode operator()(Writer& w, FormatSpec const& spec, float val) const {
+        return Util::format_float(w, spec, val);
+    }
+};
+
 } // namespace fmtxx::impl
 
 //------------------------------------------------------------------------------
@@ -673,6 +972,7 @@ struct Arg
         signed long long   slonglong;
         unsigned long long ulonglong;
         double             double_;
+        float              float_;
     };
 
     template <typename T> Arg(T const& v, Type_t<Type::formatspec>) : pvoid(&v) {}
@@ -688,6 +988,7 @@ struct Arg
     template <typename T> Arg(T const& v, Type_t<Type::slonglong> ) : slonglong(v) {}
     template <typename T> Arg(T const& v, Type_t<Type::ulonglong> ) : ulonglong(v) {}
     template <typename T> Arg(T const& v, Type_t<Type::double_>   ) : double_(v) {}
+    template <typename T> Arg(T const& v, Type_t<Type::float_>    ) : float_(v) {}
 
     Arg() {}//= default;
 
@@ -721,12 +1022,11 @@ struct Types
     constexpr Types() = default;
     constexpr Types(value_type t) : types(t) {}
 
-    Type operator[](int index) const
+    constexpr Type operator[](int index) const
     {
-        if (index < 0 || index >= kMaxArgs)
-            return Type::none;
-
-        return static_cast<Type>((types >> (kBitsPerArg * index)) & kTypeMask);
+        return (index < 0 || index >= kMaxArgs)
+            ? Type::none
+            : static_cast<Type>((types >> (kBitsPerArg * index)) & kTypeMask);
     }
 };
 
@@ -748,6 +1048,48 @@ struct MakeTypes<T, Ts...>
         = static_cast<Types::value_type>(TypeFor<T>::value) | (MakeTypes<Ts...>::value << Types::kBitsPerArg);
 };
 
+// The number of bytes an ArgStore copies for an argument of type T, in addition
+// to the data referenced by strings and C-strings.
+template <typename T, Type = TypeFor<T>::value>
+struct ArgCopySize
+    : std::integral_constant<size_t, 0>
+{
+};
+
+template <typename T>
+struct ArgCopySize<T, Type::formatspec>
+    : std::integral_constant<size_t, sizeof(FormatSpec)>
+{
+};
+
+template <typename T>
+struct ArgCopySize<T, Type::other>
+    : std::integral_constant<size_t, sizeof(T)>
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+        "Arguments of user-defined types must be trivially copyable to be stored in an ArgStore. "
+        "Format them into a std::string first.");
+    static_assert(alignof(T) <= alignof(Arg),
+        "Over-aligned types cannot be stored in an ArgStore.");
+};
+
+// Returns the number of bytes required to copy the data referenced by ARGS.
+// COPY_SIZES contains the ArgCopySize for each argument.
+size_t ComputeArgPayloadSize(Arg const* args, Types types, size_t const* copy_sizes);
+
+// Copies ARGS into DST and the data referenced by ARGS into PAYLOAD, which
+// must be aligned to alignof(Arg) and must provide ComputeArgPayloadSize bytes.
+// The copies in DST reference the data in PAYLOAD.
+void CopyArgs(Arg* dst, char* payload, Arg const* args, Types types, size_t const* copy_sizes);
+
+// Format N values using the same FormatSpec, separated by SEP.
+// For signed integers, ZEXT_MASK converts the (sign-extended) values into the
+// zero-extended values of the original type.
+ErrorCode FormatRange(Writer& w, FormatSpec const& spec, int64_t  const* first, size_t n, string_view sep, uint64_t zext_mask = UINT64_MAX);
+ErrorCode FormatRange(Writer& w, FormatSpec const& spec, uint64_t const* first, size_t n, string_view sep);
+ErrorCode FormatRange(Writer& w, FormatSpec const& spec, double   const* first, size_t n, string_view sep);
+ErrorCode FormatRange(Writer& w, FormatSpec const& spec, float    const* first, size_t n, string_view sep);
+
 ErrorCode DoFormat(Writer&      w,    string_view format, Arg const* args, Types types);
 ErrorCode DoPrintf(Writer&      w,    string_view format, Arg const* args, Types types);
 ErrorCode DoFormat(std::FILE*   file, string_view format, Arg const* args, Types types);
@@ -755,6 +1097,14 @@ ErrorCode DoPrintf(std::FILE*   file, string_view format, Arg const* args, Types
 ErrorCode DoFormat(std::string& str,  string_view format, Arg const* args, Types types);
 ErrorCode DoPrintf(std::string& str,  string_view format, Arg const* args, Types types);
 
+ErrorCode DoFormat(Writer&      w,    CompiledFormat const& format, Arg const* args, Types types);
+ErrorCode DoFormat(std::FILE*   file, CompiledFormat const& format, Arg const* args, Types types);
+ErrorCode DoFormat(std::string& str,  CompiledFormat const& format, Arg const* args, Types types);
+
+// Measure first, then format into exactly str.size() + N characters.
+ErrorCode DoFormatExact(std::string& str, string_view format, Arg const* args, Types types);
+ErrorCode DoPrintfExact(std::string& str, string_view format, Arg const* args, Types types);
+
 ToCharsResult DoFormatToChars(char* first, char* last, string_view format, Arg const* args, Types types);
 ToCharsResult DoPrintfToChars(char* first, char* last, string_view format, Arg const* args, Types types);
 
@@ -768,6 +1118,45 @@ int DoArrayPrintf(char* buf, size_t bufsize, string_view format, Arg const* args
 
 } // namespace fmtxx::impl
 
+// An owned copy of a list of format arguments.
+//
+// Strings and C-strings are copied, arguments of user-defined types must be
+// trivially copyable and are copied bytewise. The ArgStore does not reference
+// the arguments it was constructed from and may be formatted later, possibly
+// on another thread.
+//
+// All copies are stored in a single memory block.
+class ArgStore
+{
+    std::vector<impl::Arg> store_; // The arguments, followed by the copied data.
+    impl::Types::value_type types_ = 0;
+
+public:
+    ArgStore() = default;
+
+    template <typename ...Args>
+    explicit ArgStore(Args const&... args)
+    {
+        fmtxx::impl::ArgArray<Args...> arr = {args...};
+        size_t const copy_sizes[] = {fmtxx::impl::ArgCopySize<Args>::value..., 0};
+        Assign(arr, fmtxx::impl::MakeTypes<Args...>::value, copy_sizes);
+    }
+
+    // The arguments reference the memory block, which is not copyable.
+    ArgStore(ArgStore const&) = delete;
+    ArgStore& operator=(ArgStore const&) = delete;
+
+    ArgStore(ArgStore&&) = default;
+    ArgStore& operator=(ArgStore&&) = default;
+
+    // Internal.
+    impl::Arg const* args() const { return store_.data(); }
+    impl::Types types() const { return types_; }
+
+private:
+    void Assign(impl::Arg const* args, impl::Types types, size_t const* copy_sizes);
+};
+
 //------------------------------------------------------------------------------
 //
 //------------------------------------------------------------------------------
@@ -830,6 +1219,204 @@ StringFormatResult string_printf(string_view format, Args const&... args)
     return r;
 }
 
+namespace impl {
+
+// Collects the output in a local buffer and appends it to a string in large
+// chunks. Does not allocate memory other than through the string's allocator.
+// The free space of the local buffer is the buffer window.
+template <typename String>
+class StringAppender final : public Writer
+{
+    static constexpr size_t kBufferSize = 500;
+
+    String& str_;
+    char    buf_[kBufferSize];
+
+public:
+    explicit StringAppender(String& str) : str_(str) { set_window(buf_, buf_ + kBufferSize); }
+
+    void flush()
+    {
+        str_.append(buf_, Length());
+        set_window(buf_, buf_ + kBufferSize);
+    }
+
+private:
+    size_t Length() const { return static_cast<size_t>(window_next() - buf_); }
+    size_t Available() const { return static_cast<size_t>(window_last() - window_next()); }
+
+    ErrorCode Put(char c) override
+    {
+        if (Available() == 0)
+            flush();
+
+        char* const next = window_next();
+        *next = c;
+        set_window(next + 1, window_last());
+        return {};
+    }
+
+    ErrorCode Write(char const* ptr, size_t len) override
+    {
+        if (Available() < len)
+        {
+            flush();
+            if (len >= kBufferSize)
+            {
+                str_.append(ptr, len);
+                return {};
+            }
+        }
+
+        char* const next = window_next();
+        std::memcpy(next, ptr, len);
+        set_window(next + len, window_last());
+        return {};
+    }
+
+    ErrorCode Pad(char c, size_t count) override
+    {
+        while (count > 0)
+        {
+            if (Available() == 0)
+                flush();
+
+            char* const next = window_next();
+            size_t const n = (count < Available()) ? count : Available();
+            std::memset(next, static_cast<unsigned char>(c), n);
+            set_window(next + n, window_last());
+            count -= n;
+        }
+
+        return {};
+    }
+
+    ErrorCode Reserve(size_t n) override
+    {
+        str_.reserve(str_.size() + Length() + n);
+        return {};
+    }
+};
+
+} // namespace fmtxx::impl
+
+// Append to strings using any allocator.
+// Short strings are formatted into a local buffer first and then appended to
+// the string with a single call to append.
+template <typename Traits, typename Alloc, typename ...Args>
+ErrorCode format(std::basic_string<char, Traits, Alloc>& str, string_view format, Args const&... args)
+{
+    fmtxx::impl::StringAppender<std::basic_string<char, Traits, Alloc>> w{str};
+    auto const ec = fmtxx::format(w, format, args...);
+    w.flush();
+    return ec;
+}
+
+template <typename Traits, typename Alloc, typename ...Args>
+ErrorCode printf(std::basic_string<char, Traits, Alloc>& str, string_view format, Args const&... args)
+{
+    fmtxx::impl::StringAppender<std::basic_string<char, Traits, Alloc>> w{str};
+    auto const ec = fmtxx::printf(w, format, args...);
+    w.flush();
+    return ec;
+}
+
+// Returns the formatted string, which is allocated using ALLOC.
+template <typename Alloc, typename ...Args>
+BasicStringFormatResult<Alloc> string_format(std::allocator_arg_t, Alloc const& alloc, string_view format, Args const&... args)
+{
+    BasicStringFormatResult<Alloc> r{alloc};
+    r.ec = fmtxx::format(r.str, format, args...);
+    return r;
+}
+
+template <typename Alloc, typename ...Args>
+BasicStringFormatResult<Alloc> string_printf(std::allocator_arg_t, Alloc const& alloc, string_view format, Args const&... args)
+{
+    BasicStringFormatResult<Alloc> r{alloc};
+    r.ec = fmtxx::printf(r.str, format, args...);
+    return r;
+}
+
+// Like string_format, but computes the length of the output first and then
+// formats directly into a string of exactly this size. The string is allocated
+// only once, at the cost of formatting twice.
+template <typename ...Args>
+StringFormatResult string_format_exact(string_view format, Args const&... args)
+{
+    fmtxx::impl::ArgArray<Args...> arr = {args...};
+
+    StringFormatResult r;
+    r.ec = fmtxx::impl::DoFormatExact(r.str, format, arr, fmtxx::impl::MakeTypes<Args...>::value);
+    return r;
+}
+
+template <typename ...Args>
+StringFormatResult string_printf_exact(string_view format, Args const&... args)
+{
+    fmtxx::impl::ArgArray<Args...> arr = {args...};
+
+    StringFormatResult r;
+    r.ec = fmtxx::impl::DoPrintfExact(r.str, format, arr, fmtxx::impl::MakeTypes<Args...>::value);
+    return r;
+}
+
+// Returns the number of characters the output would have.
+template <typename ...Args>
+FormattedSizeResult formatted_size(string_view format, Args const&... args)
+{
+    CountingWriter w;
+    auto const ec = fmtxx::format(w, format, args...);
+    return FormattedSizeResult{w.size(), ec};
+}
+
+template <typename ...Args>
+FormattedSizeResult printf_formatted_size(string_view format, Args const&... args)
+{
+    CountingWriter w;
+    auto const ec = fmtxx::printf(w, format, args...);
+    return FormattedSizeResult{w.size(), ec};
+}
+
+// Format using a pre-parsed format string.
+// Depending on CompiledFormat::syntax(), format is either a brace-style or a printf-style format string.
+template <typename ...Args>
+ErrorCode format(Writer& w, CompiledFormat const& format, Args const&... args)
+{
+    fmtxx::impl::ArgArray<Args...> arr = {args...};
+    return fmtxx::impl::DoFormat(w, format, arr, fmtxx::impl::MakeTypes<Args...>::value);
+}
+
+template <typename ...Args>
+ErrorCode format(std::FILE* file, CompiledFormat const& format, Args const&... args)
+{
+    fmtxx::impl::ArgArray<Args...> arr = {args...};
+    return fmtxx::impl::DoFormat(file, format, arr, fmtxx::impl::MakeTypes<Args...>::value);
+}
+
+template <typename ...Args>
+ErrorCode format(std::string& str, CompiledFormat const& format, Args const&... args)
+{
+    fmtxx::impl::ArgArray<Args...> arr = {args...};
+    return fmtxx::impl::DoFormat(str, format, arr, fmtxx::impl::MakeTypes<Args...>::value);
+}
+
+template <typename ...Args>
+FormattedSizeResult formatted_size(CompiledFormat const& format, Args const&... args)
+{
+    CountingWriter w;
+    auto const ec = fmtxx::format(w, format, args...);
+    return FormattedSizeResult{w.size(), ec};
+}
+
+template <typename ...Args>
+StringFormatResult string_format(CompiledFormat const& format, Args const&... args)
+{
+    StringFormatResult r;
+    r.ec = fmtxx::format(r.str, format, args...);
+    return r;
+}
+
 template <typename ...Args>
 ToCharsResult format_to_chars(char* first, char* last, string_view format, Args const&... args)
 {
@@ -872,6 +1459,226 @@ int snprintf(char* buf, size_t bufsize, string_view format, Args const&... args)
     return fmtxx::impl::DoArrayPrintf(buf, bufsize, format, arr, fmtxx::impl::MakeTypes<Args...>::value);
 }
 
+// Parses the replacement field FIELD (e.g. "{:>8.3f}") into SPEC.
+// The replacement field must not contain an argument index and must not
+// reference run-time arguments.
+// Note: SPEC.style points into FIELD.
+ErrorCode parse_format_spec(FormatSpec& spec, string_view field);
+
+namespace impl {
+
+struct RangeSigned {};
+struct RangeUnsigned {};
+struct RangeFloat {};
+struct RangeOther {};
+
+// Selects the fast path for contiguous ranges of T's.
+// bool and char are not formatted as integers.
+template <typename T>
+using RangeTag =
+    typename std::conditional<
+        std::is_same<T, double>::value || std::is_same<T, float>::value,
+        RangeFloat,
+        typename std::conditional<
+            std::is_integral<T>::value && !std::is_same<T, bool>::value && !std::is_same<T, char>::value,
+            typename std::conditional<std::is_signed<T>::value, RangeSigned, RangeUnsigned>::type,
+            RangeOther
+        >::type
+    >::type;
+
+template <typename It>
+ErrorCode FormatEach(Writer& w, FormatSpec const& spec, It first, It last, string_view sep)
+{
+    if (first == last)
+        return {};
+
+    for (;;)
+    {
+        if (Failed ec = FormatValue<>{}(w, spec, *first))
+            return ec;
+        if (++first == last)
+            break;
+        if (Failed ec = w.write(sep.data(), sep.size()))
+            return ec;
+    }
+
+    return {};
+}
+
+// Converts the values to U in chunks and formats the chunks.
+template <typename U, typename T, typename ...Extra>
+ErrorCode FormatConverted(Writer& w, FormatSpec const& spec, T const* first, size_t n, string_view sep, Extra... extra)
+{
+    static constexpr size_t kChunkSize = 256;
+
+    U chunk[kChunkSize];
+    for (size_t i = 0; i < n; i += kChunkSize)
+    {
+        size_t const k = (n - i < kChunkSize) ? n - i : kChunkSize;
+        for (size_t j = 0; j < k; ++j)
+            chunk[j] = static_cast<U>(first[i + j]);
+
+        if (i != 0)
+        {
+            if (Failed ec = w.write(sep.data(), sep.size()))
+                return ec;
+        }
+        if (Failed ec = FormatRange(w, spec, chunk, k, sep, extra...))
+            return ec;
+    }
+
+    return {};
+}
+
+template <typename T>
+ErrorCode FormatContiguous(Writer& w, FormatSpec const& spec, T const* first, size_t n, string_view sep, RangeSigned)
+{
+    return FormatConverted<int64_t>(w, spec, first, n, sep, static_cast<uint64_t>(static_cast<typename std::make_unsigned<T>::type>(-1)));
+}
+
+template <typename T>
+ErrorCode FormatContiguous(Writer& w, FormatSpec const& spec, T const* first, size_t n, string_view sep, RangeUnsigned)
+{
+    return FormatConverted<uint64_t>(w, spec, first, n, sep);
+}
+
+template <typename T>
+ErrorCode FormatContiguous(Writer& w, FormatSpec const& spec, T const* first, size_t n, string_view sep, RangeFloat)
+{
+    return FormatConverted<double>(w, spec, first, n, sep);
+}
+
+inline ErrorCode FormatContiguous(Writer& w, FormatSpec const& spec, int64_t const* first, size_t n, string_view sep, RangeSigned)
+{
+    return FormatRange(w, spec, first, n, sep);
+}
+
+inline ErrorCode FormatContiguous(Writer& w, FormatSpec const& spec, uint64_t const* first, size_t n, string_view sep, RangeUnsigned)
+{
+    return FormatRange(w, spec, first, n, sep);
+}
+
+inline ErrorCode FormatContiguous(Writer& w, FormatSpec const& spec, double const* first, size_t n, string_view sep, RangeFloat)
+{
+    return FormatRange(w, spec, first, n, sep);
+}
+
+inline ErrorCode FormatContiguous(Writer& w, FormatSpec const& spec, float const* first, size_t n, string_view sep, RangeFloat)
+{
+    return FormatRange(w, spec, first, n, sep);
+}
+
+template <typename T>
+ErrorCode FormatContiguous(Writer& w, FormatSpec const& spec, T const* first, size_t n, string_view sep, RangeOther)
+{
+    return FormatEach(w, spec, first, first + n, sep);
+}
+
+template <typename It>
+ErrorCode FormatRangeDispatch(Writer& w, FormatSpec const& spec, It first, It last, string_view sep)
+{
+    return FormatEach(w, spec, first, last, sep);
+}
+
+template <typename T>
+ErrorCode FormatRangeDispatch(Writer& w, FormatSpec const& spec, T* first, T* last, string_view sep)
+{
+    using U = typename std::remove_cv<T>::type;
+    return FormatContiguous(w, spec, static_cast<U const*>(first), static_cast<size_t>(last - first), sep, RangeTag<U>{});
+}
+
+// Test if T has member functions data() and size(), i.e. stores its elements contiguously.
+template <typename T, typename = void>
+struct IsContiguous
+    : std::false_type
+{
+};
+
+template <typename T>
+struct IsContiguous<T, Void_t< decltype(std::declval<T const&>().data() + std::declval<T const&>().size()) >>
+    : std::is_pointer< decltype(std::declval<T const&>().data()) >
+{
+};
+
+template <typename Container>
+ErrorCode FormatRow(Writer& w, FormatSpec const& spec, Container const& values, string_view sep, /*IsContiguous*/ std::true_type)
+{
+    return FormatRangeDispatch(w, spec, values.data(), values.data() + values.size(), sep);
+}
+
+template <typename Container>
+ErrorCode FormatRow(Writer& w, FormatSpec const& spec, Container const& values, string_view sep, /*IsContiguous*/ std::false_type)
+{
+    using std::begin; // using ADL!
+    using std::end;   // using ADL!
+
+    return FormatEach(w, spec, begin(values), end(values), sep);
+}
+
+} // namespace fmtxx::impl
+
+// Formats the values in [FIRST, LAST), separated by SEP, using the replacement
+// field FIELD (e.g. "{:.3f}") for each value.
+//
+// The replacement field is parsed only once. Contiguous ranges (pointers) of
+// integers and floating-point numbers are formatted in a tight loop which
+// bypasses the argument type dispatch.
+template <typename It>
+ErrorCode format_range(Writer& w, string_view field, It first, It last, string_view sep = ", ")
+{
+    FormatSpec spec;
+    if (Failed ec = fmtxx::parse_format_spec(spec, field))
+        return ec;
+
+    return fmtxx::impl::FormatRangeDispatch(w, spec, first, last, sep);
+}
+
+// Formats all values in the container VALUES, separated by SEP, using the
+// replacement field FIELD for each value.
+//
+// Containers with member functions data() and size() (std::vector, std::array,
+// ...) use the fast path for contiguous ranges.
+template <typename Container>
+ErrorCode format_row(Writer& w, string_view field, Container const& values, string_view sep = ", ")
+{
+    FormatSpec spec;
+    if (Failed ec = fmtxx::parse_format_spec(spec, field))
+        return ec;
+
+    return fmtxx::impl::FormatRow(w, spec, values, sep, fmtxx::impl::IsContiguous<Container>{});
+}
+
+// Format the arguments stored in an ArgStore.
+inline ErrorCode format(Writer& w, string_view format, ArgStore const& args)
+{
+    return fmtxx::impl::DoFormat(w, format, args.args(), args.types());
+}
+
+inline ErrorCode printf(Writer& w, string_view format, ArgStore const& args)
+{
+    return fmtxx::impl::DoPrintf(w, format, args.args(), args.types());
+}
+
+inline ErrorCode format(std::FILE* file, string_view format, ArgStore const& args)
+{
+    return fmtxx::impl::DoFormat(file, format, args.args(), args.types());
+}
+
+inline ErrorCode printf(std::FILE* file, string_view format, ArgStore const& args)
+{
+    return fmtxx::impl::DoPrintf(file, format, args.args(), args.types());
+}
+
+inline ErrorCode format(std::string& str, string_view format, ArgStore const& args)
+{
+    return fmtxx::impl::DoFormat(str, format, args.args(), args.types());
+}
+
+inline ErrorCode printf(std::string& str, string_view format, ArgStore const& args)
+{
+    return fmtxx::impl::DoPrintf(str, format, args.args(), args.types());
+}
+
 template <size_t N, typename ...Args>
 int snformat(char (&buf)[N], string_view format, Args const&... args)
 {
@@ -886,4 +1693,10 @@ int snprintf(char (&buf)[N], string_view format, Args const&... args)
 
 } // namespace fmtxx
 
+// Format.cc also depends on Format_scan.h and Format_stats.h. If one of these
+// headers includes this file, it includes Format.cc itself at its end.
+#if FMTXX_HEADER_ONLY && !defined(FMTXX_FORMAT_SCAN_H) && !defined(FMTXX_FORMAT_STATS_H)
+#include "Format.cc"
+#endif
+
 #endif // FMTXX_FORMAT_H
@@ -0,0 +1,97 @@
+// Copyright (c) 2017 Alexander Bolz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "Format_arena.h"
+
+#include <cstdlib>
+
+using namespace fmtxx;
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+// Memory returned by malloc is suitably aligned for all types.
+static constexpr size_t kMaxAlign = alignof(std::max_align_t);
+
+fmtxx::Arena::Arena(size_t block_size)
+    : block_size_(block_size)
+{
+}
+
+fmtxx::Arena::Arena(void* buffer, size_t buffer_size, size_t block_size)
+    : next_(static_cast<char*>(buffer))
+    , end_(static_cast<char*>(buffer) + buffer_size)
+    , initial_(static_cast<char*>(buffer))
+    , initial_size_(buffer_size)
+    , block_size_(block_size)
+{
+}
+
+fmtxx::Arena::~Arena()
+{
+    release();
+}
+
+void fmtxx::Arena::release()
+{
+    while (blocks_ != nullptr)
+    {
+        Block* const next = blocks_->next;
+        std::free(blocks_);
+        blocks_ = next;
+    }
+
+    next_ = initial_;
+    end_ = initial_ + initial_size_;
+}
+
+void* fmtxx::Arena::AllocateSlow(size_t n, size_t align)
+{
+    assert(align <= kMaxAlign);
+
+    // The block header is followed by the usable memory.
+    size_t const header_size = (sizeof(Block) + (kMaxAlign - 1)) & ~(kMaxAlign - 1);
+
+    // Large allocations get a block of their own. The rest of the current
+    // block remains available.
+    bool const large = n > block_size_ / 4;
+
+    size_t const usable = large ? n : (block_size_ > n ? block_size_ : n);
+    if (usable > SIZE_MAX - header_size)
+        return nullptr;
+
+    auto const block = static_cast<Block*>(std::malloc(header_size + usable));
+    if (block == nullptr)
+        return nullptr;
+
+    block->next = blocks_;
+    blocks_ = block;
+
+    char* const first = reinterpret_cast<char*>(block) + header_size;
+    if (!large)
+    {
+        next_ = first + n;
+        end_ = first + usable;
+    }
+
+    return first;
+}
@@ -0,0 +1,151 @@
+// Copyright (c) 2017 Alexander Bolz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef FMTXX_FORMAT_ARENA_H
+#define FMTXX_FORMAT_ARENA_H 1
+
+#include "Format.h"
+
+#include <cstdint>
+#include <new>
+
+namespace fmtxx {
+
+// A monotonic memory arena.
+//
+// Memory is bump-allocated from blocks of (at least) BLOCK_SIZE bytes, which
+// are only freed on release() or destruction. Deallocation is a no-op.
+// Intended to be used per request (e.g. as the allocator of the formatted
+// strings), not thread-safe.
+class Arena
+{
+    struct Block
+    {
+        Block* next;
+    };
+
+    char*        next_ = nullptr;
+    char*        end_ = nullptr;
+    Block*       blocks_ = nullptr;
+    char* const  initial_ = nullptr;
+    size_t const initial_size_ = 0;
+    size_t const block_size_;
+
+public:
+    explicit Arena(size_t block_size = 4096);
+
+    // Uses the memory [buffer, buffer + buffer_size) before allocating blocks
+    // from the heap. The buffer must outlive the arena.
+    Arena(void* buffer, size_t buffer_size, size_t block_size = 4096);
+
+    ~Arena();
+
+    Arena(Arena const&) = delete;
+    Arena& operator=(Arena const&) = delete;
+
+    // Returns N bytes aligned to ALIGN, which must be a power of 2 not larger
+    // than alignof(std::max_align_t).
+    // Returns null if the allocation fails.
+    void* allocate(size_t n, size_t align)
+    {
+        assert(align != 0 && (align & (align - 1)) == 0);
+
+        auto const p = reinterpret_cast<uintptr_t>(next_);
+        auto const q = (p + (align - 1)) & ~static_cast<uintptr_t>(align - 1);
+        if (next_ != nullptr && q - p <= static_cast<size_t>(end_ - next_) && n <= static_cast<size_t>(end_ - next_) - (q - p))
+        {
+            next_ += (q - p) + n;
+            return reinterpret_cast<void*>(q);
+        }
+
+        return AllocateSlow(n, align);
+    }
+
+    // Frees all memory allocated from the heap and makes the initial buffer
+    // available again. Invalidates all allocations.
+    void release();
+
+private:
+    void* AllocateSlow(size_t n, size_t align);
+};
+
+// An allocator which allocates from an Arena.
+template <typename T>
+class ArenaAllocator
+{
+    template <typename U> friend class ArenaAllocator;
+
+    Arena* arena_;
+
+public:
+    using value_type = T;
+
+    ArenaAllocator(Arena& arena) noexcept : arena_(&arena) {}
+
+    template <typename U>
+    ArenaAllocator(ArenaAllocator<U> const& other) noexcept : arena_(other.arena_) {}
+
+    // Returns the arena.
+    Arena& arena() const { return *arena_; }
+
+    T* allocate(size_t n)
+    {
+        if (n > SIZE_MAX / sizeof(T))
+            throw std::bad_alloc();
+
+        void* const p = arena_->allocate(n * sizeof(T), alignof(T));
+        if (p == nullptr)
+            throw std::bad_alloc();
+
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* /*p*/, size_t /*n*/) noexcept
+    {
+    }
+
+    template <typename U>
+    bool operator==(ArenaAllocator<U> const& rhs) const noexcept { return arena_ == rhs.arena_; }
+
+    template <typename U>
+    bool operator!=(ArenaAllocator<U> const& rhs) const noexcept { return arena_ != rhs.arena_; }
+};
+
+using ArenaString = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+
+using ArenaStringFormatResult = BasicStringFormatResult<ArenaAllocator<char>>;
+
+// Returns the formatted string, which is allocated from ARENA.
+template <typename ...Args>
+ArenaStringFormatResult string_format(Arena& arena, string_view format, Args const&... args)
+{
+    return fmtxx::string_format(std::allocator_arg, ArenaAllocator<char>(arena), format, args...);
+}
+
+template <typename ...Args>
+ArenaStringFormatResult string_printf(Arena& arena, string_view format, Args const&... args)
+{
+    return fmtxx::string_printf(std::allocator_arg, ArenaAllocator<char>(arena), format, args...);
+}
+
+} // namespace fmtxx
+
+#endif // FMTXX_FORMAT_ARENA_H
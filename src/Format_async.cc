@@ -0,0 +1,302 @@
+// Copyright (c) 2017 Alexander Bolz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "Format_async.h"
+
+#include <chrono>
+#include <new>
+
+using namespace fmtxx;
+using namespace fmtxx::impl;
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+// Records in the ring buffer start at multiples of kBlockSize bytes.
+static constexpr size_t kBlockSize = 16;
+// Minimum size of the ring buffer.
+static constexpr size_t kMinCapacity = 4096;
+// Maximum number of bytes formatted before writing to the FILE.
+static constexpr size_t kMaxBatchSize = 64 * 1024;
+// Marks padding at the end of the ring buffer in AsyncSink::ready_.
+static constexpr uint32_t kPaddingBit = uint32_t{1} << 31;
+
+namespace {
+
+struct RecordHeader
+{
+    Types::value_type types;
+    uint32_t          format_pos;
+    uint32_t          format_len;
+    FormatSyntax      syntax;
+};
+
+} // namespace
+
+// The arguments follow the header.
+static constexpr size_t kArgsPos = (sizeof(RecordHeader) + (alignof(Arg) - 1)) & ~(alignof(Arg) - 1);
+
+static_assert(alignof(Arg) <= kBlockSize, "Internal error: kBlockSize too small");
+
+static size_t RoundUpToBlockSize(size_t n)
+{
+    return (n + (kBlockSize - 1)) & ~(kBlockSize - 1);
+}
+
+static size_t ComputeCapacity(size_t capacity)
+{
+    size_t c = kMinCapacity;
+    while (c < capacity && c < (size_t{1} << 30))
+        c *= 2;
+
+    return c;
+}
+
+fmtxx::AsyncSink::AsyncSink(std::FILE* file, size_t capacity, OverflowPolicy policy)
+    : file_(file)
+    , capacity_(ComputeCapacity(capacity))
+    , policy_(policy)
+    , buf_(new char[capacity_])
+    , ready_(new std::atomic<uint32_t>[capacity_ / kBlockSize])
+    , head_(0)
+    , tail_(0)
+    , written_(0)
+    , dropped_(0)
+    , ec_(0)
+    , sleeping_(false)
+    , flush_waiters_(0)
+{
+    assert(file_ != nullptr);
+
+    for (size_t i = 0; i < capacity_ / kBlockSize; ++i)
+        ready_[i].store(0, std::memory_order_relaxed);
+
+    thread_ = std::thread([this] { Run(); });
+}
+
+fmtxx::AsyncSink::~AsyncSink()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wakeup_.notify_one();
+
+    thread_.join();
+}
+
+void fmtxx::AsyncSink::flush()
+{
+    uint64_t const target = head_.load(std::memory_order_acquire);
+
+    flush_waiters_.fetch_add(1, std::memory_order_seq_cst);
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wakeup_.notify_one();
+        while (written_.load(std::memory_order_acquire) < target)
+            written_cv_.wait_for(lock, std::chrono::milliseconds(10));
+    }
+    flush_waiters_.fetch_sub(1, std::memory_order_relaxed);
+
+    std::fflush(file_);
+}
+
+ErrorCode fmtxx::AsyncSink::submit(FormatSyntax syntax, string_view format, Arg const* args, Types types, size_t const* copy_sizes)
+{
+    size_t num_args = 0;
+    while (types[static_cast<int>(num_args)] != Type::none)
+        ++num_args;
+
+    size_t const payload_pos = kArgsPos + num_args * sizeof(Arg);
+    size_t const format_pos  = payload_pos + ComputeArgPayloadSize(args, types, copy_sizes);
+    size_t const size        = RoundUpToBlockSize(format_pos + format.size());
+
+    if (size > capacity_)
+    {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return ErrorCode::io_error;
+    }
+
+    // Reserve SIZE contiguous bytes. If the record does not fit before the
+    // end of the ring buffer, the rest of the buffer is skipped.
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    size_t   pos;
+    size_t   padding;
+    for (;;)
+    {
+        pos = static_cast<size_t>(head & (capacity_ - 1));
+        padding = (capacity_ - pos < size) ? capacity_ - pos : 0;
+
+        uint64_t const tail = tail_.load(std::memory_order_acquire);
+        if (head + padding + size - tail > capacity_)
+        {
+            if (policy_ == OverflowPolicy::drop)
+            {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return ErrorCode::io_error;
+            }
+
+            WakeConsumer();
+            std::this_thread::yield();
+            head = head_.load(std::memory_order_relaxed);
+            continue;
+        }
+
+        if (head_.compare_exchange_weak(head, head + padding + size, std::memory_order_relaxed))
+            break;
+    }
+
+    if (padding != 0)
+    {
+        ready_[pos / kBlockSize].store(static_cast<uint32_t>(padding) | kPaddingBit, std::memory_order_release);
+        pos = 0;
+    }
+
+    char* const rec = buf_.get() + pos;
+
+    RecordHeader hdr;
+    hdr.types      = types.types;
+    hdr.format_pos = static_cast<uint32_t>(format_pos);
+    hdr.format_len = static_cast<uint32_t>(format.size());
+    hdr.syntax     = syntax;
+    std::memcpy(rec, &hdr, sizeof(RecordHeader));
+
+    CopyArgs(reinterpret_cast<Arg*>(rec + kArgsPos), rec + payload_pos, args, types, copy_sizes);
+    if (format.size() != 0)
+        std::memcpy(rec + format_pos, format.data(), format.size());
+
+    // Publish the record. The seq_cst operations pair with those in Run():
+    // either the producer sees that the consumer is sleeping, or the consumer
+    // sees the new record.
+    ready_[pos / kBlockSize].store(static_cast<uint32_t>(size), std::memory_order_seq_cst);
+    if (sleeping_.load(std::memory_order_seq_cst))
+        WakeConsumer();
+
+    return {};
+}
+
+void fmtxx::AsyncSink::WakeConsumer()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    wakeup_.notify_one();
+}
+
+static ErrorCode FormatRecord(Writer& w, char const* rec)
+{
+    RecordHeader hdr;
+    std::memcpy(&hdr, rec, sizeof(RecordHeader));
+
+    Arg const* const args = reinterpret_cast<Arg const*>(rec + kArgsPos);
+    string_view const format(rec + hdr.format_pos, hdr.format_len);
+
+    if (hdr.syntax == FormatSyntax::printf)
+        return ::fmtxx::impl::DoPrintf(w, format, args, hdr.types);
+    else
+        return ::fmtxx::impl::DoFormat(w, format, args, hdr.types);
+}
+
+// Formats the pending records into BUF and writes them to the FILE.
+// Returns false if there were no pending records.
+bool fmtxx::AsyncSink::ConsumeBatch(MemoryWriterBase& buf)
+{
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    bool progress = false;
+
+    ErrorCode ec = ErrorCode{};
+
+    buf.clear();
+    while (buf.size() < kMaxBatchSize)
+    {
+        size_t const pos = static_cast<size_t>(tail & (capacity_ - 1));
+        std::atomic<uint32_t>& ready = ready_[pos / kBlockSize];
+
+        uint32_t const size = ready.load(std::memory_order_acquire);
+        if (size == 0)
+            break;
+
+        if ((size & kPaddingBit) == 0)
+        {
+            Failed rec_ec = FormatRecord(buf, buf_.get() + pos);
+            if (rec_ec && ec == ErrorCode{})
+                ec = rec_ec;
+        }
+
+        // Release the record.
+        ready.store(0, std::memory_order_relaxed);
+        tail += size & ~kPaddingBit;
+        tail_.store(tail, std::memory_order_release);
+
+        progress = true;
+    }
+
+    if (buf.size() != 0)
+    {
+        FILEWriter w{file_};
+        Failed write_ec = w.write(buf.data(), buf.size());
+        if (write_ec && ec == ErrorCode{})
+            ec = write_ec;
+    }
+
+    if (ec != ErrorCode{})
+    {
+        int expected = 0;
+        ec_.compare_exchange_strong(expected, static_cast<int>(ec), std::memory_order_relaxed);
+    }
+
+    if (progress)
+    {
+        written_.store(tail, std::memory_order_release);
+        if (flush_waiters_.load(std::memory_order_seq_cst) > 0)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            written_cv_.notify_all();
+        }
+    }
+
+    return progress;
+}
+
+void fmtxx::AsyncSink::Run()
+{
+    MemoryWriter<4096> buf;
+
+    for (;;)
+    {
+        if (ConsumeBatch(buf))
+            continue;
+
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        sleeping_.store(true, std::memory_order_seq_cst);
+
+        size_t const pos = static_cast<size_t>(tail_.load(std::memory_order_relaxed) & (capacity_ - 1));
+        bool const pending = ready_[pos / kBlockSize].load(std::memory_order_seq_cst) != 0;
+
+        if (!pending)
+        {
+            if (stop_)
+                break;
+            wakeup_.wait_for(lock, std::chrono::milliseconds(100));
+        }
+
+        sleeping_.store(false, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,126 @@
+// Copyright (c) 2017 Alexander Bolz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef FMTXX_FORMAT_ASYNC_H
+#define FMTXX_FORMAT_ASYNC_H 1
+
+#include "Format.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace fmtxx {
+
+// What to do if the queue of an AsyncSink is full.
+enum struct OverflowPolicy : unsigned char {
+    block, // Wait until the background thread has made room.
+    drop,  // Discard the message and return io_error.
+};
+
+// Formats messages to a FILE on a background thread.
+//
+// The format string and the arguments are copied into a bounded ring buffer
+// (as in ArgStore, arguments of user-defined types must be trivially
+// copyable). Formatting and writing happens on a background thread, which
+// formats all pending messages into a local buffer and writes them to the
+// FILE at once.
+//
+// Submitting a message does not allocate and does not lock a mutex. Any
+// number of threads may submit messages concurrently.
+class AsyncSink
+{
+    std::FILE* const              file_;
+    size_t const                  capacity_;  // Size of the ring buffer in bytes, a power of 2
+    OverflowPolicy const          policy_;
+    std::unique_ptr<char[]>       buf_;       // Ring buffer
+    std::unique_ptr<std::atomic<uint32_t>[]> ready_; // Size of the committed record starting at each block, or 0
+    std::atomic<uint64_t>         head_;      // Total number of bytes reserved by producers
+    std::atomic<uint64_t>         tail_;      // Total number of bytes consumed
+    std::atomic<uint64_t>         written_;   // Total number of bytes consumed and written to the FILE
+    std::atomic<uint64_t>         dropped_;
+    std::atomic<int>              ec_;
+    std::atomic<bool>             sleeping_;
+    std::atomic<int>              flush_waiters_;
+    bool                          stop_ = false; // Protected by mutex_
+    std::mutex                    mutex_;
+    std::condition_variable       wakeup_;
+    std::condition_variable       written_cv_;
+    std::thread                   thread_;
+
+public:
+    // Creates a sink writing to FILE, using a ring buffer of (at least)
+    // CAPACITY bytes, and starts the background thread.
+    explicit AsyncSink(std::FILE* file, size_t capacity = 1 << 20, OverflowPolicy policy = OverflowPolicy::block);
+
+    // Writes all pending messages and stops the background thread.
+    // No messages may be submitted concurrently.
+    ~AsyncSink();
+
+    AsyncSink(AsyncSink const&) = delete;
+    AsyncSink& operator=(AsyncSink const&) = delete;
+
+    // Returns the FILE stream.
+    std::FILE* file() const { return file_; }
+
+    // Waits until all messages submitted so far have been written, then
+    // flushes the FILE.
+    void flush();
+
+    // Returns the number of messages which have been dropped because the queue
+    // was full.
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    // Returns the first error which occurred while formatting or writing a
+    // message on the background thread.
+    ErrorCode ec() const { return static_cast<ErrorCode>(ec_.load(std::memory_order_relaxed)); }
+
+    // Internal.
+    // Copies a message into the queue.
+    // Returns io_error if the message was dropped.
+    ErrorCode submit(FormatSyntax syntax, string_view format, impl::Arg const* args, impl::Types types, size_t const* copy_sizes);
+
+private:
+    void Run();
+    bool ConsumeBatch(MemoryWriterBase& buf);
+    void WakeConsumer();
+};
+
+template <typename ...Args>
+ErrorCode format(AsyncSink& sink, string_view format, Args const&... args)
+{
+    fmtxx::impl::ArgArray<Args...> arr = {args...};
+    size_t const copy_sizes[] = {fmtxx::impl::ArgCopySize<Args>::value..., 0};
+    return sink.submit(FormatSyntax::format, format, arr, fmtxx::impl::MakeTypes<Args...>::value, copy_sizes);
+}
+
+template <typename ...Args>
+ErrorCode printf(AsyncSink& sink, string_view format, Args const&... args)
+{
+    fmtxx::impl::ArgArray<Args...> arr = {args...};
+    size_t const copy_sizes[] = {fmtxx::impl::ArgCopySize<Args>::value..., 0};
+    return sink.submit(FormatSyntax::printf, format, arr, fmtxx::impl::MakeTypes<Args...>::value, copy_sizes);
+}
+
+} // namespace fmtxx
+
+#endif // FMTXX_FORMAT_ASYNC_H
@@ -0,0 +1,560 @@
+// Copyright (c) 2017 Alexander Bolz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "Format_binary.h"
+
+using namespace fmtxx;
+using namespace fmtxx::impl;
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+// The stream starts with kMagic, followed by the version number.
+static constexpr char const kMagic[8] = {'f', 'm', 't', 'x', 'x', 'b', 'i', 'n'};
+static constexpr unsigned char kVersion = 1;
+
+enum : unsigned char {
+    kTagFormat  = 1, // id, syntax, length, text
+    kTagMessage = 2, // id, types, arguments
+};
+
+enum : unsigned char {
+    kFlagHash = 1,
+    kFlagZero = 2,
+};
+
+static uint64_t ZigZagEncode(int64_t n)
+{
+    return (static_cast<uint64_t>(n) << 1) ^ static_cast<uint64_t>(n >> 63);
+}
+
+static int64_t ZigZagDecode(uint64_t n)
+{
+    return static_cast<int64_t>(n >> 1) ^ -static_cast<int64_t>(n & 1);
+}
+
+static ErrorCode PutVarint(Writer& w, uint64_t n)
+{
+    char buf[10];
+    size_t len = 0;
+    while (n >= 0x80)
+    {
+        buf[len++] = static_cast<char>(n | 0x80);
+        n >>= 7;
+    }
+    buf[len++] = static_cast<char>(n);
+
+    return w.write(buf, len);
+}
+
+static ErrorCode PutByte(Writer& w, unsigned char b)
+{
+    return w.put(static_cast<char>(b));
+}
+
+static ErrorCode PutBytes(Writer& w, char const* str, size_t len)
+{
+    if (Failed ec = PutVarint(w, len))
+        return ec;
+
+    return w.write(str, len);
+}
+
+static ErrorCode PutDouble(Writer& w, double d)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &d, sizeof(double));
+
+    char buf[8];
+    for (int i = 0; i < 8; ++i)
+        buf[i] = static_cast<char>(bits >> (8 * i));
+
+    return w.write(buf, 8);
+}
+
+static ErrorCode PutFloat(Writer& w, float f)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(float));
+
+    char buf[4];
+    for (int i = 0; i < 4; ++i)
+        buf[i] = static_cast<char>(bits >> (8 * i));
+
+    return w.write(buf, 4);
+}
+
+static ErrorCode PutFormatSpec(Writer& w, FormatSpec const& spec)
+{
+    unsigned char const flags = static_cast<unsigned char>((spec.hash ? kFlagHash : 0) | (spec.zero ? kFlagZero : 0));
+
+    if (Failed ec = PutVarint(w, ZigZagEncode(spec.width)))
+        return ec;
+    if (Failed ec = PutVarint(w, ZigZagEncode(spec.prec)))
+        return ec;
+
+    char const buf[] = {
+        spec.fill,
+        static_cast<char>(spec.align),
+        static_cast<char>(spec.sign),
+        static_cast<char>(flags),
+        spec.tsep,
+        spec.conv,
+    };
+    if (Failed ec = w.write(buf, sizeof(buf)))
+        return ec;
+
+    return PutBytes(w, spec.style.data(), spec.style.size());
+}
+
+static ErrorCode PutArg(Writer& w, Arg const& arg, Type type)
+{
+    switch (type)
+    {
+    case Type::none:
+    case Type::last:
+    case Type::other:
+        break;
+    case Type::formatspec:
+        return PutFormatSpec(w, *static_cast<FormatSpec const*>(arg.pvoid));
+    case Type::string:
+        return PutBytes(w, arg.string.data, arg.string.size);
+    case Type::pchar:
+        // 0 = nullptr, otherwise the length + 1.
+        if (arg.pchar == nullptr)
+            return PutVarint(w, 0);
+        {
+            size_t const len = ::strlen(arg.pchar);
+            if (Failed ec = PutVarint(w, len + 1))
+                return ec;
+            return w.write(arg.pchar, len);
+        }
+    case Type::pvoid:
+        return PutVarint(w, reinterpret_cast<uintptr_t>(arg.pvoid));
+    case Type::bool_:
+        return PutByte(w, arg.bool_ ? 1 : 0);
+    case Type::char_:
+        return w.put(arg.char_);
+    case Type::schar:
+        return PutVarint(w, ZigZagEncode(arg.schar));
+    case Type::sshort:
+        return PutVarint(w, ZigZagEncode(arg.sshort));
+    case Type::sint:
+        return PutVarint(w, ZigZagEncode(arg.sint));
+    case Type::slonglong:
+        return PutVarint(w, ZigZagEncode(arg.slonglong));
+    case Type::ulonglong:
+        return PutVarint(w, arg.ulonglong);
+    case Type::double_:
+        return PutDouble(w, arg.double_);
+    case Type::float_:
+        return PutFloat(w, arg.float_);
+    }
+
+    assert(false && "internal error");
+    return ErrorCode::invalid_argument;
+}
+
+size_t fmtxx::BinaryWriter::Hash::operator()(string_view str) const noexcept
+{
+    // FNV-1a
+    uint64_t h = 14695981039346656037u;
+    for (char c : str)
+    {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211u;
+    }
+
+    return static_cast<size_t>(h);
+}
+
+ErrorCode fmtxx::BinaryWriter::GetFormatId(uint32_t& id, FormatSyntax syntax, string_view format)
+{
+    IdMap& ids = ids_[syntax == FormatSyntax::printf ? 1 : 0];
+
+    auto const I = ids.find(format);
+    if (I != ids.end())
+    {
+        id = I->second;
+        return {};
+    }
+
+    // First use of this format string: write its definition.
+    MemoryWriter<> rec;
+    if (!header_written_)
+    {
+        rec.write(kMagic, sizeof(kMagic));
+        PutByte(rec, kVersion);
+    }
+    PutByte(rec, kTagFormat);
+    PutVarint(rec, next_id_);
+    PutByte(rec, static_cast<unsigned char>(syntax));
+    if (Failed ec = PutBytes(rec, format.data(), format.size()))
+        return ec;
+
+    if (Failed ec = out_.write(rec.data(), rec.size()))
+        return ec;
+
+    header_written_ = true;
+
+    formats_.emplace_back(format.data(), format.size());
+    std::string const& key = formats_.back();
+
+    id = next_id_++;
+    ids.emplace(string_view(key.data(), key.size()), id);
+
+    return {};
+}
+
+ErrorCode fmtxx::BinaryWriter::write_record(FormatSyntax syntax, string_view format, Arg const* args, Types types)
+{
+    uint32_t id = 0;
+    if (Failed ec = GetFormatId(id, syntax, format))
+        return ec;
+
+    // Arguments of user-defined types are recorded as strings.
+    Types::value_type record_types = 0;
+    for (int i = 0; types[i] != Type::none; ++i)
+    {
+        Type const t = (types[i] == Type::other) ? Type::string : types[i];
+        record_types |= static_cast<Types::value_type>(t) << (Types::kBitsPerArg * i);
+    }
+
+    MemoryWriter<> rec;
+    PutByte(rec, kTagMessage);
+    PutVarint(rec, id);
+    PutVarint(rec, record_types);
+
+    for (int i = 0; types[i] != Type::none; ++i)
+    {
+        Type const t = types[i];
+        if (t == Type::other)
+        {
+            MemoryWriter<> str;
+            if (Failed ec = args[i].other.func(str, FormatSpec{}, args[i].other.value))
+                return ec;
+            if (Failed ec = PutBytes(rec, str.data(), str.size()))
+                return ec;
+        }
+        else
+        {
+            if (Failed ec = PutArg(rec, args[i], t))
+                return ec;
+        }
+    }
+
+    return out_.write(rec.data(), rec.size());
+}
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+namespace {
+
+// Reads from [next, end). Sets incomplete if the input ends prematurely.
+struct Reader
+{
+    char const* next;
+    char const* end;
+    bool        incomplete = false;
+
+    Reader(char const* first, char const* last) : next(first), end(last) {}
+
+    bool ReadByte(unsigned char& b)
+    {
+        if (next == end)
+        {
+            incomplete = true;
+            return false;
+        }
+
+        b = static_cast<unsigned char>(*next++);
+        return true;
+    }
+
+    // Returns false if the input is incomplete or invalid.
+    bool ReadVarint(uint64_t& n)
+    {
+        n = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            unsigned char b;
+            if (!ReadByte(b))
+                return false;
+            n |= static_cast<uint64_t>(b & 0x7F) << shift;
+            if ((b & 0x80) == 0)
+                return true;
+        }
+
+        return false; // Too long.
+    }
+
+    bool ReadBytes(char const*& str, size_t len)
+    {
+        if (static_cast<size_t>(end - next) < len)
+        {
+            incomplete = true;
+            return false;
+        }
+
+        str = next;
+        next += len;
+        return true;
+    }
+
+    bool ReadString(char const*& str, size_t& len)
+    {
+        uint64_t n;
+        if (!ReadVarint(n))
+            return false;
+        if (n > static_cast<size_t>(-1))
+            return false;
+
+        len = static_cast<size_t>(n);
+        return ReadBytes(str, len);
+    }
+
+    bool ReadDouble(double& d)
+    {
+        char const* p;
+        if (!ReadBytes(p, 8))
+            return false;
+
+        uint64_t bits = 0;
+        for (int i = 0; i < 8; ++i)
+            bits |= static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+
+        std::memcpy(&d, &bits, sizeof(double));
+        return true;
+    }
+
+    bool ReadFloat(float& f)
+    {
+        char const* p;
+        if (!ReadBytes(p, 4))
+            return false;
+
+        uint32_t bits = 0;
+        for (int i = 0; i < 4; ++i)
+            bits |= static_cast<uint32_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+
+        std::memcpy(&f, &bits, sizeof(float));
+        return true;
+    }
+
+    bool ReadFormatSpec(FormatSpec& spec)
+    {
+        uint64_t width;
+        uint64_t prec;
+        char const* p;
+        char const* style;
+        size_t style_len;
+
+        if (!ReadVarint(width) || !ReadVarint(prec) || !ReadBytes(p, 6) || !ReadString(style, style_len))
+            return false;
+
+        spec.width = static_cast<int>(ZigZagDecode(width));
+        spec.prec  = static_cast<int>(ZigZagDecode(prec));
+        spec.fill  = p[0];
+        spec.align = static_cast<Align>(p[1]);
+        spec.sign  = static_cast<Sign>(p[2]);
+        spec.hash  = (p[3] & kFlagHash) != 0;
+        spec.zero  = (p[3] & kFlagZero) != 0;
+        spec.tsep  = p[4];
+        spec.conv  = p[5];
+        spec.style = string_view(style, style_len);
+        return true;
+    }
+
+    // PCHAR_BUF is used to null-terminate C-strings.
+    bool ReadArg(Arg& arg, Type type, FormatSpec& spec, std::string& pchar_buf)
+    {
+        uint64_t n;
+        unsigned char b;
+        switch (type)
+        {
+        case Type::none:
+        case Type::last:
+        case Type::other:
+            return false;
+        case Type::formatspec:
+            if (!ReadFormatSpec(spec))
+                return false;
+            arg.pvoid = &spec;
+            return true;
+        case Type::string:
+            return ReadString(arg.string.data, arg.string.size);
+        case Type::pchar:
+            if (!ReadVarint(n))
+                return false;
+            if (n == 0)
+            {
+                arg.pchar = nullptr;
+                return true;
+            }
+            {
+                char const* str;
+                if (n - 1 > static_cast<size_t>(-1) || !ReadBytes(str, static_cast<size_t>(n - 1)))
+                    return false;
+                pchar_buf.assign(str, static_cast<size_t>(n - 1));
+                arg.pchar = pchar_buf.c_str();
+            }
+            return true;
+        case Type::pvoid:
+            if (!ReadVarint(n))
+                return false;
+            arg.pvoid = reinterpret_cast<void const*>(static_cast<uintptr_t>(n));
+            return true;
+        case Type::bool_:
+            if (!ReadByte(b))
+                return false;
+            arg.bool_ = (b != 0);
+            return true;
+        case Type::char_:
+            if (!ReadByte(b))
+                return false;
+            arg.char_ = static_cast<char>(b);
+            return true;
+        case Type::schar:
+            if (!ReadVarint(n))
+                return false;
+            arg.schar = static_cast<signed char>(ZigZagDecode(n));
+            return true;
+        case Type::sshort:
+            if (!ReadVarint(n))
+                return false;
+            arg.sshort = static_cast<signed short>(ZigZagDecode(n));
+            return true;
+        case Type::sint:
+            if (!ReadVarint(n))
+                return false;
+            arg.sint = static_cast<signed int>(ZigZagDecode(n));
+            return true;
+        case Type::slonglong:
+            if (!ReadVarint(n))
+                return false;
+            arg.slonglong = ZigZagDecode(n);
+            return true;
+        case Type::ulonglong:
+            return ReadVarint(n) && (arg.ulonglong = n, true);
+        case Type::double_:
+            return ReadDouble(arg.double_);
+        case Type::float_:
+            return ReadFloat(arg.float_);
+        }
+
+        return false;
+    }
+};
+
+} // namespace
+
+// Returns whether TYPES describes a valid argument list: known types only,
+// and no arguments following the first Type::none.
+static bool IsValidTypes(uint64_t types)
+{
+    for ( ; types != 0; types >>= Types::kBitsPerArg)
+    {
+        Type const t = static_cast<Type>(types & Types::kTypeMask);
+        if (t == Type::none || t >= Type::last)
+            return false;
+    }
+
+    return true;
+}
+
+ErrorCode fmtxx::BinaryDecoder::decode(Writer& w, char const* data, size_t size, size_t& consumed)
+{
+    consumed = 0;
+
+    ErrorCode result = ErrorCode{};
+
+    Reader r{data, data + size};
+
+    if (!header_read_)
+    {
+        char const* magic;
+        unsigned char version;
+        if (!r.ReadBytes(magic, sizeof(kMagic)) || !r.ReadByte(version))
+            return r.incomplete ? ErrorCode{} : ErrorCode::invalid_argument;
+        if (std::memcmp(magic, kMagic, sizeof(kMagic)) != 0 || version != kVersion)
+            return ErrorCode::invalid_argument;
+
+        header_read_ = true;
+        consumed = static_cast<size_t>(r.next - data);
+    }
+
+    // Storage for the decoded FormatSpec's and C-strings of a single record.
+    FormatSpec  specs[Types::kMaxArgs];
+    std::string pchars[Types::kMaxArgs];
+    Arg         args[Types::kMaxArgs];
+
+    while (r.next != r.end)
+    {
+        unsigned char tag;
+        uint64_t id;
+        if (!r.ReadByte(tag) || !r.ReadVarint(id))
+            return r.incomplete ? result : ErrorCode::invalid_argument;
+
+        if (tag == kTagFormat)
+        {
+            unsigned char syntax;
+            char const* text;
+            size_t len;
+            if (!r.ReadByte(syntax) || !r.ReadString(text, len))
+                return r.incomplete ? result : ErrorCode::invalid_argument;
+            if (id != formats_.size() || syntax > static_cast<unsigned char>(FormatSyntax::printf))
+                return ErrorCode::invalid_argument;
+
+            formats_.push_back({static_cast<FormatSyntax>(syntax), std::string(text, len)});
+        }
+        else if (tag == kTagMessage)
+        {
+            uint64_t types;
+            if (!r.ReadVarint(types))
+                return r.incomplete ? result : ErrorCode::invalid_argument;
+            if (id >= formats_.size() || !IsValidTypes(types))
+                return ErrorCode::invalid_argument;
+
+            bool ok = true;
+            for (int i = 0; ok && Types(types)[i] != Type::none; ++i)
+                ok = r.ReadArg(args[i], Types(types)[i], specs[i], pchars[i]);
+            if (!ok)
+                return r.incomplete ? result : ErrorCode::invalid_argument;
+
+            FormatString const& f = formats_[static_cast<size_t>(id)];
+            Failed ec = (f.syntax == FormatSyntax::printf)
+                ? ::fmtxx::impl::DoPrintf(w, f.text, args, types)
+                : ::fmtxx::impl::DoFormat(w, f.text, args, types);
+            if (ec && result == ErrorCode{})
+                result = ec;
+        }
+        else
+        {
+            return ErrorCode::invalid_argument;
+        }
+
+        consumed = static_cast<size_t>(r.next - data);
+    }
+
+    return result;
+}
@@ -0,0 +1,121 @@
+// Copyright (c) 2017 Alexander Bolz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef FMTXX_FORMAT_BINARY_H
+#define FMTXX_FORMAT_BINARY_H 1
+
+#include "Format.h"
+
+#include <deque>
+#include <unordered_map>
+
+namespace fmtxx {
+
+// Records format calls in a compact binary encoding instead of formatting them.
+//
+// Each distinct format string is written once and is referenced by an
+// identifier in the following records. A record contains the argument types
+// and the raw argument values (integers are varint-encoded), so recording a
+// format call does not run any of the number conversions. Use BinaryDecoder
+// (or the fmtxx-decode tool) to replay the records and produce the text.
+//
+// Arguments of user-defined types (which are formatted using FormatValue<T>)
+// are formatted eagerly, using a default-constructed FormatSpec, and are
+// recorded as strings. The format-spec from the format string is applied to
+// the resulting string when the record is decoded.
+//
+// A BinaryWriter is not thread-safe.
+class BinaryWriter
+{
+    struct Hash {
+        size_t operator()(string_view str) const noexcept;
+    };
+    struct Equal {
+        bool operator()(string_view lhs, string_view rhs) const noexcept {
+            return lhs.size() == rhs.size() && std::memcmp(lhs.data(), rhs.data(), lhs.size()) == 0;
+        }
+    };
+
+    using IdMap = std::unordered_map<string_view, uint32_t, Hash, Equal>;
+
+    Writer&                 out_;
+    std::deque<std::string> formats_;  // Owns the keys of ids_
+    IdMap                   ids_[2];   // For each FormatSyntax
+    uint32_t                next_id_ = 0;
+    bool                    header_written_ = false;
+
+public:
+    // Writes the binary records to OUT.
+    explicit BinaryWriter(Writer& out) : out_(out) {}
+
+    BinaryWriter(BinaryWriter const&) = delete;
+    BinaryWriter& operator=(BinaryWriter const&) = delete;
+
+    // Returns the underlying Writer.
+    Writer& out() const { return out_; }
+
+    // Internal.
+    // Writes a record for the format call.
+    ErrorCode write_record(FormatSyntax syntax, string_view format, impl::Arg const* args, impl::Types types);
+
+private:
+    ErrorCode GetFormatId(uint32_t& id, FormatSyntax syntax, string_view format);
+};
+
+// Replays the records written by a BinaryWriter.
+class BinaryDecoder
+{
+    struct FormatString {
+        FormatSyntax syntax;
+        std::string  text;
+    };
+
+    std::vector<FormatString> formats_;
+    bool header_read_ = false;
+
+public:
+    // Decodes the records in [DATA, DATA + SIZE) and writes the formatted text
+    // to W. Stores the number of bytes consumed in CONSUMED; an incomplete
+    // record at the end of the input is not consumed and must be passed again,
+    // followed by more data.
+    //
+    // Returns invalid_argument if the input is not a valid binary log.
+    // Errors from formatting a record are returned after all records have been
+    // decoded (the first such error is returned).
+    ErrorCode decode(Writer& w, char const* data, size_t size, size_t& consumed);
+};
+
+template <typename ...Args>
+ErrorCode format(BinaryWriter& w, string_view format, Args const&... args)
+{
+    fmtxx::impl::ArgArray<Args...> arr = {args...};
+    return w.write_record(FormatSyntax::format, format, arr, fmtxx::impl::MakeTypes<Args...>::value);
+}
+
+template <typename ...Args>
+ErrorCode printf(BinaryWriter& w, string_view format, Args const&... args)
+{
+    fmtxx::impl::ArgArray<Args...> arr = {args...};
+    return w.write_record(FormatSyntax::printf, format, arr, fmtxx::impl::MakeTypes<Args...>::value);
+}
+
+} // namespace fmtxx
+
+#endif // FMTXX_FORMAT_BINARY_H
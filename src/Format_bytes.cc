@@ -0,0 +1,414 @@
+// Copyright (c) 2017 Alexander Bolz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "Format_bytes.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+// Select the instruction set used to convert bytes into hexadecimal digits.
+// Define FMTXX_NO_SIMD to always use the scalar loop.
+#if !defined(FMTXX_NO_SIMD)
+#if defined(__AVX2__)
+#define FMTXX_SIMD_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#define FMTXX_SIMD_SSSE3 1
+#include <tmmintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FMTXX_SIMD_SSE2 1
+#include <emmintrin.h>
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && (defined(__aarch64__) || defined(_M_ARM64))
+#define FMTXX_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+#endif
+
+using namespace fmtxx;
+using namespace fmtxx::impl;
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+static char const kLowerHexDigits[] = "0123456789abcdef";
+static char const kUpperHexDigits[] = "0123456789ABCDEF";
+
+// Converts the N bytes starting at SRC into 2*N hexadecimal digits, using the
+// 16 characters in DIGITS.
+//
+// The vectorized versions split each byte into its two nibbles, map the
+// nibbles to digits with a table lookup (pshufb/tbl) or, with SSE2 only, with
+// a compare and add, and interleave the results.
+static void BytesToHex(char* dst, unsigned char const* src, size_t n, char const* digits)
+{
+#if FMTXX_SIMD_AVX2
+    {
+        __m256i const table = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<__m128i const*>(digits)));
+        __m256i const mask = _mm256_set1_epi8(0x0F);
+        for ( ; n >= 32; n -= 32, src += 32, dst += 64)
+        {
+            __m256i const v  = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(src));
+            __m256i const hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+            __m256i const lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, mask));
+            // Interleaving works per 128-bit lane:
+            // r0 = [bytes 0-7, bytes 16-23], r1 = [bytes 8-15, bytes 24-31]
+            __m256i const r0 = _mm256_unpacklo_epi8(hi, lo);
+            __m256i const r1 = _mm256_unpackhi_epi8(hi, lo);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst),      _mm256_permute2x128_si256(r0, r1, 0x20));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 32), _mm256_permute2x128_si256(r0, r1, 0x31));
+        }
+    }
+#endif
+#if FMTXX_SIMD_AVX2 || FMTXX_SIMD_SSSE3
+    {
+        __m128i const table = _mm_loadu_si128(reinterpret_cast<__m128i const*>(digits));
+        __m128i const mask = _mm_set1_epi8(0x0F);
+        for ( ; n >= 16; n -= 16, src += 16, dst += 32)
+        {
+            __m128i const v  = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src));
+            __m128i const hi = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+            __m128i const lo = _mm_shuffle_epi8(table, _mm_and_si128(v, mask));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst),      _mm_unpacklo_epi8(hi, lo));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), _mm_unpackhi_epi8(hi, lo));
+        }
+    }
+#elif FMTXX_SIMD_SSE2
+    {
+        // digit = nibble + '0' + (nibble > 9 ? digits[10] - '0' - 10 : 0)
+        __m128i const mask  = _mm_set1_epi8(0x0F);
+        __m128i const nine  = _mm_set1_epi8(9);
+        __m128i const zero  = _mm_set1_epi8('0');
+        __m128i const alpha = _mm_set1_epi8(static_cast<char>(digits[10] - '0' - 10));
+        for ( ; n >= 16; n -= 16, src += 16, dst += 32)
+        {
+            __m128i const v   = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src));
+            __m128i const nhi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+            __m128i const nlo = _mm_and_si128(v, mask);
+            __m128i const hi  = _mm_add_epi8(_mm_add_epi8(nhi, zero), _mm_and_si128(_mm_cmpgt_epi8(nhi, nine), alpha));
+            __m128i const lo  = _mm_add_epi8(_mm_add_epi8(nlo, zero), _mm_and_si128(_mm_cmpgt_epi8(nlo, nine), alpha));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst),      _mm_unpacklo_epi8(hi, lo));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), _mm_unpackhi_epi8(hi, lo));
+        }
+    }
+#elif FMTXX_SIMD_NEON
+    {
+        uint8x16_t const table = vld1q_u8(reinterpret_cast<uint8_t const*>(digits));
+        uint8x16_t const mask = vdupq_n_u8(0x0F);
+        for ( ; n >= 16; n -= 16, src += 16, dst += 32)
+        {
+            uint8x16_t const v = vld1q_u8(src);
+            uint8x16x2_t r;
+            r.val[0] = vqtbl1q_u8(table, vshrq_n_u8(v, 4));
+            r.val[1] = vqtbl1q_u8(table, vandq_u8(v, mask));
+            vst2q_u8(reinterpret_cast<uint8_t*>(dst), r); // Interleaving store
+        }
+    }
+#endif
+
+    for ( ; n != 0; --n, ++src, dst += 2)
+    {
+        dst[0] = digits[*src >> 4];
+        dst[1] = digits[*src & 0x0F];
+    }
+}
+
+namespace {
+
+// Collects small pieces of output and passes them to the writer in blocks.
+class BlockBuffer
+{
+public:
+    static constexpr size_t kSize = 1024;
+
+private:
+    Writer& w_;
+    size_t  len_ = 0;
+    char    buf_[kSize];
+
+public:
+    explicit BlockBuffer(Writer& w) : w_(w) {}
+
+    // Appends N (<= kSize) uninitialized characters and returns a pointer to
+    // the first one. Returns null on error.
+    char* reserve(size_t n, ErrorCode& ec)
+    {
+        assert(n <= kSize);
+        if (kSize - len_ < n)
+        {
+            if (Failed(ec = flush()))
+                return nullptr;
+        }
+        char* const p = buf_ + len_;
+        len_ += n;
+        return p;
+    }
+
+    // Removes the last N characters.
+    void shrink(size_t n)
+    {
+        assert(n <= len_);
+        len_ -= n;
+    }
+
+    ErrorCode append(char const* str, size_t n)
+    {
+        if (kSize - len_ < n)
+        {
+            if (Failed ec = flush())
+                return ec;
+            if (n > kSize)
+                return w_.write(str, n);
+        }
+        std::memcpy(buf_ + len_, str, n);
+        len_ += n;
+        return {};
+    }
+
+    ErrorCode flush()
+    {
+        size_t const n = len_;
+        len_ = 0;
+        return w_.write(buf_, n);
+    }
+};
+
+} // namespace
+
+// The number of bytes converted at once.
+static constexpr size_t kBlockBytes = 256;
+
+// Longer separators are written piecewise.
+static constexpr size_t kMaxInlineSeparator = 16;
+
+static ErrorCode FormatHex(Writer& w, FormatSpec const& spec, unsigned char const* data, size_t size, char const* digits)
+{
+    bool const grouped = !spec.style.empty() || spec.prec > 0;
+
+    string_view const sep = spec.style.empty() ? string_view(" ") : spec.style;
+    size_t const group = spec.prec > 0 ? static_cast<size_t>(spec.prec) : 1;
+
+    size_t len = 2 * size;
+    if (grouped && size > 0)
+        len += sep.size() * ((size - 1) / group);
+
+    size_t pad_left = 0;
+    size_t pad_right = 0;
+    if (spec.width > 0 && static_cast<size_t>(spec.width) > len)
+    {
+        size_t const d = static_cast<size_t>(spec.width) - len;
+        switch (spec.align)
+        {
+        case Align::left:
+            pad_right = d;
+            break;
+        case Align::center:
+            pad_left = d / 2;
+            pad_right = d - d / 2;
+            break;
+        default:
+            pad_left = d;
+            break;
+        }
+    }
+
+    if (Failed ec = w.pad(spec.fill, pad_left))
+        return ec;
+
+    if (!grouped)
+    {
+        char hex[2 * kBlockBytes];
+        for (size_t i = 0; i < size; i += kBlockBytes)
+        {
+            size_t const n = std::min(kBlockBytes, size - i);
+            BytesToHex(hex, data + i, n, digits);
+            if (Failed ec = w.write(hex, 2 * n))
+                return ec;
+        }
+    }
+    else if (sep.size() <= kMaxInlineSeparator)
+    {
+        BlockBuffer out{w};
+        ErrorCode ec;
+
+        // Each byte produces at most 2 + sep.size() characters.
+        size_t const chunk = std::min(kBlockBytes, BlockBuffer::kSize / (2 + sep.size()));
+
+        char hex[2 * kBlockBytes];
+        size_t in_group = 0; // Number of bytes printed in the current group
+        for (size_t i = 0; i < size; i += chunk)
+        {
+            size_t const n = std::min(chunk, size - i);
+            BytesToHex(hex, data + i, n, digits);
+
+            size_t const reserved = n * (2 + sep.size());
+            char* const first = out.reserve(reserved, ec);
+            if (first == nullptr)
+                return ec;
+
+            char* dst = first;
+            for (size_t j = 0; j < n; ++j)
+            {
+                if (in_group == group)
+                {
+                    for (char const c : sep)
+                        *dst++ = c;
+                    in_group = 0;
+                }
+                dst[0] = hex[2 * j + 0];
+                dst[1] = hex[2 * j + 1];
+                dst += 2;
+                ++in_group;
+            }
+
+            out.shrink(reserved - static_cast<size_t>(dst - first));
+        }
+
+        if (Failed(ec = out.flush()))
+            return ec;
+    }
+    else
+    {
+        BlockBuffer out{w};
+
+        char hex[2 * kBlockBytes];
+        size_t in_group = 0; // Number of bytes printed in the current group
+        for (size_t i = 0; i < size; i += kBlockBytes)
+        {
+            size_t const n = std::min(kBlockBytes, size - i);
+            BytesToHex(hex, data + i, n, digits);
+
+            char const* p = hex;
+            for (size_t left = n; left != 0; )
+            {
+                if (in_group == group)
+                {
+                    if (Failed ec = out.append(sep.data(), sep.size()))
+                        return ec;
+                    in_group = 0;
+                }
+
+                size_t const k = std::min(left, group - in_group);
+                if (Failed ec = out.append(p, 2 * k))
+                    return ec;
+                p += 2 * k;
+                left -= k;
+                in_group += k;
+            }
+        }
+
+        if (Failed ec = out.flush())
+            return ec;
+    }
+
+    return w.pad(spec.fill, pad_right);
+}
+
+// Formats OFFSET as (at least) 8 hexadecimal digits.
+static size_t FormatOffset(char* dst, uint64_t offset)
+{
+    size_t n = 8;
+    while (n < 16 && (offset >> (4 * n)) != 0)
+        ++n;
+
+    for (size_t i = n; i != 0; --i)
+    {
+        dst[i - 1] = kLowerHexDigits[offset & 0x0F];
+        offset >>= 4;
+    }
+
+    return n;
+}
+
+static ErrorCode FormatHexdump(Writer& w, unsigned char const* data, size_t size)
+{
+    // "00000000  48 65 6c 6c 6f 2c 20 77  6f 72 6c 64 21 0a 00 01  |Hello, world!...|\n"
+    static constexpr size_t kHexColumn   = 2;  // Relative to the end of the offset
+    static constexpr size_t kAsciiColumn = 52; // Relative to the end of the offset
+    static constexpr size_t kMaxLineLength = 16 + kAsciiColumn + 1 + 16 + 2;
+
+    if (size == 0)
+        return {};
+
+    BlockBuffer out{w};
+    ErrorCode ec;
+
+    for (size_t i = 0; i < size; i += 16)
+    {
+        size_t const n = std::min(size_t{16}, size - i);
+
+        char* const line = out.reserve(kMaxLineLength, ec);
+        if (line == nullptr)
+            return ec;
+
+        size_t const noffset = FormatOffset(line, i);
+        char* const p = line + noffset;
+        std::memset(p, ' ', kAsciiColumn);
+
+        char hex[32];
+        BytesToHex(hex, data + i, n, kLowerHexDigits);
+        for (size_t j = 0; j < n; ++j)
+        {
+            char* const q = p + kHexColumn + 3 * j + (j >= 8 ? 1 : 0);
+            q[0] = hex[2 * j + 0];
+            q[1] = hex[2 * j + 1];
+        }
+
+        char* a = p + kAsciiColumn;
+        *a++ = '|';
+        for (size_t j = 0; j < n; ++j)
+        {
+            unsigned char const c = data[i + j];
+            *a++ = static_cast<unsigned>(c - 0x20) < 0x5F ? static_cast<char>(c) : '.';
+        }
+        *a++ = '|';
+        *a++ = '\n';
+
+        // Give back the unused part of the line.
+        out.shrink(kMaxLineLength - static_cast<size_t>(a - line));
+    }
+
+    char* const last = out.reserve(16 + 1, ec);
+    if (last == nullptr)
+        return ec;
+
+    size_t const noffset = FormatOffset(last, size);
+    last[noffset] = '\n';
+    out.shrink(16 - noffset);
+
+    return out.flush();
+}
+
+ErrorCode fmtxx::impl::FormatBytes(Writer& w, FormatSpec const& spec, unsigned char const* data, size_t size)
+{
+    switch (spec.conv)
+    {
+    case 'C':
+        return FormatHexdump(w, data, size);
+    case 'X':
+        return FormatHex(w, spec, data, size, kUpperHexDigits);
+    case '\0':
+    case 'x':
+        return FormatHex(w, spec, data, size, kLowerHexDigits);
+    default:
+        return ErrorCode::invalid_format_string;
+    }
+}
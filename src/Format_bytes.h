@@ -0,0 +1,87 @@
+// Copyright (c) 2017 Alexander Bolz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef FMTXX_FORMAT_BYTES_H
+#define FMTXX_FORMAT_BYTES_H 1
+
+#include "Format.h"
+
+namespace fmtxx {
+
+// A byte buffer, formatted as hexadecimal digits.
+//
+// Conversions:
+//
+//  'x' (default), 'X'
+//      Lower-case or upper-case hexadecimal digits, two per byte ("deadbeef").
+//      If a style is given, it is inserted between groups of bytes. The
+//      precision specifies the number of bytes per group (default 1), and if
+//      only a precision is given, the groups are separated by ' '. E.g.,
+//      "{!':'}" => "de:ad:be:ef", "{:.2X}" => "DEAD BEEF".
+//      Width, fill and alignment apply to the complete output.
+//
+//  'C'
+//      The canonical hex+ASCII layout of "hexdump -C": 16 bytes per line,
+//      preceded by the offset and followed by the printable characters, and
+//      terminated by a line containing the total size. Identical lines are not
+//      collapsed into '*' (as with "hexdump -C -v"). An empty buffer produces
+//      no output.
+//
+// Other conversions are rejected with invalid_format_string.
+//
+// The buffer is converted in blocks, it is never copied or formatted into a
+// temporary buffer as a whole.
+struct Bytes
+{
+    unsigned char const* data = nullptr;
+    size_t size = 0;
+};
+
+inline Bytes bytes(void const* data, size_t size)
+{
+    Bytes b;
+    b.data = static_cast<unsigned char const*>(data);
+    b.size = size;
+    return b;
+}
+
+inline Bytes bytes(string_view str)
+{
+    return bytes(str.data(), str.size());
+}
+
+namespace impl {
+
+ErrorCode FormatBytes(Writer& w, FormatSpec const& spec, unsigned char const* data, size_t size);
+
+} // namespace fmtxx::impl
+
+template <>
+struct FormatValue<Bytes>
+{
+    ErrorCode operator()(Writer& w, FormatSpec const& spec, Bytes const& value) const
+    {
+        return impl::FormatBytes(w, spec, value.data, value.size);
+    }
+};
+
+} // namespace fmtxx
+
+#endif // FMTXX_FORMAT_BYTES_H
@@ -0,0 +1,683 @@
+// Copyright (c) 2017 Alexander Bolz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "Format_chrono.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace fmtxx;
+using namespace fmtxx::impl;
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+static int64_t FloorDiv(int64_t x, int64_t y)
+{
+    int64_t const q = x / y;
+    return (x % y != 0 && (x < 0) != (y < 0)) ? q - 1 : q;
+}
+
+// Returns the number of days since 1970-01-01.
+// See http://howardhinnant.github.io/date_algorithms.html
+static int64_t DaysFromCivil(int64_t y, int m, int d)
+{
+    y -= m <= 2;
+    int64_t const era = FloorDiv(y, 400);
+    int64_t const yoe = y - era * 400;                                  // [0, 399]
+    int64_t const doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1; // [0, 365]
+    int64_t const doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;          // [0, 146096]
+    return era * 146097 + doe - 719468;
+}
+
+namespace {
+
+struct CivilTime
+{
+    int64_t unix_seconds = 0; // For %s
+    int64_t year = 0;
+    int     month = 0;  // [1, 12]
+    int     day = 0;    // [1, 31]
+    int     hour = 0;   // [0, 23]
+    int     minute = 0; // [0, 59]
+    int     second = 0; // [0, 59]
+    int     wday = 0;   // [0, 6], Sunday = 0
+    int     yday = 0;   // [0, 365]
+    int     offset = 0; // UTC offset in seconds
+};
+
+} // namespace
+
+// Converts T (seconds since the Unix epoch, already adjusted by the UTC offset)
+// into the broken-down time.
+static void CivilFromSeconds(CivilTime& ct, int64_t t)
+{
+    int64_t const days = FloorDiv(t, 86400);
+    int const secs = static_cast<int>(t - days * 86400);
+
+    ct.hour   = secs / 3600;
+    ct.minute = secs / 60 % 60;
+    ct.second = secs % 60;
+    ct.wday   = static_cast<int>(days + 4 - FloorDiv(days + 4, 7) * 7); // 1970-01-01 was a Thursday
+
+    // See http://howardhinnant.github.io/date_algorithms.html
+    int64_t const z   = days + 719468;
+    int64_t const era = FloorDiv(z, 146097);
+    int64_t const doe = z - era * 146097;                                   // [0, 146096]
+    int64_t const yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365; // [0, 399]
+    int64_t const doy = doe - (365 * yoe + yoe / 4 - yoe / 100);             // [0, 365]
+    int64_t const mp  = (5 * doy + 2) / 153;                                 // [0, 11]
+
+    ct.day   = static_cast<int>(doy - (153 * mp + 2) / 5 + 1);
+    ct.month = static_cast<int>(mp < 10 ? mp + 3 : mp - 9);
+    ct.year  = yoe + era * 400 + (ct.month <= 2);
+    ct.yday  = static_cast<int>(days - DaysFromCivil(ct.year, 1, 1));
+}
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+namespace {
+
+// The UTC offset of the local time zone for a 15 minute interval (starting at
+// a multiple of 15 minutes since the epoch). Only intervals with the same
+// offset at both ends are cached.
+struct OffsetCache
+{
+    int64_t interval = INT64_MIN;
+    int     offset = 0;
+};
+
+} // namespace
+
+static constexpr int64_t kOffsetInterval = 15 * 60;
+
+static thread_local OffsetCache t_offset_cache;
+
+// Computes the UTC offset of the local time zone at T using localtime.
+static ErrorCode ComputeLocalOffset(int& offset, int64_t t)
+{
+    std::time_t const tt = static_cast<std::time_t>(t);
+    if (static_cast<int64_t>(tt) != t)
+        return ErrorCode::conversion_error;
+
+    std::tm tm;
+#ifdef _WIN32
+    if (localtime_s(&tm, &tt) != 0)
+        return ErrorCode::conversion_error;
+#else
+    if (localtime_r(&tt, &tm) == nullptr)
+        return ErrorCode::conversion_error;
+#endif
+
+    int64_t const local = DaysFromCivil(int64_t{tm.tm_year} + 1900, tm.tm_mon + 1, tm.tm_mday) * 86400
+                          + tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+
+    offset = static_cast<int>(local - t);
+    return {};
+}
+
+static ErrorCode LocalOffset(int& offset, int64_t t)
+{
+    int64_t const interval = FloorDiv(t, kOffsetInterval);
+
+    auto& cache = t_offset_cache;
+    if (cache.interval == interval)
+    {
+        offset = cache.offset;
+        return {};
+    }
+
+    if (Failed ec = ComputeLocalOffset(offset, t))
+        return ec;
+
+    // Historical time zones have transitions at arbitrary times. Cache the
+    // offset only if it is the same at both ends of the interval. (If
+    // localtime succeeds, T is far from the limits of int64_t.)
+    int64_t const first = interval * kOffsetInterval;
+    int64_t const last = first + (kOffsetInterval - 1);
+
+    int first_offset;
+    int last_offset;
+    if (Failed(ComputeLocalOffset(first_offset, first)) || Failed(ComputeLocalOffset(last_offset, last)))
+        return {};
+
+    if (first_offset == offset && last_offset == offset)
+    {
+        cache.interval = interval;
+        cache.offset = offset;
+    }
+
+    return {};
+}
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+static char const* const kWeekdayNames[] = {
+    "Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday",
+};
+
+static char const* const kMonthNames[] = {
+    "January", "February", "March", "April", "May", "June",
+    "July", "August", "September", "October", "November", "December",
+};
+
+static void AppendUnsigned(std::string& out, uint64_t n, int min_digits, char pad = '0')
+{
+    char buf[24];
+    char* const end = buf + sizeof(buf);
+    char* p = end;
+    do {
+        *--p = static_cast<char>('0' + n % 10);
+        n /= 10;
+    } while (n != 0);
+    while (end - p < min_digits)
+        *--p = pad;
+
+    out.append(p, static_cast<size_t>(end - p));
+}
+
+static void AppendSigned(std::string& out, int64_t n, int min_digits)
+{
+    if (n < 0)
+    {
+        out += '-';
+        AppendUnsigned(out, 0 - static_cast<uint64_t>(n), min_digits);
+    }
+    else
+    {
+        AppendUnsigned(out, static_cast<uint64_t>(n), min_digits);
+    }
+}
+
+static void Append2(std::string& out, int n)
+{
+    out += static_cast<char>('0' + n / 10);
+    out += static_cast<char>('0' + n % 10);
+}
+
+// Writes the first DIGITS digits of the 9-digit number NANOS into DST.
+static void PutSubsecondDigits(char* dst, uint32_t nanos, int digits)
+{
+    static constexpr uint32_t kPow10[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+    uint32_t n = nanos / kPow10[9 - digits];
+    for (int i = digits - 1; i >= 0; --i)
+    {
+        dst[i] = static_cast<char>('0' + n % 10);
+        n /= 10;
+    }
+}
+
+namespace {
+
+// The position of a %N field in the formatted output.
+struct SubsecondField
+{
+    size_t pos;
+    int    digits;
+};
+
+} // namespace
+
+// Parses the optional digit count of a %N conversion.
+// On return, F points to the conversion character.
+static int ParseSubsecondDigits(char const*& f, char const* end)
+{
+    if (*f >= '1' && *f <= '9' && f + 1 != end && f[1] == 'N')
+        return *f++ - '0';
+    return 9;
+}
+
+// Formats the broken-down time CT into OUT. The sub-second digits are formatted
+// as '0's, their positions are stored in FIELDS.
+static ErrorCode RenderTimePoint(std::string& out, std::vector<SubsecondField>& fields, string_view pattern, CivilTime const& ct)
+{
+    out.clear();
+    fields.clear();
+
+    auto       f   = pattern.begin();
+    auto const end = pattern.end();
+
+    while (f != end)
+    {
+        char const* const p = static_cast<char const*>(std::memchr(f, '%', static_cast<size_t>(end - f)));
+        if (p == nullptr)
+        {
+            out.append(f, static_cast<size_t>(end - f));
+            break;
+        }
+
+        out.append(f, static_cast<size_t>(p - f));
+        f = p + 1;
+        if (f == end)
+            return ErrorCode::invalid_format_string;
+
+        int const digits = ParseSubsecondDigits(f, end);
+
+        int const hour12 = ct.hour % 12 == 0 ? 12 : ct.hour % 12;
+        switch (*f++)
+        {
+        case 'a':
+            out.append(kWeekdayNames[ct.wday], 3);
+            break;
+        case 'A':
+            out.append(kWeekdayNames[ct.wday]);
+            break;
+        case 'b':
+        case 'h':
+            out.append(kMonthNames[ct.month - 1], 3);
+            break;
+        case 'B':
+            out.append(kMonthNames[ct.month - 1]);
+            break;
+        case 'C':
+            AppendSigned(out, FloorDiv(ct.year, 100), 2);
+            break;
+        case 'd':
+            Append2(out, ct.day);
+            break;
+        case 'D':
+            Append2(out, ct.month);
+            out += '/';
+            Append2(out, ct.day);
+            out += '/';
+            Append2(out, static_cast<int>(ct.year - FloorDiv(ct.year, 100) * 100));
+            break;
+        case 'e':
+            AppendUnsigned(out, static_cast<uint64_t>(ct.day), 2, ' ');
+            break;
+        case 'F':
+            AppendSigned(out, ct.year, 4);
+            out += '-';
+            Append2(out, ct.month);
+            out += '-';
+            Append2(out, ct.day);
+            break;
+        case 'H':
+            Append2(out, ct.hour);
+            break;
+        case 'I':
+            Append2(out, hour12);
+            break;
+        case 'j':
+            AppendUnsigned(out, static_cast<uint64_t>(ct.yday + 1), 3);
+            break;
+        case 'm':
+            Append2(out, ct.month);
+            break;
+        case 'M':
+            Append2(out, ct.minute);
+            break;
+        case 'N':
+            fields.push_back({out.size(), digits});
+            out.append(static_cast<size_t>(digits), '0');
+            break;
+        case 'n':
+            out += '\n';
+            break;
+        case 'p':
+            out.append(ct.hour < 12 ? "AM" : "PM");
+            break;
+        case 'R':
+            Append2(out, ct.hour);
+            out += ':';
+            Append2(out, ct.minute);
+            break;
+        case 's':
+            AppendSigned(out, ct.unix_seconds, 1);
+            break;
+        case 'S':
+            Append2(out, ct.second);
+            break;
+        case 't':
+            out += '\t';
+            break;
+        case 'T':
+            Append2(out, ct.hour);
+            out += ':';
+            Append2(out, ct.minute);
+            out += ':';
+            Append2(out, ct.second);
+            break;
+        case 'u':
+            out += static_cast<char>('0' + (ct.wday == 0 ? 7 : ct.wday));
+            break;
+        case 'w':
+            out += static_cast<char>('0' + ct.wday);
+            break;
+        case 'y':
+            Append2(out, static_cast<int>(ct.year - FloorDiv(ct.year, 100) * 100));
+            break;
+        case 'Y':
+            AppendSigned(out, ct.year, 4);
+            break;
+        case 'z':
+            {
+                int const abs_offset = ct.offset < 0 ? -ct.offset : ct.offset;
+                out += ct.offset < 0 ? '-' : '+';
+                Append2(out, abs_offset / 3600);
+                Append2(out, abs_offset / 60 % 60);
+            }
+            break;
+        case '%':
+            out += '%';
+            break;
+        default:
+            return ErrorCode::invalid_format_string;
+        }
+    }
+
+    return {};
+}
+
+// Writes STR to W, applying the width, fill and alignment of SPEC.
+static ErrorCode WritePadded(Writer& w, FormatSpec const& spec, char const* str, size_t len)
+{
+    if (spec.width <= 0)
+        return w.write(str, len);
+
+    FormatSpec pad_spec;
+    pad_spec.width = spec.width;
+    pad_spec.fill  = spec.fill;
+    pad_spec.align = spec.align;
+    return Util::format_string(w, pad_spec, str, len);
+}
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+namespace {
+
+struct TimeCacheEntry
+{
+    std::string                 pattern;
+    bool                        local = false;
+    int64_t                     seconds = INT64_MIN; // The time point (second) which has been formatted
+    uint64_t                    last_use = 0;
+    std::string                 text; // The formatted time point, without the sub-second digits
+    std::vector<SubsecondField> fields;
+};
+
+struct TimeCache
+{
+    static constexpr int kNumEntries = 4;
+
+    TimeCacheEntry entries[kNumEntries];
+    uint64_t tick = 0;
+    // Set while writing a cached entry. A nested call of FormatTimePoint on the
+    // same thread (from a Writer, say) must not modify the text.
+    bool busy = false;
+
+    ~TimeCache();
+};
+
+class TimeCacheScope
+{
+    TimeCache& cache_;
+
+public:
+    explicit TimeCacheScope(TimeCache& cache) : cache_(cache) { cache_.busy = true; }
+    ~TimeCacheScope() { cache_.busy = false; }
+
+    TimeCacheScope(TimeCacheScope const&) = delete;
+    TimeCacheScope& operator=(TimeCacheScope const&) = delete;
+};
+
+} // namespace
+
+static thread_local TimeCache t_time_cache;
+
+// Set when t_time_cache has been destroyed.
+static thread_local bool t_time_cache_destroyed = false;
+
+TimeCache::~TimeCache()
+{
+    t_time_cache_destroyed = true;
+}
+
+static ErrorCode RenderTimePoint(TimeCacheEntry& entry, string_view pattern, bool local, int64_t seconds)
+{
+    CivilTime ct;
+    ct.unix_seconds = seconds;
+
+    if (local)
+    {
+        if (Failed ec = LocalOffset(ct.offset, seconds))
+            return ec;
+    }
+
+    if (seconds > INT64_MAX - 86400 || seconds < INT64_MIN + 86400)
+        return ErrorCode::conversion_error;
+
+    CivilFromSeconds(ct, seconds + ct.offset);
+
+    if (Failed ec = RenderTimePoint(entry.text, entry.fields, pattern, ct))
+        return ec;
+
+    entry.seconds = seconds;
+    return {};
+}
+
+ErrorCode fmtxx::impl::FormatTimePoint(Writer& w, FormatSpec const& spec, int64_t seconds, int64_t nanos)
+{
+    if (nanos < 0 || nanos >= 1000000000)
+        return ErrorCode::conversion_error;
+
+    string_view const pattern = spec.style.empty() ? string_view("%F %T") : spec.style;
+    bool const local = spec.conv == 'l';
+
+    // Nested calls, and calls from the destructors of other thread_local
+    // objects, do not use the cache.
+    if (t_time_cache_destroyed || t_time_cache.busy)
+    {
+        TimeCacheEntry entry;
+        if (Failed ec = RenderTimePoint(entry, pattern, local, seconds))
+            return ec;
+        for (auto const& field : entry.fields)
+            PutSubsecondDigits(&entry.text[field.pos], static_cast<uint32_t>(nanos), field.digits);
+        return WritePadded(w, spec, entry.text.data(), entry.text.size());
+    }
+
+    auto& cache = t_time_cache;
+    TimeCacheScope const scope{cache};
+
+    // Find the entry for this pattern, or the least recently used entry.
+    TimeCacheEntry* entry = &cache.entries[0];
+    bool found = false;
+    for (auto& e : cache.entries)
+    {
+        if (e.local == local && e.pattern.size() == pattern.size() && std::memcmp(e.pattern.data(), pattern.data(), pattern.size()) == 0)
+        {
+            entry = &e;
+            found = true;
+            break;
+        }
+        if (e.last_use < entry->last_use)
+            entry = &e;
+    }
+
+    entry->last_use = ++cache.tick;
+
+    if (!found)
+    {
+        entry->pattern.assign(pattern.data(), pattern.size());
+        entry->local = local;
+        entry->seconds = INT64_MIN;
+    }
+
+    if (entry->seconds != seconds)
+    {
+        entry->seconds = INT64_MIN; // In case of errors
+        if (Failed ec = RenderTimePoint(*entry, pattern, local, seconds))
+            return ec;
+    }
+
+    for (auto const& field : entry->fields)
+        PutSubsecondDigits(&entry->text[field.pos], static_cast<uint32_t>(nanos), field.digits);
+
+    return WritePadded(w, spec, entry->text.data(), entry->text.size());
+}
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+ErrorCode fmtxx::impl::FormatDuration(Writer& w, FormatSpec const& spec, bool negative, uint64_t seconds, uint32_t nanos)
+{
+    if (nanos >= 1000000000)
+        return ErrorCode::conversion_error;
+
+    std::string out;
+    if (negative)
+        out += '-';
+
+    uint64_t const hours   = seconds / 3600;
+    int const      minutes = static_cast<int>(seconds / 60 % 60);
+    int const      secs    = static_cast<int>(seconds % 60);
+
+    auto       f   = spec.style.begin();
+    auto const end = spec.style.end();
+
+    while (f != end)
+    {
+        if (*f != '%')
+        {
+            out += *f++;
+            continue;
+        }
+
+        ++f;
+        if (f == end)
+            return ErrorCode::invalid_format_string;
+
+        int const digits = ParseSubsecondDigits(f, end);
+
+        switch (*f++)
+        {
+        case 'H':
+            AppendUnsigned(out, hours, 2);
+            break;
+        case 'M':
+            Append2(out, minutes);
+            break;
+        case 'N':
+            out.append(static_cast<size_t>(digits), '0');
+            PutSubsecondDigits(&out[out.size() - static_cast<size_t>(digits)], nanos, digits);
+            break;
+        case 'n':
+            out += '\n';
+            break;
+        case 'R':
+            AppendUnsigned(out, hours, 2);
+            out += ':';
+            Append2(out, minutes);
+            break;
+        case 's':
+            AppendUnsigned(out, seconds, 1);
+            break;
+        case 'S':
+            Append2(out, secs);
+            break;
+        case 't':
+            out += '\t';
+            break;
+        case 'T':
+            AppendUnsigned(out, hours, 2);
+            out += ':';
+            Append2(out, minutes);
+            out += ':';
+            Append2(out, secs);
+            break;
+        case '%':
+            out += '%';
+            break;
+        default:
+            return ErrorCode::invalid_format_string;
+        }
+    }
+
+    return WritePadded(w, spec, out.data(), out.size());
+}
+
+static char const* DurationSuffix(intmax_t num, intmax_t den)
+{
+    if (num == 1)
+    {
+        switch (den) {
+        case 1:          return "s";
+        case 1000:       return "ms";
+        case 1000000:    return "us";
+        case 1000000000: return "ns";
+        }
+    }
+    else if (den == 1)
+    {
+        switch (num) {
+        case 60:    return "min";
+        case 3600:  return "h";
+        case 86400: return "d";
+        }
+    }
+
+    return nullptr;
+}
+
+template <typename T>
+static ErrorCode FormatCount(Writer& w, FormatSpec const& spec, T count, intmax_t num, intmax_t den)
+{
+    // The number is formatted using the format-spec (except for the width),
+    // the width applies to the number and the suffix.
+    FormatSpec num_spec = spec;
+    num_spec.width = 0;
+
+    MemoryWriter<> buf;
+    if (Failed ec = FormatValue<>{}(buf, num_spec, count))
+        return ec;
+
+    if (char const* suffix = DurationSuffix(num, den))
+    {
+        if (Failed ec = buf.write(suffix, std::strlen(suffix)))
+            return ec;
+    }
+    else
+    {
+        if (Failed ec = fmtxx::format(buf, "[{}/{}]s", num, den))
+            return ec;
+    }
+
+    return WritePadded(w, spec, buf.data(), buf.size());
+}
+
+ErrorCode fmtxx::impl::FormatDurationCount(Writer& w, FormatSpec const& spec, int64_t count, intmax_t num, intmax_t den)
+{
+    return FormatCount(w, spec, count, num, den);
+}
+
+ErrorCode fmtxx::impl::FormatDurationCount(Writer& w, FormatSpec const& spec, double count, intmax_t num, intmax_t den)
+{
+    return FormatCount(w, spec, count, num, den);
+}
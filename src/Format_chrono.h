@@ -0,0 +1,157 @@
+// Copyright (c) 2017 Alexander Bolz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef FMTXX_FORMAT_CHRONO_H
+#define FMTXX_FORMAT_CHRONO_H 1
+
+#include "Format.h"
+
+#include <chrono>
+#include <ctime> // timespec
+#include <type_traits>
+
+// Formatting of time points and durations.
+//
+// Time points (std::chrono::system_clock::time_point and timespec) are
+// formatted using the strftime-like pattern given as the style of the
+// replacement field, e.g. "{!'%F %T.%3N'}". The default pattern is "%F %T".
+// Time points are formatted in UTC, unless the conversion is 'l', which
+// selects the local time zone.
+//
+// Supported conversions:
+//
+//  %a %A   Abbreviated/full weekday name ("Mon", "Monday")
+//  %b %h   Abbreviated month name ("Jan")
+//  %B      Full month name ("January")
+//  %C      Century (year / 100), at least 2 digits
+//  %d %e   Day of the month, "01"-"31" and " 1"-"31"
+//  %D      Same as "%m/%d/%y"
+//  %F      Same as "%Y-%m-%d"
+//  %H %I   Hour, "00"-"23" and "01"-"12"
+//  %j      Day of the year, "001"-"366"
+//  %m %M   Month "01"-"12" and minute "00"-"59"
+//  %N      Nanoseconds, "000000000"-"999999999"
+//  %1N-%9N The first 1-9 digits of %N (e.g., %3N for milliseconds)
+//  %p      "AM" or "PM"
+//  %R %T   Same as "%H:%M" and "%H:%M:%S"
+//  %s      Seconds since the Unix epoch
+//  %S      Second, "00"-"60"
+//  %u %w   Day of the week, "1"-"7" (Monday = 1) and "0"-"6" (Sunday = 0)
+//  %y %Y   Year without century "00"-"99" and year (at least 4 digits)
+//  %z      UTC offset, "+hhmm" or "-hhmm"
+//  %n %t %% A newline, a tab, a literal '%'
+//
+// Names are always formatted in the "C" locale.
+//
+// Durations are formatted as their count followed by a unit suffix ("42ms",
+// "1.5s", "3[1/60]s"), unless a style is given, which may use the conversions
+// %H (total number of hours), %M, %S, %N, %1N-%9N, %R, %T, %s (total number of
+// seconds), %n, %t and %%. Negative durations are prefixed with '-'.
+//
+// Width, fill and alignment apply to the complete output.
+//
+// The formatted date and time (everything except the sub-second digits) is
+// cached per thread for the current second, so formatting consecutive time
+// stamps usually only needs to update the %N digits. The UTC offset of the
+// local time zone is cached per 15 minute interval, if it is the same at the
+// beginning and at the end of the interval. Changes to the time zone database
+// or the TZ environment variable may therefore be detected late.
+
+namespace fmtxx {
+
+namespace impl {
+
+// Formats the time point SECONDS + NANOS / 10^9 (since the Unix epoch).
+// Returns conversion_error if NANOS is not in [0, 10^9).
+ErrorCode FormatTimePoint(Writer& w, FormatSpec const& spec, int64_t seconds, int64_t nanos);
+
+// Formats a duration given by its sign, the number of (whole) seconds and the
+// number of nanoseconds in [0, 10^9), using the pattern in spec.style.
+ErrorCode FormatDuration(Writer& w, FormatSpec const& spec, bool negative, uint64_t seconds, uint32_t nanos);
+
+// Formats the count of a duration with the unit N/D seconds.
+ErrorCode FormatDurationCount(Writer& w, FormatSpec const& spec, int64_t count, intmax_t num, intmax_t den);
+ErrorCode FormatDurationCount(Writer& w, FormatSpec const& spec, double count, intmax_t num, intmax_t den);
+
+template <typename Rep>
+inline int64_t DurationCount(Rep count, /*is_floating_point*/ std::false_type) { return static_cast<int64_t>(count); }
+
+template <typename Rep>
+inline double DurationCount(Rep count, /*is_floating_point*/ std::true_type) { return static_cast<double>(count); }
+
+} // namespace fmtxx::impl
+
+template <typename Duration>
+struct FormatValue<std::chrono::time_point<std::chrono::system_clock, Duration>>
+{
+    ErrorCode operator()(Writer& w, FormatSpec const& spec, std::chrono::time_point<std::chrono::system_clock, Duration> const& value) const
+    {
+        using std::chrono::duration_cast;
+
+        // Round towards negative infinity.
+        auto const d = value.time_since_epoch();
+        auto secs = duration_cast<std::chrono::seconds>(d);
+        if (secs > d)
+            secs -= std::chrono::seconds(1);
+
+        auto const nanos = duration_cast<std::chrono::nanoseconds>(d - secs);
+        return impl::FormatTimePoint(w, spec, static_cast<int64_t>(secs.count()), static_cast<int64_t>(nanos.count()));
+    }
+};
+
+template <typename Rep, typename Period>
+struct FormatValue<std::chrono::duration<Rep, Period>>
+{
+    ErrorCode operator()(Writer& w, FormatSpec const& spec, std::chrono::duration<Rep, Period> const& value) const
+    {
+        using std::chrono::duration_cast;
+
+        if (spec.style.empty())
+        {
+            auto const count = impl::DurationCount(value.count(), std::is_floating_point<Rep>{});
+            return impl::FormatDurationCount(w, spec, count, Period::num, Period::den);
+        }
+
+        // Both parts have the same sign.
+        auto const secs = duration_cast<std::chrono::seconds>(value);
+        auto const nanos = duration_cast<std::chrono::nanoseconds>(value - secs);
+
+        auto const s = static_cast<int64_t>(secs.count());
+        auto const n = static_cast<int64_t>(nanos.count());
+        bool const negative = s < 0 || n < 0;
+
+        uint64_t const abs_s = negative ? 0 - static_cast<uint64_t>(s) : static_cast<uint64_t>(s);
+        uint32_t const abs_n = static_cast<uint32_t>(negative ? -n : n);
+        return impl::FormatDuration(w, spec, negative, abs_s, abs_n);
+    }
+};
+
+template <>
+struct FormatValue<timespec>
+{
+    ErrorCode operator()(Writer& w, FormatSpec const& spec, timespec const& value) const
+    {
+        return impl::FormatTimePoint(w, spec, static_cast<int64_t>(value.tv_sec), static_cast<int64_t>(value.tv_nsec));
+    }
+};
+
+} // namespace fmtxx
+
+#endif // FMTXX_FORMAT_CHRONO_H
@@ -0,0 +1,234 @@
+// Copyright (c) 2017 Alexander Bolz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "Format_iovec.h"
+#include "Format_stats.h"
+
+#ifndef _WIN32
+
+#include <cerrno>
+#include <climits>
+#include <functional>
+
+#include <unistd.h>
+
+using namespace fmtxx;
+using namespace fmtxx::impl;
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+#ifdef IOV_MAX
+static constexpr int kMaxIovecs = IOV_MAX;
+#else
+static constexpr int kMaxIovecs = 1024;
+#endif
+
+fmtxx::IovecWriter::IovecWriter(int fd, size_t ref_threshold)
+    : fd_(fd)
+    , ref_threshold_(ref_threshold > 0 ? ref_threshold : 1)
+{
+}
+
+fmtxx::IovecWriter::~IovecWriter()
+{
+}
+
+size_t fmtxx::IovecWriter::referenced_size() const
+{
+    size_t n = 0;
+    for (auto const& p : pieces_)
+    {
+        if (p.ref != nullptr)
+            n += p.len;
+    }
+
+    return n;
+}
+
+void fmtxx::IovecWriter::add_stable_range(char const* ptr, size_t len)
+{
+    if (len >= ref_threshold_)
+        stable_.push_back(Range{ptr, ptr + len});
+}
+
+// Writes IOV[0, IOVCNT) to FD, handling partial writes.
+// Modifies the contents of IOV.
+static ErrorCode WriteAll(int fd, iovec* iov, int iovcnt, size_t& count)
+{
+    while (iovcnt > 0)
+    {
+        ssize_t const n = ::writev(fd, iov, iovcnt < kMaxIovecs ? iovcnt : kMaxIovecs);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return ErrorCode::io_error;
+        }
+        if (n == 0)
+            return ErrorCode::io_error;
+
+        count += static_cast<size_t>(n);
+
+        // Skip the pieces which have been written completely.
+        size_t k = static_cast<size_t>(n);
+        while (iovcnt > 0 && k >= iov->iov_len)
+        {
+            k -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+
+        if (k > 0)
+        {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + k;
+            iov->iov_len -= k;
+        }
+    }
+
+    return {};
+}
+
+ErrorCode fmtxx::IovecWriter::flush()
+{
+    iov_.clear();
+    for (auto const& p : pieces_)
+    {
+        iovec v;
+        v.iov_base = const_cast<char*>(p.ref != nullptr ? p.ref : buf_.data() + p.pos);
+        v.iov_len = p.len;
+        iov_.push_back(v);
+    }
+
+    auto const ec = WriteAll(fd_, iov_.data(), static_cast<int>(iov_.size()), size_);
+
+    buf_.clear();
+    pieces_.clear();
+    stable_.clear();
+
+    return ec;
+}
+
+bool fmtxx::IovecWriter::IsStable(char const* ptr, size_t len) const
+{
+    // NB: std::less provides a total order on pointers.
+    std::less<char const*> const less;
+
+    for (auto const& r : stable_)
+    {
+        if (!less(ptr, r.first) && !less(r.last, ptr) && len <= static_cast<size_t>(r.last - ptr))
+            return true;
+    }
+
+    return false;
+}
+
+void fmtxx::IovecWriter::AppendCopied(size_t pos, size_t len)
+{
+    // Merge with the previous piece if possible.
+    if (!pieces_.empty() && pieces_.back().ref == nullptr)
+        pieces_.back().len += len;
+    else
+        pieces_.push_back(Piece{nullptr, pos, len});
+}
+
+ErrorCode fmtxx::IovecWriter::Put(char c)
+{
+    size_t const pos = buf_.size();
+    if (Failed ec = buf_.put(c))
+        return ec;
+
+    AppendCopied(pos, 1);
+    stats::impl::CountBytes(stats::WriterKind::iovec, 1);
+    return {};
+}
+
+ErrorCode fmtxx::IovecWriter::Write(char const* ptr, size_t len)
+{
+    if (len >= ref_threshold_ && IsStable(ptr, len))
+    {
+        pieces_.push_back(Piece{ptr, 0, len});
+        stats::impl::CountBytes(stats::WriterKind::iovec, len);
+        return {};
+    }
+
+    size_t const pos = buf_.size();
+    if (Failed ec = buf_.write(ptr, len))
+        return ec;
+
+    AppendCopied(pos, len);
+    stats::impl::CountBytes(stats::WriterKind::iovec, len);
+    return {};
+}
+
+ErrorCode fmtxx::IovecWriter::Pad(char c, size_t count)
+{
+    size_t const pos = buf_.size();
+    if (Failed ec = buf_.pad(c, count))
+        return ec;
+
+    AppendCopied(pos, count);
+    stats::impl::CountBytes(stats::WriterKind::iovec, count);
+    return {};
+}
+
+// The format string and the string arguments are valid until the format call
+// returns.
+static void AddStableRanges(IovecWriter& w, string_view format, Arg const* args, Types types)
+{
+    w.add_stable_range(format.data(), format.size());
+
+    for (int i = 0; i < Types::kMaxArgs; ++i)
+    {
+        Type const t = types[i];
+        if (t == Type::none)
+            break;
+        if (t == Type::string)
+            w.add_stable_range(args[i].string.data, args[i].string.size);
+    }
+}
+
+template <typename Format>
+static ErrorCode FormatToFd(int fd, string_view format, Arg const* args, Types types, Format func)
+{
+    IovecWriter w{fd};
+    AddStableRanges(w, format, args, types);
+
+    auto const ec = func(w);
+    auto const ec_write = w.flush();
+
+    return ec != ErrorCode::success ? ec : ec_write;
+}
+
+ErrorCode fmtxx::impl::DoFormatToFd(int fd, string_view format, Arg const* args, Types types)
+{
+    stats::impl::CallScope const scope{stats::EntryPoint::format_fd};
+    return FormatToFd(fd, format, args, types, [&](Writer& w) { return fmtxx::impl::DoFormat(w, format, args, types); });
+}
+
+ErrorCode fmtxx::impl::DoPrintfToFd(int fd, string_view format, Arg const* args, Types types)
+{
+    stats::impl::CallScope const scope{stats::EntryPoint::printf_fd};
+    return FormatToFd(fd, format, args, types, [&](Writer& w) { return fmtxx::impl::DoPrintf(w, format, args, types); });
+}
+
+#endif // _WIN32
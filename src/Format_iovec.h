@@ -0,0 +1,130 @@
+// Copyright (c) 2017 Alexander Bolz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef FMTXX_FORMAT_IOVEC_H
+#define FMTXX_FORMAT_IOVEC_H 1
+
+#include "Format.h"
+
+#ifndef _WIN32
+
+#include <vector>
+
+#include <sys/uio.h> // iovec
+
+namespace fmtxx {
+
+// Collects the output as a list of pieces and writes them to a file descriptor
+// (a file, a pipe or a socket) using writev(2). POSIX only.
+//
+// Characters are copied into an internal buffer, except for large writes which
+// lie completely within one of the stable ranges (see add_stable_range):
+// these are only referenced. format_to_fd (below) registers the format string
+// and all string arguments as stable ranges.
+class IovecWriter : public Writer
+{
+    struct Piece
+    {
+        char const* ref; // The referenced characters, or null if the characters have been copied...
+        size_t      pos; // ...to [pos, pos + len) of buf_.
+        size_t      len;
+    };
+
+    struct Range
+    {
+        char const* first;
+        char const* last;
+    };
+
+    int const          fd_;
+    size_t const       ref_threshold_;
+    size_t             size_ = 0;
+    MemoryWriter<1024> buf_;
+    std::vector<Piece> pieces_;
+    std::vector<Range> stable_;
+    std::vector<iovec> iov_;
+
+public:
+    // Writes to the file descriptor FD.
+    // Writes of at least REF_THRESHOLD characters within a stable range are
+    // referenced instead of copied.
+    explicit IovecWriter(int fd, size_t ref_threshold = 512);
+
+    // Note: The destructor does not flush the pending output.
+    ~IovecWriter();
+
+    // Returns the file descriptor.
+    int fd() const { return fd_; }
+
+    // Returns the number of bytes successfully transmitted (since construction).
+    size_t size() const { return size_; }
+
+    // Returns the number of pending bytes which are referenced instead of copied.
+    size_t referenced_size() const;
+
+    // Allows referencing characters in [ptr, ptr + len).
+    // The characters must remain valid and unchanged until flush() returns.
+    void add_stable_range(char const* ptr, size_t len);
+
+    // Writes all pending output and forgets all stable ranges.
+    // Returns io_error if writev fails.
+    ErrorCode flush();
+
+private:
+    ErrorCode Put(char c) override;
+    ErrorCode Write(char const* ptr, size_t len) override;
+    ErrorCode Pad(char c, size_t count) override;
+
+    bool IsStable(char const* ptr, size_t len) const;
+    void AppendCopied(size_t pos, size_t len);
+};
+
+namespace impl {
+
+ErrorCode DoFormatToFd(int fd, string_view format, Arg const* args, Types types);
+ErrorCode DoPrintfToFd(int fd, string_view format, Arg const* args, Types types);
+
+} // namespace fmtxx::impl
+
+// Formats the message and writes it to the file descriptor FD with a single
+// call to writev(2) (unless the message consists of more than IOV_MAX pieces
+// or the file descriptor accepts only part of the message).
+// Large string arguments are not copied.
+// Partial output is written even if formatting fails (like fprintf).
+template <typename ...Args>
+ErrorCode format_to_fd(int fd, string_view format, Args const&... args)
+{
+    fmtxx::impl::ArgArray<Args...> arr = {args...};
+    return fmtxx::impl::DoFormatToFd(fd, format, arr, fmtxx::impl::MakeTypes<Args...>::value);
+}
+
+template <typename ...Args>
+ErrorCode printf_to_fd(int fd, string_view format, Args const&... args)
+{
+    fmtxx::impl::ArgArray<Args...> arr = {args...};
+    return fmtxx::impl::DoPrintfToFd(fd, format, arr, fmtxx::impl::MakeTypes<Args...>::value);
+}
+
+} // namespace fmtxx
+
+#endif // _WIN32
+
+#endif // FMTXX_FORMAT_IOVEC_H
@@ -0,0 +1,488 @@
+// Copyright (c) 2017 Alexander Bolz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "Format_mmap.h"
+#include "Format_stats.h"
+
+#ifndef _WIN32
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace fmtxx;
+using namespace fmtxx::impl;
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+static uint64_t PageSize()
+{
+    static uint64_t const page_size = [] {
+        long const n = sysconf(_SC_PAGESIZE);
+        return n > 0 ? static_cast<uint64_t>(n) : uint64_t{4096};
+    }();
+    return page_size;
+}
+
+static uint64_t RoundUpToPageSize(uint64_t n)
+{
+    uint64_t const page_size = PageSize();
+    return std::max(page_size, (n + (page_size - 1)) / page_size * page_size);
+}
+
+// Opens PATH for appending and returns the file descriptor and the current
+// size of the file.
+static int OpenFile(char const* path, uint64_t& size)
+{
+    int const fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return -1;
+    }
+
+    size = static_cast<uint64_t>(st.st_size);
+    return fd;
+}
+
+static bool Truncate(int fd, uint64_t size)
+{
+    int r;
+    do
+        r = ::ftruncate(fd, static_cast<off_t>(size));
+    while (r != 0 && errno == EINTR);
+
+    return r == 0;
+}
+
+// Extends the file from OLD_SIZE to NEW_SIZE bytes.
+// If possible, the disk space is allocated, so that running out of space is
+// reported here instead of raising SIGBUS when writing to the mapping.
+static bool Extend(int fd, uint64_t old_size, uint64_t new_size)
+{
+#if defined(__linux__)
+    int const r = ::posix_fallocate(fd, static_cast<off_t>(old_size), static_cast<off_t>(new_size - old_size));
+    if (r == 0)
+        return true;
+    if (r != EINVAL && r != EOPNOTSUPP)
+        return false;
+    // Not supported by the file system.
+#else
+    static_cast<void>(old_size);
+#endif
+
+    return Truncate(fd, new_size);
+}
+
+static ErrorCode Sync(void* addr, size_t len, MmapSyncPolicy policy)
+{
+    if (policy == MmapSyncPolicy::none || len == 0)
+        return {};
+
+    // msync requires a page-aligned address.
+    uint64_t const page_size = PageSize();
+    uintptr_t const p = reinterpret_cast<uintptr_t>(addr);
+    uintptr_t const first = p / page_size * page_size;
+
+    int const flags = policy == MmapSyncPolicy::sync ? MS_SYNC : MS_ASYNC;
+    if (::msync(reinterpret_cast<void*>(first), len + (p - first), flags) != 0)
+        return ErrorCode::io_error;
+
+    return {};
+}
+
+static ErrorCode CloseFile(int fd, uint64_t size, MmapSyncPolicy policy)
+{
+    ErrorCode ec = ErrorCode{};
+
+    if (!Truncate(fd, size))
+        ec = ErrorCode::io_error;
+    if (policy == MmapSyncPolicy::sync && ::fsync(fd) != 0)
+        ec = ErrorCode::io_error;
+    if (::close(fd) != 0)
+        ec = ErrorCode::io_error;
+
+    return ec;
+}
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+fmtxx::MmapWriter::MmapWriter(char const* path, size_t window_size, MmapSyncPolicy policy)
+    : window_size_(static_cast<size_t>(RoundUpToPageSize(window_size)))
+    , policy_(policy)
+{
+    uint64_t size = 0;
+
+    fd_ = OpenFile(path, size);
+    if (fd_ < 0)
+    {
+        ec_ = ErrorCode::io_error;
+        return;
+    }
+
+    open_size_ = size;
+    file_size_ = size;
+    ec_ = MapWindow(size);
+}
+
+fmtxx::MmapWriter::~MmapWriter()
+{
+    close();
+}
+
+uint64_t fmtxx::MmapWriter::size() const
+{
+    if (map_ == nullptr)
+        return map_offset_;
+
+    return map_offset_ + static_cast<uint64_t>(window_next() - map_);
+}
+
+ErrorCode fmtxx::MmapWriter::sync()
+{
+    if (map_ == nullptr)
+        return ErrorCode::io_error;
+
+    return Sync(map_, static_cast<size_t>(window_next() - map_), MmapSyncPolicy::sync);
+}
+
+ErrorCode fmtxx::MmapWriter::close()
+{
+    if (fd_ < 0)
+        return ec_;
+
+    uint64_t pos = size();
+    if (ec_ != ErrorCode{})
+    {
+        // Never truncate the previous contents of the file.
+        pos = std::max(pos, open_size_);
+    }
+
+    ErrorCode ec = UnmapWindow();
+    if (Failed ec2 = CloseFile(fd_, pos, policy_))
+        ec = ec2.ec;
+
+    fd_ = -1;
+    map_offset_ = pos;
+    if (ec_ == ErrorCode{})
+        ec_ = ec;
+
+    return ec;
+}
+
+// Maps the window containing the file offset POS and extends the file to the
+// end of the window.
+ErrorCode fmtxx::MmapWriter::MapWindow(uint64_t pos)
+{
+    assert(map_ == nullptr);
+
+    // The file ends at POS if the window cannot be mapped.
+    map_offset_ = pos;
+
+    uint64_t const offset = pos / PageSize() * PageSize();
+    uint64_t const end = offset + window_size_;
+
+    if (file_size_ < end)
+    {
+        if (!Extend(fd_, file_size_, end))
+            return ErrorCode::io_error;
+        file_size_ = end;
+    }
+
+    void* const p = ::mmap(nullptr, window_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, static_cast<off_t>(offset));
+    if (p == MAP_FAILED)
+        return ErrorCode::io_error;
+
+    ::madvise(p, window_size_, MADV_SEQUENTIAL);
+
+    map_ = static_cast<char*>(p);
+    map_offset_ = offset;
+    set_window(map_ + (pos - offset), map_ + window_size_);
+
+    return {};
+}
+
+ErrorCode fmtxx::MmapWriter::UnmapWindow()
+{
+    if (map_ == nullptr)
+        return {};
+
+    uint64_t const pos = size();
+
+    ErrorCode ec = Sync(map_, static_cast<size_t>(window_next() - map_), policy_);
+    if (::munmap(map_, window_size_) != 0)
+        ec = ErrorCode::io_error;
+
+    map_ = nullptr;
+    map_offset_ = pos;
+    set_window(nullptr, nullptr);
+
+    return ec;
+}
+
+ErrorCode fmtxx::MmapWriter::NextWindow()
+{
+    if (fd_ < 0 || ec_ != ErrorCode{})
+        return ErrorCode::io_error;
+
+    uint64_t const pos = size();
+
+    if (Failed ec = UnmapWindow())
+    {
+        ec_ = ec;
+        return ec;
+    }
+    if (Failed ec = MapWindow(pos))
+    {
+        ec_ = ec;
+        return ec;
+    }
+
+    return {};
+}
+
+ErrorCode fmtxx::MmapWriter::Put(char c)
+{
+    stats::impl::CountBytes(stats::WriterKind::mmap, 1);
+
+    if (window_next() == window_last())
+    {
+        if (Failed ec = NextWindow())
+            return ec;
+    }
+
+    char* const next = window_next();
+    *next = c;
+    set_window(next + 1, window_last());
+    return {};
+}
+
+ErrorCode fmtxx::MmapWriter::Write(char const* ptr, size_t len)
+{
+    stats::impl::CountBytes(stats::WriterKind::mmap, len);
+
+    for (;;)
+    {
+        char* const next = window_next();
+        size_t const n = std::min(len, static_cast<size_t>(window_last() - next));
+
+        std::copy_n(ptr, n, next);
+        set_window(next + n, window_last());
+        ptr += n;
+        len -= n;
+
+        if (len == 0)
+            return {};
+        if (Failed ec = NextWindow())
+            return ec;
+    }
+}
+
+ErrorCode fmtxx::MmapWriter::Pad(char c, size_t count)
+{
+    stats::impl::CountBytes(stats::WriterKind::mmap, count);
+
+    for (;;)
+    {
+        char* const next = window_next();
+        size_t const n = std::min(count, static_cast<size_t>(window_last() - next));
+
+        std::fill_n(next, n, c);
+        set_window(next + n, window_last());
+        count -= n;
+
+        if (count == 0)
+            return {};
+        if (Failed ec = NextWindow())
+            return ec;
+    }
+}
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+fmtxx::MmapFile::MmapFile(char const* path, uint64_t capacity, size_t grow_size, MmapSyncPolicy policy)
+    : grow_size_(RoundUpToPageSize(grow_size))
+    , policy_(policy)
+    , size_(0)
+    , limit_(UINT64_MAX)
+    , file_size_(0)
+{
+    uint64_t size = 0;
+
+    fd_ = OpenFile(path, size);
+    if (fd_ < 0)
+    {
+        ec_ = ErrorCode::io_error;
+        return;
+    }
+
+    capacity_ = RoundUpToPageSize(std::max(capacity, size));
+    if (capacity_ > SIZE_MAX)
+    {
+        ::close(fd_);
+        fd_ = -1;
+        ec_ = ErrorCode::invalid_argument;
+        return;
+    }
+
+    // Only reserves address space. Pages beyond the end of the file are never
+    // accessed.
+    void* const p = ::mmap(nullptr, static_cast<size_t>(capacity_), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED)
+    {
+        ::close(fd_);
+        fd_ = -1;
+        ec_ = ErrorCode::io_error;
+        return;
+    }
+
+    map_ = static_cast<char*>(p);
+    size_.store(size, std::memory_order_relaxed);
+    file_size_.store(size, std::memory_order_relaxed);
+}
+
+fmtxx::MmapFile::~MmapFile()
+{
+    close();
+}
+
+uint64_t fmtxx::MmapFile::size() const
+{
+    return std::min(size_.load(std::memory_order_relaxed), limit_.load(std::memory_order_relaxed));
+}
+
+void fmtxx::MmapFile::SetLimit(uint64_t pos)
+{
+    uint64_t limit = limit_.load(std::memory_order_relaxed);
+    while (pos < limit && !limit_.compare_exchange_weak(limit, pos, std::memory_order_relaxed))
+    {
+    }
+}
+
+ErrorCode fmtxx::MmapFile::Grow(uint64_t end)
+{
+    std::lock_guard<std::mutex> lock(grow_mutex_);
+
+    uint64_t const file_size = file_size_.load(std::memory_order_relaxed);
+    if (file_size >= end)
+        return {}; // Another thread has extended the file.
+    if (grow_failed_)
+        return ErrorCode::io_error;
+
+    if (Failed ec = Sync(map_ + file_size - std::min(file_size, grow_size_), static_cast<size_t>(std::min(file_size, grow_size_)), policy_))
+        return ec;
+
+    uint64_t const new_size = std::min(capacity_, std::max(end, file_size + grow_size_));
+    if (!Extend(fd_, file_size, new_size))
+    {
+        // Do not try again. The file would contain holes otherwise.
+        grow_failed_ = true;
+        return ErrorCode::io_error;
+    }
+
+    file_size_.store(new_size, std::memory_order_release);
+    return {};
+}
+
+ErrorCode fmtxx::MmapFile::append(char const* ptr, size_t len)
+{
+    if (map_ == nullptr)
+        return ErrorCode::io_error;
+
+    uint64_t const pos = size_.fetch_add(len, std::memory_order_relaxed);
+    uint64_t const end = pos + len;
+    if (end > capacity_)
+    {
+        // All following ranges do not fit either. The file ends at the first
+        // range which did not fit.
+        SetLimit(pos);
+        return ErrorCode::io_error;
+    }
+
+    if (end > file_size_.load(std::memory_order_acquire))
+    {
+        if (Failed ec = Grow(end))
+        {
+            // Once growing the file has failed, all following ranges fail,
+            // too. The file ends at the first range which could not be stored.
+            SetLimit(pos);
+            return ec;
+        }
+    }
+
+    stats::impl::CountBytes(stats::WriterKind::mmap, len);
+    std::memcpy(map_ + pos, ptr, len);
+    return {};
+}
+
+ErrorCode fmtxx::MmapFile::close()
+{
+    if (map_ == nullptr)
+        return ec_;
+
+    uint64_t const size = this->size();
+
+    ErrorCode ec = Sync(map_, static_cast<size_t>(size), policy_);
+    if (::munmap(map_, static_cast<size_t>(capacity_)) != 0)
+        ec = ErrorCode::io_error;
+    if (Failed ec2 = CloseFile(fd_, size, policy_))
+        ec = ec2.ec;
+
+    map_ = nullptr;
+    fd_ = -1;
+    return ec;
+}
+
+template <typename Fn>
+static ErrorCode AppendFormatted(MmapFile& file, Fn fn)
+{
+    MemoryWriter<> w;
+    if (Failed ec = fn(w))
+        return ec;
+
+    return file.append(w.data(), w.size());
+}
+
+ErrorCode fmtxx::impl::DoFormat(MmapFile& file, string_view format, Arg const* args, Types types)
+{
+    return AppendFormatted(file, [&](Writer& w) { return ::fmtxx::impl::DoFormat(w, format, args, types); });
+}
+
+ErrorCode fmtxx::impl::DoPrintf(MmapFile& file, string_view format, Arg const* args, Types types)
+{
+    return AppendFormatted(file, [&](Writer& w) { return ::fmtxx::impl::DoPrintf(w, format, args, types); });
+}
+
+#endif // _WIN32
@@ -0,0 +1,186 @@
+// Copyright (c) 2017 Alexander Bolz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef FMTXX_FORMAT_MMAP_H
+#define FMTXX_FORMAT_MMAP_H 1
+
+#include "Format.h"
+
+#ifndef _WIN32
+
+#include <atomic>
+#include <mutex>
+
+namespace fmtxx {
+
+// What to do with the pages of a window which has been completely written.
+enum struct MmapSyncPolicy : unsigned char {
+    none,  // Leave the write-back to the kernel.
+    async, // Start the write-back (msync MS_ASYNC).
+    sync,  // Wait for the write-back (msync MS_SYNC). On close, also fsync.
+};
+
+// Appends to a file through a memory mapping. POSIX only.
+//
+// A window of the file is mapped and the formatted output is stored directly
+// into the mapping. The file is extended (using posix_fallocate on Linux,
+// ftruncate otherwise) one window ahead of the write cursor. When the window
+// is full, it is unmapped and the next window is mapped. In steady state,
+// writing does not copy the output (other than into the mapping) and does not
+// make any system calls.
+//
+// The preallocated part of the file is truncated in close() and in the
+// destructor. (If the process dies before, the file ends with '\0's.) The
+// previous contents of the file are kept, even if writing has failed.
+class MmapWriter : public Writer
+{
+    int            fd_ = -1;
+    size_t         window_size_;
+    MmapSyncPolicy policy_;
+    char*          map_ = nullptr; // The current window
+    uint64_t       map_offset_ = 0; // The file offset of map_
+    uint64_t       file_size_ = 0; // The size of the file, including the preallocated part
+    uint64_t       open_size_ = 0; // The size of the file when it was opened
+    ErrorCode      ec_ = ErrorCode{};
+
+public:
+    // Opens (or creates) the file PATH and appends to its current contents.
+    // WINDOW_SIZE is rounded up to a multiple of the page size.
+    explicit MmapWriter(char const* path, size_t window_size = 4 << 20, MmapSyncPolicy policy = MmapSyncPolicy::none);
+
+    // Calls close().
+    ~MmapWriter();
+
+    MmapWriter(MmapWriter const&) = delete;
+    MmapWriter& operator=(MmapWriter const&) = delete;
+
+    // Returns whether the file is open (and no write has failed).
+    bool is_open() const { return ec_ == ErrorCode{} && fd_ >= 0; }
+
+    // Returns the first error (opening the file, or mapping a window).
+    ErrorCode ec() const { return ec_; }
+
+    // Returns the current size of the file, excluding the preallocated part.
+    uint64_t size() const;
+
+    // Synchronously writes the modified pages of the current window back to
+    // the file (msync MS_SYNC).
+    ErrorCode sync();
+
+    // Unmaps the current window, truncates the file to size() and closes the
+    // file. Writing fails with io_error afterwards.
+    ErrorCode close();
+
+private:
+    ErrorCode MapWindow(uint64_t pos);
+    ErrorCode UnmapWindow();
+    ErrorCode NextWindow();
+
+    ErrorCode Put(char c) override;
+    ErrorCode Write(char const* ptr, size_t len) override;
+    ErrorCode Pad(char c, size_t count) override;
+};
+
+// A memory mapped file, which any number of threads may append to
+// concurrently. POSIX only.
+//
+// The maximum size of the file is mapped up front (this only reserves address
+// space). Appending reserves a range of the file using an atomic fetch-add and
+// copies the message into the mapping, which does not lock a mutex (unless the
+// file needs to be extended, which happens once every GROW_SIZE bytes).
+//
+// Note: Ranges are reserved before they are written. A reader might observe
+// '\0's in ranges which have been reserved but not yet written.
+class MmapFile
+{
+    int                   fd_ = -1;
+    char*                 map_ = nullptr;
+    uint64_t              capacity_ = 0; // Size of the mapping
+    uint64_t              grow_size_;
+    MmapSyncPolicy        policy_;
+    std::atomic<uint64_t> size_;      // Number of bytes reserved
+    std::atomic<uint64_t> limit_;     // Offset of the first range which did not fit, if any
+    std::atomic<uint64_t> file_size_; // The size of the file, including the preallocated part
+    std::mutex            grow_mutex_;
+    bool                  grow_failed_ = false; // Guarded by grow_mutex_
+    ErrorCode             ec_ = ErrorCode{};
+
+public:
+    // Opens (or creates) the file PATH and appends to its current contents.
+    // Appending fails if the file would become larger than CAPACITY bytes.
+    explicit MmapFile(char const* path, uint64_t capacity = uint64_t{1} << 32, size_t grow_size = 16 << 20, MmapSyncPolicy policy = MmapSyncPolicy::none);
+
+    // Calls close(). No other thread may append concurrently.
+    ~MmapFile();
+
+    MmapFile(MmapFile const&) = delete;
+    MmapFile& operator=(MmapFile const&) = delete;
+
+    // Returns whether the file has been opened and mapped successfully.
+    bool is_open() const { return map_ != nullptr; }
+
+    // Returns the error which occurred while opening and mapping the file.
+    ErrorCode ec() const { return ec_; }
+
+    // Returns the number of bytes appended (reserved) so far.
+    uint64_t size() const;
+
+    // Copies [ptr, ptr + len) to the end of the file.
+    // Returns io_error if the capacity is exhausted or the file could not be
+    // extended. All following appends fail then, too.
+    ErrorCode append(char const* ptr, size_t len);
+
+    // Unmaps the file, truncates it to size() and closes it.
+    // No other thread may append concurrently.
+    ErrorCode close();
+
+private:
+    void SetLimit(uint64_t pos);
+    ErrorCode Grow(uint64_t end);
+};
+
+namespace impl {
+
+ErrorCode DoFormat(MmapFile& file, string_view format, Arg const* args, Types types);
+ErrorCode DoPrintf(MmapFile& file, string_view format, Arg const* args, Types types);
+
+} // namespace fmtxx::impl
+
+// Formats the message into a local buffer and appends it to FILE as a whole.
+// Nothing is appended if formatting fails.
+template <typename ...Args>
+ErrorCode format(MmapFile& file, string_view format, Args const&... args)
+{
+    fmtxx::impl::ArgArray<Args...> arr = {args...};
+    return fmtxx::impl::DoFormat(file, format, arr, fmtxx::impl::MakeTypes<Args...>::value);
+}
+
+template <typename ...Args>
+ErrorCode printf(MmapFile& file, string_view format, Args const&... args)
+{
+    fmtxx::impl::ArgArray<Args...> arr = {args...};
+    return fmtxx::impl::DoPrintf(file, format, arr, fmtxx::impl::MakeTypes<Args...>::value);
+}
+
+} // namespace fmtxx
+
+#endif // _WIN32
+
+#endif // FMTXX_FORMAT_MMAP_H
@@ -19,9 +19,13 @@
 // SOFTWARE.
 
 #include "Format_ostream.h"
+#include "Format_stats.h"
 
 #include <algorithm>
+#include <cstring>
 #include <limits>
+#include <memory>
+#include <vector>
 
 using namespace fmtxx;
 
@@ -29,20 +33,48 @@ using namespace fmtxx;
 //
 //------------------------------------------------------------------------------
 
-fmtxx::impl::StreamBuf::StreamBuf(Writer& w) : w_(w)
+fmtxx::impl::StreamBuf::StreamBuf()
 {
+    setp(buf_, buf_ + kBufferSize);
+}
+
+fmtxx::impl::StreamBuf::StreamBuf(Writer& w) : w_(&w)
+{
+    setp(buf_, buf_ + kBufferSize);
 }
 
 fmtxx::impl::StreamBuf::~StreamBuf()
 {
+    flush();
+}
+
+void fmtxx::impl::StreamBuf::reset(Writer& w)
+{
+    assert(pptr() == pbase());
+    w_ = &w;
+}
+
+ErrorCode fmtxx::impl::StreamBuf::flush()
+{
+    auto const len = static_cast<size_t>(pptr() - pbase());
+    if (len == 0)
+        return {};
+
+    setp(buf_, buf_ + kBufferSize);
+
+    assert(w_ != nullptr);
+    return w_->write(buf_, len);
 }
 
 fmtxx::impl::StreamBuf::int_type fmtxx::impl::StreamBuf::overflow(int_type ch)
 {
+    if (Failed(flush()))
+        return traits_type::eof();
     if (traits_type::eq_int_type(ch, traits_type::eof()))
         return 0;
-    if (Failed(w_.put(traits_type::to_char_type(ch))))
-        return traits_type::eof();
+
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
     return ch;
 }
 
@@ -51,11 +83,126 @@ std::streamsize fmtxx::impl::StreamBuf::xsputn(char const* str, std::streamsize
     assert(len >= 0);
     if (len == 0)
         return 0;
-    if (Failed(w_.write(str, static_cast<size_t>(len))))
+
+    auto const n = static_cast<size_t>(len);
+    if (n <= static_cast<size_t>(epptr() - pptr()))
+    {
+        std::memcpy(pptr(), str, n);
+        pbump(static_cast<int>(n));
+        return len;
+    }
+
+    // Does not fit into the buffer.
+    // Write the pending output and then the string directly.
+    if (Failed(flush()))
+        return 0;
+    if (Failed(w_->write(str, n)))
         return 0;
     return len;
 }
 
+int fmtxx::impl::StreamBuf::sync()
+{
+    return Failed(flush()) ? -1 : 0;
+}
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+struct fmtxx::impl::CachedStream::Entry
+{
+    StreamBuf         buf;
+    std::ostream      os{&buf};
+    std::locale const loc = os.getloc();
+};
+
+namespace {
+
+// Streams are re-used per nesting level: operator<< might itself format
+// objects using a CachedStream.
+struct StreamCache
+{
+    std::vector<std::unique_ptr<fmtxx::impl::CachedStream::Entry>> entries;
+    size_t depth = 0;
+
+    ~StreamCache();
+};
+
+} // namespace
+
+static thread_local StreamCache t_stream_cache;
+
+// Set when t_stream_cache has been destroyed.
+static thread_local bool t_stream_cache_destroyed = false;
+
+StreamCache::~StreamCache()
+{
+    t_stream_cache_destroyed = true;
+}
+
+fmtxx::impl::CachedStream::CachedStream(Writer& w)
+{
+    if (t_stream_cache_destroyed)
+    {
+        entry_ = new Entry;
+        cached_ = false;
+    }
+    else
+    {
+        auto& cache = t_stream_cache;
+
+        if (cache.depth == cache.entries.size())
+            cache.entries.emplace_back(new Entry);
+
+        entry_ = cache.entries[cache.depth].get();
+        ++cache.depth;
+    }
+
+    entry_->buf.reset(w);
+
+    auto& os = entry_->os;
+    os.exceptions(std::ios_base::goodbit);
+    os.clear();
+    os.flags(std::ios_base::skipws | std::ios_base::dec);
+    os.width(0);
+    os.precision(6);
+    os.fill(' ');
+    if (os.getloc() != entry_->loc)
+        os.imbue(entry_->loc);
+}
+
+fmtxx::impl::CachedStream::~CachedStream()
+{
+    // Write the pending output if finish() has not been called (e.g. if
+    // operator<< has thrown an exception).
+    entry_->buf.flush();
+
+    if (cached_)
+        --t_stream_cache.depth;
+    else
+        delete entry_;
+}
+
+std::ostream& fmtxx::impl::CachedStream::stream()
+{
+    return entry_->os;
+}
+
+ErrorCode fmtxx::impl::CachedStream::finish()
+{
+    auto& os = entry_->os;
+
+    if (Failed(entry_->buf.flush()))
+        os.setstate(std::ios_base::badbit);
+
+    if (os.bad())
+        return ErrorCode::io_error;
+    if (os.fail())
+        return ErrorCode::conversion_error;
+    return {};
+}
+
 //------------------------------------------------------------------------------
 //
 //------------------------------------------------------------------------------
@@ -85,6 +232,7 @@ inline ErrorCode StreamWriter::Put(char c)
         return ErrorCode::io_error;
     }
 
+    stats::impl::CountBytes(stats::WriterKind::ostream, 1);
     return {};
 }
 
@@ -99,6 +247,7 @@ inline ErrorCode StreamWriter::Write(char const* str, size_t len)
         return ErrorCode::io_error;
     }
 
+    stats::impl::CountBytes(stats::WriterKind::ostream, len);
     return {};
 }
 
@@ -124,13 +273,22 @@ inline ErrorCode StreamWriter::Pad(char c, size_t count)
 
 ErrorCode fmtxx::impl::DoFormat(std::ostream& os, string_view format, Arg const* args, Types types)
 {
+    stats::impl::CallScope const scope{stats::EntryPoint::format_ostream};
+
     auto ec = ErrorCode::success;
 
     std::ostream::sentry const ok(os);
     if (ok)
     {
+        // Format into a local buffer first, then write the string to the
+        // stream with a single call to sputn.
+        MemoryWriter<> buf;
+        ec = fmtxx::impl::DoFormat(buf, format, args, types);
+
         StreamWriter w{os};
-        ec = fmtxx::impl::DoFormat(w, format, args, types);
+        auto const ec_write = w.write(buf.data(), buf.size());
+        if (ec == ErrorCode::success)
+            ec = ec_write;
     }
     else
     {
@@ -146,13 +304,22 @@ ErrorCode fmtxx::impl::DoFormat(std::ostream& os, string_view format, Arg const*
 
 ErrorCode fmtxx::impl::DoPrintf(std::ostream& os, string_view format, Arg const* args, Types types)
 {
+    stats::impl::CallScope const scope{stats::EntryPoint::printf_ostream};
+
     auto ec = ErrorCode::success;
 
     std::ostream::sentry const ok(os);
     if (ok)
     {
+        // Format into a local buffer first, then write the string to the
+        // stream with a single call to sputn.
+        MemoryWriter<> buf;
+        ec = fmtxx::impl::DoPrintf(buf, format, args, types);
+
         StreamWriter w{os};
-        ec = fmtxx::impl::DoPrintf(w, format, args, types);
+        auto const ec_write = w.write(buf.data(), buf.size());
+        if (ec == ErrorCode::success)
+            ec = ec_write;
     }
     else
     {
@@ -30,17 +30,67 @@ namespace fmtxx {
 
 namespace impl {
 
+// A streambuf which writes to a Writer.
+// Small insertions are collected in a local buffer, which is passed to the
+// writer when it is full, on sync() and on destruction.
 class StreamBuf final : public std::streambuf
 {
-    Writer& w_;
+    static constexpr size_t kBufferSize = 256;
+
+    Writer* w_ = nullptr;
+    char    buf_[kBufferSize];
 
 public:
+    StreamBuf();
     explicit StreamBuf(Writer& w);
     ~StreamBuf();
 
+    // Sets the writer.
+    // Must only be called if no output is pending, i.e. after flush().
+    void reset(Writer& w);
+
+    // Passes the buffered characters to the writer.
+    ErrorCode flush();
+
 protected:
     int_type overflow(int_type ch = traits_type::eof()) override;
     std::streamsize xsputn(char const* str, std::streamsize len) override;
+    int sync() override;
+};
+
+// Provides a std::ostream which writes to a Writer.
+//
+// Constructing a std::ostream is expensive (it copies the global locale, which
+// might require a global lock). The streams are therefore cached (per thread
+// and nesting level) and re-used. Before each use the stream is reset to the
+// state of a newly constructed stream: flags, fill character, width,
+// precision, exception mask, error state and locale (as it was when the
+// stream was first created).
+// If the cache has already been destroyed on thread exit (e.g. when used from
+// the destructor of another thread_local object), a new stream is constructed.
+class CachedStream
+{
+public:
+    struct Entry; // Internal.
+
+private:
+    Entry* entry_;
+    bool cached_ = true; // entry_ is owned by the cache
+
+public:
+    explicit CachedStream(Writer& w);
+    ~CachedStream();
+
+    CachedStream(CachedStream const&) = delete;
+    CachedStream& operator=(CachedStream const&) = delete;
+
+    // Returns the stream.
+    std::ostream& stream();
+
+    // Flushes the stream.
+    // Returns io_error if writing failed, conversion_error if the stream's
+    // failbit has been set.
+    ErrorCode finish();
 };
 
 namespace type_traits {
@@ -72,14 +122,9 @@ struct DefaultFormatValue<T, Type::other>
     // implementations of operator<< set some flags themselves (possibly resetting on exit).
     ErrorCode operator()(Writer& w, FormatSpec const& /*spec*/, T const& val) const
     {
-        StreamBuf buf{w};
-        std::ostream os{&buf};
-        os << val;
-        if (os.bad())
-            return ErrorCode::io_error;
-        if (os.fail())
-            return ErrorCode::conversion_error;
-        return {};
+        CachedStream cs{w};
+        cs.stream() << val;
+        return cs.finish();
     }
 };
 
@@ -0,0 +1,233 @@
+// Copyright (c) 2017 Alexander Bolz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "Format_parallel.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace fmtxx;
+using namespace fmtxx::impl;
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+// Bounds for the automatically chosen chunk size (in elements).
+static constexpr size_t kMinChunkSize = 256;
+static constexpr size_t kMaxChunkSize = 16 * 1024;
+// Number of chunks per thread for the automatically chosen chunk size.
+static constexpr size_t kChunksPerThread = 8;
+// Maximum number of chunks (per thread) which have been formatted or are being
+// formatted, but have not yet been written.
+static constexpr size_t kWindowPerThread = 2;
+
+namespace {
+
+struct Slot
+{
+    MemoryWriter<> buf;
+    ErrorCode      ec = ErrorCode{};
+    std::exception_ptr ex;        // Thrown by the formatter
+    bool           ready = false; // Protected by ParallelJob::mutex
+};
+
+struct ParallelJob
+{
+    FormatChunkFn const      fn;
+    void const* const        data;
+    size_t const             n;
+    size_t const             chunk_size;
+    size_t const             window;
+    std::unique_ptr<Slot[]>  slots;
+    std::mutex               mutex;
+    std::condition_variable  slot_ready;
+    std::condition_variable  slot_free;
+    size_t                   next = 0;    // The next chunk to be formatted
+    size_t                   written = 0; // The number of chunks written
+    size_t                   stop;        // Chunks >= stop are not formatted
+
+    ParallelJob(FormatChunkFn fn_, void const* data_, size_t n_, size_t chunk_size_, size_t num_chunks, size_t window_)
+        : fn(fn_)
+        , data(data_)
+        , n(n_)
+        , chunk_size(chunk_size_)
+        , window(window_)
+        , slots(new Slot[window_])
+        , stop(num_chunks)
+    {
+    }
+
+    void Work();
+    void Stop();
+};
+
+// Stops the job and joins the worker threads, even if an exception is thrown
+// on the calling thread.
+struct JoinGuard
+{
+    ParallelJob&              job;
+    std::vector<std::thread>& workers;
+
+    ~JoinGuard()
+    {
+        job.Stop();
+        for (auto& t : workers)
+            t.join();
+    }
+};
+
+} // namespace
+
+void ParallelJob::Work()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (;;)
+    {
+        slot_free.wait(lock, [&] { return next >= stop || next < written + window; });
+        if (next >= stop)
+            return;
+
+        size_t const chunk = next++;
+        Slot& slot = slots[chunk % window];
+
+        lock.unlock();
+
+        size_t const first = chunk * chunk_size;
+        size_t const last = std::min(n, first + chunk_size);
+
+        slot.buf.clear();
+
+        ErrorCode ec = ErrorCode{};
+        std::exception_ptr ex;
+        try
+        {
+            ec = fn(slot.buf, data, first, last);
+        }
+        catch (...)
+        {
+            // Rethrown on the calling thread.
+            ex = std::current_exception();
+        }
+
+        lock.lock();
+
+        slot.ec = ec;
+        slot.ex = ex;
+        slot.ready = true;
+        if (ec != ErrorCode{} || ex)
+        {
+            // Chunks up to (and including) this one have already been claimed
+            // and will be completed.
+            stop = std::min(stop, chunk + 1);
+            slot_free.notify_all();
+        }
+        slot_ready.notify_one();
+    }
+}
+
+// Prevents any further chunks from being formatted.
+// Chunks which are currently being formatted are completed.
+void ParallelJob::Stop()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    stop = std::min(stop, next);
+    slot_free.notify_all();
+}
+
+ErrorCode fmtxx::impl::DoFormatParallel(Writer& w, size_t n, FormatChunkFn fn, void const* data, int threads, size_t chunk_size)
+{
+    size_t num_threads = threads > 0 ? static_cast<size_t>(threads) : std::thread::hardware_concurrency();
+    if (num_threads == 0)
+        num_threads = 1;
+
+    if (chunk_size == 0)
+        chunk_size = std::min(kMaxChunkSize, std::max(kMinChunkSize, n / (num_threads * kChunksPerThread)));
+
+    size_t const num_chunks = n / chunk_size + (n % chunk_size != 0 ? 1 : 0);
+
+    // Not worth spawning threads.
+    if (num_threads == 1 || num_chunks <= 1)
+        return fn(w, data, 0, n);
+
+    num_threads = std::min(num_threads, num_chunks);
+
+    ParallelJob job(fn, data, n, chunk_size, num_chunks, num_threads * kWindowPerThread);
+
+    std::vector<std::thread> workers;
+    workers.reserve(num_threads);
+
+    ErrorCode result = ErrorCode{};
+    std::exception_ptr ex;
+    {
+        JoinGuard const guard{job, workers};
+
+        for (size_t i = 0; i < num_threads; ++i)
+            workers.emplace_back([&job] { job.Work(); });
+
+        for (size_t chunk = 0; chunk < num_chunks; ++chunk)
+        {
+            Slot& slot = job.slots[chunk % job.window];
+            {
+                std::unique_lock<std::mutex> lock(job.mutex);
+                if (chunk >= job.stop)
+                    break;
+                job.slot_ready.wait(lock, [&] { return slot.ready; });
+            }
+
+            // Write the output of the chunk, even if formatting failed.
+            if (Failed ec = w.write(slot.buf.data(), slot.buf.size()))
+            {
+                result = ec;
+                break;
+            }
+            if (slot.ex)
+            {
+                ex = slot.ex;
+                break;
+            }
+            if (slot.ec != ErrorCode{})
+            {
+                result = slot.ec;
+                break;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(job.mutex);
+                slot.ready = false;
+                ++job.written;
+            }
+            job.slot_free.notify_all();
+        }
+    } // Stops the job and joins the workers.
+
+    if (ex)
+        std::rethrow_exception(ex);
+
+    return result;
+}
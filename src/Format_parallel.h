@@ -0,0 +1,100 @@
+// Copyright (c) 2017 Alexander Bolz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef FMTXX_FORMAT_PARALLEL_H
+#define FMTXX_FORMAT_PARALLEL_H 1
+
+#include "Format.h"
+
+#include <iterator>
+
+namespace fmtxx {
+
+namespace impl {
+
+// Formats the elements [first, last) of the range described by DATA into W.
+using FormatChunkFn = ErrorCode (*)(Writer& w, void const* data, size_t first, size_t last);
+
+ErrorCode DoFormatParallel(Writer& w, size_t n, FormatChunkFn fn, void const* data, int threads, size_t chunk_size);
+
+template <typename It>
+struct ParallelRange
+{
+    CompiledFormat const& format;
+    It first;
+};
+
+template <typename It>
+ErrorCode FormatParallelChunk(Writer& w, void const* data, size_t first, size_t last)
+{
+    using Diff = typename std::iterator_traits<It>::difference_type;
+
+    auto const& range = *static_cast<ParallelRange<It> const*>(data);
+
+    It it = range.first + static_cast<Diff>(first);
+    for (size_t i = first; i != last; ++i, ++it)
+    {
+        if (Failed ec = fmtxx::format(w, range.format, *it))
+            return ec;
+    }
+
+    return {};
+}
+
+} // namespace fmtxx::impl
+
+// Formats each element in [FIRST, LAST) using FORMAT (with the element as the
+// only argument) and writes the concatenated output to W.
+//
+// The range is split into chunks of CHUNK_SIZE elements (0 = automatic), which
+// are formatted into thread-private buffers by THREADS worker threads
+// (0 = std::thread::hardware_concurrency()). The calling thread writes the
+// chunks to W in order, as soon as they are complete. At most a few chunks per
+// thread are buffered at any time.
+//
+// The output (and the returned error code) is the same as if the elements
+// were formatted one after the other: If formatting an element fails, the
+// output up to that point is written and formatting stops.
+// Exceptions thrown by FormatValue (or by W) are rethrown on the calling
+// thread, after all worker threads have finished.
+//
+// Note: The iterators must be random-access iterators and FormatValue must be
+// safe to call concurrently for different elements.
+template <typename It>
+ErrorCode format_parallel(Writer& w, CompiledFormat const& format, It first, It last, int threads = 0, size_t chunk_size = 0)
+{
+    static_assert(std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<It>::iterator_category>::value,
+        "format_parallel requires random-access iterators");
+
+    fmtxx::impl::ParallelRange<It> const range{format, first};
+    return fmtxx::impl::DoFormatParallel(w, static_cast<size_t>(last - first), &fmtxx::impl::FormatParallelChunk<It>, &range, threads, chunk_size);
+}
+
+template <typename It>
+ErrorCode format_parallel(Writer& w, string_view format, It first, It last, int threads = 0, size_t chunk_size = 0)
+{
+    CompiledFormat const compiled{format};
+    return fmtxx::format_parallel(w, compiled, first, last, threads, chunk_size);
+}
+
+} // namespace fmtxx
+
+#endif // FMTXX_FORMAT_PARALLEL_H
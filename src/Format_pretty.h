@@ -23,11 +23,39 @@
 
 #include "Format.h"
 
+#include <cstring>  // memcpy, memset
 #include <iterator> // begin, end
+#include <limits>   // numeric_limits
 #include <utility>  // declval, forward, get<pair>, tuple_size<pair>
 
 namespace fmtxx {
 
+// Specialize this to pretty-print custom types.
+template <typename T = void, typename /*Enable*/ = void>
+struct FormatPretty;
+
+// Limits the output of pretty().
+//
+// When a limit is hit, the output is truncated and marked with "...". The
+// remaining elements are not visited, so that the cost of pretty-printing huge
+// containers is bounded.
+//
+// The limits apply to the containers and tuples printed by the default
+// implementation of FormatPretty.
+struct PrettyLimits
+{
+    // Maximum number of elements printed per container: [1, 2, 3, ...]
+    size_t max_elements = std::numeric_limits<size_t>::max();
+
+    // Maximum nesting depth of containers and tuples. More deeply nested
+    // containers are printed as [...] and tuples as {...}.
+    int max_depth = std::numeric_limits<int>::max();
+
+    // Maximum number of characters written (not including the "..." appended
+    // if the output has been truncated).
+    size_t max_bytes = std::numeric_limits<size_t>::max();
+};
+
 //------------------------------------------------------------------------------
 //
 //------------------------------------------------------------------------------
@@ -38,6 +66,7 @@ namespace impl
     struct PrettyPrinter
     {
         T object;
+        PrettyLimits limits;
     };
 }
 
@@ -47,7 +76,13 @@ inline impl::PrettyPrinter<T> pretty(T&& object)
     // NB:
     // Forward lvalue-references, copy rvalue-references.
 
-    return impl::PrettyPrinter<T>{std::forward<T>(object)};
+    return impl::PrettyPrinter<T>{std::forward<T>(object), PrettyLimits{}};
+}
+
+template <typename T>
+inline impl::PrettyPrinter<T> pretty(T&& object, PrettyLimits const& limits)
+{
+    return impl::PrettyPrinter<T>{std::forward<T>(object), limits};
 }
 
 //------------------------------------------------------------------------------
@@ -88,8 +123,187 @@ struct IsTuple<T, Void_t< typename std::tuple_size<T>::type >>
 {
 };
 
+// Test if FormatPretty<T> is not specialized for T.
+template <typename T, typename = void>
+struct HasDefaultPretty
+    : std::false_type
+{
+};
+
+template <typename T>
+struct HasDefaultPretty<T, Void_t< typename FormatPretty<T>::default_pretty >>
+    : std::true_type
+{
+};
+
+// The element type of containers which store their elements contiguously,
+// or void.
+template <typename T, typename = void>
+struct ContiguousElement
+{
+    using type = void;
+};
+
+template <typename T>
+struct ContiguousElement<T, typename std::enable_if< IsContiguous<T>::value >::type>
+{
+    using type = typename std::remove_cv<
+        typename std::remove_pointer< decltype(std::declval<T const&>().data()) >::type
+    >::type;
+};
+
+template <typename T, size_t N>
+struct ContiguousElement<T[N]>
+{
+    using type = typename std::remove_cv<T>::type;
+};
+
 } // namespace type_traits
 
+// Forwards at most MAX_BYTES characters to another Writer.
+// The output is collected in a local buffer. The buffer window never extends
+// beyond the budget, so that the limit is only checked if the window is full.
+// Once the budget is exhausted, all further output fails.
+class PrettyWriter final : public Writer
+{
+    Writer&   out_;
+    size_t    avail_;             // Remaining budget, not including the buffered characters
+    bool      exhausted_ = false;
+    char      buf_[256];
+
+public:
+    PrettyWriter(Writer& out, size_t max_bytes) : out_(out), avail_(max_bytes) { ResetWindow(); }
+
+    // Returns whether any output has been dropped.
+    bool exhausted() const { return exhausted_; }
+
+    // Writes the buffered characters to the underlying Writer.
+    ErrorCode flush()
+    {
+        size_t const len = Length();
+        if (len == 0)
+            return {};
+
+        avail_ -= len;
+        ResetWindow();
+        return out_.write(buf_, len);
+    }
+
+private:
+    size_t Length() const { return static_cast<size_t>(window_next() - buf_); }
+    size_t Available() const { return static_cast<size_t>(window_last() - window_next()); }
+
+    void ResetWindow()
+    {
+        set_window(buf_, buf_ + (avail_ < sizeof(buf_) ? avail_ : sizeof(buf_)));
+    }
+
+    // Flushes the buffer if it is full.
+    // Returns an error if the budget is exhausted.
+    ErrorCode MakeRoom()
+    {
+        if (Available() != 0)
+            return {};
+        if (Failed ec = flush())
+            return ec;
+        if (Available() != 0)
+            return {};
+
+        exhausted_ = true;
+        return ErrorCode::io_error;
+    }
+
+    ErrorCode Put(char c) override
+    {
+        if (Failed ec = MakeRoom())
+            return ec;
+
+        char* const next = window_next();
+        *next = c;
+        set_window(next + 1, window_last());
+        return {};
+    }
+
+    ErrorCode Write(char const* ptr, size_t len) override
+    {
+        while (len > 0)
+        {
+            if (Failed ec = MakeRoom())
+                return ec;
+
+            char* const next = window_next();
+            size_t const n = (len < Available()) ? len : Available();
+            std::memcpy(next, ptr, n);
+            set_window(next + n, window_last());
+            ptr += n;
+            len -= n;
+        }
+
+        return {};
+    }
+
+    ErrorCode Pad(char c, size_t count) override
+    {
+        while (count > 0)
+        {
+            if (Failed ec = MakeRoom())
+                return ec;
+
+            char* const next = window_next();
+            size_t const n = (count < Available()) ? count : Available();
+            std::memset(next, static_cast<unsigned char>(c), n);
+            set_window(next + n, window_last());
+            count -= n;
+        }
+
+        return {};
+    }
+
+    ErrorCode Reserve(size_t n) override
+    {
+        return out_.reserve(n < avail_ ? n : avail_);
+    }
+};
+
+// The limits of the innermost pretty() call which is currently being
+// formatted on this thread.
+// The limits only apply to output written to WRITER. Objects which are
+// formatted into another Writer by a specialization of FormatPretty are not
+// limited.
+struct PrettyContext
+{
+    Writer*        writer;
+    PrettyLimits   limits;
+    int            depth = 0;
+    PrettyContext* prev;
+
+    PrettyContext(Writer& w, PrettyLimits const& l) : writer(&w), limits(l), prev(Current())
+    {
+        Current() = this;
+    }
+
+    ~PrettyContext()
+    {
+        Current() = prev;
+    }
+
+    PrettyContext(PrettyContext const&) = delete;
+    PrettyContext& operator=(PrettyContext const&) = delete;
+
+    static PrettyContext*& Current()
+    {
+        static thread_local PrettyContext* current = nullptr;
+        return current;
+    }
+
+    // Returns the limits which apply to output written to W, or null.
+    static PrettyContext* Find(Writer& w)
+    {
+        PrettyContext* const ctx = Current();
+        return (ctx != nullptr && ctx->writer == &w) ? ctx : nullptr;
+    }
+};
+
 struct PP
 {
     struct AsString {};
@@ -97,6 +311,10 @@ struct PP
     struct AsTuple {};
     struct AsOther {};
 
+    struct ElementsAsNumbers {};
+    struct ElementsAsStrings {};
+    struct ElementsAsOther {};
+
     //
     // Determine how to print objects of type T.
     //
@@ -122,6 +340,37 @@ struct PP
             >::type
         >::type;
 
+    //
+    // Determine how to print the elements of the container T.
+    //
+    // Contiguous ranges of numbers and strings for which FormatPretty has not
+    // been specialized are printed in a loop which does not recurse into
+    // FormatPretty for each element. The output is the same.
+    //
+    template <typename E, bool = std::is_void<E>::value || !type_traits::HasDefaultPretty<E>::value>
+    struct SelectElementsAs
+    {
+        using type = ElementsAsOther;
+    };
+
+    template <typename E>
+    struct SelectElementsAs<E, false>
+    {
+        using type =
+            typename std::conditional<
+                !std::is_same<RangeTag<E>, RangeOther>::value,
+                ElementsAsNumbers,
+                typename std::conditional<
+                    MayTreatAsString<E>::value && std::is_same<PrintAs<E const&>, AsString>::value,
+                    ElementsAsStrings,
+                    ElementsAsOther
+                >::type
+            >::type;
+    };
+
+    template <typename T>
+    using PrintElementsAs = typename SelectElementsAs<typename type_traits::ContiguousElement<T>::type>::type;
+
     // Recursively calls FormatPretty<T>::operator().
     // The default implementation of FormatPretty<T>::operator() then calls PP::Print(w, spec, val, PRINT_AS).
     template <typename T>
@@ -151,6 +400,132 @@ struct PP
 
     template <typename T>
     static ErrorCode Print(Writer& w, FormatSpec const& spec, T const& val, AsContainer)
+    {
+        PrettyContext* const ctx = PrettyContext::Find(w);
+        if (ctx == nullptr)
+            return PrintElements(w, spec, val, PrintElementsAs<T>(), std::numeric_limits<size_t>::max());
+
+        if (ctx->depth >= ctx->limits.max_depth)
+            return w.write("[...]", 5);
+
+        ++ctx->depth;
+        ErrorCode const ec = PrintElements(w, spec, val, PrintElementsAs<T>(), ctx->limits.max_elements);
+        --ctx->depth;
+
+        return ec;
+    }
+
+    // Writes the marker for omitted elements, preceded by SEP if any elements
+    // have been printed.
+    static ErrorCode PrintEllipsis(Writer& w, string_view sep, bool first)
+    {
+        if (!first)
+        {
+            if (Failed ec = w.write(sep.data(), sep.size()))
+                return ec;
+        }
+
+        return w.write("...", 3);
+    }
+
+    template <typename E, size_t N>
+    static E const* Data(E const (&arr)[N]) { return arr; }
+    template <typename E, size_t N>
+    static size_t Size(E const (&/*arr*/)[N]) { return N; }
+
+    template <typename T>
+    static auto Data(T const& val) -> decltype(val.data()) { return val.data(); }
+    template <typename T>
+    static size_t Size(T const& val) { return static_cast<size_t>(val.size()); }
+
+    // Returns an estimate of the length of a number of type E formatted using SPEC.
+    template <typename E>
+    static size_t EstimateLength(FormatSpec const& spec)
+    {
+        size_t const len = std::is_floating_point<E>::value
+            ? (spec.prec >= 0 ? static_cast<size_t>(spec.prec) + 8 : 24)
+            : static_cast<size_t>(std::numeric_limits<E>::digits10) + 2;
+
+        return (spec.width > 0 && static_cast<size_t>(spec.width) > len) ? static_cast<size_t>(spec.width) : len;
+    }
+
+    template <typename T>
+    static ErrorCode PrintElements(Writer& w, FormatSpec const& spec, T const& val, ElementsAsNumbers, size_t max_elements)
+    {
+        using E = typename type_traits::ContiguousElement<T>::type;
+
+        string_view const sep = spec.style.empty() ? ", " : spec.style;
+
+        auto const first = Data(val);
+        size_t const size = Size(val);
+        size_t const n = (size < max_elements) ? size : max_elements;
+
+        if (Failed ec = w.reserve(2 + n * (EstimateLength<E>(spec) + sep.size())))
+            return ec;
+        if (Failed ec = w.put('['))
+            return ec;
+        if (Failed ec = FormatRangeDispatch(w, spec, first, first + n, sep))
+            return ec;
+        if (n < size)
+        {
+            if (Failed ec = PrintEllipsis(w, sep, n == 0))
+                return ec;
+        }
+        if (Failed ec = w.put(']'))
+            return ec;
+
+        return {};
+    }
+
+    template <typename T>
+    static ErrorCode PrintElements(Writer& w, FormatSpec const& spec, T const& val, ElementsAsStrings, size_t max_elements)
+    {
+        string_view const sep = spec.style.empty() ? ", " : spec.style;
+
+        auto const first = Data(val);
+        size_t const size = Size(val);
+        size_t const n = (size < max_elements) ? size : max_elements;
+
+        // The length of the output is known in advance.
+        size_t len = 2;
+        for (size_t i = 0; i < n; ++i)
+            len += 2 + static_cast<size_t>(first[i].size());
+        if (n > 1)
+            len += (n - 1) * sep.size();
+
+        if (Failed ec = w.reserve(len))
+            return ec;
+        if (Failed ec = w.put('['))
+            return ec;
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (i != 0)
+            {
+                if (Failed ec = w.write(sep.data(), sep.size()))
+                    return ec;
+            }
+            if (Failed ec = w.put('"'))
+                return ec;
+            if (Failed ec = w.write(first[i].data(), static_cast<size_t>(first[i].size())))
+                return ec;
+            if (Failed ec = w.put('"'))
+                return ec;
+        }
+
+        if (n < size)
+        {
+            if (Failed ec = PrintEllipsis(w, sep, n == 0))
+                return ec;
+        }
+        if (Failed ec = w.put(']'))
+            return ec;
+
+        return {};
+    }
+
+    template <typename T>
+    static ErrorCode PrintElements(Writer& w, FormatSpec const& spec, T const& val, ElementsAsOther, size_t max_elements)
     {
         using std::begin; // using ADL!
         using std::end;   // using ADL!
@@ -164,14 +539,25 @@ struct PP
         auto E = end(val);
         if (I != E)
         {
-            for (;;)
+            for (size_t n = 0; ; )
             {
+                if (n == max_elements)
+                {
+                    // Stop here. Do not walk the rest of the range.
+                    if (Failed ec = PrintEllipsis(w, sep, n == 0))
+                        return ec;
+                    break;
+                }
                 if (Failed ec = Print(w, spec, *I)) // Recursive!!!
                     return ec;
+                ++n;
                 if (++I == E)
                     break;
-                if (Failed ec = w.write(sep.data(), sep.size()))
-                    return ec;
+                if (n != max_elements)
+                {
+                    if (Failed ec = w.write(sep.data(), sep.size()))
+                        return ec;
+                }
             }
         }
 
@@ -213,7 +599,7 @@ struct PP
     }
 
     template <typename T>
-    static ErrorCode Print(Writer& w, FormatSpec const& spec, T const& val, AsTuple)
+    static ErrorCode PrintTupleElements(Writer& w, FormatSpec const& spec, T const& val)
     {
         if (Failed ec = w.put('{'))
             return ec;
@@ -225,6 +611,23 @@ struct PP
         return {};
     }
 
+    template <typename T>
+    static ErrorCode Print(Writer& w, FormatSpec const& spec, T const& val, AsTuple)
+    {
+        PrettyContext* const ctx = PrettyContext::Find(w);
+        if (ctx == nullptr)
+            return PrintTupleElements(w, spec, val);
+
+        if (ctx->depth >= ctx->limits.max_depth)
+            return w.write("{...}", 5);
+
+        ++ctx->depth;
+        ErrorCode const ec = PrintTupleElements(w, spec, val);
+        --ctx->depth;
+
+        return ec;
+    }
+
     template <typename T>
     static ErrorCode Print(Writer& w, FormatSpec const& spec, T const& val, AsOther)
     {
@@ -233,14 +636,19 @@ struct PP
         // Fall back to FormatValue and see what happens.
         return FormatValue<>{}(w, spec, val);
     }
+
+    template <typename T>
+    static ErrorCode Print(Writer& w, FormatSpec const& spec, T const& val, PrettyLimits const& limits);
 };
 
 } // namespace impl
 
-// Specialize this to pretty-print custom types.
-template <typename T = void, typename /*Enable*/ = void>
+template <typename T, typename /*Enable*/>
 struct FormatPretty
 {
+    // Marks the default implementation.
+    using default_pretty = void;
+
     ErrorCode operator()(Writer& w, FormatSpec const& spec, T const& val) const
     {
         // Note:
@@ -272,6 +680,38 @@ namespace impl
         // impl::PP::Print (the 4 argument version, so there is no infinite recursion here).
         return FormatPretty<T>{}(w, spec, val);
     }
+
+    template <typename T>
+    ErrorCode PP::Print(Writer& w, FormatSpec const& spec, T const& val, PrettyLimits const& limits)
+    {
+        size_t const kUnlimited = std::numeric_limits<size_t>::max();
+
+        if (limits.max_bytes == kUnlimited)
+        {
+            if (limits.max_elements == kUnlimited && limits.max_depth == std::numeric_limits<int>::max())
+                return Print(w, spec, val);
+
+            PrettyContext ctx(w, limits);
+            return Print(w, spec, val);
+        }
+
+        PrettyWriter out(w, limits.max_bytes);
+
+        ErrorCode ec = ErrorCode{};
+        {
+            PrettyContext ctx(out, limits);
+            ec = Print(out, spec, val);
+        }
+
+        // Write the output up to the limit, even if formatting failed.
+        if (Failed flush_ec = out.flush())
+            return flush_ec;
+
+        if (out.exhausted())
+            return w.write("...", 3);
+
+        return ec;
+    }
 }
 
 template <typename T>
@@ -279,7 +719,7 @@ struct FormatValue<impl::PrettyPrinter<T>>
 {
     ErrorCode operator()(Writer& w, FormatSpec const& spec, impl::PrettyPrinter<T> const& value) const
     {
-        return impl::PP::Print(w, spec, value.object);
+        return impl::PP::Print(w, spec, value.object, value.limits);
     }
 };
 
@@ -0,0 +1,672 @@
+// Copyright (c) 2017 Alexander Bolz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "Format_scan.h"
+
+#include <limits>
+
+using namespace fmtxx;
+using namespace fmtxx::impl;
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+// Not locale-dependent.
+static bool IsSpace(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static bool IsDecimalDigit(char c)
+{
+    return static_cast<unsigned char>(c) - static_cast<unsigned>('0') <= 9;
+}
+
+static char ToLower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+static char const* SkipSpace(char const* p, char const* end)
+{
+    while (p != end && IsSpace(*p))
+        ++p;
+    return p;
+}
+
+// Returns whether [P, END) starts with the lower-case string STR (ignoring case).
+static bool StartsWithIgnoreCase(char const* p, char const* end, char const* str, size_t len)
+{
+    if (static_cast<size_t>(end - p) < len)
+        return false;
+
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (ToLower(p[i]) != str[i])
+            return false;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Integers
+//------------------------------------------------------------------------------
+
+static uint64_t Load8(char const* p)
+{
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+// Returns whether all 8 bytes of V are in the range ['0', '9'].
+static bool IsEightDigits(uint64_t v)
+{
+    return ((v & 0xF0F0F0F0F0F0F0F0) | (((v + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) == 0x3333333333333333;
+}
+
+// Converts 8 decimal digits (the first digit in the lowest byte) to an integer.
+static uint32_t ParseEightDigits(uint64_t v)
+{
+    uint64_t const kMask = 0x000000FF000000FF;
+    uint64_t const kMul1 = 100 + (uint64_t{1000000} << 32);
+    uint64_t const kMul2 = 1 + (uint64_t{10000} << 32);
+
+    v -= 0x3030303030303030;
+    v = (v * 10) + (v >> 8); // Combine pairs of digits
+    v = (((v & kMask) * kMul1) + (((v >> 16) & kMask) * kMul2)) >> 32;
+
+    return static_cast<uint32_t>(v);
+}
+
+// Parses a sequence of decimal digits.
+// The first 16 digits are converted 8 at a time (they cannot overflow); only
+// the remaining digits are checked for overflow. On overflow, the remaining
+// digits are consumed and OVERFLOW is set.
+static char const* ParseDecimalDigits(char const* p, char const* end, uint64_t& value, bool& overflow)
+{
+    char const* const first = p;
+
+    uint64_t v = 0;
+
+    while (end - p >= 8 && p - first < 16)
+    {
+        uint64_t const chunk = Load8(p);
+        if (!IsEightDigits(chunk))
+            break;
+        v = v * 100000000 + ParseEightDigits(chunk);
+        p += 8;
+    }
+
+    for ( ; p != end; ++p)
+    {
+        uint32_t const d = static_cast<unsigned char>(*p) - static_cast<uint32_t>('0');
+        if (d > 9)
+            break;
+        if (v > (UINT64_MAX - d) / 10)
+            overflow = true;
+        v = 10 * v + d;
+    }
+
+    value = v;
+    return p;
+}
+
+static uint32_t DigitValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return static_cast<uint32_t>(c - '0');
+    c = ToLower(c);
+    if (c >= 'a' && c <= 'z')
+        return static_cast<uint32_t>(c - 'a' + 10);
+    return UINT32_MAX;
+}
+
+// Parses a sequence of digits in base BASE (2, 8 or 16).
+static char const* ParseRadixDigits(char const* p, char const* end, uint32_t base, uint64_t& value, bool& overflow)
+{
+    int const shift = base == 16 ? 4 : (base == 8 ? 3 : 1);
+
+    uint64_t v = 0;
+    for ( ; p != end; ++p)
+    {
+        uint32_t const d = DigitValue(*p);
+        if (d >= base)
+            break;
+        if ((v >> (64 - shift)) != 0)
+            overflow = true;
+        v = (v << shift) | d;
+    }
+
+    value = v;
+    return p;
+}
+
+static uint32_t IntegerBase(char conv)
+{
+    switch (conv)
+    {
+    case 'x':
+    case 'X':
+        return 16;
+    case 'o':
+        return 8;
+    case 'b':
+    case 'B':
+        return 2;
+    default:
+        return 10;
+    }
+}
+
+// Parses an optionally signed integer.
+static ErrorCode ParseInteger(char const*& next, char const* end, uint32_t base, bool& negative, uint64_t& magnitude)
+{
+    char const* p = next;
+
+    negative = false;
+    if (p != end && (*p == '-' || *p == '+'))
+    {
+        negative = (*p == '-');
+        ++p;
+    }
+
+    // Skip the (optional) prefix, but only if it is followed by a digit.
+    if ((base == 16 || base == 2) && end - p >= 3 && p[0] == '0' && ToLower(p[1]) == (base == 16 ? 'x' : 'b') && DigitValue(p[2]) < base)
+        p += 2;
+
+    char const* const digits = p;
+
+    bool overflow = false;
+    if (base == 10)
+        p = ParseDecimalDigits(p, end, magnitude, overflow);
+    else
+        p = ParseRadixDigits(p, end, base, magnitude, overflow);
+
+    if (p == digits)
+        return ErrorCode::conversion_error;
+    if (overflow)
+        return ErrorCode::value_out_of_range;
+
+    next = p;
+    return {};
+}
+
+// Converts the two's complement bit pattern U to a signed integer.
+template <typename T, typename U>
+static T ToSigned(U u)
+{
+    if (u <= static_cast<U>(std::numeric_limits<T>::max()))
+        return static_cast<T>(u);
+
+    return static_cast<T>(-static_cast<T>(static_cast<U>(~u)) - 1);
+}
+
+// Stores the integer into VALUE, if its value is in the range of T.
+// For bases other than 10, a non-negative MAGNITUDE may also be the bit pattern
+// of a negative number (as produced by format()).
+template <typename T>
+static ErrorCode StoreSigned(void* value, uint32_t base, bool negative, uint64_t magnitude)
+{
+    using U = typename std::make_unsigned<T>::type;
+
+    auto const max = static_cast<uint64_t>(std::numeric_limits<T>::max());
+
+    T result;
+    if (negative)
+    {
+        if (magnitude > max + 1)
+            return ErrorCode::value_out_of_range;
+        result = (magnitude == 0) ? T{0} : static_cast<T>(-static_cast<T>(magnitude - 1) - 1);
+    }
+    else if (magnitude <= max)
+    {
+        result = static_cast<T>(magnitude);
+    }
+    else
+    {
+        if (base == 10 || magnitude > std::numeric_limits<U>::max())
+            return ErrorCode::value_out_of_range;
+        result = ToSigned<T>(static_cast<U>(magnitude));
+    }
+
+    *static_cast<T*>(value) = result;
+    return {};
+}
+
+template <typename T>
+static ErrorCode StoreUnsigned(void* value, bool negative, uint64_t magnitude)
+{
+    if (negative && magnitude != 0)
+        return ErrorCode::value_out_of_range;
+    if (magnitude > std::numeric_limits<T>::max())
+        return ErrorCode::value_out_of_range;
+
+    *static_cast<T*>(value) = static_cast<T>(magnitude);
+    return {};
+}
+
+static ErrorCode ScanInteger(char const*& next, char const* end, char conv, ScanArg const& arg)
+{
+    uint32_t const base = IntegerBase(conv);
+
+    char const* p = next;
+
+    bool negative;
+    uint64_t magnitude;
+    if (Failed ec = ParseInteger(p, end, base, negative, magnitude))
+        return ec;
+
+    ErrorCode ec;
+    switch (arg.type)
+    {
+    case ScanType::sint8:
+        ec = StoreSigned<int8_t>(arg.ptr, base, negative, magnitude);
+        break;
+    case ScanType::sint16:
+        ec = StoreSigned<int16_t>(arg.ptr, base, negative, magnitude);
+        break;
+    case ScanType::sint32:
+        ec = StoreSigned<int32_t>(arg.ptr, base, negative, magnitude);
+        break;
+    case ScanType::sint64:
+        ec = StoreSigned<int64_t>(arg.ptr, base, negative, magnitude);
+        break;
+    case ScanType::uint8:
+        ec = StoreUnsigned<uint8_t>(arg.ptr, negative, magnitude);
+        break;
+    case ScanType::uint16:
+        ec = StoreUnsigned<uint16_t>(arg.ptr, negative, magnitude);
+        break;
+    case ScanType::uint32:
+        ec = StoreUnsigned<uint32_t>(arg.ptr, negative, magnitude);
+        break;
+    case ScanType::uint64:
+        ec = StoreUnsigned<uint64_t>(arg.ptr, negative, magnitude);
+        break;
+    default:
+        assert(false && "internal error");
+        ec = ErrorCode::invalid_argument;
+        break;
+    }
+
+    if (ec == ErrorCode::success)
+        next = p;
+
+    return ec;
+}
+
+//------------------------------------------------------------------------------
+// Floating-point
+//------------------------------------------------------------------------------
+
+// Maximum number of significant digits passed to DecimalToDouble.
+// Any digits beyond this limit only affect the rounding and are replaced by a
+// single non-zero digit.
+static constexpr int kMaxSignificantDigits = 780;
+
+// Limits the exponent to avoid integer overflow. (The result is either 0 or
+// infinity long before.)
+static constexpr int kMaxExponent = 1000000;
+
+static ErrorCode ScanFloatingPoint(char const*& next, char const* end, ScanArg const& arg)
+{
+    bool const is_float = (arg.type == ScanType::float_);
+
+    char const* p = next;
+
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+'))
+    {
+        negative = (*p == '-');
+        ++p;
+    }
+
+    double value;
+
+    if (StartsWithIgnoreCase(p, end, "inf", 3))
+    {
+        p += 3;
+        if (StartsWithIgnoreCase(p, end, "inity", 5))
+            p += 5;
+        value = std::numeric_limits<double>::infinity();
+    }
+    else if (StartsWithIgnoreCase(p, end, "nan", 3))
+    {
+        p += 3;
+        value = std::numeric_limits<double>::quiet_NaN();
+    }
+    else
+    {
+        char digits[kMaxSignificantDigits];
+        int  num_digits = 0;
+        int  exponent = 0;
+        bool any_digits = false;
+        bool nonzero_tail = false;
+
+        for ( ; p != end && IsDecimalDigit(*p); ++p)
+        {
+            any_digits = true;
+            if (num_digits == 0 && *p == '0')
+                continue;
+            if (num_digits < kMaxSignificantDigits - 1)
+            {
+                digits[num_digits++] = *p;
+            }
+            else
+            {
+                nonzero_tail |= (*p != '0');
+                if (exponent < kMaxExponent)
+                    ++exponent;
+            }
+        }
+
+        if (p != end && *p == '.')
+        {
+            ++p;
+            for ( ; p != end && IsDecimalDigit(*p); ++p)
+            {
+                any_digits = true;
+                if (num_digits == 0 && *p == '0')
+                {
+                    if (exponent > -kMaxExponent)
+                        --exponent;
+                    continue;
+                }
+                if (num_digits < kMaxSignificantDigits - 1)
+                {
+                    digits[num_digits++] = *p;
+                    --exponent;
+                }
+                else
+                {
+                    nonzero_tail |= (*p != '0');
+                }
+            }
+        }
+
+        if (!any_digits)
+            return ErrorCode::conversion_error;
+
+        // The exponent is optional: "1e" is parsed as "1" followed by "e".
+        if (p != end && (*p == 'e' || *p == 'E'))
+        {
+            char const* q = p + 1;
+
+            bool exp_negative = false;
+            if (q != end && (*q == '-' || *q == '+'))
+            {
+                exp_negative = (*q == '-');
+                ++q;
+            }
+
+            if (q != end && IsDecimalDigit(*q))
+            {
+                int e = 0;
+                for ( ; q != end && IsDecimalDigit(*q); ++q)
+                {
+                    if (e < kMaxExponent)
+                        e = 10 * e + (*q - '0');
+                }
+                exponent += exp_negative ? -e : e;
+                p = q;
+            }
+        }
+
+        if (nonzero_tail)
+        {
+            digits[num_digits++] = '1';
+            --exponent;
+        }
+
+        if (num_digits == 0)
+        {
+            value = 0.0;
+        }
+        else if (is_float)
+        {
+            float const f = DecimalToFloat(digits, num_digits, exponent);
+            if (f == std::numeric_limits<float>::infinity())
+                return ErrorCode::value_out_of_range;
+            value = static_cast<double>(f);
+        }
+        else
+        {
+            value = DecimalToDouble(digits, num_digits, exponent);
+            if (value == std::numeric_limits<double>::infinity())
+                return ErrorCode::value_out_of_range;
+        }
+    }
+
+    if (negative)
+        value = -value;
+
+    if (is_float)
+        *static_cast<float*>(arg.ptr) = static_cast<float>(value);
+    else
+        *static_cast<double*>(arg.ptr) = value;
+
+    next = p;
+    return {};
+}
+
+//------------------------------------------------------------------------------
+// Strings
+//------------------------------------------------------------------------------
+
+static ErrorCode ScanBool(char const*& next, char const* end, ScanArg const& arg)
+{
+    struct Literal {
+        char const* str;
+        size_t len;
+        bool value;
+    };
+
+    static constexpr Literal const kLiterals[] = {
+        {"true", 4, true},
+        {"false", 5, false},
+        {"1", 1, true},
+        {"0", 1, false},
+    };
+
+    for (auto const& lit : kLiterals)
+    {
+        if (static_cast<size_t>(end - next) >= lit.len && std::memcmp(next, lit.str, lit.len) == 0)
+        {
+            *static_cast<bool*>(arg.ptr) = lit.value;
+            next += lit.len;
+            return {};
+        }
+    }
+
+    return ErrorCode::conversion_error;
+}
+
+static ErrorCode ScanString(char const*& next, char const* end, char delim, ScanArg const& arg)
+{
+    char const* p = next;
+    while (p != end && !IsSpace(*p) && *p != delim)
+        ++p;
+
+    if (p == next)
+        return ErrorCode::conversion_error;
+
+    auto const len = static_cast<size_t>(p - next);
+    if (arg.type == ScanType::string)
+        static_cast<std::string*>(arg.ptr)->assign(next, len);
+    else
+        *static_cast<string_view*>(arg.ptr) = string_view(next, len);
+
+    next = p;
+    return {};
+}
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+// Returns whether the conversion CONV applies to arguments of type TYPE.
+static bool IsSupportedConversion(ScanType type, char conv)
+{
+    if (conv == '\0')
+        return true;
+
+    switch (type)
+    {
+    case ScanType::none:
+        return true;
+    case ScanType::bool_:
+    case ScanType::string:
+    case ScanType::string_view:
+        return conv == 's';
+    case ScanType::char_:
+        return conv == 'c' || conv == 's';
+    case ScanType::sint8:
+    case ScanType::sint16:
+    case ScanType::sint32:
+    case ScanType::sint64:
+    case ScanType::uint8:
+    case ScanType::uint16:
+    case ScanType::uint32:
+    case ScanType::uint64:
+        return std::strchr("diuxXobB", conv) != nullptr;
+    case ScanType::float_:
+    case ScanType::double_:
+        return std::strchr("sSeEfFgG", conv) != nullptr;
+    }
+
+    assert(false && "internal error");
+    return false;
+}
+
+// Converts the next field of the input.
+// DELIM is the character which terminates strings (in addition to whitespace),
+// or '\0'.
+static ErrorCode ScanField(char const*& next, char const* end, FormatSpec const& spec, ScanArg const& arg, char delim)
+{
+    if (!IsSupportedConversion(arg.type, spec.conv))
+        return ErrorCode::not_supported;
+
+    if (arg.type != ScanType::char_)
+        next = SkipSpace(next, end);
+
+    // A non-zero width limits the number of characters the field may consume.
+    char const* const field_end = (spec.width > 0 && static_cast<size_t>(end - next) > static_cast<size_t>(spec.width))
+        ? next + spec.width
+        : end;
+
+    switch (arg.type)
+    {
+    case ScanType::none:
+        break;
+    case ScanType::bool_:
+        return ScanBool(next, field_end, arg);
+    case ScanType::char_:
+        if (next == field_end)
+            return ErrorCode::conversion_error;
+        *static_cast<char*>(arg.ptr) = *next++;
+        return {};
+    case ScanType::sint8:
+    case ScanType::sint16:
+    case ScanType::sint32:
+    case ScanType::sint64:
+    case ScanType::uint8:
+    case ScanType::uint16:
+    case ScanType::uint32:
+    case ScanType::uint64:
+        return ScanInteger(next, field_end, spec.conv, arg);
+    case ScanType::float_:
+    case ScanType::double_:
+        return ScanFloatingPoint(next, field_end, arg);
+    case ScanType::string:
+    case ScanType::string_view:
+        return ScanString(next, field_end, delim, arg);
+    }
+
+    assert(false && "internal error");
+    return ErrorCode::invalid_argument;
+}
+
+ScanResult fmtxx::impl::DoScan(string_view input, string_view format, ScanArg const* args, int num_args)
+{
+    char const*       in     = input.data();
+    char const* const in_end = input.data() + input.size();
+
+    char const*       f     = format.data();
+    char const* const f_end = format.data() + format.size();
+
+    int count = 0;
+
+    while (f != f_end)
+    {
+        char const c = *f;
+
+        if (c == '{' && (f_end - f < 2 || f[1] != '{'))
+        {
+            char const* const field_end = static_cast<char const*>(std::memchr(f, '}', static_cast<size_t>(f_end - f)));
+            if (field_end == nullptr)
+                return ScanResult{in, count, ErrorCode::invalid_format_string};
+
+            FormatSpec spec;
+            if (field_end - f > 1) // Fast path for "{}"
+            {
+                if (Failed ec = fmtxx::parse_format_spec(spec, string_view(f, static_cast<size_t>(field_end - f + 1))))
+                    return ScanResult{in, count, ec};
+            }
+
+            if (count >= num_args)
+                return ScanResult{in, count, ErrorCode::index_out_of_range};
+
+            f = field_end + 1;
+
+            char const delim = (f != f_end && *f != '{' && !IsSpace(*f)) ? *f : '\0';
+
+            if (Failed ec = ScanField(in, in_end, spec, args[count], delim))
+                return ScanResult{in, count, ec};
+
+            ++count;
+        }
+        else if (c == '}' && (f_end - f < 2 || f[1] != '}'))
+        {
+            return ScanResult{in, count, ErrorCode::invalid_format_string};
+        }
+        else if (IsSpace(c))
+        {
+            f = SkipSpace(f + 1, f_end);
+            in = SkipSpace(in, in_end);
+        }
+        else
+        {
+            if (in == in_end || *in != c)
+                return ScanResult{in, count, ErrorCode::conversion_error};
+
+            ++in;
+            f += (c == '{' || c == '}') ? 2 : 1;
+        }
+    }
+
+    return ScanResult{in, count, ErrorCode{}};
+}
@@ -0,0 +1,173 @@
+// Copyright (c) 2017 Alexander Bolz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef FMTXX_FORMAT_SCAN_H
+#define FMTXX_FORMAT_SCAN_H 1
+
+#include "Format.h"
+
+namespace fmtxx {
+
+struct ScanResult
+{
+    char const* next = nullptr; // Points past the last character consumed
+    int count = 0;              // The number of arguments which have been assigned
+    ErrorCode ec = ErrorCode{};
+
+    ScanResult() = default;
+    ScanResult(char const* next_, int count_, ErrorCode ec_) : next(next_), count(count_), ec(ec_) {}
+
+    // Test for successful conversions
+    explicit operator bool() const { return ec == ErrorCode{}; }
+};
+
+namespace impl {
+
+enum struct ScanType : int {
+    none,
+    bool_,
+    char_,
+    sint8,
+    sint16,
+    sint32,
+    sint64,
+    uint8,
+    uint16,
+    uint32,
+    uint64,
+    float_,
+    double_,
+    string,
+    string_view,
+};
+
+template <ScanType Val>
+using ScanType_t = std::integral_constant<ScanType, Val>;
+
+template <size_t Size, bool Signed> struct SelectIntScanType;
+template <> struct SelectIntScanType<1, true > : ScanType_t<ScanType::sint8> {};
+template <> struct SelectIntScanType<2, true > : ScanType_t<ScanType::sint16> {};
+template <> struct SelectIntScanType<4, true > : ScanType_t<ScanType::sint32> {};
+template <> struct SelectIntScanType<8, true > : ScanType_t<ScanType::sint64> {};
+template <> struct SelectIntScanType<1, false> : ScanType_t<ScanType::uint8> {};
+template <> struct SelectIntScanType<2, false> : ScanType_t<ScanType::uint16> {};
+template <> struct SelectIntScanType<4, false> : ScanType_t<ScanType::uint32> {};
+template <> struct SelectIntScanType<8, false> : ScanType_t<ScanType::uint64> {};
+
+template <typename T>
+using IntScanType = SelectIntScanType<sizeof(T), std::is_signed<T>::value>;
+
+template <typename T> struct SelectScanType : ScanType_t<ScanType::none> {};
+template <> struct SelectScanType<bool              > : ScanType_t<ScanType::bool_> {};
+template <> struct SelectScanType<char              > : ScanType_t<ScanType::char_> {};
+template <> struct SelectScanType<signed char       > : IntScanType<signed char> {};
+template <> struct SelectScanType<signed short      > : IntScanType<signed short> {};
+template <> struct SelectScanType<signed int        > : IntScanType<signed int> {};
+template <> struct SelectScanType<signed long       > : IntScanType<signed long> {};
+template <> struct SelectScanType<signed long long  > : IntScanType<signed long long> {};
+template <> struct SelectScanType<unsigned char     > : IntScanType<unsigned char> {};
+template <> struct SelectScanType<unsigned short    > : IntScanType<unsigned short> {};
+template <> struct SelectScanType<unsigned int      > : IntScanType<unsigned int> {};
+template <> struct SelectScanType<unsigned long     > : IntScanType<unsigned long> {};
+template <> struct SelectScanType<unsigned long long> : IntScanType<unsigned long long> {};
+template <> struct SelectScanType<float             > : ScanType_t<ScanType::float_> {};
+template <> struct SelectScanType<double            > : ScanType_t<ScanType::double_> {};
+template <> struct SelectScanType<std::string       > : ScanType_t<ScanType::string> {};
+template <> struct SelectScanType<string_view       > : ScanType_t<ScanType::string_view> {};
+
+struct ScanArg
+{
+    void* ptr = nullptr;
+    ScanType type = ScanType::none;
+
+    ScanArg() = default;
+
+    template <typename T>
+    ScanArg(T& value) : ptr(&value), type(SelectScanType<T>::value)
+    {
+        static_assert(
+            SelectScanType<T>::value != ScanType::none,
+            "Scanning objects of type T is not supported.");
+    }
+};
+
+ScanResult DoScan(string_view input, string_view format, ScanArg const* args, int num_args);
+
+// Returns the double (float) nearest to DIGITS * 10^EXPONENT.
+// DIGITS must contain only decimal digits. Returns +infinity on overflow.
+double DecimalToDouble(char const* digits, int num_digits, int exponent);
+float DecimalToFloat(char const* digits, int num_digits, int exponent);
+
+} // namespace fmtxx::impl
+
+// Parses INPUT according to the format string FORMAT and stores the converted
+// values into ARGS.
+//
+// The format string uses the same syntax as format():
+//  - A replacement field "{}" or "{:spec}" converts the next argument. The
+//    spec is parsed by the same parser as the format side, but only the width
+//    and the conversion are used: a non-zero width limits the number of
+//    characters the field may consume. (Argument indices and dynamic fields
+//    are not supported.)
+//  - A whitespace character matches any amount of whitespace (including none).
+//  - Any other character (and "{{" and "}}") must match the input exactly.
+//
+// Supported argument types and conversions:
+//  - Integers: 'd' (default), 'i', 'u', 'x', 'X', 'o', 'b', 'B'. Hexadecimal
+//    and binary inputs may have a "0x" or "0b" prefix. A leading '-' or '+' is
+//    accepted for all integer types, but negative values for unsigned types
+//    are out of range.
+//  - float and double: decimal and scientific notation, "inf", "infinity" and
+//    "nan" (case-insensitive), for any of 's' (default), 'e', 'f' and 'g' (or
+//    their upper-case variants). The result is correctly rounded. ('a' and
+//    'x' are not supported.)
+//  - bool ('s'): "true", "false", "1" or "0".
+//  - char ('c' or 's'): a single character. Leading whitespace is not skipped.
+//  - std::string and string_view ('s'): a non-empty sequence of characters
+//    which is terminated by whitespace, the end of the input or by the
+//    character which immediately follows the replacement field in the format
+//    string. (E.g., "{},{}" splits "abc,def" into "abc" and "def".) A
+//    string_view points into INPUT.
+// Except for char, leading whitespace in the input is skipped.
+//
+// Returns the number of arguments which have been assigned and a pointer to
+// the first character in INPUT which has not been consumed.
+// Errors:
+//  - conversion_error: The input does not match the format string.
+//  - value_out_of_range: The number does not fit into the argument type.
+//  - index_out_of_range: There are more replacement fields than arguments.
+//  - invalid_format_string: The format string is invalid.
+//  - not_supported: The conversion does not apply to the argument type.
+// On error, the argument which failed to convert is not modified.
+template <typename ...Args>
+ScanResult scan(string_view input, string_view format, Args&... args)
+{
+    impl::ScanArg const arr[] = {args..., impl::ScanArg{}};
+    return ::fmtxx::impl::DoScan(input, format, arr, static_cast<int>(sizeof...(Args)));
+}
+
+} // namespace fmtxx
+
+#if FMTXX_HEADER_ONLY
+#include "Format.cc"
+#endif
+
+#endif // FMTXX_FORMAT_SCAN_H
@@ -0,0 +1,273 @@
+// Copyright (c) 2017 Alexander Bolz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "Format_stats.h"
+
+using namespace fmtxx;
+using namespace fmtxx::stats;
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+#ifdef FMTXX_STATS
+
+thread_local stats::impl::ThreadCounters* stats::impl::t_counters = nullptr;
+thread_local int stats::impl::t_call_depth = 0;
+
+// The counters of all threads, which have ever used the library.
+// Entries are never removed. The counters of exited threads are re-used by new
+// threads (and continue counting), so that the totals never decrease.
+static std::atomic<stats::impl::ThreadCounters*> g_counters{nullptr};
+
+// Set when t_thread_exit has been destroyed.
+static thread_local bool t_exited = false;
+
+namespace {
+
+// Releases the counters of the current thread on thread exit.
+struct ThreadExit
+{
+    ~ThreadExit()
+    {
+        stats::impl::ThreadCounters* c = stats::impl::t_counters;
+
+        // Detach the counters first. The destructors of other thread_local
+        // objects might still use the library. Once released, the counters may
+        // be re-used by another thread at any time, so they must not be
+        // modified by the current thread anymore.
+        stats::impl::t_counters = nullptr;
+        t_exited = true;
+
+        if (c != nullptr)
+            c->in_use.store(false, std::memory_order_release);
+    }
+};
+
+} // namespace
+
+static thread_local ThreadExit t_thread_exit;
+
+stats::impl::ThreadCounters* stats::impl::RegisterThread()
+{
+    // Touch t_thread_exit to make sure its destructor runs on thread exit.
+    // If it already has run, the counters registered here are never released.
+    if (!t_exited)
+        static_cast<void>(&t_thread_exit);
+
+    ThreadCounters* c = nullptr;
+
+    // Try to re-use the counters of an exited thread.
+    for (auto p = g_counters.load(std::memory_order_acquire); p != nullptr; p = p->next.load(std::memory_order_acquire))
+    {
+        bool expected = false;
+        if (p->in_use.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+        {
+            c = p;
+            break;
+        }
+    }
+
+    if (c == nullptr)
+    {
+        c = new ThreadCounters;
+        for (auto& v : c->values)
+            v.store(0, std::memory_order_relaxed);
+        c->in_use.store(true, std::memory_order_relaxed);
+
+        auto head = g_counters.load(std::memory_order_relaxed);
+        do
+            c->next.store(head, std::memory_order_relaxed);
+        while (!g_counters.compare_exchange_weak(head, c, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    t_counters = c;
+    return c;
+}
+
+bool fmtxx::stats::enabled() noexcept
+{
+    return true;
+}
+
+void fmtxx::stats::snapshot(Stats& stats) noexcept
+{
+    uint64_t sums[impl::kNumCounters] = {};
+
+    for (auto p = g_counters.load(std::memory_order_acquire); p != nullptr; p = p->next.load(std::memory_order_acquire))
+    {
+        for (int i = 0; i < impl::kNumCounters; ++i)
+            sums[i] += p->values[i].load(std::memory_order_relaxed);
+    }
+
+    for (int e = 0; e < kNumEntryPoints; ++e)
+    {
+        stats.calls[e] = sums[impl::kCallsPos + e];
+        for (int b = 0; b < kNumLatencyBuckets; ++b)
+            stats.latency[e][b] = sums[impl::kLatencyPos + e * kNumLatencyBuckets + b];
+    }
+    for (int k = 0; k < kNumWriterKinds; ++k)
+        stats.bytes[k] = sums[impl::kBytesPos + k];
+    for (int t = 0; t < kNumTypes; ++t)
+        stats.conversions[t] = sums[impl::kConversionsPos + t];
+    for (int m = 0; m < kNumDtoaModes; ++m)
+        stats.bignum_fallbacks[m] = sums[impl::kFallbacksPos + m];
+    stats.parse_cache_hits = sums[impl::kParseCachePos + 0];
+    stats.parse_cache_misses = sums[impl::kParseCachePos + 1];
+}
+
+#else
+
+bool fmtxx::stats::enabled() noexcept
+{
+    return false;
+}
+
+void fmtxx::stats::snapshot(Stats& stats) noexcept
+{
+    stats = Stats{};
+}
+
+#endif
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+char const* fmtxx::stats::name(EntryPoint e) noexcept
+{
+    switch (e)
+    {
+    case EntryPoint::format:          return "format";
+    case EntryPoint::printf:          return "printf";
+    case EntryPoint::format_compiled: return "format_compiled";
+    case EntryPoint::format_file:     return "format_file";
+    case EntryPoint::printf_file:     return "printf_file";
+    case EntryPoint::format_string:   return "format_string";
+    case EntryPoint::printf_string:   return "printf_string";
+    case EntryPoint::format_to_chars: return "format_to_chars";
+    case EntryPoint::printf_to_chars: return "printf_to_chars";
+    case EntryPoint::format_ostream:  return "format_ostream";
+    case EntryPoint::printf_ostream:  return "printf_ostream";
+    case EntryPoint::format_fd:       return "format_fd";
+    case EntryPoint::printf_fd:       return "printf_fd";
+    case EntryPoint::last:            break;
+    }
+
+    return "?";
+}
+
+char const* fmtxx::stats::name(WriterKind k) noexcept
+{
+    switch (k)
+    {
+    case WriterKind::file:     return "file";
+    case WriterKind::array:    return "array";
+    case WriterKind::memory:   return "memory";
+    case WriterKind::counting: return "counting";
+    case WriterKind::to_chars: return "to_chars";
+    case WriterKind::ostream:  return "ostream";
+    case WriterKind::iovec:    return "iovec";
+    case WriterKind::mmap:     return "mmap";
+    case WriterKind::last:     break;
+    }
+
+    return "?";
+}
+
+char const* fmtxx::stats::name(DtoaMode m) noexcept
+{
+    switch (m)
+    {
+    case DtoaMode::fixed:     return "fixed";
+    case DtoaMode::precision: return "precision";
+    case DtoaMode::shortest:  return "shortest";
+    case DtoaMode::last:      break;
+    }
+
+    return "?";
+}
+
+static char const* const kTypeNames[] = {
+    "none", "formatspec", "string", "other", "pchar", "pvoid", "bool", "char",
+    "schar", "sshort", "sint", "slonglong", "ulonglong", "double",
+    "float",
+};
+
+static_assert(sizeof(kTypeNames) / sizeof(kTypeNames[0]) == kNumTypes, "Internal error: kTypeNames and impl::Type out of sync");
+
+ErrorCode fmtxx::stats::print(Writer& w, Stats const& stats)
+{
+    for (int e = 0; e < kNumEntryPoints; ++e)
+    {
+        if (stats.calls[e] == 0)
+            continue;
+
+        char const* const entry = name(static_cast<EntryPoint>(e));
+        if (Failed ec = fmtxx::format(w, "calls.{} {}\n", entry, stats.calls[e]))
+            return ec;
+
+        for (int b = 0; b < kNumLatencyBuckets; ++b)
+        {
+            if (stats.latency[e][b] == 0)
+                continue;
+            if (Failed ec = fmtxx::format(w, "latency.{}.{}ns {}\n", entry, uint64_t{1} << b, stats.latency[e][b]))
+                return ec;
+        }
+    }
+
+    for (int k = 0; k < kNumWriterKinds; ++k)
+    {
+        if (stats.bytes[k] == 0)
+            continue;
+        if (Failed ec = fmtxx::format(w, "bytes.{} {}\n", name(static_cast<WriterKind>(k)), stats.bytes[k]))
+            return ec;
+    }
+
+    for (int t = 0; t < kNumTypes; ++t)
+    {
+        if (stats.conversions[t] == 0)
+            continue;
+        if (Failed ec = fmtxx::format(w, "conversions.{} {}\n", kTypeNames[t], stats.conversions[t]))
+            return ec;
+    }
+
+    for (int m = 0; m < kNumDtoaModes; ++m)
+    {
+        if (stats.bignum_fallbacks[m] == 0)
+            continue;
+        if (Failed ec = fmtxx::format(w, "bignum_fallbacks.{} {}\n", name(static_cast<DtoaMode>(m)), stats.bignum_fallbacks[m]))
+            return ec;
+    }
+
+    if (stats.parse_cache_hits != 0)
+    {
+        if (Failed ec = fmtxx::format(w, "parse_cache.hits {}\n", stats.parse_cache_hits))
+            return ec;
+    }
+    if (stats.parse_cache_misses != 0)
+    {
+        if (Failed ec = fmtxx::format(w, "parse_cache.misses {}\n", stats.parse_cache_misses))
+            return ec;
+    }
+
+    return {};
+}
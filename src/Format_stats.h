@@ -0,0 +1,241 @@
+// Copyright (c) 2017 Alexander Bolz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef FMTXX_FORMAT_STATS_H
+#define FMTXX_FORMAT_STATS_H 1
+
+#include "Format.h"
+
+//
+// Opt-in instrumentation of the formatting engine.
+//
+// Define FMTXX_STATS when compiling the library (and the code which includes
+// this header) to enable the counters. Otherwise all counters remain zero and
+// the instrumentation compiles to nothing.
+//
+// The counters are stored per thread. Each thread only updates its own
+// counters; snapshot() sums the counters of all threads, including threads
+// which have exited.
+//
+
+#ifdef FMTXX_STATS
+#include <atomic>
+#include <chrono>
+#endif
+
+namespace fmtxx {
+namespace stats {
+
+// The public entry points.
+// Only top-level calls are counted: calls from within other entry points (or
+// from within FormatValue's) are attributed to the outermost call.
+enum struct EntryPoint : int {
+    format,          // format(Writer&, ...)
+    printf,          // printf(Writer&, ...)
+    format_compiled, // format(..., CompiledFormat const&, ...)
+    format_file,     // format(std::FILE*, ...), fformat
+    printf_file,     // printf(std::FILE*, ...), fprintf
+    format_string,   // format(std::string&, ...), string_format, string_format_exact
+    printf_string,   // printf(std::string&, ...), string_printf, string_printf_exact
+    format_to_chars, // format_to_chars, snformat
+    printf_to_chars, // printf_to_chars, snprintf
+    format_ostream,  // format(std::ostream&, ...)
+    printf_ostream,  // printf(std::ostream&, ...)
+    format_fd,       // format_to_fd
+    printf_fd,       // printf_to_fd
+    last,            // Unused -- must be last.
+};
+
+// The built-in Writer's.
+enum struct WriterKind : int {
+    file,     // FILEWriter
+    array,    // ArrayWriter
+    memory,   // MemoryWriter
+    counting, // CountingWriter
+    to_chars, // format_to_chars
+    ostream,  // format(std::ostream&, ...)
+    iovec,    // IovecWriter
+    mmap,     // MmapWriter, MmapFile
+    last,     // Unused -- must be last.
+};
+
+// The floating-point conversions which might fall back to the (slow) bignum
+// algorithm.
+enum struct DtoaMode : int {
+    fixed,     // 'f' with precision > 17
+    precision, // 'e', 'g' with precision
+    shortest,  // Shortest representation
+    last,      // Unused -- must be last.
+};
+
+static constexpr int kNumEntryPoints  = static_cast<int>(EntryPoint::last);
+static constexpr int kNumWriterKinds  = static_cast<int>(WriterKind::last);
+static constexpr int kNumTypes        = static_cast<int>(impl::Type::last);
+static constexpr int kNumDtoaModes    = static_cast<int>(DtoaMode::last);
+
+// Bucket i counts the calls which took [2^i, 2^(i+1)) nanoseconds.
+// (The first bucket includes 0, the last bucket includes all longer calls.)
+static constexpr int kNumLatencyBuckets = 32;
+
+struct Stats
+{
+    uint64_t calls[kNumEntryPoints] = {};
+    uint64_t latency[kNumEntryPoints][kNumLatencyBuckets] = {};
+    uint64_t bytes[kNumWriterKinds] = {};
+    uint64_t conversions[kNumTypes] = {}; // Indexed by impl::Type
+    uint64_t bignum_fallbacks[kNumDtoaModes] = {};
+    uint64_t parse_cache_hits = 0;   // See set_parse_cache_capacity
+    uint64_t parse_cache_misses = 0;
+};
+
+// Returns whether the library has been compiled with FMTXX_STATS.
+bool enabled() noexcept;
+
+// Sums the counters of all threads into STATS.
+// Does not allocate and does not lock: may be called from a signal handler
+// (provided std::atomic<uint64_t> is lock-free).
+void snapshot(Stats& stats) noexcept;
+
+// Returns the name of the enumerator.
+char const* name(EntryPoint e) noexcept;
+char const* name(WriterKind k) noexcept;
+char const* name(DtoaMode m) noexcept;
+
+// Prints all non-zero counters of STATS, one per line, in the form
+// "calls.format 123".
+ErrorCode print(Writer& w, Stats const& stats);
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+namespace impl {
+
+#ifdef FMTXX_STATS
+
+static constexpr int kCallsPos       = 0;
+static constexpr int kLatencyPos     = kCallsPos + kNumEntryPoints;
+static constexpr int kBytesPos       = kLatencyPos + kNumEntryPoints * kNumLatencyBuckets;
+static constexpr int kConversionsPos = kBytesPos + kNumWriterKinds;
+static constexpr int kFallbacksPos   = kConversionsPos + kNumTypes;
+static constexpr int kParseCachePos  = kFallbacksPos + kNumDtoaModes; // hits, misses
+static constexpr int kNumCounters    = kParseCachePos + 2;
+
+struct ThreadCounters
+{
+    std::atomic<uint64_t> values[kNumCounters];
+    std::atomic<ThreadCounters*> next;
+    std::atomic<bool> in_use;
+};
+
+extern thread_local ThreadCounters* t_counters;
+extern thread_local int t_call_depth;
+
+// Returns the counters of the current thread, registering them on first use.
+ThreadCounters* RegisterThread();
+
+inline void Add(int index, uint64_t n)
+{
+    ThreadCounters* c = t_counters;
+    if (c == nullptr)
+        c = RegisterThread();
+
+    // Only the current thread modifies its counters.
+    auto& v = c->values[index];
+    v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline int LatencyBucket(uint64_t ns)
+{
+    int b = 0;
+    while (ns > 1 && b < kNumLatencyBuckets - 1)
+    {
+        ns >>= 1;
+        ++b;
+    }
+    return b;
+}
+
+// Counts a call to an entry point and measures its latency.
+class CallScope
+{
+    using Clock = std::chrono::steady_clock;
+
+    EntryPoint        entry_;
+    bool const        outermost_;
+    Clock::time_point start_;
+
+public:
+    explicit CallScope(EntryPoint e)
+        : entry_(e)
+        , outermost_(t_call_depth++ == 0)
+    {
+        if (outermost_)
+            start_ = Clock::now();
+    }
+
+    ~CallScope()
+    {
+        --t_call_depth;
+        if (!outermost_)
+            return;
+
+        auto const ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_).count();
+
+        int const e = static_cast<int>(entry_);
+        Add(kCallsPos + e, 1);
+        Add(kLatencyPos + e * kNumLatencyBuckets + LatencyBucket(ns > 0 ? static_cast<uint64_t>(ns) : 0), 1);
+    }
+
+    CallScope(CallScope const&) = delete;
+    CallScope& operator=(CallScope const&) = delete;
+};
+
+inline void CountBytes(WriterKind k, size_t n) { Add(kBytesPos + static_cast<int>(k), n); }
+inline void CountConversions(fmtxx::impl::Type t, size_t n = 1) { Add(kConversionsPos + static_cast<int>(t), n); }
+inline void CountBignumFallback(DtoaMode m) { Add(kFallbacksPos + static_cast<int>(m), 1); }
+inline void CountParseCacheLookup(bool hit) { Add(kParseCachePos + (hit ? 0 : 1), 1); }
+
+#else
+
+class CallScope
+{
+public:
+    explicit CallScope(EntryPoint /*e*/) {}
+};
+
+inline void CountBytes(WriterKind /*k*/, size_t /*n*/) {}
+inline void CountConversions(fmtxx::impl::Type /*t*/, size_t /*n*/ = 1) {}
+inline void CountBignumFallback(DtoaMode /*m*/) {}
+inline void CountParseCacheLookup(bool /*hit*/) {}
+
+#endif
+
+} // namespace fmtxx::stats::impl
+
+} // namespace fmtxx::stats
+} // namespace fmtxx
+
+#if FMTXX_HEADER_ONLY
+#include "Format.cc"
+#endif
+
+#endif // FMTXX_FORMAT_STATS_H
@@ -0,0 +1,661 @@
+// Copyright (c) 2017 Alexander Bolz
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef FMTXX_FORMAT_STRING_H
+#define FMTXX_FORMAT_STRING_H 1
+
+#include "Format.h"
+
+#include <tuple>
+#include <utility>
+
+// Compile-time checked (brace-style) format strings.
+//
+//  fmtxx::format(w, FMTXX_STRING("{} {:08x}"), 1, 2);
+//
+// If the compiler supports C++14 (relaxed) constexpr, the format string is parsed
+// and checked against the argument types at compile time. Invalid format strings
+// and argument indices which are out of range result in a compile-time error.
+// Unless the format string contains replacement fields which reference run-time
+// arguments ('*', '{}'), the formatting code is then generated at compile time,
+// i.e. literal text and arguments are written without parsing the format string.
+//
+// Otherwise FMTXX_STRING("...") is just a string and checked at run time.
+
+#if defined(__cpp_constexpr) && __cpp_constexpr >= 201304
+#define FMTXX_HAS_RELAXED_CONSTEXPR 1
+#else
+#define FMTXX_HAS_RELAXED_CONSTEXPR 0
+#endif
+
+#define FMTXX_STRING(S)                                                         \
+    [] {                                                                        \
+        struct FMTXX_STRING_TYPE : ::fmtxx::impl::StaticString {                \
+            static constexpr char const* data() { return S; }                   \
+            static constexpr size_t size() { return sizeof(S) - 1; }            \
+        };                                                                      \
+        return FMTXX_STRING_TYPE{};                                             \
+    }()                                                                         \
+    /**/
+
+namespace fmtxx {
+
+namespace impl {
+
+// Base class for the types created by FMTXX_STRING.
+struct StaticString
+{
+};
+
+template <typename S>
+using IsStaticString = std::is_base_of<StaticString, S>;
+
+template <typename S>
+inline string_view ToStringView(S const& /*str*/)
+{
+    return string_view(S::data(), S::size());
+}
+
+#if FMTXX_HAS_RELAXED_CONSTEXPR
+
+// The static counterpart of CompiledField.
+struct StaticField
+{
+    size_t     text_pos  = 0; // Literal text preceding the replacement field
+    size_t     text_len  = 0;
+    size_t     style_pos = 0;
+    size_t     style_len = 0;
+    FormatSpec spec;          // Note: spec.style is always empty
+    int        arg       = -1; // Negative if this field only consists of literal text
+};
+
+struct StaticParseResult
+{
+    ErrorCode   ec         = ErrorCode{};
+    int         num_fields = 0;
+    bool        dynamic    = false; // References run-time arguments ('*', '{}')
+    StaticField field;              // The requested field
+};
+
+// The functions below mirror the format string parser in Format.cc.
+// They do not compute any values which depend on run-time arguments.
+
+constexpr bool StaticIsDigit(char ch) { return '0' <= ch && ch <= '9'; }
+
+constexpr bool StaticParseInt(int& value, char const* s, size_t& i, size_t n)
+{
+    int x = 0;
+    for ( ; i < n && StaticIsDigit(s[i]); ++i)
+    {
+        int const d = s[i] - '0';
+        if (x > (INT_MAX - d) / 10)
+        {
+            while (i < n && StaticIsDigit(s[i]))
+                ++i;
+            return false;
+        }
+        x = 10 * x + d;
+    }
+
+    value = x;
+    return true;
+}
+
+constexpr ErrorCode StaticCheckIntArg(Types types, int index)
+{
+    switch (types[index])
+    {
+    case Type::none:
+        return ErrorCode::index_out_of_range;
+    case Type::schar:
+    case Type::sshort:
+    case Type::sint:
+    case Type::slonglong:
+    case Type::ulonglong:
+        return {};
+    default:
+        return ErrorCode::invalid_argument;
+    }
+}
+
+constexpr ErrorCode StaticParseLBrace(char const* s, size_t& i, size_t n, int& nextarg, Types types)
+{
+    ++i; // skip '{'
+    if (i == n)
+        return ErrorCode::invalid_format_string;
+
+    int index = 0;
+    if (StaticIsDigit(s[i]))
+    {
+        if (!StaticParseInt(index, s, i, n))
+            return ErrorCode::invalid_format_string;
+        if (i == n)
+            return ErrorCode::invalid_format_string;
+    }
+    else
+    {
+        index = nextarg++;
+    }
+
+    if (s[i] != '}')
+        return ErrorCode::invalid_format_string;
+    ++i; // skip '}'
+
+    return StaticCheckIntArg(types, index);
+}
+
+constexpr ErrorCode StaticParseFormatSpecArg(char const* s, size_t& i, size_t n, int& nextarg, Types types)
+{
+    ++i; // skip '*'
+    if (i == n)
+        return ErrorCode::invalid_format_string;
+
+    int index = 0;
+    if (StaticIsDigit(s[i]))
+    {
+        if (!StaticParseInt(index, s, i, n))
+            return ErrorCode::invalid_format_string;
+    }
+    else
+    {
+        index = nextarg++;
+    }
+
+    if (types[index] == Type::none)
+        return ErrorCode::index_out_of_range;
+    if (types[index] != Type::formatspec)
+        return ErrorCode::invalid_argument;
+
+    return {};
+}
+
+constexpr bool StaticParseAlign(FormatSpec& spec, char c)
+{
+    switch (c) {
+    case '<':
+        spec.align = Align::left;
+        return true;
+    case '>':
+        spec.align = Align::right;
+        return true;
+    case '^':
+        spec.align = Align::center;
+        return true;
+    case '=':
+        spec.align = Align::pad_after_sign;
+        return true;
+    default:
+        return false;
+    }
+}
+
+constexpr ErrorCode StaticParseFormatSpec(FormatSpec& spec, char const* s, size_t& i, size_t n, int& nextarg, Types types, bool& dynamic)
+{
+    ++i; // skip ':'
+    if (i == n)
+        return ErrorCode::invalid_format_string;
+
+    if (i + 1 != n && StaticParseAlign(spec, s[i + 1]))
+    {
+        spec.fill = s[i];
+        i += 2;
+        if (i == n)
+            return ErrorCode::invalid_format_string;
+    }
+    else if (StaticParseAlign(spec, s[i]))
+    {
+        ++i;
+        if (i == n)
+            return ErrorCode::invalid_format_string;
+    }
+
+    for (;;)
+    {
+        switch (s[i])
+        {
+        case '-':
+            spec.sign = Sign::minus;
+            ++i;
+            break;
+        case '+':
+            spec.sign = Sign::plus;
+            ++i;
+            break;
+        case ' ':
+            spec.sign = Sign::space;
+            ++i;
+            break;
+        case '#':
+            spec.hash = true;
+            ++i;
+            break;
+        case '0':
+            spec.zero = true;
+            ++i;
+            break;
+        case '\'':
+        case '_':
+        case ',':
+            spec.tsep = s[i];
+            ++i;
+            break;
+        case '1':
+        case '2':
+        case '3':
+        case '4':
+        case '5':
+        case '6':
+        case '7':
+        case '8':
+        case '9':
+            if (!StaticParseInt(spec.width, s, i, n))
+                return ErrorCode::invalid_format_string;
+            break;
+        case '{':
+            dynamic = true;
+            if (Failed ec = StaticParseLBrace(s, i, n, nextarg, types))
+                return ec;
+            break;
+        case '.':
+            ++i;
+            if (i == n)
+                return ErrorCode::invalid_format_string;
+            if (StaticIsDigit(s[i]))
+            {
+                if (!StaticParseInt(spec.prec, s, i, n))
+                    return ErrorCode::invalid_format_string;
+            }
+            else if (s[i] == '{')
+            {
+                dynamic = true;
+                if (Failed ec = StaticParseLBrace(s, i, n, nextarg, types))
+                    return ec;
+            }
+            else
+            {
+                spec.prec = 0;
+            }
+            break;
+        case '!':
+        case '}':
+            return {};
+        default:
+            spec.conv = s[i];
+            ++i;
+            return {};
+        }
+
+        if (i == n)
+            return ErrorCode::invalid_format_string;
+    }
+}
+
+constexpr ErrorCode StaticParseStyle(StaticField& field, char const* s, size_t& i, size_t n)
+{
+    ++i; // skip '!'
+    if (i == n)
+        return ErrorCode::invalid_format_string;
+
+    char delim = '\0';
+    switch (s[i])
+    {
+    case '\'':
+        delim = '\'';
+        break;
+    case '"':
+        delim = '"';
+        break;
+    case '{':
+        delim = '}';
+        break;
+    case '(':
+        delim = ')';
+        break;
+    case '[':
+        delim = ']';
+        break;
+    default:
+        break;
+    }
+
+    if (delim != '\0')
+        ++i;
+
+    size_t const i0 = i;
+    if (i0 == n)
+        return ErrorCode::invalid_format_string;
+
+    char const end_char = (delim == '\0') ? '}' : delim;
+    while (i < n && s[i] != end_char)
+        ++i;
+
+    field.style_pos = i0;
+    field.style_len = i - i0;
+
+    if (delim != '\0')
+    {
+        if (i == n)
+            return ErrorCode::invalid_format_string;
+        ++i; // skip delim
+    }
+
+    return {};
+}
+
+constexpr ErrorCode StaticParseReplacementField(StaticField& field, char const* s, size_t& i, size_t n, int& nextarg, Types types, bool& dynamic)
+{
+    if (s[i] == '*')
+    {
+        dynamic = true;
+        if (Failed ec = StaticParseFormatSpecArg(s, i, n, nextarg, types))
+            return ec;
+        if (i == n)
+            return ErrorCode::invalid_format_string;
+    }
+
+    if (s[i] == ':')
+    {
+        if (Failed ec = StaticParseFormatSpec(field.spec, s, i, n, nextarg, types, dynamic))
+            return ec;
+        if (i == n)
+            return ErrorCode::invalid_format_string;
+    }
+
+    if (s[i] == '!')
+    {
+        if (Failed ec = StaticParseStyle(field, s, i, n))
+            return ec;
+        if (i == n)
+            return ErrorCode::invalid_format_string;
+    }
+
+    if (s[i] != '}')
+        return ErrorCode::invalid_format_string;
+    ++i;
+
+    return {};
+}
+
+// Parses the format string [s, s + n) and checks the argument references
+// against TYPES. Returns the field with index WANT in result.field.
+constexpr StaticParseResult StaticParseFormatString(char const* s, size_t n, Types types, int want)
+{
+    StaticParseResult r;
+
+    StaticField field; // The current field
+    int nextarg = 0;
+
+    size_t lit = 0; // Start of the current run of literal text
+    size_t i = 0;
+    for (;;)
+    {
+        while (i < n && s[i] != '{' && s[i] != '}')
+            ++i;
+
+        if (i != lit)
+        {
+            if (field.text_len > 0) // Not contiguous. ('{{' or '}}')
+            {
+                if (r.num_fields == want)
+                    r.field = field;
+                ++r.num_fields;
+                field = StaticField{};
+            }
+            field.text_pos = lit;
+            field.text_len = i - lit;
+        }
+
+        if (i == n) // done.
+            break;
+
+        char const prev = s[i];
+        ++i; // skip '{' or '}'
+
+        if (i == n)
+        {
+            r.ec = ErrorCode::invalid_format_string;
+            return r;
+        }
+
+        if (prev == s[i]) // '{{' or '}}'
+        {
+            lit = i;
+            ++i;
+            continue;
+        }
+
+        if (prev == '}')
+        {
+            r.ec = ErrorCode::invalid_format_string;
+            return r;
+        }
+
+        int arg_index = -1;
+        if (StaticIsDigit(s[i]))
+        {
+            if (!StaticParseInt(arg_index, s, i, n) || i == n)
+            {
+                r.ec = ErrorCode::invalid_format_string;
+                return r;
+            }
+        }
+
+        if (s[i] != '}')
+        {
+            if (Failed ec = StaticParseReplacementField(field, s, i, n, nextarg, types, r.dynamic))
+            {
+                r.ec = ec;
+                return r;
+            }
+        }
+        else
+        {
+            ++i; // skip '}'
+        }
+
+        if (arg_index < 0)
+            arg_index = nextarg++;
+
+        lit = i;
+
+        if (types[arg_index] == Type::none)
+        {
+            r.ec = ErrorCode::index_out_of_range;
+            return r;
+        }
+        if (types[arg_index] == Type::formatspec)
+        {
+            r.ec = ErrorCode::invalid_argument;
+            return r;
+        }
+
+        field.arg = arg_index;
+
+        if (r.num_fields == want)
+            r.field = field;
+        ++r.num_fields;
+        field = StaticField{};
+    }
+
+    if (field.text_len > 0)
+    {
+        if (r.num_fields == want)
+            r.field = field;
+        ++r.num_fields;
+    }
+
+    return r;
+}
+
+template <typename S, Types::value_type Types>
+struct StaticFormat
+{
+    static constexpr StaticParseResult Parse(int want = -1) {
+        return StaticParseFormatString(S::data(), S::size(), Types, want);
+    }
+
+    static constexpr ErrorCode ec = Parse().ec;
+
+    static_assert(ec != ErrorCode::invalid_format_string, "invalid format string");
+    static_assert(ec != ErrorCode::index_out_of_range,    "argument index out of range");
+    static_assert(ec != ErrorCode::invalid_argument,      "invalid argument type: '*' requires a FormatSpec, '{}' requires an integer, and FormatSpecs cannot be formatted");
+
+    static constexpr int  num_fields = Parse().num_fields;
+    static constexpr bool dynamic    = Parse().dynamic;
+};
+
+// Like CallFormatFunc in Format.cc, but the type of the argument is known at compile time.
+inline ErrorCode CallStaticFormatFunc(Writer& w, FormatSpec const& spec, Arg const& arg, Type_t<Type::other>    ) { return arg.other.func(w, spec, arg.other.value); }
+inline ErrorCode CallStaticFormatFunc(Writer& w, FormatSpec const& spec, Arg const& arg, Type_t<Type::string>   ) { return Util::format_string(w, spec, arg.string.data, arg.string.size); }
+inline ErrorCode CallStaticFormatFunc(Writer& w, FormatSpec const& spec, Arg const& arg, Type_t<Type::pvoid>    ) { return Util::format_pointer(w, spec, arg.pvoid); }
+inline ErrorCode CallStaticFormatFunc(Writer& w, FormatSpec const& spec, Arg const& arg, Type_t<Type::pchar>    ) { return Util::format_char_pointer(w, spec, arg.pchar); }
+inline ErrorCode CallStaticFormatFunc(Writer& w, FormatSpec const& spec, Arg const& arg, Type_t<Type::char_>    ) { return Util::format_char(w, spec, arg.char_); }
+inline ErrorCode CallStaticFormatFunc(Writer& w, FormatSpec const& spec, Arg const& arg, Type_t<Type::bool_>    ) { return Util::format_bool(w, spec, arg.bool_); }
+inline ErrorCode CallStaticFormatFunc(Writer& w, FormatSpec const& spec, Arg const& arg, Type_t<Type::schar>    ) { return Util::format_int(w, spec, arg.schar); }
+inline ErrorCode CallStaticFormatFunc(Writer& w, FormatSpec const& spec, Arg const& arg, Type_t<Type::sshort>   ) { return Util::format_int(w, spec, arg.sshort); }
+inline ErrorCode CallStaticFormatFunc(Writer& w, FormatSpec const& spec, Arg const& arg, Type_t<Type::sint>     ) { return Util::format_int(w, spec, arg.sint); }
+inline ErrorCode CallStaticFormatFunc(Writer& w, FormatSpec const& spec, Arg const& arg, Type_t<Type::slonglong>) { return Util::format_int(w, spec, arg.slonglong); }
+inline ErrorCode CallStaticFormatFunc(Writer& w, FormatSpec const& spec, Arg const& arg, Type_t<Type::ulonglong>) { return Util::format_int(w, spec, arg.ulonglong); }
+inline ErrorCode CallStaticFormatFunc(Writer& w, FormatSpec const& spec, Arg const& arg, Type_t<Type::double_>  ) { return Util::format_double(w, spec, arg.double_); }
+inline ErrorCode CallStaticFormatFunc(Writer& w, FormatSpec const& spec, Arg const& arg, Type_t<Type::float_>   ) { return Util::format_float(w, spec, arg.float_); }
+
+template <typename S, typename Tuple>
+inline ErrorCode StaticFormatArg(Writer& /*w*/, StaticField const& /*field*/, Tuple const& /*args*/, std::integral_constant<int, -1>)
+{
+    return {};
+}
+
+template <typename S, typename Tuple, int Index>
+inline ErrorCode StaticFormatArg(Writer& w, StaticField const& field, Tuple const& args, std::integral_constant<int, Index>)
+{
+    using T = typename std::tuple_element<static_cast<size_t>(Index), Tuple>::type;
+
+    auto const& value = std::get<Index>(args);
+
+    if (field.style_len == 0)
+        return CallStaticFormatFunc(w, field.spec, Arg(value), TypeFor<T>{});
+
+    FormatSpec spec = field.spec;
+    spec.style = string_view(S::data() + field.style_pos, field.style_len);
+
+    return CallStaticFormatFunc(w, spec, Arg(value), TypeFor<T>{});
+}
+
+template <typename S, typename F, typename Tuple>
+inline ErrorCode StaticFormatFields(Writer& /*w*/, Tuple const& /*args*/, std::integral_constant<int, F::num_fields>)
+{
+    return {};
+}
+
+template <typename S, typename F, typename Tuple, int I>
+inline ErrorCode StaticFormatFields(Writer& w, Tuple const& args, std::integral_constant<int, I>)
+{
+    constexpr StaticField field = F::Parse(I).field;
+
+    if (Failed ec = w.write(S::data() + field.text_pos, field.text_len))
+        return ec;
+    if (Failed ec = StaticFormatArg<S>(w, field, args, std::integral_constant<int, field.arg>{}))
+        return ec;
+
+    return StaticFormatFields<S, F>(w, args, std::integral_constant<int, I + 1>{});
+}
+
+template <typename S, typename ...Args>
+inline ErrorCode DoStaticFormat(Writer& w, /*dynamic*/ std::true_type, S const& format, Args const&... args)
+{
+    // The format string has been checked, but the format-specs depend on
+    // run-time arguments. Use the run-time parser.
+    impl::ArgArray<Args...> arr = {args...};
+    return impl::DoFormat(w, ToStringView(format), arr, MakeTypes<Args...>::value);
+}
+
+template <typename S, typename ...Args>
+inline ErrorCode DoStaticFormat(Writer& w, /*dynamic*/ std::false_type, S const& /*format*/, Args const&... args)
+{
+    using F = StaticFormat<S, MakeTypes<Args...>::value>;
+
+    std::tuple<Args const&...> const tup(args...);
+    return StaticFormatFields<S, F>(w, tup, std::integral_constant<int, 0>{});
+}
+
+template <typename S, typename ...Args>
+inline ErrorCode DoStaticFormat(Writer& w, S const& format, Args const&... args)
+{
+    using F = StaticFormat<S, MakeTypes<Args...>::value>;
+
+    return DoStaticFormat(w, std::integral_constant<bool, F::dynamic>{}, format, args...);
+}
+
+#else // ^^^ FMTXX_HAS_RELAXED_CONSTEXPR ^^^
+
+template <typename S, typename ...Args>
+inline ErrorCode DoStaticFormat(Writer& w, S const& format, Args const&... args)
+{
+    impl::ArgArray<Args...> arr = {args...};
+    return impl::DoFormat(w, ToStringView(format), arr, MakeTypes<Args...>::value);
+}
+
+#endif // ^^^ !FMTXX_HAS_RELAXED_CONSTEXPR ^^^
+
+} // namespace fmtxx::impl
+
+template <typename S, typename ...Args, typename = typename std::enable_if<impl::IsStaticString<S>::value>::type>
+ErrorCode format(Writer& w, S const& format, Args const&... args)
+{
+    return fmtxx::impl::DoStaticFormat(w, format, args...);
+}
+
+template <typename S, typename ...Args, typename = typename std::enable_if<impl::IsStaticString<S>::value>::type>
+ErrorCode format(std::FILE* file, S const& format, Args const&... args)
+{
+    // Like the run-time version: format into a local buffer, then write the
+    // string to the stream with a single call to fwrite.
+    MemoryWriter<> buf;
+    auto const ec = fmtxx::impl::DoStaticFormat(buf, format, args...);
+
+    FILEWriter w{file};
+    auto const ec_write = w.write(buf.data(), buf.size());
+
+    return ec != ErrorCode::success ? ec : ec_write;
+}
+
+template <typename S, typename ...Args, typename = typename std::enable_if<impl::IsStaticString<S>::value>::type>
+ErrorCode format(std::string& str, S const& format, Args const&... args)
+{
+    MemoryWriter<> w;
+    auto const ec = fmtxx::impl::DoStaticFormat(w, format, args...);
+    if (str.empty())
+        w.release_into(str);
+    else
+        str.append(w.data(), w.size());
+    return ec;
+}
+
+template <typename S, typename ...Args, typename = typename std::enable_if<impl::IsStaticString<S>::value>::type>
+StringFormatResult string_format(S const& format, Args const&... args)
+{
+    StringFormatResult r;
+    r.ec = fmtxx::format(r.str, format, args...);
+    return r;
+}
+
+} // namespace fmtxx
+
+#endif // FMTXX_FORMAT_STRING_H
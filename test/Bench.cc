@@ -0,0 +1,1189 @@
+// Microbenchmarks.
+//
+// Usage: Bench [--csv | --json] [--filter=SUBSTRING] [--min-time=MILLISECONDS] [--threads=N]
+//
+// Each benchmark formats a fixed set of (random) inputs, one at a time, and
+// reports the best average time per call over a few repetitions. The fmtxx
+// benchmarks are run against each Writer; std::snprintf and std::ostringstream
+// are run as baselines where an equivalent conversion exists.
+//
+// The results are written to stdout, either as CSV (default) or as JSON, with
+// one record per (benchmark, target) pair.
+
+#include "../src/Format.h"
+#include "../src/Format_arena.h"
+#include "../src/Format_async.h"
+#include "../src/Format_binary.h"
+#include "../src/Format_bytes.h"
+#include "../src/Format_chrono.h"
+#include "../src/Format_iovec.h"
+#include "../src/Format_mmap.h"
+#include "../src/Format_ostream.h"
+#include "../src/Format_parallel.h"
+#include "../src/Format_pretty.h"
+#include "../src/Format_scan.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h> // close
+#endif
+
+#ifdef _WIN32
+static char const* const kNullDevice = "NUL";
+#else
+static char const* const kNullDevice = "/dev/null";
+#endif
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+struct Options
+{
+    bool        json = false;
+    std::string filter;
+    double      min_time = 0.05; // seconds
+    int         repetitions = 3;
+    int         threads = 4;
+};
+
+struct Result
+{
+    std::string benchmark;
+    std::string target;
+    double      ns_per_op = 0.0;
+    double      bytes_per_op = 0.0;
+    uint64_t    ops = 0;
+};
+
+static Options             g_options;
+static std::vector<Result> g_results;
+static std::FILE*          g_null_file = nullptr;
+
+// Accumulates the output sizes to keep the compiler from removing the
+// benchmarked code.
+static volatile size_t g_sink = 0;
+
+using Clock = std::chrono::steady_clock;
+
+static double SecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static bool Selected(std::string const& benchmark)
+{
+    return g_options.filter.empty() || benchmark.find(g_options.filter) != std::string::npos;
+}
+
+// Runs OP(i) for i in [0, num_inputs) until at least min_time seconds have
+// passed, repeats the measurement and records the best time per call.
+// OP returns the number of bytes produced.
+template <typename Op>
+static void Run(std::string const& benchmark, char const* target, size_t num_inputs, Op op)
+{
+    double   best_ns = std::numeric_limits<double>::infinity();
+    double   bytes_per_op = 0.0;
+    uint64_t total_ops = 0;
+
+    for (int rep = 0; rep < g_options.repetitions; ++rep)
+    {
+        uint64_t ops = 0;
+        size_t   bytes = 0;
+
+        auto const start = Clock::now();
+        double elapsed = 0.0;
+        do
+        {
+            for (size_t i = 0; i < num_inputs; ++i)
+                bytes += op(i);
+            ops += num_inputs;
+            elapsed = SecondsSince(start);
+        }
+        while (elapsed < g_options.min_time);
+
+        g_sink += bytes;
+
+        best_ns = std::min(best_ns, elapsed * 1e9 / static_cast<double>(ops));
+        bytes_per_op = static_cast<double>(bytes) / static_cast<double>(ops);
+        total_ops += ops;
+    }
+
+    Result r;
+    r.benchmark = benchmark;
+    r.target = target;
+    r.ns_per_op = best_ns;
+    r.bytes_per_op = bytes_per_op;
+    r.ops = total_ops;
+    g_results.push_back(r);
+
+    std::fprintf(stderr, "%-36s %-16s %10.2f ns\n", benchmark.c_str(), target, best_ns);
+}
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+struct Identity
+{
+    template <typename T>
+    T const& operator()(T const& value) const { return value; }
+};
+
+struct MakePretty
+{
+    template <typename T>
+    fmtxx::impl::PrettyPrinter<T const&> operator()(T const& value) const { return fmtxx::pretty(value); }
+};
+
+template <typename T>
+using StreamFunc = void (*)(std::ostream& os, T const& value);
+
+// std::snprintf takes C-strings.
+template <typename T>
+static T PrintfArg(T value) { return value; }
+
+static char const* PrintfArg(std::string const& value) { return value.c_str(); }
+
+template <typename T>
+using HasPrintfArg = std::integral_constant<bool, std::is_arithmetic<T>::value || std::is_same<T, std::string>::value>;
+
+template <typename T>
+static void RunSnprintf(std::string const& benchmark, std::vector<T> const& values, char const* printf_format, std::true_type)
+{
+    Run(benchmark, "snprintf", values.size(), [&](size_t i) {
+        char buf[1024];
+        int const len = std::snprintf(buf, sizeof(buf), printf_format, PrintfArg(values[i]));
+        return static_cast<size_t>(len);
+    });
+}
+
+template <typename T>
+static void RunSnprintf(std::string const& /*benchmark*/, std::vector<T> const& /*values*/, char const* /*printf_format*/, std::false_type)
+{
+}
+
+// Runs the brace-style format string FORMAT against each Writer, and the
+// printf-style format string PRINTF_FORMAT (if non-null) and STREAM_FUNC (if
+// non-null) as baselines.
+template <typename T, typename Transform = Identity>
+static void BenchFormat(std::string const& benchmark, std::vector<T> const& values,
+                        char const* format, char const* printf_format = nullptr,
+                        typename std::common_type<StreamFunc<T>>::type stream_func = nullptr, Transform transform = Transform{})
+{
+    if (!Selected(benchmark))
+        return;
+
+    size_t const n = values.size();
+
+    Run(benchmark, "fmtxx-array", n, [&](size_t i) {
+        char buf[1024];
+        fmtxx::ArrayWriter w{buf};
+        fmtxx::format(w, format, transform(values[i]));
+        return w.size();
+    });
+
+    Run(benchmark, "fmtxx-memory", n, [&](size_t i) {
+        fmtxx::MemoryWriter<> w;
+        fmtxx::format(w, format, transform(values[i]));
+        return w.size();
+    });
+
+    Run(benchmark, "fmtxx-string", n, [&](size_t i) {
+        std::string str;
+        fmtxx::format(str, format, transform(values[i]));
+        return str.size();
+    });
+
+    Run(benchmark, "fmtxx-file", n, [&](size_t i) {
+        return static_cast<size_t>(fmtxx::fformat(g_null_file, format, transform(values[i])));
+    });
+
+    {
+        std::ostringstream os;
+        Run(benchmark, "fmtxx-ostream", n, [&](size_t i) {
+            os.seekp(0);
+            fmtxx::format(os, format, transform(values[i]));
+            return static_cast<size_t>(os.tellp());
+        });
+    }
+
+    if (printf_format != nullptr)
+        RunSnprintf(benchmark, values, printf_format, HasPrintfArg<T>{});
+
+    if (stream_func != nullptr)
+    {
+        std::ostringstream os;
+        Run(benchmark, "ostringstream", n, [&](size_t i) {
+            os.seekp(0);
+            stream_func(os, values[i]);
+            return static_cast<size_t>(os.tellp());
+        });
+    }
+}
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+static constexpr size_t kNumInputs = 1024;
+
+static std::mt19937_64 g_random(0x5EED);
+
+template <typename T>
+static std::vector<T> RandomInts(T min, T max)
+{
+    std::uniform_int_distribution<T> dist(min, max);
+
+    std::vector<T> values(kNumInputs);
+    for (auto& v : values)
+        v = dist(g_random);
+
+    return values;
+}
+
+// Random integers with a uniformly distributed number of digits.
+static std::vector<uint64_t> RandomLengthInts()
+{
+    std::uniform_int_distribution<int> num_bits(1, 64);
+
+    std::vector<uint64_t> values(kNumInputs);
+    for (auto& v : values)
+        v = g_random() >> (64 - num_bits(g_random));
+
+    return values;
+}
+
+// Random finite doubles with uniformly distributed bit patterns.
+static std::vector<double> RandomBitsDoubles()
+{
+    std::vector<double> values;
+    values.reserve(kNumInputs);
+
+    while (values.size() < kNumInputs)
+    {
+        uint64_t const bits = g_random();
+        double v;
+        std::memcpy(&v, &bits, sizeof(double));
+        if (v == v && v - v == 0) // finite
+            values.push_back(v);
+    }
+
+    return values;
+}
+
+// Random finite floats with uniformly distributed bit patterns.
+static std::vector<float> RandomBitsFloats()
+{
+    std::vector<float> values;
+    values.reserve(kNumInputs);
+
+    while (values.size() < kNumInputs)
+    {
+        uint32_t const bits = static_cast<uint32_t>(g_random());
+        float v;
+        std::memcpy(&v, &bits, sizeof(float));
+        if (v == v && v - v == 0) // finite
+            values.push_back(v);
+    }
+
+    return values;
+}
+
+static std::vector<double> RandomDoubles(double min, double max)
+{
+    std::uniform_real_distribution<double> dist(min, max);
+
+    std::vector<double> values(kNumInputs);
+    for (auto& v : values)
+        v = dist(g_random);
+
+    return values;
+}
+
+// Subnormal numbers. These require a large number of digits in fixed and
+// precision mode and are hard cases for Grisu (which falls back to Bignum).
+static std::vector<double> RandomSubnormals()
+{
+    std::vector<double> values(kNumInputs);
+    for (auto& v : values)
+    {
+        uint64_t const bits = g_random() & ((uint64_t{1} << 52) - 1);
+        std::memcpy(&v, &bits, sizeof(double));
+    }
+
+    return values;
+}
+
+static std::vector<std::string> RandomStrings(size_t min_len, size_t max_len, char const* alphabet)
+{
+    size_t const alphabet_len = std::strlen(alphabet);
+
+    std::uniform_int_distribution<size_t> len_dist(min_len, max_len);
+    std::uniform_int_distribution<size_t> char_dist(0, alphabet_len - 1);
+
+    std::vector<std::string> values(kNumInputs);
+    for (auto& s : values)
+    {
+        s.resize(len_dist(g_random));
+        for (auto& c : s)
+            c = alphabet[char_dist(g_random)];
+    }
+
+    return values;
+}
+
+static std::vector<std::vector<int>> RandomVectors(size_t len)
+{
+    std::uniform_int_distribution<int> dist(-100000, 100000);
+
+    std::vector<std::vector<int>> values(kNumInputs / 8);
+    for (auto& vec : values)
+    {
+        vec.resize(len);
+        for (auto& v : vec)
+            v = dist(g_random);
+    }
+
+    return values;
+}
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+static void BenchInts()
+{
+    auto const i32 = RandomInts<int32_t>(std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::max());
+    auto const small = RandomInts<int32_t>(-999, 999);
+    auto const u64 = RandomLengthInts();
+
+    BenchFormat("int32/dec", i32, "{}", "%" PRId32,
+        [](std::ostream& os, int32_t const& v) { os << v; });
+    BenchFormat("int32/dec-small", small, "{}", "%" PRId32,
+        [](std::ostream& os, int32_t const& v) { os << v; });
+    BenchFormat("int32/dec-width", i32, "{:12}", "%12" PRId32,
+        [](std::ostream& os, int32_t const& v) { os << std::setw(12) << v; });
+    BenchFormat("int32/dec-zero", small, "{:08}", "%08" PRId32,
+        [](std::ostream& os, int32_t const& v) { os << std::setfill('0') << std::setw(8) << v; });
+    BenchFormat("uint64/dec", u64, "{}", "%" PRIu64,
+        [](std::ostream& os, uint64_t const& v) { os << v; });
+    BenchFormat("uint64/hex", u64, "{:x}", "%" PRIx64,
+        [](std::ostream& os, uint64_t const& v) { os << std::hex << v; });
+    BenchFormat("uint64/oct", u64, "{:o}", "%" PRIo64,
+        [](std::ostream& os, uint64_t const& v) { os << std::oct << v; });
+    BenchFormat("uint64/bin", u64, "{:b}");
+    BenchFormat("uint64/dec-tsep", u64, "{:'}");
+}
+
+static void BenchDoubles()
+{
+    auto const bits = RandomBitsDoubles();
+    auto const uniform = RandomDoubles(0.0, 1.0e6);
+    auto const subnormals = RandomSubnormals();
+
+    // There is no printf conversion for the shortest representation; "%.17g"
+    // is what is typically used to round-trip doubles.
+    BenchFormat("double/shortest", bits, "{}", "%.17g",
+        [](std::ostream& os, double const& v) { os << std::setprecision(17) << v; });
+    BenchFormat("double/shortest-uniform", uniform, "{}", "%.17g",
+        [](std::ostream& os, double const& v) { os << std::setprecision(17) << v; });
+    BenchFormat("double/shortest-subnormal", subnormals, "{}", "%.17g",
+        [](std::ostream& os, double const& v) { os << std::setprecision(17) << v; });
+    BenchFormat("double/fixed", uniform, "{:f}", "%f",
+        [](std::ostream& os, double const& v) { os << std::fixed << v; });
+    BenchFormat("double/fixed-prec2", uniform, "{:.2f}", "%.2f",
+        [](std::ostream& os, double const& v) { os << std::fixed << std::setprecision(2) << v; });
+    BenchFormat("double/exponent", bits, "{:e}", "%e",
+        [](std::ostream& os, double const& v) { os << std::scientific << v; });
+    BenchFormat("double/general", bits, "{:g}", "%g",
+        [](std::ostream& os, double const& v) { os << v; });
+    BenchFormat("double/hex", bits, "{:a}", "%a",
+        [](std::ostream& os, double const& v) { os << std::hexfloat << v; });
+
+    // Large precisions, which Grisu cannot handle and which require the Bignum
+    // fallback.
+    BenchFormat("double/exponent-prec30", bits, "{:.30e}", "%.30e",
+        [](std::ostream& os, double const& v) { os << std::scientific << std::setprecision(30) << v; });
+    BenchFormat("double/fixed-subnormal", subnormals, "{:.400f}", "%.400f",
+        [](std::ostream& os, double const& v) { os << std::fixed << std::setprecision(400) << v; });
+}
+
+struct PromoteToDouble
+{
+    double operator()(float value) const { return value; }
+};
+
+static void BenchFloats()
+{
+    auto const bits = RandomBitsFloats();
+
+    // "%.9g" round-trips floats.
+    BenchFormat("float/shortest", bits, "{}", "%.9g",
+        [](std::ostream& os, float const& v) { os << std::setprecision(9) << v; });
+    // The shortest representation of the promoted value, for comparison.
+    BenchFormat("float/shortest-as-double", bits, "{}", nullptr, nullptr, PromoteToDouble{});
+    BenchFormat("float/general", bits, "{:g}", "%g",
+        [](std::ostream& os, float const& v) { os << v; });
+}
+
+static void BenchStrings()
+{
+    auto const words = RandomStrings(1, 24, "abcdefghijklmnopqrstuvwxyz");
+    auto const text = RandomStrings(64, 256, "abcdefghijklmnopqrstuvwxyz ");
+    auto const special = RandomStrings(16, 128, "abcdefgh\"\\\t\n\x01\x7f");
+
+    BenchFormat("string/plain", words, "{}", "%s",
+        [](std::ostream& os, std::string const& v) { os << v; });
+    BenchFormat("string/pad-right", words, "{:>32}", "%32s",
+        [](std::ostream& os, std::string const& v) { os << std::setw(32) << v; });
+    BenchFormat("string/pad-left", words, "{:<32}", "%-32s",
+        [](std::ostream& os, std::string const& v) { os << std::left << std::setw(32) << v; });
+    BenchFormat("string/center", words, "{:*^32}");
+    BenchFormat("string/long", text, "{}", "%s",
+        [](std::ostream& os, std::string const& v) { os << v; });
+    BenchFormat("string/quoted", text, "{:q}");
+    BenchFormat("string/quoted-special", special, "{:q}");
+    BenchFormat("string/escaped-special", special, "{:x}");
+    BenchFormat("string/json", text, "{:j}");
+    BenchFormat("string/json-special", special, "{:j}");
+}
+
+static void BenchPretty()
+{
+    auto const vectors = RandomVectors(16);
+
+    BenchFormat("pretty/vector-int16", vectors, "{}", nullptr,
+        [](std::ostream& os, std::vector<int> const& vec) {
+            os << '[';
+            for (size_t i = 0; i < vec.size(); ++i)
+            {
+                if (i != 0)
+                    os << ", ";
+                os << vec[i];
+            }
+            os << ']';
+        },
+        MakePretty{});
+}
+
+// A typical log line with multiple arguments.
+static void BenchMultipleArgs()
+{
+    std::string const benchmark = "mixed/log-line";
+    if (!Selected(benchmark))
+        return;
+
+    auto const ids = RandomInts<int32_t>(-100000, 100000);
+    size_t const n = ids.size();
+
+    char const* const format = "[{:>8}] request {} took {:.3f} ms: {}";
+    char const* const printf_format = "[%8s] request %d took %.3f ms: %s";
+
+    Run(benchmark, "fmtxx-array", n, [&](size_t i) {
+        char buf[1024];
+        fmtxx::ArrayWriter w{buf};
+        fmtxx::format(w, format, "info", ids[i], ids[i] * 0.001, "ok");
+        return w.size();
+    });
+
+    Run(benchmark, "fmtxx-memory", n, [&](size_t i) {
+        fmtxx::MemoryWriter<> w;
+        fmtxx::format(w, format, "info", ids[i], ids[i] * 0.001, "ok");
+        return w.size();
+    });
+
+    Run(benchmark, "fmtxx-string", n, [&](size_t i) {
+        std::string str;
+        fmtxx::format(str, format, "info", ids[i], ids[i] * 0.001, "ok");
+        return str.size();
+    });
+
+    Run(benchmark, "fmtxx-file", n, [&](size_t i) {
+        return static_cast<size_t>(fmtxx::fformat(g_null_file, format, "info", ids[i], ids[i] * 0.001, "ok"));
+    });
+
+    {
+        std::ostringstream os;
+        Run(benchmark, "fmtxx-ostream", n, [&](size_t i) {
+            os.seekp(0);
+            fmtxx::format(os, format, "info", ids[i], ids[i] * 0.001, "ok");
+            return static_cast<size_t>(os.tellp());
+        });
+    }
+
+    Run(benchmark, "snprintf", n, [&](size_t i) {
+        char buf[1024];
+        int const len = std::snprintf(buf, sizeof(buf), printf_format, "info", ids[i], ids[i] * 0.001, "ok");
+        return static_cast<size_t>(len);
+    });
+
+    {
+        std::ostringstream os;
+        os << std::fixed << std::setprecision(3);
+        Run(benchmark, "ostringstream", n, [&](size_t i) {
+            os.seekp(0);
+            os << '[' << std::setw(8) << "info" << "] request " << ids[i] << " took " << ids[i] * 0.001 << " ms: " << "ok";
+            return static_cast<size_t>(os.tellp());
+        });
+    }
+}
+
+// A long format string with only a few cheap arguments, where parsing is a
+// significant part of the total cost.
+static void BenchParseCache()
+{
+    std::string const benchmark = "mixed/parse-cache";
+    if (!Selected(benchmark))
+        return;
+
+    auto const ids = RandomInts<int32_t>(0, 100000);
+    size_t const n = ids.size();
+
+    char const* const format = "{{\"id\": {}, \"parent\": {}, \"state\": \"{}\", \"retries\": {}, \"flags\": \"{:08x}\"}}";
+    char const* const printf_format = "{\"id\": %d, \"parent\": %d, \"state\": \"%s\", \"retries\": %d, \"flags\": \"%08x\"}";
+
+    for (size_t capacity : {size_t{0}, size_t{16}})
+    {
+        fmtxx::set_parse_cache_capacity(capacity);
+        bool const cached = capacity != 0;
+
+        Run(benchmark, cached ? "fmtxx-array-cached" : "fmtxx-array", n, [&](size_t i) {
+            char buf[1024];
+            fmtxx::ArrayWriter w{buf};
+            fmtxx::format(w, format, ids[i], ids[i] / 2, "done", ids[i] % 4, ids[i]);
+            return w.size();
+        });
+
+        Run(benchmark, cached ? "fmtxx-printf-cached" : "fmtxx-printf", n, [&](size_t i) {
+            char buf[1024];
+            fmtxx::ArrayWriter w{buf};
+            fmtxx::printf(w, printf_format, ids[i], ids[i] / 2, "done", ids[i] % 4, ids[i]);
+            return w.size();
+        });
+    }
+    fmtxx::set_parse_cache_capacity(0);
+
+    fmtxx::CompiledFormat const compiled{format};
+    Run(benchmark, "fmtxx-compiled", n, [&](size_t i) {
+        char buf[1024];
+        fmtxx::ArrayWriter w{buf};
+        fmtxx::format(w, compiled, ids[i], ids[i] / 2, "done", ids[i] % 4, ids[i]);
+        return w.size();
+    });
+
+    Run(benchmark, "snprintf", n, [&](size_t i) {
+        char buf[1024];
+        int const len = std::snprintf(buf, sizeof(buf), printf_format, ids[i], ids[i] / 2, "done", ids[i] % 4, ids[i]);
+        return static_cast<size_t>(len);
+    });
+}
+
+// Hex dumps of keys (32 bytes) and packets (1500 bytes).
+static void BenchBytes(std::string const& benchmark, size_t size)
+{
+    if (!Selected(benchmark))
+        return;
+
+    auto const ints = RandomInts<int32_t>(0, 255);
+    std::vector<unsigned char> data(ints.size() + size);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<unsigned char>(ints[i % ints.size()]);
+
+    size_t const n = ints.size();
+
+    fmtxx::MemoryWriter<> w;
+
+    Run(benchmark, "fmtxx-bytes", n, [&](size_t i) {
+        w.clear();
+        fmtxx::format(w, "{}", fmtxx::bytes(data.data() + i, size));
+        return w.size();
+    });
+
+    Run(benchmark, "fmtxx-bytes-grouped", n, [&](size_t i) {
+        w.clear();
+        fmtxx::format(w, "{!' '}", fmtxx::bytes(data.data() + i, size));
+        return w.size();
+    });
+
+    Run(benchmark, "fmtxx-hexdump", n, [&](size_t i) {
+        w.clear();
+        fmtxx::format(w, "{:C}", fmtxx::bytes(data.data() + i, size));
+        return w.size();
+    });
+
+    // What callers had to do before.
+    Run(benchmark, "fmtxx-loop", n, [&](size_t i) {
+        w.clear();
+        for (size_t j = 0; j < size; ++j)
+            fmtxx::format(w, "{:02x}", data[i + j]);
+        return w.size();
+    });
+
+    Run(benchmark, "snprintf-loop", n, [&](size_t i) {
+        char buf[2 * 1500 + 1];
+        for (size_t j = 0; j < size; ++j)
+            std::snprintf(buf + 2 * j, 3, "%02x", data[i + j]);
+        return 2 * size;
+    });
+}
+
+static void BenchBytes()
+{
+    BenchBytes("bytes/hex-32", 32);
+    BenchBytes("bytes/hex-1500", 1500);
+}
+
+// Log line prefixes: consecutive time stamps, ~1000 per second.
+static void BenchTimestamps()
+{
+    std::string const benchmark = "chrono/log-timestamp";
+    if (!Selected(benchmark))
+        return;
+
+    using std::chrono::system_clock;
+
+    size_t const n = 10000;
+    std::vector<system_clock::time_point> stamps(n);
+    auto const start = system_clock::now();
+    for (size_t i = 0; i < n; ++i)
+        stamps[i] = start + std::chrono::duration_cast<system_clock::duration>(std::chrono::microseconds(i * 997));
+
+    Run(benchmark, "fmtxx-array", n, [&](size_t i) {
+        char buf[128];
+        fmtxx::ArrayWriter w{buf};
+        fmtxx::format(w, "[{:l!'%F %T.%6N'}] ", stamps[i]);
+        return w.size();
+    });
+
+    Run(benchmark, "fmtxx-array-utc", n, [&](size_t i) {
+        char buf[128];
+        fmtxx::ArrayWriter w{buf};
+        fmtxx::format(w, "[{!'%FT%T.%6N'}] ", stamps[i]);
+        return w.size();
+    });
+
+#ifndef _WIN32
+    // What callers had to do before: localtime_r + strftime, then pass the
+    // result as a string.
+    Run(benchmark, "strftime+fmtxx", n, [&](size_t i) {
+        auto const us = std::chrono::duration_cast<std::chrono::microseconds>(stamps[i].time_since_epoch()).count();
+        std::time_t const t = system_clock::to_time_t(stamps[i]);
+        std::tm tm;
+        char date[64];
+        std::strftime(date, sizeof(date), "%F %T", localtime_r(&t, &tm));
+
+        char buf[128];
+        fmtxx::ArrayWriter w{buf};
+        fmtxx::format(w, "[{}.{:06}] ", date, us % 1000000);
+        return w.size();
+    });
+#endif
+}
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+// Multiple threads writing to the same FILE. Each call writes a complete line
+// and must lock the stream.
+static void BenchFileContention()
+{
+    int const num_threads = std::max(1, g_options.threads);
+
+    std::string const benchmark = "contention/fprintf-" + std::to_string(num_threads) + "-threads";
+    if (!Selected(benchmark))
+        return;
+
+    auto run = [&](char const* target, void (*op)(int thread, int i))
+    {
+        static constexpr int kOpsPerThread = 20000;
+
+        double best_ns = std::numeric_limits<double>::infinity();
+        for (int rep = 0; rep < g_options.repetitions; ++rep)
+        {
+            std::atomic<bool> go{false};
+
+            std::vector<std::thread> threads;
+            for (int t = 0; t < num_threads; ++t)
+            {
+                threads.emplace_back([&, t] {
+                    while (!go.load(std::memory_order_acquire))
+                        std::this_thread::yield();
+                    for (int i = 0; i < kOpsPerThread; ++i)
+                        op(t, i);
+                });
+            }
+
+            auto const start = Clock::now();
+            go.store(true, std::memory_order_release);
+            for (auto& t : threads)
+                t.join();
+            double const elapsed = SecondsSince(start);
+
+            best_ns = std::min(best_ns, elapsed * 1e9 / (1.0 * kOpsPerThread * num_threads));
+        }
+
+        Result r;
+        r.benchmark = benchmark;
+        r.target = target;
+        r.ns_per_op = best_ns;
+        r.ops = static_cast<uint64_t>(kOpsPerThread) * static_cast<uint64_t>(num_threads * g_options.repetitions);
+        g_results.push_back(r);
+
+        std::fprintf(stderr, "%-36s %-16s %10.2f ns\n", benchmark.c_str(), target, best_ns);
+    };
+
+    run("fmtxx-fformat", [](int thread, int i) {
+        fmtxx::fformat(g_null_file, "thread {} line {}: {:.3f} {}\n", thread, i, i * 0.5, "some text");
+    });
+    run("fmtxx-fprintf", [](int thread, int i) {
+        fmtxx::fprintf(g_null_file, "thread %d line %d: %.3f %s\n", thread, i, i * 0.5, "some text");
+    });
+    run("fprintf", [](int thread, int i) {
+        std::fprintf(g_null_file, "thread %d line %d: %.3f %s\n", thread, i, i * 0.5, "some text");
+    });
+}
+
+// The cost on the calling thread of submitting a message to an AsyncSink,
+// compared to formatting it directly.
+static void BenchAsync()
+{
+    std::string const benchmark = "async/log-line";
+    if (!Selected(benchmark))
+        return;
+
+    auto const ids = RandomInts<int32_t>(-100000, 100000);
+    size_t const n = ids.size();
+
+    char const* const format = "[{:>8}] request {} took {:.3f} ms: {}\n";
+
+    Run(benchmark, "fmtxx-file", n, [&](size_t i) {
+        return static_cast<size_t>(fmtxx::fformat(g_null_file, format, "info", ids[i], ids[i] * 0.001, "ok"));
+    });
+
+    fmtxx::AsyncSink sink{g_null_file};
+    Run(benchmark, "fmtxx-async", n, [&](size_t i) {
+        fmtxx::format(sink, format, "info", ids[i], ids[i] * 0.001, "ok");
+        return size_t{0};
+    });
+    sink.flush();
+}
+
+// Recording a message with a BinaryWriter, compared to formatting it.
+static void BenchBinary()
+{
+    std::string const benchmark = "binary/log-line";
+    if (!Selected(benchmark))
+        return;
+
+    auto const ids = RandomInts<int32_t>(-100000, 100000);
+    size_t const n = ids.size();
+
+    char const* const format = "[{:>8}] request {} took {:.3f} ms: {}\n";
+
+    Run(benchmark, "fmtxx-memory", n, [&](size_t i) {
+        fmtxx::MemoryWriter<> w;
+        fmtxx::format(w, format, "info", ids[i], ids[i] * 0.001, "ok");
+        return w.size();
+    });
+
+    fmtxx::MemoryWriter<> buf;
+    fmtxx::BinaryWriter bw{buf};
+    Run(benchmark, "fmtxx-binary", n, [&](size_t i) {
+        buf.clear();
+        fmtxx::format(bw, format, "info", ids[i], ids[i] * 0.001, "ok");
+        return buf.size();
+    });
+}
+
+static void BenchExactString()
+{
+    std::string const benchmark = "string/exact-8k";
+    if (!Selected(benchmark))
+        return;
+
+    auto const ids = RandomInts<int32_t>(-100000, 100000);
+    size_t const n = ids.size();
+
+    std::string const payload(8000, 'x');
+    char const* const format = "{} {} {}\n";
+
+    Run(benchmark, "fmtxx-string", n, [&](size_t i) {
+        return fmtxx::string_format(format, ids[i], payload, ids[i] * 0.5).str.size();
+    });
+
+    Run(benchmark, "fmtxx-exact", n, [&](size_t i) {
+        return fmtxx::string_format_exact(format, ids[i], payload, ids[i] * 0.5).str.size();
+    });
+}
+
+// Formats strings of ~600 bytes (too large for the small string buffer and
+// the inline buffer of MemoryWriter), releasing the arena every 64 strings.
+static void BenchArena()
+{
+    std::string const benchmark = "string/arena";
+    if (!Selected(benchmark))
+        return;
+
+    auto const ids = RandomInts<int32_t>(-100000, 100000);
+    size_t const n = ids.size();
+
+    std::string const payload(600, 'x');
+    char const* const format = "{} {} {}";
+
+    Run(benchmark, "fmtxx-string", n, [&](size_t i) {
+        return fmtxx::string_format(format, ids[i], payload, ids[i] * 0.5).str.size();
+    });
+
+    fmtxx::Arena arena{64 * 1024};
+    Run(benchmark, "fmtxx-arena", n, [&](size_t i) {
+        if (i % 64 == 0)
+            arena.release();
+        return fmtxx::string_format(arena, format, ids[i], payload, ids[i] * 0.5).str.size();
+    });
+}
+
+static void BenchIovec()
+{
+#ifndef _WIN32
+    std::string const benchmark = "iovec/payload-8k";
+    if (!Selected(benchmark))
+        return;
+
+    auto const ids = RandomInts<int32_t>(-100000, 100000);
+    size_t const n = ids.size();
+
+    std::string const payload(8000, 'x');
+    char const* const format = "HDR {} {}\n{}\nEND\n";
+
+    Run(benchmark, "fmtxx-file", n, [&](size_t i) {
+        fmtxx::format(g_null_file, format, ids[i], payload.size(), payload);
+        std::fflush(g_null_file);
+        return payload.size();
+    });
+
+    int const fd = fileno(g_null_file);
+    Run(benchmark, "fmtxx-writev", n, [&](size_t i) {
+        fmtxx::format_to_fd(fd, format, ids[i], payload.size(), payload);
+        return payload.size();
+    });
+#endif
+}
+
+// Appending log lines to a file. Uses a real (temporary) file, since the
+// page cache is part of the cost.
+static void BenchMmap()
+{
+#ifndef _WIN32
+    std::string const benchmark = "file/log-lines";
+    if (!Selected(benchmark))
+        return;
+
+    char path[] = "/tmp/fmtxx-bench-XXXXXX";
+    int const fd = ::mkstemp(path);
+    if (fd < 0)
+        return;
+    ::close(fd);
+
+    auto const ids = RandomInts<int32_t>(-100000, 100000);
+    size_t const n = ids.size();
+
+    char const* const format = "[{:>8}] request {} took {:.3f} ms: {}\n";
+
+    {
+        std::FILE* file = std::fopen(path, "wb");
+        fmtxx::FILEWriter w{file};
+        Run(benchmark, "fmtxx-file", n, [&](size_t i) {
+            size_t const size = w.size();
+            fmtxx::format(w, format, "info", ids[i], ids[i] * 0.001, "ok");
+            return w.size() - size;
+        });
+        std::fclose(file);
+    }
+
+    std::fclose(std::fopen(path, "wb"));
+    {
+        fmtxx::MmapWriter w{path};
+        Run(benchmark, "fmtxx-mmap", n, [&](size_t i) {
+            uint64_t const size = w.size();
+            fmtxx::format(w, format, "info", ids[i], ids[i] * 0.001, "ok");
+            return static_cast<size_t>(w.size() - size);
+        });
+    }
+
+    std::fclose(std::fopen(path, "wb"));
+    {
+        fmtxx::MmapFile file{path, uint64_t{1} << 36};
+        Run(benchmark, "fmtxx-mmapfile", n, [&](size_t i) {
+            uint64_t const size = file.size();
+            fmtxx::format(file, format, "info", ids[i], ids[i] * 0.001, "ok");
+            return static_cast<size_t>(file.size() - size);
+        });
+    }
+
+    std::remove(path);
+#endif
+}
+
+namespace {
+
+struct Point
+{
+    int x;
+    int y;
+};
+
+// Only streamable, no FormatValue.
+std::ostream& operator<<(std::ostream& os, Point const& p)
+{
+    return os << '(' << p.x << ", " << p.y << ')';
+}
+
+} // namespace
+
+static void BenchStreamable()
+{
+    std::string const benchmark = "ostream/operator<<";
+    if (!Selected(benchmark))
+        return;
+
+    auto const ints = RandomInts<int32_t>(-100000, 100000);
+    size_t const n = ints.size();
+
+    Run(benchmark, "fmtxx-memory", n, [&](size_t i) {
+        fmtxx::MemoryWriter<> w;
+        fmtxx::format(w, "{}", Point{ints[i], ints[n - 1 - i]});
+        return w.size();
+    });
+
+    Run(benchmark, "ostringstream", n, [&](size_t i) {
+        std::ostringstream os;
+        os << Point{ints[i], ints[n - 1 - i]};
+        return os.str().size();
+    });
+}
+
+// Formats rows of 64 values, cell by cell and using format_row.
+template <typename T>
+static void BenchRange(std::string const& benchmark, std::vector<T> const& values, char const* field)
+{
+    if (!Selected(benchmark))
+        return;
+
+    static constexpr size_t kRowSize = 64;
+    size_t const n = values.size() / kRowSize;
+
+    std::string const cell = std::string(field) + ",";
+
+    fmtxx::MemoryWriter<> w;
+    Run(benchmark, "fmtxx-cells", n, [&](size_t i) {
+        w.clear();
+        for (size_t j = 0; j < kRowSize; ++j)
+            fmtxx::format(w, cell, values[i * kRowSize + j]);
+        return w.size();
+    });
+
+    Run(benchmark, "fmtxx-row", n, [&](size_t i) {
+        w.clear();
+        fmtxx::format_range(w, field, values.data() + i * kRowSize, values.data() + (i + 1) * kRowSize, ",");
+        return w.size();
+    });
+}
+
+static void BenchRanges()
+{
+    BenchRange("range/int64", RandomInts<int64_t>(INT64_MIN, INT64_MAX), "{}");
+    BenchRange("range/int32-hex", RandomInts<int32_t>(INT32_MIN, INT32_MAX), "{:08x}");
+    BenchRange("range/double-fixed", RandomDoubles(-1000.0, 1000.0), "{:.3f}");
+}
+
+// Formats a batch of 256K rows, one after the other and using format_parallel
+// with --threads worker threads. The times are per batch.
+static void BenchParallel()
+{
+    std::string const benchmark = "parallel/256k-rows";
+    if (!Selected(benchmark))
+        return;
+
+    std::vector<double> values;
+    for (int i = 0; i < 256; ++i)
+    {
+        auto const chunk = RandomDoubles(-1.0e6, 1.0e6);
+        values.insert(values.end(), chunk.begin(), chunk.end());
+    }
+
+    fmtxx::CompiledFormat const format{"{0:.3f},{0:e},{0}\n"};
+    std::string const parallel_target = "fmtxx-parallel-" + std::to_string(g_options.threads);
+
+    fmtxx::MemoryWriter<> w;
+    Run(benchmark, "fmtxx-sequential", 1, [&](size_t) {
+        w.clear();
+        for (double v : values)
+            fmtxx::format(w, format, v);
+        return w.size();
+    });
+
+    Run(benchmark, parallel_target.c_str(), 1, [&](size_t) {
+        w.clear();
+        fmtxx::format_parallel(w, format, values.begin(), values.end(), g_options.threads);
+        return w.size();
+    });
+}
+
+// Parses the (formatted) values back, using scan and the C library as the
+// baseline.
+template <typename T, typename Parse>
+static void BenchScan(std::string const& benchmark, std::vector<T> const& values, char const* field, char const* scanf_format, Parse parse)
+{
+    if (!Selected(benchmark))
+        return;
+
+    std::vector<std::string> inputs;
+    for (auto const& v : values)
+        inputs.push_back(fmtxx::string_format(field, v).str);
+
+    size_t const n = inputs.size();
+
+    Run(benchmark, "fmtxx-scan", n, [&](size_t i) {
+        T value{};
+        auto const r = fmtxx::scan(inputs[i], "{}", value);
+        return static_cast<size_t>(r.next - inputs[i].data()) + (value != T{} ? 1u : 0u);
+    });
+
+    Run(benchmark, "sscanf", n, [&](size_t i) {
+        T value{};
+        int len = 0;
+        std::sscanf(inputs[i].c_str(), scanf_format, &value, &len);
+        return static_cast<size_t>(len) + (value != T{} ? 1u : 0u);
+    });
+
+    Run(benchmark, "strto*", n, [&](size_t i) {
+        char* end = nullptr;
+        T const value = parse(inputs[i].c_str(), &end);
+        return static_cast<size_t>(end - inputs[i].c_str()) + (value != T{} ? 1u : 0u);
+    });
+}
+
+static void BenchScans()
+{
+    BenchScan("scan/int64", RandomInts<int64_t>(INT64_MIN, INT64_MAX), "{}", "%" SCNd64 "%n",
+        [](char const* str, char** end) { return static_cast<int64_t>(std::strtoll(str, end, 10)); });
+    BenchScan("scan/int32-small", RandomInts<int32_t>(-1000, 1000), "{}", "%" SCNd32 "%n",
+        [](char const* str, char** end) { return static_cast<int32_t>(std::strtol(str, end, 10)); });
+    BenchScan("scan/double-shortest", RandomDoubles(-1e10, 1e10), "{}", "%lf%n",
+        [](char const* str, char** end) { return std::strtod(str, end); });
+    BenchScan("scan/double-fixed", RandomDoubles(-1000.0, 1000.0), "{:.3f}", "%lf%n",
+        [](char const* str, char** end) { return std::strtod(str, end); });
+}
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+
+static void PrintCSV()
+{
+    std::printf("benchmark,target,ns_per_op,bytes_per_op,ops\n");
+    for (auto const& r : g_results)
+    {
+        fmtxx::format(stdout, "{},{},{:.3f},{:.2f},{}\n",
+            r.benchmark, r.target, r.ns_per_op, r.bytes_per_op, r.ops);
+    }
+}
+
+static void PrintJSON()
+{
+    std::printf("[\n");
+    for (size_t i = 0; i < g_results.size(); ++i)
+    {
+        auto const& r = g_results[i];
+        fmtxx::format(stdout, "  {{\"benchmark\": {:j}, \"target\": {:j}, \"ns_per_op\": {:.3f}, \"bytes_per_op\": {:.2f}, \"ops\": {}}}{}\n",
+            r.benchmark, r.target, r.ns_per_op, r.bytes_per_op, r.ops, i + 1 < g_results.size() ? "," : "");
+    }
+    std::printf("]\n");
+}
+
+static bool ParseOptions(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string const arg = argv[i];
+
+        if (arg == "--csv")
+            g_options.json = false;
+        else if (arg == "--json")
+            g_options.json = true;
+        else if (arg.compare(0, 9, "--filter=") == 0)
+            g_options.filter = arg.substr(9);
+        else if (arg.compare(0, 11, "--min-time=") == 0)
+            g_options.min_time = std::atof(arg.c_str() + 11) / 1000.0;
+        else if (arg.compare(0, 10, "--threads=") == 0)
+            g_options.threads = std::atoi(arg.c_str() + 10);
+        else
+        {
+            std::fprintf(stderr, "usage: %s [--csv | --json] [--filter=SUBSTRING] [--min-time=MILLISECONDS] [--threads=N]\n", argv[0]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    if (!ParseOptions(argc, argv))
+        return 1;
+
+    g_null_file = std::fopen(kNullDevice, "w");
+    if (g_null_file == nullptr)
+    {
+        std::fprintf(stderr, "error: cannot open %s\n", kNullDevice);
+        return 1;
+    }
+
+    BenchInts();
+    BenchDoubles();
+    BenchFloats();
+    BenchStrings();
+    BenchPretty();
+    BenchMultipleArgs();
+    BenchParseCache();
+    BenchTimestamps();
+    BenchBytes();
+    BenchFileContention();
+    BenchAsync();
+    BenchBinary();
+    BenchRanges();
+    BenchParallel();
+    BenchScans();
+    BenchExactString();
+    BenchArena();
+    BenchIovec();
+    BenchMmap();
+    BenchStreamable();
+
+    std::fclose(g_null_file);
+
+    if (g_options.json)
+        PrintJSON();
+    else
+        PrintCSV();
+
+    return 0;
+}
@@ -1,22 +1,46 @@
 #include "../src/Format.h"
+#include "../src/Format_arena.h"
+#include "../src/Format_async.h"
+#include "../src/Format_binary.h"
+#include "../src/Format_bytes.h"
+#include "../src/Format_chrono.h"
+#include "../src/Format_iovec.h"
+#include "../src/Format_mmap.h"
 #include "../src/Format_pretty.h"
 #include "../src/Format_ostream.h"
+#include "../src/Format_parallel.h"
+#include "../src/Format_scan.h"
+#include "../src/Format_stats.h"
+#include "../src/Format_string.h"
 
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
 
+#include <array>
 #include <cfloat>
 #include <clocale>
 #include <cmath>
+#include <functional>
+#include <ctime>
 #include <iostream>
 #include <limits>
+#include <list>
 #include <map>
+#include <random>
 #include <sstream>
+#include <stdexcept>
+#include <thread>
 #include <tuple>
 #include <unordered_map>
 #include <vector>
 #include <cstdlib>
 
+#ifndef _WIN32
+#include <csignal>        // signal, SIGXFSZ
+#include <sys/resource.h> // setrlimit
+#include <unistd.h>       // pipe, close
+#endif
+
 //------------------------------------------------------------------------------
 // Clean me up, Scotty!
 //------------------------------------------------------------------------------
@@ -124,7 +148,23 @@ struct StreamFormatter
    }
 };
 
-#if 0
+struct CompiledFormatter
+{
+   template <typename ...Args>
+   static StringFormatResult do_format(fmtxx::string_view format, Args const&... args)
+   {
+       fmtxx::CompiledFormat const compiled{format};
+       return fmtxx::string_format(compiled, args...);
+   }
+
+   template <typename ...Args>
+   static StringFormatResult do_printf(fmtxx::string_view format, Args const&... args)
+   {
+       fmtxx::CompiledFormat const compiled{format, fmtxx::FormatSyntax::printf};
+       return fmtxx::string_format(compiled, args...);
+   }
+};
+
 struct MemoryFormatter
 {
    template <typename ...Args>
@@ -143,7 +183,6 @@ struct MemoryFormatter
        return { std::string(w.data(), w.size()), ec };
    }
 };
-#endif
 
 template <typename Formatter>
 struct FormatFn
@@ -193,13 +232,16 @@ static std::string FormatArgsTemplate(fmtxx::string_view format, Args const&...
         REQUIRE(res.ec == x.ec);
         REQUIRE(res.str == x.str);
     }
-#if 0
+    {
+        auto const x = Fn< CompiledFormatter >::apply(format, args...);
+        REQUIRE(res.ec == x.ec);
+        REQUIRE(res.str == x.str);
+    }
     {
         auto const x = Fn< MemoryFormatter >::apply(format, args...);
         REQUIRE(res.ec == x.ec);
         REQUIRE(res.str == x.str);
     }
-#endif
 
     return res.str;
 }
@@ -334,6 +376,25 @@ TEST_CASE("General_Printf")
     CHECK("2 1 1 2"                         == PrintfArgs("%2$d %d %1$d %d",                          1, 2));
 }
 
+TEST_CASE("General_LongLiterals")
+{
+    // Place the replacement fields at all positions within (and across) 16- and 32-byte blocks.
+    for (size_t i = 0; i < 80; ++i)
+    {
+        std::string const prefix(i, 'a');
+        std::string const suffix(80 - i, 'b');
+
+        CHECK(prefix + "1" + suffix          == FormatArgs(prefix + "{}" + suffix, 1));
+        CHECK(prefix + "{1}" + suffix        == FormatArgs(prefix + "{{{}}}" + suffix, 1));
+        CHECK(prefix + "}" + suffix + "{"    == FormatArgs(prefix + "}}" + suffix + "{{"));
+        CHECK(prefix + "1" + suffix + "%"    == PrintfArgs(prefix + "%d" + suffix + "%%", 1));
+    }
+
+    fmtxx::ArrayWriter w{nullptr, 0};
+    CHECK(fmtxx::ErrorCode::invalid_format_string == fmtxx::format(w, std::string(40, 'a') + "}" + std::string(40, 'b')));
+    CHECK(fmtxx::ErrorCode::invalid_format_string == fmtxx::format(w, std::string(40, 'a') + "{"));
+}
+
 TEST_CASE("Strings")
 {
     CHECK(""  == FormatArgs(""));
@@ -437,6 +498,51 @@ TEST_CASE("Strings escaped")
     CHECK(R"(hello \360\237\230\215a)" == FormatArgs("{:x}", u8"hello 😍a"));
 }
 
+TEST_CASE("Strings escaped - long")
+{
+    // Long enough to exercise the vectorized scanning loops.
+    std::string const plain(100, 'a');
+
+    CHECK("\"" + plain + "\"" == FormatArgs("{:q}", plain));
+    CHECK(plain == FormatArgs("{:x}", plain));
+    CHECK("\"" + plain + "\"" == FormatArgs("{:j}", plain));
+
+    for (size_t i = 0; i < plain.size(); ++i)
+    {
+        std::string s = plain;
+        s[i] = '"';
+
+        std::string quoted = "\"" + plain + "\"";
+        quoted.replace(i + 1, 1, "\\\"");
+        CHECK(quoted == FormatArgs("{:q}", s));
+        CHECK(quoted == FormatArgs("{:j}", s));
+
+        s[i] = '\x7F';
+
+        std::string escaped = plain;
+        escaped.replace(i, 1, "\\177");
+        CHECK(escaped == FormatArgs("{:x}", s));
+    }
+
+    CHECK("    \"a\\\"b\"" == FormatArgs("{:10q}", "a\"b"));
+    CHECK("\"a\\\"b\"    " == FormatArgs("{:<10q}", "a\"b"));
+    CHECK("  \\001\\002  " == FormatArgs("{:^12x}", "\x01\x02"));
+    CHECK("\"a\\\"\""       == FormatArgs("{:.2q}", "a\"b"));
+}
+
+TEST_CASE("Strings JSON")
+{
+    CHECK(R"("")"                   == FormatArgs("{:j}", ""));
+    CHECK(R"("hello")"              == FormatArgs("{:j}", "hello"));
+    CHECK(R"("a\"b\\c")"           == FormatArgs("{:j}", "a\"b\\c"));
+    CHECK(R"("\b\f\n\r\t")"        == FormatArgs("{:j}", "\b\f\n\r\t"));
+    CHECK(R"("\u0001\u001f\u0000")" == FormatArgs("{:j}", std::string("\x01\x1F\0", 3)));
+    CHECK("\"/\x7F\"" == FormatArgs("{:j}", "/\x7F"));
+    CHECK(u8"\"😍\"" == FormatArgs("{:j}", u8"😍"));
+    CHECK(R"(  "a\nb")" == FormatArgs("{:8j}", "a\nb"));
+    CHECK(R"({"key":"x\ty"})" == FormatArgs("{{\"key\":{:j}}}", "x\ty"));
+}
+
 TEST_CASE("Ints")
 {
     CHECK("2 1 1 2" == FormatArgs("{1} {} {0} {}", 1, 2));
@@ -634,6 +740,24 @@ TEST_CASE("Ints")
     CHECK("        01" == FormatArgs("{:#10o}",  1));
 }
 
+TEST_CASE("Ints")
+{
+    CHECK("99999999"                   == FormatArgs("{}", 99999999));
+    CHECK("100000000"                  == FormatArgs("{}", 100000000));
+    CHECK("1234567890123456"           == FormatArgs("{}", 1234567890123456ll));
+    CHECK("12345678901234567"          == FormatArgs("{}", 12345678901234567ll));
+    CHECK("18446744073709551615"       == FormatArgs("{}", UINT64_MAX));
+    CHECK("18,446,744,073,709,551,615" == FormatArgs("{:,}", UINT64_MAX));
+    CHECK("-9,223,372,036,854,775,808" == FormatArgs("{:,}", INT64_MIN));
+    CHECK("0,000,012"                  == FormatArgs("{:,.7}", 12));
+    CHECK("ffff_ffff_ffff_ffff"        == FormatArgs("{:_x}", UINT64_MAX));
+    CHECK("DEADBEEF"                   == FormatArgs("{:X}", 0xDEADBEEFu));
+    CHECK("1_2345_6789"                == FormatArgs("{:_x}", 0x123456789ull));
+    CHECK("1777777777777777777777"     == FormatArgs("{:o}", UINT64_MAX));
+    CHECK("1'0000'0000"                == FormatArgs("{:'b}", 256));
+    CHECK(std::string(64, '1')         == FormatArgs("{:b}", UINT64_MAX));
+}
+
 TEST_CASE("Floats")
 {
     CHECK(
@@ -666,6 +790,25 @@ TEST_CASE("Floats")
             == FormatArgs("{:.1074f}", std::numeric_limits<double>::denorm_min()));
 }
 
+TEST_CASE("Floats")
+{
+    // Zeros implied by the precision are not stored in the digit buffer.
+    // Long results are written piecewise.
+
+    std::string const zeros800(800, '0');
+
+    CHECK("1." + zeros800 + "e+00"                     == FormatArgs("{:.800e}", 1.0));
+    CHECK("1.25" + zeros800 + "e-01"                   == FormatArgs("{:.802e}", 0.125));
+    CHECK("0x1." + zeros800 + "p+0"                    == FormatArgs("{:#.800x}", 1.0));
+    CHECK("1" + zeros800.substr(0, 20) + "." + zeros800 == FormatArgs("{:.800f}", 1e20));
+    CHECK("100'000'000'000'000'000'000." + zeros800    == FormatArgs("{:'.800f}", 1e20));
+    CHECK("-0000100'000'000'000'000'000'000." + zeros800
+                                                       == FormatArgs("{:'0833.800f}", -1e20));
+    CHECK("0.0625" + zeros800.substr(0, 796)           == FormatArgs("{:.800f}", 0.0625));
+    CHECK("*1.25" + zeros800 + "e-01*"                 == FormatArgs("{:*^810.802e}", 0.125));
+    CHECK("0.125" + zeros800.substr(0, 797)            == FormatArgs("{:#.800g}", 0.125));
+}
+
 TEST_CASE("Floats")
 {
     static const double PI  = 3.1415926535897932384626433832795;
@@ -849,6 +992,10 @@ TEST_CASE("Floats")
 {
     // Requires BignumDtoa:
     CHECK("3.5844466002796428e+298" == FormatArgs("{:s}", 3.5844466002796428e+298));
+    CHECK("1e+23"                   == FormatArgs("{:s}", 1e+23));
+    CHECK("9007199254740992"        == FormatArgs("{:s}", 9007199254740993.0));
+    CHECK("0.30000000000000004"     == FormatArgs("{:s}", 0.1 + 0.2));
+    CHECK("5.960464477539063e-8"    == FormatArgs("{:s}", 5.960464477539063e-8)); // 2^-24
 
     CHECK("1.7976931348623157e+308"  == FormatArgs("{:s}",  std::numeric_limits<double>::max()));
     CHECK("1.7976931348623157E+308"  == FormatArgs("{:S}",  std::numeric_limits<double>::max()));
@@ -866,6 +1013,22 @@ TEST_CASE("Floats")
     CHECK("-000000000000000005e-324" == FormatArgs("{:024s}", -std::numeric_limits<double>::denorm_min()));
 }
 
+TEST_CASE("Floats - fixed")
+{
+    CHECK("0.13"                    == FormatArgs("{:.2f}", 0.125)); // ties away from zero
+    CHECK("-0.13"                   == FormatArgs("{:.2f}", -0.125));
+    CHECK("3"                       == FormatArgs("{:.0f}", 2.5));
+    CHECK("3."                      == FormatArgs("{:#.0f}", 2.5));
+    CHECK("0.00"                    == FormatArgs("{:.2f}", 0.001));
+    CHECK("0.01"                    == FormatArgs("{:.2f}", 0.005));
+    CHECK("0.000002"                == FormatArgs("{:f}", 1.5e-6));
+    CHECK("0.10000000000000001"     == FormatArgs("{:.17f}", 0.1));
+    CHECK("1,234,567.89"            == FormatArgs("{:,.2f}", 1234567.891));
+    CHECK("2251799813685248.50"     == FormatArgs("{:.2f}", 2251799813685248.5));
+    CHECK("18446744073709551616.00" == FormatArgs("{:.2f}", 18446744073709551616.0));
+    CHECK("0.000000000000000000"    == FormatArgs("{:.18f}", 1e-20));
+}
+
 TEST_CASE("Floats")
 {
     CHECK("0"       == FormatArgs("{:s}",  0.0));
@@ -1052,6 +1215,62 @@ TEST_CASE("Floats")
     }
 }
 
+TEST_CASE("Floats - single")
+{
+    // The shortest representation is computed with respect to single-precision.
+    CHECK("0.1"           == FormatArgs("{}", 0.1f));
+    CHECK("-0.3"          == FormatArgs("{}", -0.3f));
+    CHECK("1e+30"         == FormatArgs("{}", 1e30f));
+    CHECK("3.4028235e+38" == FormatArgs("{}", FLT_MAX));
+    CHECK("1.1754944e-38" == FormatArgs("{}", FLT_MIN));
+    CHECK("1e-45"         == FormatArgs("{}", std::numeric_limits<float>::denorm_min()));
+    CHECK("16777216"      == FormatArgs("{}", 16777216.0f));
+    CHECK("0"             == FormatArgs("{}", 0.0f));
+    CHECK("-0"            == FormatArgs("{}", -0.0f));
+    CHECK("inf"           == FormatArgs("{}", std::numeric_limits<float>::infinity()));
+    CHECK("nan"           == FormatArgs("{}", std::numeric_limits<float>::quiet_NaN()));
+    CHECK("  0.1"         == FormatArgs("{:5}", 0.1f));
+    CHECK("1E+30"         == FormatArgs("{:S}", 1e30f));
+    CHECK("0.1"           == PrintfArgs("%s", 0.1f));
+
+    // All other conversions print the exact value, just like doubles.
+    CHECK("0.10000000149011612" == FormatArgs("{:.17g}", 0.1f));
+    CHECK("0.100000"            == FormatArgs("{:f}", 0.1f));
+    CHECK("1.000000e-01"        == FormatArgs("{:e}", 0.1f));
+    CHECK("0x1.99999ap-4"       == FormatArgs("{:a}", 0.1f));
+    CHECK(FormatArgs("{:.12e}", static_cast<double>(1.1f)) == FormatArgs("{:.12e}", 1.1f));
+
+    // Ranges use the same conversion.
+    CHECK("[0.1, 0.2, 0.3]" == FormatArgs("{}", fmtxx::pretty(std::vector<float>{0.1f, 0.2f, 0.3f})));
+
+    // The output round-trips and uses at most 9 digits.
+    std::mt19937 rng;
+    for (int i = 0; i < 100000; ++i)
+    {
+        uint32_t const bits = static_cast<uint32_t>(rng());
+        float f;
+        std::memcpy(&f, &bits, sizeof(float));
+        if (!std::isfinite(f))
+            continue;
+
+        std::string const shortest = FormatArgs("{}", f);
+        CHECK(std::strtof(shortest.c_str(), nullptr) == f);
+
+        // Count the significant digits.
+        std::string digits;
+        for (char c : shortest)
+        {
+            if (c == 'e')
+                break;
+            if (c >= '0' && c <= '9' && (c != '0' || !digits.empty()))
+                digits += c;
+        }
+        while (!digits.empty() && digits.back() == '0')
+            digits.pop_back();
+        CHECK(digits.size() <= 9);
+    }
+}
+
 TEST_CASE("Pointers_1")
 {
 #if UINTPTR_MAX == UINT64_MAX
@@ -1212,6 +1431,97 @@ TEST_CASE("Custom_1")
 #endif
 }
 
+namespace foo2_ns
+{
+    struct Sticky {
+        double value;
+    };
+
+    // Changes the stream state and does not restore it.
+    inline std::ostream& operator<<(std::ostream& stream, Sticky const& value) {
+        stream.setf(std::ios_base::fixed | std::ios_base::showpos);
+        stream.precision(2);
+        stream.fill('*');
+        return stream << value.value;
+    }
+
+    struct Nested {
+        Foo2 inner;
+    };
+
+    // Formats another streamable object into the same stream.
+    inline std::ostream& operator<<(std::ostream& stream, Nested const& value) {
+        return stream << '<' << fmtxx::string_format("{}", value.inner).str << '>';
+    }
+
+    struct Failing {
+    };
+
+    inline std::ostream& operator<<(std::ostream& stream, Failing const&) {
+        stream << "abc";
+        stream.setstate(std::ios_base::failbit);
+        return stream;
+    }
+
+    struct Large {
+        size_t len;
+    };
+
+    inline std::ostream& operator<<(std::ostream& stream, Large const& value) {
+        for (size_t i = 0; i < value.len; ++i)
+            stream << static_cast<char>('a' + i % 26);
+        return stream << std::string(value.len, '.');
+    }
+}
+
+// Runs BODY in a new thread, and then AT_EXIT from the destructor of a
+// thread_local object, which is destroyed after any thread_local objects
+// created by BODY.
+static void RunAtThreadExit(std::function<void()> body, std::function<void()> at_exit)
+{
+    struct OnExit {
+        std::function<void()> fn;
+        ~OnExit() { fn(); }
+    };
+
+    std::thread([&] {
+        static thread_local OnExit on_exit;
+        on_exit.fn = at_exit;
+        body();
+    }).join();
+}
+
+TEST_CASE("Custom_2")
+{
+    // The stream state is reset before each use.
+    CHECK("+1.50 1.5 -1.25 ---123" == FormatArgs("{} {} {} {}", foo2_ns::Sticky{1.5}, 1.5, foo2_ns::Sticky{-1.25}, foo2_ns::Foo2{123}));
+    CHECK("+1.50|-----x" == FormatArgs("{}|{}", foo2_ns::Sticky{1.5}, foo2_ns::Foo3{'x'}));
+
+    CHECK("[<---123>] [<----42>]" == FormatArgs("[{}] [{}]", foo2_ns::Nested{{123}}, foo2_ns::Nested{{42}}));
+
+    std::string str;
+    CHECK(fmtxx::ErrorCode::conversion_error == fmtxx::format(str, "{}|{}", foo2_ns::Failing{}, 1));
+    CHECK("abc" == str);
+    CHECK("---123" == FormatArgs("{}", foo2_ns::Foo2{123}));
+
+    for (size_t len : {size_t{0}, size_t{1}, size_t{255}, size_t{256}, size_t{257}, size_t{1000}})
+    {
+        std::string expected;
+        for (size_t i = 0; i < len; ++i)
+            expected += static_cast<char>('a' + i % 26);
+        expected += std::string(len, '.');
+
+        CHECK("[" + expected + "]" == fmtxx::string_format("[{}]", foo2_ns::Large{len}).str);
+    }
+
+    // The streams are still usable after the cache has been destroyed.
+    std::string at_exit;
+    RunAtThreadExit(
+        [] { fmtxx::string_format("{}", foo2_ns::Foo2{1}); },
+        [&] { at_exit = fmtxx::string_format("{}|{}", foo2_ns::Nested{{123}}, foo2_ns::Sticky{1.5}).str; });
+    CHECK("<---123>|+1.50" == at_exit);
+}
+
 TEST_CASE("Chars_1")
 {
     CHECK("A"     == FormatArgs("{}", 'A'));
@@ -1277,6 +1587,65 @@ TEST_CASE("Vector_1")
     CHECK("1234" == FormatArgs("{}", str));
 }
 
+// Stores the output in a small buffer window and moves it to a string when the
+// window is full.
+class WindowBuffer : public fmtxx::Writer
+{
+    char buf_[8];
+
+public:
+    std::string str;
+    int calls = 0;
+
+    WindowBuffer() { set_window(buf_, buf_ + sizeof(buf_)); }
+
+    void flush() {
+        str.append(buf_, static_cast<size_t>(window_next() - buf_));
+        set_window(buf_, buf_ + sizeof(buf_));
+    }
+
+private:
+    fmtxx::ErrorCode Put(char c) override {
+        ++calls;
+        flush();
+        str += c;
+        return {};
+    }
+
+    fmtxx::ErrorCode Write(char const* ptr, size_t len) override {
+        ++calls;
+        flush();
+        str.append(ptr, len);
+        return {};
+    }
+
+    fmtxx::ErrorCode Pad(char c, size_t count) override {
+        ++calls;
+        flush();
+        str.append(count, c);
+        return {};
+    }
+};
+
+TEST_CASE("Window_1")
+{
+    WindowBuffer w;
+    fmtxx::format(w, "{:6}", -1234);
+    w.flush();
+    CHECK(" -1234" == w.str);
+#ifndef FMTXX_STATS
+    CHECK(0 == w.calls);
+#endif
+
+    w.str.clear();
+    fmtxx::format(w, "{:*^12}|{}|{:.3f}|{:>20}", "abc", 'x', 3.14159, 1.0e100);
+    w.flush();
+    CHECK("****abc*****|x|3.142|              1e+100" == w.str);
+#ifndef FMTXX_STATS
+    CHECK(0 < w.calls);
+#endif
+}
+
 //------------------------------------------------------------------------------
 
 TEST_CASE("FormatPretty_1")
@@ -1382,6 +1751,142 @@ TEST_CASE("FormatPretty_4")
     CHECK(R"(||1<2<3<|<|4<5<6<|<|7<8<9<|<|)" == s3);
 }
 
+namespace fmtxx {
+    template <>
+    struct FormatPretty<unsigned short>
+    {
+        ErrorCode operator()(Writer& w, FormatSpec const& /*spec*/, unsigned short const& val) const
+        {
+            return fmtxx::format(w, "<{}>", val);
+        }
+    };
+}
+
+TEST_CASE("FormatPretty_5")
+{
+    std::vector<int> const v1 = {1, -2, 3};
+    CHECK("[1, -2, 3]" == FormatArgs("{}", fmtxx::pretty(v1)));
+    CHECK("[  1|  2|  3]" == FormatArgs("{:3!|}", fmtxx::pretty(std::vector<unsigned>{1, 2, 3})));
+    CHECK("[[1, -2, 3], []]" == FormatArgs("{}", fmtxx::pretty(std::vector<std::vector<int>>{v1, {}})));
+    CHECK("[]" == FormatArgs("{}", fmtxx::pretty(std::vector<int>{})));
+
+    std::array<double, 3> const a1 = {{1.5, -0.25, 1e100}};
+    CHECK("[1.5, -0.25, 1e+100]" == FormatArgs("{}", fmtxx::pretty(a1)));
+    CHECK("[1.500; -0.250]" == FormatArgs("{:.3f!; }", fmtxx::pretty(std::vector<float>{1.5f, -0.25f})));
+
+    std::vector<std::string> const v2 = {"a", "", "ccc"};
+    CHECK(R"(["a", "", "ccc"])" == FormatArgs("{}", fmtxx::pretty(v2)));
+    fmtxx::string_view const a2[] = {"x", "yy"};
+    CHECK(R"(["x"/"yy"])" == FormatArgs("{!/}", fmtxx::pretty(a2)));
+
+    // Not printed as numbers or strings.
+    CHECK("[true, false]" == FormatArgs("{}", fmtxx::pretty(std::vector<bool>{true, false})));
+    CHECK("[a, b]" == FormatArgs("{}", fmtxx::pretty(std::vector<char>{'a', 'b'})));
+    CHECK("[<1>, <2>]" == FormatArgs("{}", fmtxx::pretty(std::vector<unsigned short>{1, 2})));
+
+    // The output is written into a buffer of the final size.
+    std::vector<std::string> v3;
+    for (int i = 0; i < 1000; ++i)
+        v3.push_back(std::string(static_cast<size_t>(i % 17), 'x'));
+
+    fmtxx::MemoryWriter<> w;
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format(w, "{}", fmtxx::pretty(v3)));
+    CHECK(w.size() == w.capacity());
+    CHECK(w.size() == fmtxx::string_format("{}", fmtxx::pretty(std::list<std::string>(v3.begin(), v3.end()))).str.size());
+
+    std::vector<int64_t> v4;
+    for (int i = 0; i < 1000; ++i)
+        v4.push_back(INT64_MIN + i);
+
+    w.clear();
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format(w, "{}", fmtxx::pretty(v4)));
+    CHECK(std::string(w.data(), w.size()) == fmtxx::string_format("{}", fmtxx::pretty(std::list<int64_t>(v4.begin(), v4.end()))).str);
+}
+
+namespace {
+    // An infinite range: 0, 1, 2, ...
+    struct Naturals
+    {
+        struct iterator
+        {
+            int value;
+
+            int operator*() const { return value; }
+            iterator& operator++() { ++value; return *this; }
+            bool operator==(iterator const& /*rhs*/) const { return false; }
+            bool operator!=(iterator const& /*rhs*/) const { return true; }
+        };
+
+        iterator begin() const { return {0}; }
+        iterator end() const { return {0}; }
+    };
+}
+
+static fmtxx::PrettyLimits MakeLimits(size_t max_elements, int max_depth, size_t max_bytes)
+{
+    fmtxx::PrettyLimits limits;
+    limits.max_elements = max_elements;
+    limits.max_depth = max_depth;
+    limits.max_bytes = max_bytes;
+    return limits;
+}
+
+TEST_CASE("FormatPretty_6")
+{
+    size_t const kUnlimited = SIZE_MAX;
+
+    std::vector<int> const v1 = {1, 2, 3, 4, 5};
+    std::vector<std::string> const v2 = {"a", "b", "c"};
+    std::list<int> const l1 = {1, 2, 3};
+
+    // Max elements
+    CHECK("[1, 2, 3, ...]" == FormatArgs("{}", fmtxx::pretty(v1, MakeLimits(3, INT_MAX, kUnlimited))));
+    CHECK("[1|2|...]" == FormatArgs("{!|}", fmtxx::pretty(v1, MakeLimits(2, INT_MAX, kUnlimited))));
+    CHECK("[...]" == FormatArgs("{}", fmtxx::pretty(v1, MakeLimits(0, INT_MAX, kUnlimited))));
+    CHECK("[1, 2, 3, 4, 5]" == FormatArgs("{}", fmtxx::pretty(v1, MakeLimits(5, INT_MAX, kUnlimited))));
+    CHECK("[]" == FormatArgs("{}", fmtxx::pretty(std::vector<int>{}, MakeLimits(0, INT_MAX, kUnlimited))));
+    CHECK(R"(["a", ...])" == FormatArgs("{}", fmtxx::pretty(v2, MakeLimits(1, INT_MAX, kUnlimited))));
+    CHECK("[1, 2, ...]" == FormatArgs("{}", fmtxx::pretty(l1, MakeLimits(2, INT_MAX, kUnlimited))));
+    CHECK("[1, 2, 3]" == FormatArgs("{}", fmtxx::pretty(l1, MakeLimits(3, INT_MAX, kUnlimited))));
+    CHECK("[0, 1, 2, 3, ...]" == FormatArgs("{}", fmtxx::pretty(Naturals{}, MakeLimits(4, INT_MAX, kUnlimited))));
+    CHECK("[[1, 2, ...], [], ...]" == FormatArgs("{}", fmtxx::pretty(std::vector<std::vector<int>>{v1, {}, v1}, MakeLimits(2, INT_MAX, kUnlimited))));
+
+    // Max depth
+    std::vector<std::vector<int>> const vv1 = {{1, 2}, {3}};
+    CHECK("[...]" == FormatArgs("{}", fmtxx::pretty(vv1, MakeLimits(kUnlimited, 0, kUnlimited))));
+    CHECK("[[...], [...]]" == FormatArgs("{}", fmtxx::pretty(vv1, MakeLimits(kUnlimited, 1, kUnlimited))));
+    CHECK("[[1, 2], [3]]" == FormatArgs("{}", fmtxx::pretty(vv1, MakeLimits(kUnlimited, 2, kUnlimited))));
+    CHECK("{1, {...}}" == FormatArgs("{}", fmtxx::pretty(std::make_tuple(1, std::make_pair(2, 3)), MakeLimits(kUnlimited, 1, kUnlimited))));
+    CHECK("[{1, [...]}]" == FormatArgs("{}", fmtxx::pretty(std::vector<std::pair<int, std::vector<int>>>{{1, {2}}}, MakeLimits(kUnlimited, 2, kUnlimited))));
+
+    // Max bytes
+    CHECK("[1, 2, 3, 4, 5]" == FormatArgs("{}", fmtxx::pretty(v1, MakeLimits(kUnlimited, INT_MAX, 15))));
+    CHECK("[1, 2, 3, 4, 5..." == FormatArgs("{}", fmtxx::pretty(v1, MakeLimits(kUnlimited, INT_MAX, 14))));
+    CHECK("[1, 2..." == FormatArgs("{}", fmtxx::pretty(v1, MakeLimits(kUnlimited, INT_MAX, 5))));
+    CHECK("..." == FormatArgs("{}", fmtxx::pretty(v1, MakeLimits(kUnlimited, INT_MAX, 0))));
+    CHECK(R"(["a", "b...)" == FormatArgs("{}", fmtxx::pretty(v2, MakeLimits(kUnlimited, INT_MAX, 8))));
+    CHECK("[0, 1, 2, 3, ..." == FormatArgs("{}", fmtxx::pretty(Naturals{}, MakeLimits(kUnlimited, INT_MAX, 13))));
+    CHECK("<<[<1>, <2>, <3>]>>" == FormatArgs("<<{}>>", fmtxx::pretty(std::vector<unsigned short>{1, 2, 3}, MakeLimits(kUnlimited, INT_MAX, 15))));
+    CHECK("<<[<1>, <2>, <3>...>>" == FormatArgs("<<{}>>", fmtxx::pretty(std::vector<unsigned short>{1, 2, 3}, MakeLimits(kUnlimited, INT_MAX, 14))));
+
+    // The byte budget applies to the total output, not per buffer.
+    std::vector<int> v3(100000, 12345);
+    std::string const s3 = FormatArgs("{}", fmtxx::pretty(v3, MakeLimits(kUnlimited, INT_MAX, 1000)));
+    CHECK(s3.size() == 1000 + 3);
+    CHECK(s3.compare(0, 8, "[12345, ") == 0);
+    CHECK(s3.compare(s3.size() - 3, 3, "...") == 0);
+
+    // All limits combined.
+    std::vector<std::vector<int>> const vv2 = {v1, v1, v1};
+    CHECK("[[1, 2, ...], [1, 2, ...], ...]" == FormatArgs("{}", fmtxx::pretty(vv2, MakeLimits(2, 2, kUnlimited))));
+    CHECK("[[...], [...], ...]" == FormatArgs("{}", fmtxx::pretty(vv2, MakeLimits(2, 1, kUnlimited))));
+    CHECK("[[1, 2, ...], [..." == FormatArgs("{}", fmtxx::pretty(vv2, MakeLimits(2, 2, 15))));
+
+    // The limits do not leak into subsequent calls.
+    CHECK("[[1, 2], [3]]" == FormatArgs("{}", fmtxx::pretty(vv1)));
+    CHECK("[0, 1, ...] [[1, 2], [3]]" == FormatArgs("{} {}", fmtxx::pretty(Naturals{}, MakeLimits(2, INT_MAX, kUnlimited)), fmtxx::pretty(vv1)));
+}
+
 //------------------------------------------------------------------------------
 
 TEST_CASE("ArrayWriter_1")
@@ -1406,7 +1911,1671 @@ TEST_CASE("ArrayWriter_1")
     CHECK('\0' == buf2[3]);
 }
 
-//------------------------------------------------------------------------------
+TEST_CASE("MemoryWriter_1")
+{
+    fmtxx::MemoryWriter<8> w;
+    CHECK(8 == w.capacity());
+
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format(w, "{}", 1234567));
+    CHECK(!w.heap_allocated());
+    CHECK("1234567" == std::string(w.data(), w.size()));
+
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format(w, "{:>6}{}", 'x', "abc"));
+    CHECK(w.heap_allocated());
+    CHECK(16 == w.size());
+    CHECK("1234567     xabc" == std::string(w.data(), w.size()));
+
+    std::string str = "old";
+    w.release_into(str);
+    CHECK(0 == w.size());
+    CHECK("1234567     xabc" == str);
+
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format(w, "{:*^40}", ""));
+    CHECK(std::string(40, '*') == std::string(w.data(), w.size()));
+    w.clear();
+    CHECK(w.view().empty());
+
+    str = "abc";
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format(str, "{}", 123));
+    CHECK("abc123" == str);
+}
+
+TEST_CASE("CountingWriter_1")
+{
+    fmtxx::CountingWriter w;
+    CHECK(0 == w.size());
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format(w, "{:>6}{}", 'x', "abc"));
+    CHECK(9 == w.size());
+
+    auto r = fmtxx::formatted_size("{} {:.3f} {:*^20}", -123, 3.14159, "x");
+    CHECK(r);
+    CHECK(31 == r.size);
+
+    r = fmtxx::printf_formatted_size("%5d|%s", 42, "hello");
+    CHECK(r);
+    CHECK(11 == r.size);
+
+    r = fmtxx::formatted_size(fmtxx::CompiledFormat("{}-{}"), 1, 22);
+    CHECK(r);
+    CHECK(4 == r.size);
+
+    r = fmtxx::formatted_size("{} {", 1);
+    CHECK(!r);
+    CHECK(fmtxx::ErrorCode::invalid_format_string == r.ec);
+
+    std::string const payload(10000, 'x');
+    auto s = fmtxx::string_format_exact("[{}] {} {:.2f}", payload, 42, 1.5);
+    CHECK(s);
+    CHECK(fmtxx::string_format("[{}] {} {:.2f}", payload, 42, 1.5).str == s.str);
+    CHECK(s.str.size() == fmtxx::formatted_size("[{}] {} {:.2f}", payload, 42, 1.5).size);
+
+    s = fmtxx::string_printf_exact("%s|%-4d|", "abc", 7);
+    CHECK(s);
+    CHECK("abc|7   |" == s.str);
+
+    s = fmtxx::string_format_exact("");
+    CHECK(s);
+    CHECK(s.str.empty());
+
+    // Partial output on errors.
+    s = fmtxx::string_format_exact("abc{}{1", 1);
+    CHECK(fmtxx::ErrorCode::invalid_format_string == s.ec);
+    CHECK(s.str == fmtxx::string_format("abc{}{1", 1).str);
+}
+
+TEST_CASE("Arena_1")
+{
+    alignas(16) char buf[64];
+    fmtxx::Arena arena{buf, sizeof(buf), 256};
+
+    void* p1 = arena.allocate(3, 1);
+    void* p2 = arena.allocate(8, 8);
+    CHECK(p1 == buf);
+    CHECK(p2 == buf + 8);
+
+    // Does not fit into the initial buffer.
+    void* p3 = arena.allocate(60, 4);
+    CHECK(p3 != nullptr);
+    CHECK((p3 < buf || p3 >= buf + sizeof(buf)));
+    CHECK(0 == reinterpret_cast<uintptr_t>(p3) % 4);
+
+    // Large allocations get a block of their own.
+    void* p4 = arena.allocate(10000, 16);
+    CHECK(p4 != nullptr);
+    CHECK(0 == reinterpret_cast<uintptr_t>(p4) % 16);
+    std::memset(p4, 0, 10000);
+    void* p5 = arena.allocate(4, 4);
+    CHECK(static_cast<char*>(p5) == static_cast<char*>(p3) + 60);
+
+    arena.release();
+    CHECK(arena.allocate(1, 1) == buf);
+
+    fmtxx::Arena arena2;
+    auto r = fmtxx::string_format(arena2, "{} {:>5} {}", "hello", 42, std::string(1000, 'x'));
+    CHECK(r);
+    CHECK("hello    42 " + std::string(1000, 'x') == std::string(r.str.data(), r.str.size()));
+    CHECK(&r.str.get_allocator().arena() == &arena2);
+
+    auto r2 = fmtxx::string_printf(arena2, "%s-%03d", "abc", 7);
+    CHECK(r2);
+    CHECK("abc-007" == std::string(r2.str.data(), r2.str.size()));
+
+    auto r3 = fmtxx::string_format(arena2, "{} {", 1);
+    CHECK(fmtxx::ErrorCode::invalid_format_string == r3.ec);
+
+    // Append to strings using any allocator.
+    fmtxx::ArenaString str{fmtxx::ArenaAllocator<char>(arena2)};
+    str = "[";
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format(str, "{}|{}", 1.5, fmtxx::string_view(r2.str.data(), r2.str.size())));
+    CHECK(fmtxx::ErrorCode{} == fmtxx::printf(str, "%c]", 'x'));
+    CHECK("[1.5|abc-007x]" == std::string(str.data(), str.size()));
+
+    auto r4 = fmtxx::string_format(std::allocator_arg, std::allocator<char>(), "{}", 123);
+    CHECK(r4);
+    CHECK("123" == r4.str);
+}
+
+// Formats from the destructor of a thread_local object, which is destroyed
+// after the statistics of the thread have been released.
+struct FormatOnThreadExit
+{
+    ~FormatOnThreadExit() { fmtxx::string_format("{}", 1); }
+};
+
+TEST_CASE("Stats_1")
+{
+    using fmtxx::stats::EntryPoint;
+    using fmtxx::stats::WriterKind;
+    using fmtxx::impl::Type;
+
+    auto const ep = [](EntryPoint e) { return static_cast<int>(e); };
+    auto const wk = [](WriterKind k) { return static_cast<int>(k); };
+    auto const ty = [](Type t) { return static_cast<int>(t); };
+
+    fmtxx::stats::Stats s0;
+    fmtxx::stats::snapshot(s0);
+
+    std::string str;
+    fmtxx::format(str, "{} {} {}", 1, 2.5, "abc");
+
+    char buf[32];
+    fmtxx::format_to_chars(buf, buf + sizeof(buf), "{:.30f}", 1.0 / 3.0);
+
+    // Counted in another thread.
+    std::thread([] { fmtxx::string_printf("%d", 123); }).join();
+
+    // Counted after thread exit. The other threads re-use the released
+    // counters meanwhile.
+    {
+        std::thread t1([] {
+            static thread_local FormatOnThreadExit on_exit;
+            static_cast<void>(&on_exit);
+            fmtxx::string_format("{}", 2);
+        });
+        std::thread t2([] { fmtxx::string_format("{}", 3); });
+        t1.join();
+        t2.join();
+        std::thread([] { fmtxx::string_format("{}", 4); }).join();
+    }
+
+    fmtxx::stats::Stats s1;
+    fmtxx::stats::snapshot(s1);
+
+    if (!fmtxx::stats::enabled())
+    {
+        CHECK(s1.calls[ep(EntryPoint::format_string)] == 0);
+        CHECK(s1.bytes[wk(WriterKind::memory)] == 0);
+        return;
+    }
+
+    // Only the outermost entry point is counted.
+    CHECK(s1.calls[ep(EntryPoint::format_string)] - s0.calls[ep(EntryPoint::format_string)] == 5);
+    CHECK(s1.calls[ep(EntryPoint::format_to_chars)] - s0.calls[ep(EntryPoint::format_to_chars)] == 1);
+    CHECK(s1.calls[ep(EntryPoint::printf_string)] - s0.calls[ep(EntryPoint::printf_string)] == 1);
+    CHECK(s1.calls[ep(EntryPoint::format)] - s0.calls[ep(EntryPoint::format)] == 0);
+
+    uint64_t latency_total = 0;
+    for (auto n : s1.latency[ep(EntryPoint::format_string)])
+        latency_total += n;
+    for (auto n : s0.latency[ep(EntryPoint::format_string)])
+        latency_total -= n;
+    CHECK(latency_total == 5);
+
+    CHECK(s1.bytes[wk(WriterKind::memory)] - s0.bytes[wk(WriterKind::memory)] == str.size() + 3 + 4);
+    CHECK(s1.bytes[wk(WriterKind::to_chars)] - s0.bytes[wk(WriterKind::to_chars)] == 32);
+
+    CHECK(s1.conversions[ty(Type::sint)] - s0.conversions[ty(Type::sint)] == 2 + 4);
+    CHECK(s1.conversions[ty(Type::double_)] - s0.conversions[ty(Type::double_)] == 2);
+    CHECK(s1.conversions[ty(Type::pchar)] - s0.conversions[ty(Type::pchar)] == 1);
+
+    // 1/3 requires more than 17 digits.
+    auto const fixed = static_cast<int>(fmtxx::stats::DtoaMode::fixed);
+    CHECK(s1.bignum_fallbacks[fixed] - s0.bignum_fallbacks[fixed] == 1);
+
+    std::string text;
+    {
+        fmtxx::MemoryWriter<> w;
+        CHECK(fmtxx::ErrorCode{} == fmtxx::stats::print(w, s1));
+        text.assign(w.data(), w.size());
+    }
+    CHECK(text.find("calls.format_string ") != std::string::npos);
+    CHECK(text.find("conversions.double ") != std::string::npos);
+}
+
+TEST_CASE("Scan_1")
+{
+    using fmtxx::ErrorCode;
+
+    int i = 0;
+    unsigned u = 0;
+    int64_t ll = 0;
+    signed char sc = 0;
+    unsigned short us = 0;
+
+    auto r = fmtxx::scan("  -123 456", "{}{}", i, u);
+    CHECK(r.ec == ErrorCode::success);
+    CHECK(r.count == 2);
+    CHECK(i == -123);
+    CHECK(u == 456);
+    CHECK(*r.next == '\0');
+
+    CHECK(fmtxx::scan("-9223372036854775808", "{}", ll).ec == ErrorCode::success);
+    CHECK(ll == INT64_MIN);
+    CHECK(fmtxx::scan("9223372036854775807", "{}", ll).ec == ErrorCode::success);
+    CHECK(ll == INT64_MAX);
+    CHECK(fmtxx::scan("9223372036854775808", "{}", ll).ec == ErrorCode::value_out_of_range);
+    CHECK(ll == INT64_MAX);
+    CHECK(fmtxx::scan("00000000000000000000000000000000001234567890123", "{}", ll).ec == ErrorCode::success);
+    CHECK(ll == 1234567890123);
+
+    uint64_t ull = 0;
+    CHECK(fmtxx::scan("18446744073709551615", "{}", ull).ec == ErrorCode::success);
+    CHECK(ull == UINT64_MAX);
+    CHECK(fmtxx::scan("18446744073709551616", "{}", ull).ec == ErrorCode::value_out_of_range);
+    CHECK(fmtxx::scan("123456789012345678901234567890", "{}", ull).ec == ErrorCode::value_out_of_range);
+    CHECK(fmtxx::scan("-1", "{}", u).ec == ErrorCode::value_out_of_range);
+    CHECK(fmtxx::scan("-0", "{}", u).ec == ErrorCode::success);
+    CHECK(u == 0);
+
+    CHECK(fmtxx::scan("-128", "{}", sc).ec == ErrorCode::success);
+    CHECK(sc == -128);
+    CHECK(fmtxx::scan("128", "{}", sc).ec == ErrorCode::value_out_of_range);
+    CHECK(fmtxx::scan("65535", "{}", us).ec == ErrorCode::success);
+    CHECK(us == 65535);
+    CHECK(fmtxx::scan("65536", "{}", us).ec == ErrorCode::value_out_of_range);
+
+    // Bases
+    CHECK(fmtxx::scan("0xFF ff 0b101 777", "{:x} {:X} {:b} {:o}", i, u, ll, us).count == 4);
+    CHECK(i == 255);
+    CHECK(u == 255);
+    CHECK(ll == 5);
+    CHECK(us == 511);
+    CHECK(fmtxx::scan("0x", "{:x}", i).ec == ErrorCode::success);
+    CHECK(i == 0);
+
+    // Signed integers accept the bit pattern produced by format.
+    CHECK(fmtxx::scan(fmtxx::string_format("{:x}", -1).str, "{:x}", i).ec == ErrorCode::success);
+    CHECK(i == -1);
+    CHECK(fmtxx::scan(fmtxx::string_format("{:x}", INT64_MIN).str, "{:x}", ll).ec == ErrorCode::success);
+    CHECK(ll == INT64_MIN);
+    CHECK(fmtxx::scan("ff", "{:x}", sc).ec == ErrorCode::success);
+    CHECK(sc == -1);
+    CHECK(fmtxx::scan("1ff", "{:x}", sc).ec == ErrorCode::value_out_of_range);
+
+    // Width
+    CHECK(fmtxx::scan("12345", "{:2}{:3}", i, u).count == 2);
+    CHECK(i == 12);
+    CHECK(u == 345);
+
+    // Errors
+    r = fmtxx::scan("12 abc", "{} {}", i, u);
+    CHECK(r.ec == ErrorCode::conversion_error);
+    CHECK(r.count == 1);
+    CHECK(std::string(r.next) == "abc");
+    CHECK(fmtxx::scan("12", "{} {}", i).ec == ErrorCode::index_out_of_range);
+    CHECK(fmtxx::scan("12", "{", i).ec == ErrorCode::invalid_format_string);
+    CHECK(fmtxx::scan("12", "}", i).ec == ErrorCode::invalid_format_string);
+    CHECK(fmtxx::scan("12", "{:{}}", i).ec == ErrorCode::invalid_format_string);
+    CHECK(fmtxx::scan("12", "{0}", i).ec == ErrorCode::invalid_format_string);
+    CHECK(fmtxx::scan("", "{}", i).ec == ErrorCode::conversion_error);
+    CHECK(fmtxx::scan("-", "{}", i).ec == ErrorCode::conversion_error);
+
+    // Conversions which do not apply to integers
+    CHECK(fmtxx::scan("12 34", "{:d} {:i}", i, u).count == 2);
+    CHECK(fmtxx::scan("12", "{:u}", u).ec == ErrorCode::success);
+    i = 7;
+    CHECK(fmtxx::scan("12", "{:s}", i).ec == ErrorCode::not_supported);
+    CHECK(i == 7);
+    CHECK(fmtxx::scan("12", "{:*}", i).ec == ErrorCode::not_supported);
+    CHECK(fmtxx::scan("12", "{:e}", i).ec == ErrorCode::not_supported);
+    CHECK(fmtxx::scan("12", "{:c}", u).ec == ErrorCode::not_supported);
+    r = fmtxx::scan("12 34", "{} {:q}", i, u);
+    CHECK(r.ec == ErrorCode::not_supported);
+    CHECK(r.count == 1);
+}
+
+TEST_CASE("Scan_2")
+{
+    using fmtxx::ErrorCode;
+
+    std::string key;
+    fmtxx::string_view val;
+    int n = 0;
+    char c = 0;
+    bool b = false;
+
+    auto r = fmtxx::scan("name = value\t; 42", "{} = {} ; {}", key, val, n);
+    CHECK(r.count == 3);
+    CHECK(key == "name");
+    CHECK(std::string(val.data(), val.size()) == "value");
+    CHECK(n == 42);
+
+    // A string is terminated by the character which follows the field.
+    std::string a, b2, c2;
+    CHECK(fmtxx::scan("abc,def,ghi", "{},{},{}", a, b2, c2).count == 3);
+    CHECK(a == "abc");
+    CHECK(b2 == "def");
+    CHECK(c2 == "ghi");
+    CHECK(fmtxx::scan("{abc}", "{{{}}}", a).count == 1);
+    CHECK(a == "abc");
+    CHECK(fmtxx::scan("abcdef", "{:3}", a).count == 1);
+    CHECK(a == "abc");
+
+    CHECK(fmtxx::scan("x= y", "{}={}", c, a).count == 2);
+    CHECK(c == 'x');
+    CHECK(a == "y");
+    CHECK(fmtxx::scan(" x", "{}", c).count == 1);
+    CHECK(c == ' ');
+
+    CHECK(fmtxx::scan("true", "{}", b).count == 1);
+    CHECK(b == true);
+    CHECK(fmtxx::scan("0", "{}", b).count == 1);
+    CHECK(b == false);
+    CHECK(fmtxx::scan("yes", "{}", b).ec == ErrorCode::conversion_error);
+
+    // Literals
+    CHECK(fmtxx::scan("  a", "a", c).ec == ErrorCode::conversion_error);
+    CHECK(fmtxx::scan("  a", " a", c).ec == ErrorCode::success);
+    CHECK(fmtxx::scan("a", "  a  ", c).ec == ErrorCode::success);
+    CHECK(fmtxx::scan("ab", "ac", c).ec == ErrorCode::conversion_error);
+
+    // Conversions
+    CHECK(fmtxx::scan("x y true abc", "{:c} {:s} {:s} {:s}", c, c, b, a).count == 4);
+    CHECK(fmtxx::scan("x", "{:d}", c).ec == ErrorCode::not_supported);
+    CHECK(fmtxx::scan("yes", "{:y}", b).ec == ErrorCode::not_supported);
+    CHECK(fmtxx::scan("1", "{:d}", b).ec == ErrorCode::not_supported);
+    CHECK(fmtxx::scan("abc", "{:x}", a).ec == ErrorCode::not_supported);
+    CHECK(fmtxx::scan("abc", "{:*}", val).ec == ErrorCode::not_supported);
+}
+
+TEST_CASE("Scan_3")
+{
+    using fmtxx::ErrorCode;
+
+    double d = 0;
+    float f = 0;
+
+    CHECK(fmtxx::scan("1.5 -2.5e3", "{} {}", d, f).count == 2);
+    CHECK(d == 1.5);
+    CHECK(f == -2500.0f);
+    CHECK(fmtxx::scan("0.1", "{}", d).count == 1);
+    CHECK(d == 0.1);
+    CHECK(fmtxx::scan("0.1", "{}", f).count == 1);
+    CHECK(f == 0.1f);
+    CHECK(fmtxx::scan(".5", "{}", d).count == 1);
+    CHECK(d == 0.5);
+    CHECK(fmtxx::scan("5.", "{}", d).count == 1);
+    CHECK(d == 5.0);
+    CHECK(fmtxx::scan("-0", "{}", d).count == 1);
+    CHECK(d == 0.0);
+    CHECK(std::signbit(d));
+
+    // Boundary cases
+    CHECK(fmtxx::scan("4.9406564584124654e-324", "{}", d).count == 1);
+    CHECK(d == std::numeric_limits<double>::denorm_min());
+    CHECK(fmtxx::scan("2.2250738585072014e-308", "{}", d).count == 1);
+    CHECK(d == std::numeric_limits<double>::min());
+    CHECK(fmtxx::scan("1.7976931348623157e308", "{}", d).count == 1);
+    CHECK(d == std::numeric_limits<double>::max());
+    CHECK(fmtxx::scan("1e-400", "{}", d).count == 1);
+    CHECK(d == 0.0);
+    CHECK(fmtxx::scan("1e400", "{}", d).ec == ErrorCode::value_out_of_range);
+    CHECK(fmtxx::scan("1e39", "{}", f).ec == ErrorCode::value_out_of_range);
+
+    // Halfway between 2^53 and 2^53 + 2: ties to even, unless there are more non-zero digits.
+    CHECK(fmtxx::scan("9007199254740993", "{}", d).count == 1);
+    CHECK(d == 9007199254740992.0);
+    CHECK(fmtxx::scan("9007199254740993.00000000000000000000000000000000000000000000000001", "{}", d).count == 1);
+    CHECK(d == 9007199254740994.0);
+    CHECK(fmtxx::scan(std::string(1000, '1') + "e-1000", "{}", d).count == 1);
+    CHECK(d == 0.11111111111111111);
+
+    CHECK(fmtxx::scan("inf -Infinity nan", "{} {} {}", d, f, d).count == 3);
+    CHECK(std::isnan(d));
+    CHECK(f == -std::numeric_limits<float>::infinity());
+
+    // The exponent is optional.
+    auto r = fmtxx::scan("1e", "{}", d);
+    CHECK(r.count == 1);
+    CHECK(d == 1.0);
+    CHECK(std::string(r.next) == "e");
+
+    CHECK(fmtxx::scan(".", "{}", d).ec == ErrorCode::conversion_error);
+    CHECK(fmtxx::scan("e5", "{}", d).ec == ErrorCode::conversion_error);
+    CHECK(fmtxx::scan("1", "{:a}", d).ec == ErrorCode::not_supported);
+    CHECK(fmtxx::scan("1", "{:x}", d).ec == ErrorCode::not_supported);
+    CHECK(fmtxx::scan("1", "{:d}", f).ec == ErrorCode::not_supported);
+    CHECK(fmtxx::scan("1", "{:*}", d).ec == ErrorCode::not_supported);
+    CHECK(fmtxx::scan("1 2 3 4", "{:s} {:E} {:f} {:G}", d, f, d, f).count == 4);
+
+    // Round-trip the output of format.
+    std::mt19937 rng(0);
+    std::uniform_int_distribution<uint64_t> dist;
+    for (int i = 0; i < 10000; ++i)
+    {
+        uint64_t const bits = dist(rng);
+        double x;
+        std::memcpy(&x, &bits, sizeof(double));
+        if (!std::isfinite(x))
+            continue;
+
+        for (auto spec : {"{}", "{:.17e}", "{:.3g}"})
+        {
+            auto const str = fmtxx::string_format(spec, x).str;
+            double y = 0;
+            auto const r2 = fmtxx::scan(str, "{}", y);
+            CHECK(r2.ec == ErrorCode::success);
+            CHECK(r2.next == str.data() + str.size());
+            CHECK(y == std::strtod(str.c_str(), nullptr));
+        }
+    }
+}
+
+struct FailAt {
+    int value;
+};
+
+namespace fmtxx
+{
+    template <>
+    struct FormatValue<FailAt> {
+        fmtxx::ErrorCode operator()(Writer& w, FormatSpec const& spec, FailAt const& value) const {
+            if (value.value < 0)
+                return fmtxx::ErrorCode::invalid_argument;
+            return fmtxx::FormatValue<>{}(w, spec, value.value);
+        }
+    };
+}
+
+struct ThrowAt {
+    int value;
+};
+
+namespace fmtxx
+{
+    template <>
+    struct FormatValue<ThrowAt> {
+        fmtxx::ErrorCode operator()(Writer& w, FormatSpec const& spec, ThrowAt const& value) const {
+            if (value.value < 0)
+                throw std::runtime_error("ThrowAt");
+            return fmtxx::FormatValue<>{}(w, spec, value.value);
+        }
+    };
+}
+
+class ThrowingWriter : public fmtxx::Writer
+{
+    size_t remaining;
+
+public:
+    explicit ThrowingWriter(size_t remaining_) : remaining(remaining_) {}
+
+private:
+    fmtxx::ErrorCode Put(char c) override {
+        return Write(&c, 1);
+    }
+
+    fmtxx::ErrorCode Write(char const* /*str*/, size_t len) override {
+        if (remaining < len)
+            throw std::runtime_error("ThrowingWriter");
+        remaining -= len;
+        return {};
+    }
+
+    fmtxx::ErrorCode Pad(char c, size_t count) override {
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (fmtxx::Failed ec = Write(&c, 1))
+                return ec;
+        }
+        return {};
+    }
+};
+
+TEST_CASE("Parallel_1")
+{
+    std::vector<int> ints(50000);
+    for (size_t i = 0; i < ints.size(); ++i)
+        ints[i] = static_cast<int>(i * 7919 % 100003) - 50000;
+
+    std::string expected;
+    for (int i : ints)
+        fmtxx::format(expected, "{:x}|{}\n", i, i);
+
+    fmtxx::CompiledFormat const format{"{0:x}|{0}\n"};
+
+    for (int threads : {1, 2, 3, 8})
+    {
+        for (size_t chunk_size : {size_t{0}, size_t{1}, size_t{1000}, size_t{100000}})
+        {
+            fmtxx::MemoryWriter<> w;
+            CHECK(fmtxx::ErrorCode{} == fmtxx::format_parallel(w, format, ints.begin(), ints.end(), threads, chunk_size));
+            CHECK(expected == std::string(w.data(), w.size()));
+        }
+    }
+
+    std::vector<double> doubles = {1.5, -0.25, 1e300, 0.1};
+    {
+        fmtxx::MemoryWriter<> w;
+        CHECK(fmtxx::ErrorCode{} == fmtxx::format_parallel(w, "{:.2f};", doubles.data(), doubles.data() + doubles.size(), 2, 1));
+        CHECK(std::string(w.data(), w.size()) == FormatArgs("{:.2f};{:.2f};{:.2f};{:.2f};", 1.5, -0.25, 1e300, 0.1));
+    }
+    {
+        fmtxx::MemoryWriter<> w;
+        CHECK(fmtxx::ErrorCode{} == fmtxx::format_parallel(w, "{}", doubles.data(), doubles.data(), 4));
+        CHECK(w.size() == 0);
+    }
+
+    // Formatting stops at the first error, just like formatting the elements
+    // one after the other.
+    std::vector<FailAt> values(10000);
+    for (size_t i = 0; i < values.size(); ++i)
+        values[i].value = static_cast<int>(i);
+    values[4321].value = -1;
+    values[8000].value = -1;
+
+    expected.clear();
+    fmtxx::ErrorCode expected_ec = fmtxx::ErrorCode{};
+    for (auto const& v : values)
+    {
+        expected_ec = fmtxx::format(expected, "[{:4}]", v);
+        if (expected_ec != fmtxx::ErrorCode{})
+            break;
+    }
+    CHECK(fmtxx::ErrorCode::invalid_argument == expected_ec);
+
+    for (size_t chunk_size : {size_t{1}, size_t{7}, size_t{4096}})
+    {
+        fmtxx::MemoryWriter<> w;
+        CHECK(expected_ec == fmtxx::format_parallel(w, "[{:4}]", values.begin(), values.end(), 4, chunk_size));
+        CHECK(expected == std::string(w.data(), w.size()));
+    }
+
+    // Invalid format strings are reported.
+    {
+        fmtxx::MemoryWriter<> w;
+        CHECK(fmtxx::ErrorCode::invalid_format_string == fmtxx::format_parallel(w, "x{:", ints.begin(), ints.end(), 4));
+        CHECK("x" == std::string(w.data(), w.size()));
+    }
+
+    // Exceptions thrown by the formatter are rethrown on the calling thread,
+    // after the output up to the failing chunk has been written.
+    std::vector<ThrowAt> throwing(10000);
+    for (size_t i = 0; i < throwing.size(); ++i)
+        throwing[i].value = static_cast<int>(i);
+    throwing[4321].value = -1;
+
+    {
+        fmtxx::MemoryWriter<> w;
+        CHECK_THROWS_AS(fmtxx::format_parallel(w, "[{:4}]", throwing.begin(), throwing.end(), 1), std::runtime_error const&);
+        expected.assign(w.data(), w.size());
+    }
+    CHECK(expected.size() == 4321 * 6 + 1);
+
+    for (size_t chunk_size : {size_t{1}, size_t{7}, size_t{4096}})
+    {
+        fmtxx::MemoryWriter<> w;
+        CHECK_THROWS_AS(fmtxx::format_parallel(w, "[{:4}]", throwing.begin(), throwing.end(), 4, chunk_size), std::runtime_error const&);
+        CHECK(expected == std::string(w.data(), w.size()));
+    }
+
+    // So are exceptions thrown by the writer.
+    {
+        ThrowingWriter w(1000);
+        CHECK_THROWS_AS(fmtxx::format_parallel(w, format, ints.begin(), ints.end(), 4, 10), std::runtime_error const&);
+    }
+}
+
+TEST_CASE("Bytes_1")
+{
+    std::vector<unsigned char> data(5000);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<unsigned char>(i * 7 + (i >> 8));
+
+    // All lengths up to a few vector widths, and a few block sizes.
+    for (size_t n : {0, 1, 2, 15, 16, 17, 31, 32, 33, 47, 63, 64, 65, 100, 255, 256, 257, 1000, 5000})
+    {
+        std::string lower;
+        std::string upper;
+        std::string grouped;
+        for (size_t i = 0; i < n; ++i)
+        {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "%02x", data[i]);
+            lower += buf;
+            std::snprintf(buf, sizeof(buf), "%02X", data[i]);
+            upper += buf;
+            if (i != 0 && i % 3 == 0)
+                grouped += "--";
+            grouped += buf;
+        }
+
+        CHECK(lower   == fmtxx::string_format("{}", fmtxx::bytes(data.data(), n)).str);
+        CHECK(lower   == fmtxx::string_format("{:x}", fmtxx::bytes(data.data(), n)).str);
+        CHECK(upper   == fmtxx::string_format("{:X}", fmtxx::bytes(data.data(), n)).str);
+        CHECK(grouped == fmtxx::string_format("{:.3X!--}", fmtxx::bytes(data.data(), n)).str);
+    }
+
+    unsigned char const key[] = {0xde, 0xad, 0xbe, 0xef, 0x01};
+    CHECK("de ad be ef 01"  == fmtxx::string_format("{!' '}", fmtxx::bytes(key, sizeof(key))).str);
+    CHECK("DE:AD:BE:EF:01"  == fmtxx::string_format("{:X!':'}", fmtxx::bytes(key, sizeof(key))).str);
+    CHECK("dead beef 01"    == fmtxx::string_format("{:.2}", fmtxx::bytes(key, sizeof(key))).str);
+    CHECK("  deadbeef01"    == fmtxx::string_format("{:12}", fmtxx::bytes(key, sizeof(key))).str);
+    CHECK("deadbeef01**"    == fmtxx::string_format("{:*<12}", fmtxx::bytes(key, sizeof(key))).str);
+    CHECK(".de.ad.be.ef.01." == fmtxx::string_format("{:.^16!.}", fmtxx::bytes(key, sizeof(key))).str);
+    CHECK("616263"          == fmtxx::string_format("{}", fmtxx::bytes("abc")).str);
+
+    // Undocumented conversions are rejected.
+    CHECK(fmtxx::ErrorCode::invalid_format_string == fmtxx::string_format("{:q}", fmtxx::bytes(key, sizeof(key))).ec);
+    CHECK(fmtxx::ErrorCode::invalid_format_string == fmtxx::string_format("{:c}", fmtxx::bytes(key, sizeof(key))).ec);
+
+    CHECK("" == fmtxx::string_format("{:C}", fmtxx::bytes("")).str);
+    CHECK(
+        "00000000  48 65 6c 6c 6f 2c 20 77  6f 72 6c 64 21 0a 00 01  |Hello, world!...|\n"
+        "00000010  02                                                |.|\n"
+        "00000011\n"
+        == fmtxx::string_format("{:C}", fmtxx::bytes("Hello, world!\n\x00\x01\x02", 17)).str);
+    CHECK(
+        "00000000  30 31 32 33 34 35 36 37  38 39 61 62 63 64 65 66  |0123456789abcdef|\n"
+        "00000010\n"
+        == fmtxx::string_format("{:C}", fmtxx::bytes("0123456789abcdef")).str);
+
+    // Larger than the internal buffers.
+    std::string const dump = fmtxx::string_format("{:C}", fmtxx::bytes(data.data(), data.size())).str;
+    CHECK(dump.size() == (data.size() + 15) / 16 * 79 - (16 - data.size() % 16) + 9);
+    CHECK(dump.compare(0, 10, "00000000  ") == 0);
+    CHECK(dump.compare(dump.size() - 9, 9, "00001388\n") == 0);
+
+    fmtxx::ArrayWriter w{nullptr, 0};
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format(w, "{:C}", fmtxx::bytes(data.data(), data.size())));
+    CHECK(dump.size() == w.size());
+}
+
+TEST_CASE("Chrono_1")
+{
+    using namespace std::chrono;
+
+    auto const tp = system_clock::time_point(duration_cast<system_clock::duration>(seconds(1234567890) + microseconds(123456)));
+
+    CHECK("2009-02-13 23:31:30"     == fmtxx::string_format("{}", tp).str);
+    CHECK("2009-02-13 23:31:30.123" == fmtxx::string_format("{!'%F %T.%3N'}", tp).str);
+    CHECK("23:31:30.123456000"      == fmtxx::string_format("{!'%T.%N'}", tp).str);
+    CHECK("30.1|30.123456"          == fmtxx::string_format("{!'%S.%1N'}|{!'%S.%6N'}", tp, tp).str);
+    CHECK("Fri Friday Feb February Feb" == fmtxx::string_format("{!'%a %A %b %B %h'}", tp).str);
+    CHECK("13 13 044 09 20 02/13/09 11 PM" == fmtxx::string_format("{!'%d %e %j %y %C %D %I %p'}", tp).str);
+    CHECK("5 5 1234567890 +0000 % 23:31" == fmtxx::string_format("{!'%u %w %s %z %% %R'}", tp).str);
+    CHECK("      2009-02-13 23:31:30" == fmtxx::string_format("{:>25}", tp).str);
+    CHECK("2009-02-13 23:31:30......" == fmtxx::string_format("{:.<25}", tp).str);
+
+    // Same second, different sub-second digits.
+    CHECK("30.123" == fmtxx::string_format("{!'%S.%3N'}", tp).str);
+    CHECK("30.999" == fmtxx::string_format("{!'%S.%3N'}", tp + milliseconds(876)).str);
+    CHECK("31.000" == fmtxx::string_format("{!'%S.%3N'}", tp + milliseconds(877)).str);
+
+    // More patterns than cache entries.
+    for (int i = 0; i < 3; ++i)
+    {
+        CHECK("2009" == fmtxx::string_format("{!'%Y'}", tp).str);
+        CHECK("02"   == fmtxx::string_format("{!'%m'}", tp).str);
+        CHECK("13"   == fmtxx::string_format("{!'%d'}", tp).str);
+        CHECK("23"   == fmtxx::string_format("{!'%H'}", tp).str);
+        CHECK("31"   == fmtxx::string_format("{!'%M'}", tp).str);
+    }
+
+    CHECK("1969-12-31 23:59:59.500" == fmtxx::string_format("{!'%F %T.%3N'}", system_clock::time_point(milliseconds(-500))).str);
+    CHECK("-0001-12-31 Fri"         == fmtxx::string_format("{!'%F %a'}", time_point<system_clock, hours>(hours(24 * -719529))).str);
+
+    timespec ts;
+    ts.tv_sec = 1;
+    ts.tv_nsec = 5;
+    CHECK("1.000000005" == fmtxx::string_format("{!'%s.%N'}", ts).str);
+    ts.tv_nsec = 1000000000;
+    CHECK(fmtxx::ErrorCode::conversion_error == fmtxx::string_format("{}", ts).ec);
+
+    // Formatting still works after the cache has been destroyed.
+    std::string at_exit;
+    RunAtThreadExit(
+        [&] { fmtxx::string_format("{!'%s.%N'}", tp); },
+        [&] { ts.tv_nsec = 7; at_exit = fmtxx::string_format("{!'%s.%N'}|{!'%s.%3N'}", ts, tp).str; });
+    CHECK("1.000000007|1234567890.123" == at_exit);
+
+    CHECK(fmtxx::ErrorCode::invalid_format_string == fmtxx::string_format("{!'%Q'}", tp).ec);
+    CHECK(fmtxx::ErrorCode::invalid_format_string == fmtxx::string_format("{!'%'}", tp).ec);
+    CHECK(fmtxx::ErrorCode::invalid_format_string == fmtxx::string_format("{!'%3S'}", tp).ec);
+
+#ifndef _WIN32
+    // Compare with strftime.
+    std::mt19937 rng;
+    std::uniform_int_distribution<int64_t> dist(-2208988800, 7258118400); // [1900, 2200)
+    for (int i = 0; i < 10000; ++i)
+    {
+        // Random time points, then a few years in steps of ~7 hours, then
+        // steps of 37 seconds around 2021-03-14 (DST transition in the US).
+        std::time_t const t = static_cast<std::time_t>(i < 5000 ? dist(rng)
+                                                     : i < 9500 ? int64_t{1600000000} + (i - 5000) * 25247
+                                                                : int64_t{1615700000} + (i - 9500) * 37);
+
+        char buf[128];
+        std::tm tm;
+        std::strftime(buf, sizeof(buf), "%F %T %a %b %j %u %w %y %I %p", gmtime_r(&t, &tm));
+        CHECK(buf == fmtxx::string_format("{!'%F %T %a %b %j %u %w %y %I %p'}", system_clock::from_time_t(t)).str);
+
+        std::strftime(buf, sizeof(buf), "%F %T %z", localtime_r(&t, &tm));
+        CHECK(buf == fmtxx::string_format("{:l!'%F %T %z'}", system_clock::from_time_t(t)).str);
+    }
+
+    // Time zone transitions which are not at a multiple of 15 minutes.
+    {
+        char const* const tz = std::getenv("TZ");
+        std::string const saved_tz = tz ? tz : "";
+
+        struct Transition {
+            char const* tz;
+            int64_t t;
+        };
+        Transition const transitions[] = {
+            {"AAA0BBB-1,M5.3.0/2:07,M10.5.0/3", 1621130820}, // 2021-05-16 02:07 UTC
+            {"Europe/Dublin", -1691962479},                  // 1916-05-21 02:25:21 UTC
+        };
+        for (auto const& tr : transitions)
+        {
+            setenv("TZ", tr.tz, 1);
+            tzset();
+
+            for (int64_t d = -1800; d <= 1800; d += 60)
+            {
+                std::time_t const t = static_cast<std::time_t>(tr.t + d);
+
+                char buf[128];
+                std::tm tm;
+                std::strftime(buf, sizeof(buf), "%F %T %z", localtime_r(&t, &tm));
+                CHECK(buf == fmtxx::string_format("{:l!'%F %T %z'}", system_clock::from_time_t(t)).str);
+            }
+        }
+
+        if (tz)
+            setenv("TZ", saved_tz.c_str(), 1);
+        else
+            unsetenv("TZ");
+        tzset();
+    }
+#endif
+
+    CHECK("42ms"      == fmtxx::string_format("{}", milliseconds(42)).str);
+    CHECK("-7us"      == fmtxx::string_format("{}", microseconds(-7)).str);
+    CHECK("1ns 2s"    == fmtxx::string_format("{} {}", nanoseconds(1), seconds(2)).str);
+    CHECK("3min 4h"   == fmtxx::string_format("{} {}", minutes(3), hours(4)).str);
+    CHECK("1.5s"      == fmtxx::string_format("{}", duration<double>(1.5)).str);
+    CHECK("1.50s"     == fmtxx::string_format("{:.2f}", duration<double>(1.5)).str);
+    CHECK("3[1/60]s"  == fmtxx::string_format("{}", duration<int, std::ratio<1, 60>>(3)).str);
+    CHECK("  42ms"    == fmtxx::string_format("{:>6}", milliseconds(42)).str);
+
+    CHECK("01:02:03.456"  == fmtxx::string_format("{!'%T.%3N'}", milliseconds(3723456)).str);
+    CHECK("-01.500"       == fmtxx::string_format("{!'%S.%3N'}", milliseconds(-1500)).str);
+    CHECK("100:00 360000" == fmtxx::string_format("{!'%R %s'}", hours(100)).str);
+    CHECK("00:00:00.250"  == fmtxx::string_format("{!'%T.%3N'}", duration<double>(0.25)).str);
+    CHECK(fmtxx::ErrorCode::invalid_format_string == fmtxx::string_format("{!'%Y'}", seconds(1)).ec);
+}
+
+TEST_CASE("FILE_1")
+{
+    std::FILE* file = std::tmpfile();
+    REQUIRE(file != nullptr);
+
+    CHECK(12 == fmtxx::fformat(file, "{} {:>8}", 123, "abc"));
+    CHECK(5 == fmtxx::fprintf(file, "%s|%03d", 'x', 7));
+    CHECK(-1 == fmtxx::fformat(file, "def{}"));
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format(file, FMTXX_STRING("[{}]"), 1.5));
+
+    std::rewind(file);
+    char buf[64] = {0};
+    auto const n = std::fread(buf, 1, sizeof(buf) - 1, file);
+    std::fclose(file);
+
+    // Partial output is written on failure (like fprintf).
+    CHECK("123      abcx|007def[1.5]" == std::string(buf, n));
+}
+
+//------------------------------------------------------------------------------
+
+TEST_CASE("CompiledFormat_1")
+{
+    fmtxx::CompiledFormat const f1{"{} {:08x} {{{!style}}}"};
+    CHECK(f1);
+    CHECK("1 0000002a {x}" == fmtxx::string_format(f1, 1, 42, 'x').str);
+    CHECK("2 0000002b {y}" == fmtxx::string_format(f1, 2, 43, 'y').str);
+
+    fmtxx::CompiledFormat const f2{"%*d|%-*d|%.*f", fmtxx::FormatSyntax::printf};
+    CHECK(f2);
+    CHECK("   42|7   |3.14" == fmtxx::string_format(f2, 5, 42, 4, 7, 2, 3.14159).str);
+    CHECK("42|7|3.1"        == fmtxx::string_format(f2, 2, 42, -1, 7, 1, 3.14159).str);
+    CHECK("   42"           == fmtxx::string_format(fmtxx::CompiledFormat{"%2$*1$d", fmtxx::FormatSyntax::printf}, 5, 42).str);
+
+    fmtxx::FormatSpec spec;
+    spec.width = 6;
+    spec.fill = '.';
+    fmtxx::CompiledFormat const f3{"{*}|{*:<}|{:{}.{}f}"};
+    CHECK(f3);
+    CHECK("...abc|abc...| 1.23"  == fmtxx::string_format(f3, spec, "abc", spec, "abc", 5, 2, 1.234).str);
+    CHECK("abc|abc|1.2     "     == fmtxx::string_format(f3, fmtxx::FormatSpec{}, "abc", fmtxx::FormatSpec{}, "abc", -8, 1, 1.234).str);
+
+    fmtxx::CompiledFormat const f4{"abc{:1"};
+    CHECK(!f4);
+    CHECK(fmtxx::ErrorCode::invalid_format_string == f4.ec());
+
+    std::string str;
+    CHECK(fmtxx::ErrorCode::invalid_format_string == fmtxx::format(str, f4, 1));
+    CHECK("abc" == str);
+
+    fmtxx::ArrayWriter w{nullptr, 0};
+    CHECK(fmtxx::ErrorCode::index_out_of_range == fmtxx::format(w, f1, 1, 2));
+    CHECK(fmtxx::ErrorCode::invalid_argument   == fmtxx::format(w, f1, spec, 2, 3));
+    CHECK(fmtxx::ErrorCode::invalid_argument   == fmtxx::format(w, f3, 1, "abc", spec, "abc", 1, 1, 1.0));
+    CHECK(fmtxx::ErrorCode::value_out_of_range == fmtxx::format(w, f2, 2147483648u, 1, 1, 1, 1, 1.0));
+}
+
+struct Nested {
+    int value;
+};
+
+namespace fmtxx
+{
+    template <>
+    struct FormatValue<Nested> {
+        fmtxx::ErrorCode operator()(Writer& w, FormatSpec const& /*spec*/, Nested const& value) const {
+            return fmtxx::format(w, "<{:03}>", value.value);
+        }
+    };
+}
+
+TEST_CASE("ParseCache_1")
+{
+    CHECK(0 == fmtxx::parse_cache_capacity());
+    fmtxx::set_parse_cache_capacity(100000);
+    CHECK(fmtxx::kMaxParseCacheCapacity == fmtxx::parse_cache_capacity());
+    fmtxx::set_parse_cache_capacity(2);
+
+    fmtxx::stats::Stats s0;
+    fmtxx::stats::snapshot(s0);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        CHECK("1 0000002a {x}" == fmtxx::string_format("{} {:08x} {{{!style}}}", 1, 42, 'x').str);
+        CHECK("   42|7   |3.14" == fmtxx::string_printf("%*d|%-*d|%.*f", 5, 42, 4, 7, 2, 3.14159).str);
+    }
+
+    fmtxx::stats::Stats s1;
+    fmtxx::stats::snapshot(s1);
+
+    // The same string at the same address, but with different contents.
+    char buf[] = "a{}";
+    CHECK("a1" == fmtxx::string_format(buf, 1).str);
+    buf[0] = 'b';
+    CHECK("b1" == fmtxx::string_format(buf, 1).str);
+
+    // The same string at different addresses.
+    for (int i = 0; i < 3; ++i)
+    {
+        std::string const fmt = std::string("[{:") + "5}]";
+        CHECK("[    7]" == fmtxx::string_format(fmt, 7).str);
+    }
+
+    // Brace-style and printf-style format strings are cached separately.
+    CHECK("%d" == fmtxx::string_format("%d", 1).str);
+    CHECK("1" == fmtxx::string_printf("%d", 1).str);
+    CHECK("%d" == fmtxx::string_format("%d", 1).str);
+
+    // Formatting from within FormatValue bypasses the cache.
+    CHECK("<001> <002>" == fmtxx::string_format("{} {}", Nested{1}, Nested{2}).str);
+    CHECK("<003> <004>" == fmtxx::string_format("{} {}", Nested{3}, Nested{4}).str);
+
+    // Invalid format strings are not cached.
+    std::string str;
+    CHECK(fmtxx::ErrorCode::invalid_format_string == fmtxx::format(str, "abc{:1", 1));
+    CHECK(fmtxx::ErrorCode::invalid_format_string == fmtxx::format(str, "abc{:1", 1));
+    CHECK("abcabc" == str);
+    CHECK(fmtxx::ErrorCode::index_out_of_range == fmtxx::format(str, "{}{}", 1));
+
+    fmtxx::set_parse_cache_capacity(0);
+    CHECK("1 0000002a {x}" == fmtxx::string_format("{} {:08x} {{{!style}}}", 1, 42, 'x').str);
+
+    fmtxx::stats::Stats s2;
+    fmtxx::stats::snapshot(s2);
+
+    if (!fmtxx::stats::enabled())
+        return;
+
+    CHECK(s1.parse_cache_misses - s0.parse_cache_misses == 2);
+    CHECK(s1.parse_cache_hits - s0.parse_cache_hits == 4);
+    // buf: 2 misses
+    // fmt: 1 miss, 2 hits
+    // "%d": 2 misses, 1 hit
+    // "{} {}": 1 miss, 1 hit
+    // "abc{:1": 2 misses
+    // "{}{}": 1 miss
+    CHECK(s2.parse_cache_misses - s1.parse_cache_misses == 9);
+    CHECK(s2.parse_cache_hits - s1.parse_cache_hits == 4);
+}
+
+TEST_CASE("ParseCache_2")
+{
+    fmtxx::set_parse_cache_capacity(256);
+
+    // Formatting still works after the cache has been destroyed.
+    std::string at_exit;
+    RunAtThreadExit(
+        [] { fmtxx::string_format("{} {:08x}", 1, 42); },
+        [&] { at_exit = fmtxx::string_format("{} {:08x}", 2, 43).str + fmtxx::string_printf("|%d", 3).str; });
+    CHECK("2 0000002b|3" == at_exit);
+
+    fmtxx::set_parse_cache_capacity(0);
+}
+
+TEST_CASE("StaticFormat_1")
+{
+    CHECK("1 0000002a {x}" == fmtxx::string_format(FMTXX_STRING("{} {:08x} {{{!style}}}"), 1, 42, 'x').str);
+    CHECK("{}}"            == fmtxx::string_format(FMTXX_STRING("{{}}}}")).str);
+    CHECK(""               == fmtxx::string_format(FMTXX_STRING("")).str);
+    CHECK("2 1 2"          == fmtxx::string_format(FMTXX_STRING("{1} {0} {1}"), 1, 2).str);
+    CHECK("\"abc\""        == fmtxx::string_format(FMTXX_STRING("{:q!'style'}"), "abc").str);
+    CHECK("  3.14|abc   "  == fmtxx::string_format(FMTXX_STRING("{:6.2f}|{:<6}"), 3.14159, std::string("abc")).str);
+
+    fmtxx::FormatSpec spec;
+    spec.width = 6;
+    spec.fill = '.';
+    CHECK("...abc|abc...| 1.23" == fmtxx::string_format(FMTXX_STRING("{*}|{*:<}|{:{}.{}f}"), spec, "abc", spec, "abc", 5, 2, 1.234).str);
+
+    char buf[64];
+    fmtxx::ArrayWriter w{buf};
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format(w, FMTXX_STRING("{}-{:x}-{:q}-{:{}}"), "abc", 255u, std::string("de"), 3, 1));
+    CHECK("abc-ff-\"de\"-  1" == std::string(w.data(), w.size()));
+
+    fmtxx::ArrayWriter w0{nullptr, 0};
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format(w0, FMTXX_STRING("x{}"), 123));
+    CHECK(4 == w0.size());
+    CHECK(fmtxx::ErrorCode::value_out_of_range == fmtxx::format(w0, FMTXX_STRING("{:{}}"), 2147483648u, 1));
+
+    //fmtxx::format(w0, FMTXX_STRING("{"));             // should not compile (C++14)
+    //fmtxx::format(w0, FMTXX_STRING("{:1"), 1);        // should not compile (C++14)
+    //fmtxx::format(w0, FMTXX_STRING("{} {}"), 1);      // should not compile (C++14)
+    //fmtxx::format(w0, FMTXX_STRING("{:{}}"), 2.0, 1); // should not compile (C++14)
+    //fmtxx::format(w0, FMTXX_STRING("{*}"), 1, 2);     // should not compile (C++14)
+    //fmtxx::format(w0, FMTXX_STRING("{}"), spec);      // should not compile (C++14)
+}
+
+struct PrintStyle {};
+
+namespace fmtxx
+{
+    template <>
+    struct FormatValue<PrintStyle> {
+        fmtxx::ErrorCode operator()(Writer& w, FormatSpec const& spec, PrintStyle) const {
+            return w.write(spec.style.data(), spec.style.size());
+        }
+    };
+}
+
+TEST_CASE("ArgStore_1")
+{
+    fmtxx::FormatSpec spec;
+    spec.width = 5;
+    spec.fill = '.';
+
+    fmtxx::ArgStore store;
+    {
+        std::string str = "hello";
+        std::string style = "style";
+        char pchar[] = "world";
+        Foo foo = {42};
+
+        fmtxx::FormatSpec spec2;
+        spec2.style = style;
+
+        store = fmtxx::ArgStore(str, pchar, foo, 1.5, 'x', spec, 7, (char const*)nullptr, spec2, PrintStyle{});
+
+        // The store holds copies.
+        str.assign(str.size(), '?');
+        std::memset(pchar, '?', sizeof(pchar) - 1);
+        foo.value = -1;
+        spec.fill = '!';
+        style.assign(style.size(), '?');
+    }
+
+    std::string str;
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format(str, "{} {} {} {} {} {*} {} {*}", store));
+    CHECK("hello world 42 1.5 x ....7 (null) style" == str);
+
+    str.clear();
+    CHECK(fmtxx::ErrorCode{} == fmtxx::printf(str, "%s|%5s", store));
+    CHECK("hello|world" == str);
+
+    fmtxx::ArgStore const empty;
+    str.clear();
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format(str, "abc", empty));
+    CHECK("abc" == str);
+    CHECK(fmtxx::ErrorCode::index_out_of_range == fmtxx::format(str, "{}", empty));
+}
+
+static std::string ReadFile(std::FILE* file)
+{
+    std::string str;
+
+    std::rewind(file);
+    char buf[4096];
+    for (;;)
+    {
+        auto const n = std::fread(buf, 1, sizeof(buf), file);
+        if (n == 0)
+            break;
+        str.append(buf, n);
+    }
+
+    return str;
+}
+
+TEST_CASE("BinaryWriter_1")
+{
+    fmtxx::MemoryWriter<> bin;
+    fmtxx::BinaryWriter w{bin};
+
+    fmtxx::FormatSpec spec;
+    spec.width = 6;
+    spec.fill = '.';
+    spec.align = fmtxx::Align::left;
+    spec.style = "abc";
+
+    Foo const foo = {42};
+
+    std::string expected;
+    for (int i = 0; i < 3; ++i)
+    {
+        CHECK(fmtxx::ErrorCode{} == fmtxx::format(w, "{} {:x} {:.3f} {:>4} {}|", -i, 255u + i, 1.5 * i, "ab", 'c'));
+        CHECK(fmtxx::ErrorCode{} == fmtxx::printf(w, "%d %s %s %5.1f %c|", INT_MIN + i, (char const*)nullptr, "def", -0.25, 'x'));
+        CHECK(fmtxx::ErrorCode{} == fmtxx::format(w, "{*} {:5} {} {}|", spec, true, (signed char)-5, (short)300, -1234567890123ll));
+        CHECK(fmtxx::ErrorCode{} == fmtxx::format(w, "{:>4}|{:08.3}|", foo, 1.0 / 3));
+        CHECK(fmtxx::ErrorCode{} == fmtxx::format(w, "{}|{}|{}|", std::string("x\0y", 3), ULLONG_MAX, 0.1f));
+
+        CHECK(fmtxx::ErrorCode{} == fmtxx::format(expected, "{} {:x} {:.3f} {:>4} {}|", -i, 255u + i, 1.5 * i, "ab", 'c'));
+        CHECK(fmtxx::ErrorCode{} == fmtxx::printf(expected, "%d %s %s %5.1f %c|", INT_MIN + i, (char const*)nullptr, "def", -0.25, 'x'));
+        CHECK(fmtxx::ErrorCode{} == fmtxx::format(expected, "{*} {:5} {} {}|", spec, true, (signed char)-5, (short)300, -1234567890123ll));
+        CHECK(fmtxx::ErrorCode{} == fmtxx::format(expected, "{:>4}|{:08.3}|", foo, 1.0 / 3));
+        CHECK(fmtxx::ErrorCode{} == fmtxx::format(expected, "{}|{}|{}|", std::string("x\0y", 3), ULLONG_MAX, 0.1f));
+    }
+
+    // Decode all at once.
+    {
+        fmtxx::BinaryDecoder d;
+        std::string text;
+        fmtxx::MemoryWriter<> out;
+        size_t consumed = 0;
+        CHECK(fmtxx::ErrorCode{} == d.decode(out, bin.data(), bin.size(), consumed));
+        CHECK(bin.size() == consumed);
+        CHECK(expected == std::string(out.data(), out.size()));
+    }
+
+    // Decode byte by byte.
+    {
+        fmtxx::BinaryDecoder d;
+        fmtxx::MemoryWriter<> out;
+        std::string pending;
+        for (size_t i = 0; i < bin.size(); ++i)
+        {
+            pending += bin.data()[i];
+            size_t consumed = 0;
+            CHECK(fmtxx::ErrorCode{} == d.decode(out, pending.data(), pending.size(), consumed));
+            pending.erase(0, consumed);
+        }
+        CHECK(pending.empty());
+        CHECK(expected == std::string(out.data(), out.size()));
+    }
+
+    // Invalid input.
+    {
+        fmtxx::BinaryDecoder d;
+        fmtxx::MemoryWriter<> out;
+        size_t consumed = 0;
+        CHECK(fmtxx::ErrorCode::invalid_argument == d.decode(out, "fmtxxtxt\x01", 9, consumed));
+
+        std::string corrupt(bin.data(), bin.size());
+        corrupt[9] = '\x7F'; // Unknown tag
+        CHECK(fmtxx::ErrorCode::invalid_argument == fmtxx::BinaryDecoder{}.decode(out, corrupt.data(), corrupt.size(), consumed));
+    }
+}
+
+TEST_CASE("BinaryWriter_2")
+{
+    fmtxx::MemoryWriter<> bin;
+    fmtxx::BinaryWriter w{bin};
+
+    // Format errors are reported when decoding.
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format(w, "a{}b{}", 1));
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format(w, "c"));
+
+    fmtxx::BinaryDecoder d;
+    fmtxx::MemoryWriter<> out;
+    size_t consumed = 0;
+    CHECK(fmtxx::ErrorCode::index_out_of_range == d.decode(out, bin.data(), bin.size(), consumed));
+    CHECK(bin.size() == consumed);
+    CHECK("a1bc" == std::string(out.data(), out.size()));
+
+    // Malformed argument types are rejected.
+    using fmtxx::impl::Type;
+
+    auto const put_varint = [](std::string& rec, uint64_t n) {
+        for ( ; n >= 0x80; n >>= 7)
+            rec += static_cast<char>((n & 0x7F) | 0x80);
+        rec += static_cast<char>(n);
+    };
+    auto const nibble = [](Type t, int i) { return static_cast<uint64_t>(t) << (4 * i); };
+
+    std::string header("fmtxxbin\x01", 9);
+    header += '\x01'; // Format
+    header += '\x00'; // Id
+    header += static_cast<char>(fmtxx::FormatSyntax::format);
+    put_varint(header, 3);
+    header += "{2}";
+
+    uint64_t const invalid_types[] = {
+        nibble(Type::sint, 0) | nibble(Type::none, 1) | nibble(Type::pchar, 2),
+        nibble(Type::none, 0) | nibble(Type::sint, 1),
+        nibble(Type::sint, 0) | nibble(Type::last, 1),
+        nibble(Type::sint, 0) | nibble(Type::sint, 15),
+    };
+    for (uint64_t types : invalid_types)
+    {
+        std::string rec = header;
+        rec += '\x02'; // Message
+        rec += '\x00'; // Id
+        put_varint(rec, types);
+        rec += std::string(8, '\x02');
+
+        fmtxx::BinaryDecoder d2;
+        fmtxx::MemoryWriter<> out2;
+        CHECK(fmtxx::ErrorCode::invalid_argument == d2.decode(out2, rec.data(), rec.size(), consumed));
+        CHECK(header.size() == consumed);
+        CHECK(out2.size() == 0);
+    }
+}
+
+TEST_CASE("AsyncSink_1")
+{
+    std::FILE* file = std::tmpfile();
+    REQUIRE(file != nullptr);
+
+    {
+        fmtxx::AsyncSink sink{file};
+
+        CHECK(fmtxx::ErrorCode{} == fmtxx::format(sink, "{} {:>5}|", std::string("abc"), 1.5));
+        CHECK(fmtxx::ErrorCode{} == fmtxx::printf(sink, "%s %03d|", "def", 7));
+        CHECK(fmtxx::ErrorCode{} == fmtxx::format(sink, "{:"));
+        sink.flush();
+
+        CHECK("abc   1.5|def 007|" == ReadFile(file));
+        CHECK(fmtxx::ErrorCode::invalid_format_string == sink.ec());
+        CHECK(0 == sink.dropped());
+    }
+
+    std::fclose(file);
+}
+
+TEST_CASE("AsyncSink_2")
+{
+    std::FILE* file = std::tmpfile();
+    REQUIRE(file != nullptr);
+
+    static constexpr int kNumThreads = 4;
+    static constexpr int kNumMessages = 5000;
+
+    {
+        // Small buffer: producers must wait for the background thread.
+        fmtxx::AsyncSink sink{file, 4096, fmtxx::OverflowPolicy::block};
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < kNumThreads; ++t)
+        {
+            threads.emplace_back([&sink, t] {
+                for (int i = 0; i < kNumMessages; ++i)
+                    fmtxx::format(sink, "{} {} {}\n", t, i, std::string(static_cast<size_t>(i % 100), 'x'));
+            });
+        }
+        for (auto& t : threads)
+            t.join();
+
+        CHECK(0 == sink.dropped());
+    }
+
+    std::istringstream lines{ReadFile(file)};
+    std::fclose(file);
+
+    int next[kNumThreads] = {0};
+    int num_lines = 0;
+    int num_errors = 0;
+
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        ++num_lines;
+
+        int t = -1;
+        int i = -1;
+        std::string text;
+        std::istringstream{line} >> t >> i >> text;
+
+        if (t < 0 || t >= kNumThreads || i != next[t] || text != std::string(static_cast<size_t>(i % 100), 'x'))
+            ++num_errors;
+        else
+            ++next[t];
+    }
+
+    CHECK(kNumThreads * kNumMessages == num_lines);
+    CHECK(0 == num_errors);
+}
+
+TEST_CASE("AsyncSink_3")
+{
+    std::FILE* file = std::tmpfile();
+    REQUIRE(file != nullptr);
+
+    {
+        fmtxx::AsyncSink sink{file, 4096, fmtxx::OverflowPolicy::drop};
+
+        // Does not fit into the ring buffer.
+        CHECK(fmtxx::ErrorCode::io_error == fmtxx::format(sink, "{}", std::string(5000, 'x')));
+        CHECK(1 == sink.dropped());
+
+        CHECK(fmtxx::ErrorCode{} == fmtxx::format(sink, "{}", std::string(1000, 'y')));
+        sink.flush();
+        CHECK(std::string(1000, 'y') == ReadFile(file));
+    }
+
+    std::fclose(file);
+}
+
+//------------------------------------------------------------------------------
+
+#ifndef _WIN32
+TEST_CASE("IovecWriter_1")
+{
+    std::FILE* file = std::tmpfile();
+    REQUIRE(file != nullptr);
+    int const fd = fileno(file);
+
+    std::string const body(5000, 'b');
+    std::string const small = "small";
+
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format_to_fd(fd, "{} {:>7} {} {}|", small, 42, body, -1.5));
+    CHECK(fmtxx::ErrorCode{} == fmtxx::printf_to_fd(fd, "%.3s|%s|", body, "x"));
+    CHECK("small      42 " + body + " -1.5|bbb|x|" == ReadFile(file));
+
+    // Partial output.
+    CHECK(fmtxx::ErrorCode::invalid_format_string == fmtxx::format_to_fd(fd, "abc{:"));
+
+    std::fclose(file);
+}
+
+TEST_CASE("IovecWriter_2")
+{
+    std::FILE* file = std::tmpfile();
+    REQUIRE(file != nullptr);
+
+    std::string body(3000, 'b');
+
+    fmtxx::IovecWriter w{fileno(file), 1000};
+    w.add_stable_range(body.data(), body.size());
+
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format(w, "[{}] [{:.500}] [{}]", body, body, std::string(2000, 't')));
+    CHECK(3000 == w.referenced_size());
+
+    // The body is referenced, not copied.
+    body.assign(body.size(), 'B');
+
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format(w, "{:*^4}", "x"));
+    CHECK(fmtxx::ErrorCode{} == w.flush());
+    CHECK(0 == w.referenced_size());
+
+    std::string const expected = "[" + std::string(3000, 'B') + "] [" + std::string(500, 'b') + "] [" + std::string(2000, 't') + "]*x**";
+    CHECK(expected.size() == w.size());
+    CHECK(expected == ReadFile(file));
+
+    CHECK(fmtxx::ErrorCode{} == w.flush());
+
+    std::fclose(file);
+
+    // Closed file descriptor.
+    int fds[2];
+    REQUIRE(0 == ::pipe(fds));
+    ::close(fds[0]);
+    ::close(fds[1]);
+    CHECK(fmtxx::ErrorCode::io_error == fmtxx::format_to_fd(fds[1], "{}", 1));
+}
+
+static std::string ReadFile(char const* path)
+{
+    std::FILE* file = std::fopen(path, "rb");
+    REQUIRE(file != nullptr);
+    std::string const str = ReadFile(file);
+    std::fclose(file);
+    return str;
+}
+
+static void WriteFile(char const* path, std::string const& str)
+{
+    std::FILE* file = std::fopen(path, "wb");
+    REQUIRE(file != nullptr);
+    REQUIRE(str.size() == std::fwrite(str.data(), 1, str.size(), file));
+    std::fclose(file);
+}
+
+// Limits the size of files written by this process, so that extending a file
+// fails with EFBIG (instead of raising SIGXFSZ).
+struct FileSizeLimit
+{
+    struct rlimit saved;
+    void (*saved_handler)(int);
+
+    explicit FileSizeLimit(rlim_t limit)
+    {
+        REQUIRE(0 == ::getrlimit(RLIMIT_FSIZE, &saved));
+        saved_handler = std::signal(SIGXFSZ, SIG_IGN);
+
+        struct rlimit rl = saved;
+        rl.rlim_cur = limit;
+        REQUIRE(0 == ::setrlimit(RLIMIT_FSIZE, &rl));
+    }
+
+    ~FileSizeLimit()
+    {
+        ::setrlimit(RLIMIT_FSIZE, &saved);
+        std::signal(SIGXFSZ, saved_handler);
+    }
+};
+
+TEST_CASE("MmapWriter_1")
+{
+    char path[] = "/tmp/fmtxx-mmap-XXXXXX";
+    int const fd = ::mkstemp(path);
+    REQUIRE(fd >= 0);
+    REQUIRE(5 == ::write(fd, "head|", 5));
+    ::close(fd);
+
+    std::string expected = "head|";
+    {
+        // A single page per window.
+        fmtxx::MmapWriter w{path, 1};
+        REQUIRE(w.is_open());
+        CHECK(5 == w.size());
+
+        for (int i = 0; i < 2000; ++i)
+        {
+            CHECK(fmtxx::ErrorCode{} == fmtxx::format(w, "{} {:>5} {:*<3}|", i, i * 0.5, 'x'));
+            expected += fmtxx::string_format("{} {:>5} {:*<3}|", i, i * 0.5, 'x').str;
+        }
+
+        std::string const large(10000, 'L');
+        CHECK(fmtxx::ErrorCode{} == fmtxx::format(w, "{}{:.^9000}", large, ""));
+        expected += large + std::string(9000, '.');
+
+        CHECK(expected.size() == w.size());
+        CHECK(fmtxx::ErrorCode{} == w.sync());
+        CHECK(fmtxx::ErrorCode{} == w.close());
+        CHECK(expected.size() == w.size());
+
+        CHECK(fmtxx::ErrorCode::io_error == fmtxx::format(w, "{}", 1));
+    }
+    CHECK(expected == ReadFile(path));
+
+    // Appends to the existing file.
+    {
+        fmtxx::MmapWriter w{path, 1 << 16, fmtxx::MmapSyncPolicy::sync};
+        REQUIRE(w.is_open());
+        CHECK(fmtxx::ErrorCode{} == fmtxx::format(w, "tail"));
+    }
+    CHECK(expected + "tail" == ReadFile(path));
+
+    std::remove(path);
+
+    fmtxx::MmapWriter bad{"/nonexistent/dir/file"};
+    CHECK(!bad.is_open());
+    CHECK(fmtxx::ErrorCode::io_error == bad.ec());
+    CHECK(fmtxx::ErrorCode::io_error == fmtxx::format(bad, "{}", 1));
+}
+
+TEST_CASE("MmapWriter_2")
+{
+    char path[] = "/tmp/fmtxx-mmap-XXXXXX";
+    int const fd = ::mkstemp(path);
+    REQUIRE(fd >= 0);
+    ::close(fd);
+
+    std::string const contents(13000, 'c');
+    WriteFile(path, contents);
+
+    // Extending the file to the end of the first window fails.
+    {
+        FileSizeLimit const limit{1 << 14};
+
+        fmtxx::MmapWriter w{path, 1 << 16};
+        CHECK(!w.is_open());
+        CHECK(fmtxx::ErrorCode::io_error == w.ec());
+        CHECK(contents.size() == w.size());
+        CHECK(fmtxx::ErrorCode::io_error == fmtxx::format(w, "{}", 1));
+    }
+    CHECK(contents == ReadFile(path));
+
+    // Extending the file to the end of the second window fails.
+    {
+        FileSizeLimit const limit{1 << 17};
+
+        fmtxx::MmapWriter w{path, 1 << 16};
+        REQUIRE(w.is_open());
+        CHECK(fmtxx::ErrorCode::io_error == fmtxx::format(w, "{}", std::string(1 << 16, 'x')));
+        CHECK(!w.is_open());
+    }
+    std::string const str = ReadFile(path);
+    CHECK(str.size() >= contents.size());
+    CHECK(str.compare(0, contents.size(), contents) == 0);
+
+    std::remove(path);
+}
+
+TEST_CASE("MmapFile_1")
+{
+    char path[] = "/tmp/fmtxx-mmap-XXXXXX";
+    int const fd = ::mkstemp(path);
+    REQUIRE(fd >= 0);
+    ::close(fd);
+
+    static constexpr int kThreads = 4;
+    static constexpr int kLines = 5000;
+    {
+        fmtxx::MmapFile file{path, 1 << 24, 1};
+        REQUIRE(file.is_open());
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < kThreads; ++t)
+        {
+            threads.emplace_back([&file, t] {
+                for (int i = 0; i < kLines; ++i)
+                    fmtxx::format(file, "{}:{:04}\n", t, i);
+            });
+        }
+        for (auto& t : threads)
+            t.join();
+
+        CHECK(fmtxx::ErrorCode{} == fmtxx::printf(file, "%s\n", "end"));
+        CHECK(fmtxx::ErrorCode::invalid_format_string == fmtxx::format(file, "{:"));
+        CHECK(kThreads * kLines * 7 + 4 == file.size());
+    }
+
+    // Each line of each thread appears exactly once, in order.
+    std::string const str = ReadFile(path);
+    REQUIRE(kThreads * kLines * 7 + 4 == str.size());
+    CHECK(str.compare(str.size() - 4, 4, "end\n") == 0);
+
+    int next[kThreads] = {};
+    bool ok = true;
+    for (size_t i = 0; i + 4 < str.size(); i += 7)
+    {
+        int const t = str[i] - '0';
+        ok = ok && t >= 0 && t < kThreads && str.compare(i, 7, fmtxx::string_format("{}:{:04}\n", t, next[t]).str) == 0;
+        if (ok)
+            ++next[t];
+    }
+    CHECK(ok);
+    for (int t = 0; t < kThreads; ++t)
+        CHECK(kLines == next[t]);
+
+    // Capacity exhausted.
+    {
+        fmtxx::MmapFile file{path, 1, 1};
+        REQUIRE(file.is_open());
+        CHECK(fmtxx::ErrorCode::io_error == fmtxx::format(file, "{}", std::string(1 << 20, 'x')));
+    }
+    CHECK(str == ReadFile(path));
+
+    std::remove(path);
+}
+
+TEST_CASE("MmapFile_2")
+{
+    char path[] = "/tmp/fmtxx-mmap-XXXXXX";
+    int const fd = ::mkstemp(path);
+    REQUIRE(fd >= 0);
+    ::close(fd);
+
+    std::string const contents(100, 'c');
+    WriteFile(path, contents);
+
+    std::string expected = contents;
+    {
+        FileSizeLimit const limit{1 << 14};
+
+        fmtxx::MmapFile file{path, 1 << 20, 1};
+        REQUIRE(file.is_open());
+
+        // Fill the file up to the limit.
+        std::string const line(1000, 'x');
+        fmtxx::ErrorCode ec = fmtxx::ErrorCode{};
+        for (int i = 0; i < 100 && ec == fmtxx::ErrorCode{}; ++i)
+        {
+            ec = file.append(line.data(), line.size());
+            if (ec == fmtxx::ErrorCode{})
+                expected += line;
+        }
+        CHECK(fmtxx::ErrorCode::io_error == ec);
+        CHECK(expected.size() == file.size());
+
+        // All following appends fail, so that the file does not contain a hole.
+        CHECK(fmtxx::ErrorCode::io_error == file.append("y", 1));
+        CHECK(fmtxx::ErrorCode::io_error == fmtxx::format(file, "{}", 1));
+        CHECK(expected.size() == file.size());
+    }
+    CHECK(expected == ReadFile(path));
+
+    std::remove(path);
+}
+#endif
+
+template <typename Container>
+static std::string FormatEachCell(std::string const& field, Container const& values, std::string const& sep)
+{
+    std::string str;
+    bool first = true;
+    for (auto const& v : values)
+    {
+        if (!first)
+            str += sep;
+        first = false;
+        fmtxx::format(str, "{" + field, v);
+    }
+    return str;
+}
+
+template <typename Container>
+static std::string FormatRow(std::string const& field, Container const& values, std::string const& sep)
+{
+    fmtxx::MemoryWriter<> w;
+    auto const ec = fmtxx::format_row(w, "{" + field, values, sep);
+    CHECK(fmtxx::ErrorCode{} == ec);
+    return std::string(w.data(), w.size());
+}
+
+TEST_CASE("FormatRange_1")
+{
+    fmtxx::FormatSpec spec;
+    CHECK(fmtxx::ErrorCode{} == fmtxx::parse_format_spec(spec, "{:*>8.3f!style}"));
+    CHECK(spec.fill == '*');
+    CHECK(spec.align == fmtxx::Align::right);
+    CHECK(spec.width == 8);
+    CHECK(spec.prec == 3);
+    CHECK(spec.conv == 'f');
+    CHECK(std::string(spec.style.data(), spec.style.size()) == "style");
+
+    CHECK(fmtxx::ErrorCode{} == fmtxx::parse_format_spec(spec, "{}"));
+    CHECK(spec.width == 0);
+    CHECK(spec.conv == '\0');
+
+    CHECK(fmtxx::ErrorCode::invalid_format_string == fmtxx::parse_format_spec(spec, ""));
+    CHECK(fmtxx::ErrorCode::invalid_format_string == fmtxx::parse_format_spec(spec, "{"));
+    CHECK(fmtxx::ErrorCode::invalid_format_string == fmtxx::parse_format_spec(spec, "{0}"));
+    CHECK(fmtxx::ErrorCode::invalid_format_string == fmtxx::parse_format_spec(spec, "{}x"));
+    CHECK(fmtxx::ErrorCode::invalid_format_string == fmtxx::parse_format_spec(spec, "{:{}}"));
+    CHECK(fmtxx::ErrorCode::invalid_format_string == fmtxx::parse_format_spec(spec, "{*}"));
+
+    int const ints[] = {1, -22, 333, INT_MIN, INT_MAX, 0};
+    fmtxx::MemoryWriter<> w;
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format_range(w, "{}", std::begin(ints), std::end(ints), ","));
+    CHECK("1,-22,333,-2147483648,2147483647,0" == std::string(w.data(), w.size()));
+
+    w.clear();
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format_range(w, "{}", std::begin(ints), std::begin(ints)));
+    CHECK(0 == w.size());
+
+    w.clear();
+    CHECK(fmtxx::ErrorCode::invalid_format_string == fmtxx::format_range(w, "{:{}}", std::begin(ints), std::end(ints)));
+    CHECK(0 == w.size());
+
+    std::vector<std::string> const strs = {"a", "bb", "ccc"};
+    w.clear();
+    CHECK(fmtxx::ErrorCode{} == fmtxx::format_range(w, "{:>4}", strs.begin(), strs.end(), " | "));
+    CHECK("   a |   bb |  ccc" == std::string(w.data(), w.size()));
+}
+
+TEST_CASE("FormatRange_2")
+{
+    // Larger than the chunk size used for conversions and the local buffer
+    // used for the plain decimal numbers.
+    std::vector<int64_t> i64;
+    std::vector<uint64_t> u64;
+    std::vector<short> i16;
+    std::vector<unsigned char> u8;
+    std::vector<double> f64;
+    std::vector<float> f32;
+    for (int i = 0; i < 1000; ++i)
+    {
+        i64.push_back((i % 2 == 0 ? -1 : 1) * (int64_t{1} << (i % 63)) - i);
+        u64.push_back(UINT64_MAX - static_cast<uint64_t>(i) * 0x123456789ull);
+        i16.push_back(static_cast<short>(i * 77 - 20000));
+        u8.push_back(static_cast<unsigned char>(i));
+        f64.push_back(i / 7.0 - 50.0);
+        f32.push_back(static_cast<float>(i) / 3.0f);
+    }
+    i64.push_back(INT64_MIN);
+    i64.push_back(INT64_MAX);
+
+    for (auto* field : {"}", ":}", ":d}", ":i}", ":8}", ":+}", ": }", ":'}", ":x}", ":#o}", ":.3}", ":<5}", ":u}"})
+    {
+        for (auto* sep : {"", ", ", "\t"})
+        {
+            CHECK(FormatEachCell(field, i64, sep) == FormatRow(field, i64, sep));
+            CHECK(FormatEachCell(field, u64, sep) == FormatRow(field, u64, sep));
+            CHECK(FormatEachCell(field, i16, sep) == FormatRow(field, i16, sep));
+            CHECK(FormatEachCell(field, u8, sep) == FormatRow(field, u8, sep));
+        }
+    }
+
+    for (auto* field : {"}", ":.3f}", ":12.4e}", ":g}", ":a}", ":x}", ":+010.2f}"})
+    {
+        CHECK(FormatEachCell(field, f64, ", ") == FormatRow(field, f64, ", "));
+        CHECK(FormatEachCell(field, f32, ", ") == FormatRow(field, f32, ", "));
+    }
+
+    std::string const long_sep(1000, '-');
+    CHECK(FormatEachCell("}", i64, long_sep) == FormatRow("}", i64, long_sep));
+
+    // Not formatted as integers.
+    std::vector<char> const chars = {'a', 'b', 'c'};
+    CHECK("a b c" == FormatRow("}", chars, " "));
+    std::vector<bool> const bools = {true, false};
+    CHECK("true false" == FormatRow("}", bools, " "));
+
+    // Not contiguous.
+    std::map<int, int> const m = {{1, 2}, {3, 4}};
+    std::vector<int> keys;
+    for (auto const& kv : m)
+        keys.push_back(kv.first);
+    CHECK("1;3" == FormatRow("}", keys, ";"));
+}
 
 #if 0
 TEST_CASE("FormatArgs_1")
@@ -0,0 +1,95 @@
+// fmtxx-decode: Converts binary logs written by fmtxx::BinaryWriter to text.
+//
+// Usage: fmtxx-decode [FILE]
+//
+// Reads the binary log from FILE (or stdin) and writes the formatted records to
+// stdout.
+
+#include "../src/Format_binary.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+int main(int argc, char* argv[])
+{
+    if (argc > 2)
+    {
+        std::fprintf(stderr, "usage: %s [FILE]\n", argv[0]);
+        return 2;
+    }
+
+    std::FILE* in = stdin;
+    if (argc == 2)
+    {
+        in = std::fopen(argv[1], "rb");
+        if (in == nullptr)
+        {
+            std::fprintf(stderr, "error: cannot open '%s'\n", argv[1]);
+            return 1;
+        }
+    }
+    else
+    {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    }
+
+    fmtxx::BinaryDecoder decoder;
+    fmtxx::FILEWriter out{stdout};
+
+    int status = 0;
+
+    std::vector<char> buf(64 * 1024);
+    size_t len = 0; // Number of pending bytes in BUF
+    for (;;)
+    {
+        if (len == buf.size())
+            buf.resize(buf.size() * 2); // A single record larger than the buffer.
+
+        size_t const n = std::fread(buf.data() + len, 1, buf.size() - len, in);
+        if (n == 0)
+            break;
+        len += n;
+
+        size_t consumed = 0;
+        fmtxx::ErrorCode const ec = decoder.decode(out, buf.data(), len, consumed);
+        if (ec == fmtxx::ErrorCode::invalid_argument || ec == fmtxx::ErrorCode::io_error)
+        {
+            std::fprintf(stderr, "error: %s\n", ec == fmtxx::ErrorCode::io_error ? "write error" : "invalid input");
+            if (in != stdin)
+                std::fclose(in);
+            return 1;
+        }
+        if (ec != fmtxx::ErrorCode{})
+        {
+            std::fprintf(stderr, "warning: a record could not be formatted (error %d)\n", static_cast<int>(ec));
+            status = 1;
+        }
+
+        len -= consumed;
+        std::memmove(buf.data(), buf.data() + consumed, len);
+    }
+
+    if (std::ferror(in))
+    {
+        std::fprintf(stderr, "error: read error\n");
+        status = 1;
+    }
+    else if (len != 0)
+    {
+        std::fprintf(stderr, "error: truncated input\n");
+        status = 1;
+    }
+
+    if (in != stdin)
+        std::fclose(in);
+
+    return status;
+}